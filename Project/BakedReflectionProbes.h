@@ -0,0 +1,503 @@
+#pragma once
+
+// Std. Includes
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// GL Includes
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "GLState.h"
+#include "GLExtensions.h"
+#include "DiskCache.h"
+#include "ReflectionProbes.h"
+#include "ThreadPool.h"
+
+// Binding point of the baked probe block and texture unit of their array (shaders/baked_probes.glsl)
+const GLuint BAKED_PROBE_DATA_BINDING = 2;
+const GLuint BAKED_PROBE_TEXTURE_UNIT = 13;
+// Size of the arrays in the block
+const int MAX_BAKED_PROBES = 16;
+// Selection() of an object no probe reaches, it sees the sky
+const int NO_BAKED_PROBE = 255;
+
+// A probe as the scene places it: where it captures, the box its reflections are projected onto (the room, or
+// whatever bounds what it sees) and how far inside that box it fades out towards the next probe, per axis; 0
+// never fades along that axis, for floors and ceilings every probe ends at alike
+struct BakedProbe
+{
+    glm::vec3 position;
+    glm::vec3 boxMin, boxMax;
+    glm::vec3 blendDistance = glm::vec3(1.0f, 0.0f, 1.0f);
+};
+
+struct BakedProbeSettings
+{
+    int resolution = 128;       // of every face, its mips go down to one BC1 block
+    float nearPlane = 0.05f;
+    float farPlane = 50.0f;
+};
+
+// What Create() and the bake did, for the stats line
+struct BakedProbeStats
+{
+    bool cached = false;        // the blocks came from the disk cache
+    bool compressed = false;    // uploaded as BC1, decoded to RGBA8 otherwise
+    int captureFrames = 0;      // frames the probes took to render, one probe each
+    double compressMilliseconds = 0.0;  // read back, mips and BC1, or loading
+};
+
+// std140 mirror of the BakedProbeData block
+struct BakedProbeData
+{
+    glm::vec4 position[MAX_BAKED_PROBES];
+    glm::vec4 boxMin[MAX_BAKED_PROBES];
+    glm::vec4 boxMax[MAX_BAKED_PROBES];
+    int count;
+    float maxLevel;         // mip level a roughness of 1 reads
+    int padding[2];
+};
+
+// Reflection probes of the static scene, captured once and then only sampled. Each probe's six faces are layers
+// 6 * probe + face of one 2D texture array: GL 3.3 has no cube map arrays, so shaders/baked_probes.glsl picks the
+// face and its coordinates from the direction itself, as GL does for cube maps. Texels are BC1 blocks holding the
+// square root of the color, which spends the 5:6:5 endpoints where dark colors need them; every mip level down to
+// 4x4 is compressed on the CPU over the thread pool, and without EXT_texture_compression_s3tc the blocks are
+// decoded back to RGBA8, so both paths show the same colors.
+// The blocks are cached on disk, keyed by the probes, the settings and the scene's key (the lightmap's, which
+// covers the static triangles, lighting and sky). On a miss the probes are rendered through a ReflectionProbes
+// instance, one probe a frame in the frame's probe pass, then read back and compressed once the last one is done.
+// Reflections are parallax corrected: the ray from the shaded point is cut by the probe's box and the probe is
+// sampled towards that hit, so a floor or a wall shows up where it really is instead of infinitely far away.
+// Objects pick their probe on the CPU, the one with the smallest box around them; inside its blend distance
+// it is blended with the next, and only there does the shader fetch twice.
+class BakedReflectionProbes
+{
+public:
+    BakedProbeSettings Settings;
+    BakedProbeStats Stats;
+    GLuint Texture = 0;         // GL_TEXTURE_2D_ARRAY, 6 layers per probe
+
+    // Probes are added before Create(), at most MAX_BAKED_PROBES
+    int Add(const BakedProbe& probe)
+    {
+        if ((int)this->probes.size() >= MAX_BAKED_PROBES)
+        {
+            std::cout << "ERROR::BAKED_PROBES::TOO_MANY_PROBES" << std::endl;
+            return NO_BAKED_PROBE;
+        }
+        this->probes.push_back(probe);
+        return (int)this->probes.size() - 1;
+    }
+
+    void Create(const BakedProbeSettings& settings, std::uint64_t sceneKey)
+    {
+        this->Settings = settings;
+        this->Stats = BakedProbeStats();
+        this->Stats.compressed = glExtensions().textureCompressionS3tc;
+        this->levels = 0;
+        while ((settings.resolution >> this->levels) >= 4)
+            this->levels++;
+        this->key = this->cacheKey(sceneKey);
+
+        BakedProbeData data = {};
+        for (size_t i = 0; i < this->probes.size(); i++)
+        {
+            data.position[i] = glm::vec4(this->probes[i].position, 1.0f);
+            data.boxMin[i] = glm::vec4(this->probes[i].boxMin, 0.0f);
+            data.boxMax[i] = glm::vec4(this->probes[i].boxMax, 0.0f);
+        }
+        // none until their texels are there, see publish()
+        data.count = 0;
+        data.maxLevel = (float)(this->levels - 1);
+        glGenBuffers(1, &this->dataBuffer);
+        glBindBuffer(GL_UNIFORM_BUFFER, this->dataBuffer);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(BakedProbeData), &data, GL_STATIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glGenTextures(1, &this->Texture);
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::vector<char> blob;
+        this->Stats.cached = !this->probes.empty() && DiskCache::Read("baked_probes", this->key, blob) && blob.size() == this->blockBytes();
+        if (this->Stats.cached)
+        {
+            this->upload(blob);
+            this->publish();
+        }
+        else if (!this->probes.empty())
+        {
+            // every face of the capture cubes is out of date, Update() renders them one probe a frame
+            ReflectionProbeSettings capture;
+            capture.resolution = settings.resolution;
+            capture.facesPerFrame = 6;
+            capture.nearPlane = settings.nearPlane;
+            capture.farPlane = settings.farPlane;
+            for (const BakedProbe& probe : this->probes)
+                this->capture.Add(probe.position, settings.farPlane);
+            this->capture.Create(capture);
+            this->capturing = true;
+        }
+        this->Stats.compressMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void Destroy()
+    {
+        GLState& state = GLState::Instance();
+        if (this->capturing)
+            this->capture.Destroy();
+        state.DeleteTextures(1, &this->Texture);
+        glDeleteBuffers(1, &this->dataBuffer);
+        this->dataBuffer = 0;
+    }
+
+    // Schedules the next probe to capture, or compresses the captures once all are rendered. True while the
+    // frame's probe pass belongs to Capture()
+    bool Update()
+    {
+        if (!this->capturing)
+            return false;
+        this->capture.Update(glm::vec3(0.0f), std::vector<glm::vec4>());
+        if (this->capture.Active() >= 0)
+        {
+            this->Stats.captureFrames++;
+            return true;
+        }
+        this->finish();
+        return false;
+    }
+
+    bool Capturing() const
+    {
+        return this->capturing;
+    }
+
+    ReflectionProbes& Capture()
+    {
+        return this->capture;
+    }
+
+    // Whether the array holds the probes yet; until then every object sees the sky
+    bool Ready() const
+    {
+        return this->ready;
+    }
+
+    void Bind() const
+    {
+        GLState::Instance().BindTexture(BAKED_PROBE_TEXTURE_UNIT, GL_TEXTURE_2D_ARRAY, this->Texture);
+        glBindBufferBase(GL_UNIFORM_BUFFER, BAKED_PROBE_DATA_BINDING, this->dataBuffer);
+    }
+
+    // The probes an object at position reflects, packed for the shader: the first probe in bits 0-7, the one it
+    // blends towards in bits 8-15 and that one's weight (0-255) above; NO_BAKED_PROBE where there is none
+    int Selection(const glm::vec3& position) const
+    {
+        int first = NO_BAKED_PROBE, second = NO_BAKED_PROBE;
+        float firstWeight = 0.0f, firstVolume = 0.0f, secondVolume = 0.0f;
+        for (size_t i = 0; i < this->probes.size() && this->ready; i++)
+        {
+            const BakedProbe& probe = this->probes[i];
+            float weight = influence(probe, position);
+            if (weight <= 0.0f)
+                continue;
+            glm::vec3 size = probe.boxMax - probe.boxMin;
+            float volume = size.x * size.y * size.z;
+            if (first == NO_BAKED_PROBE || volume < firstVolume)
+            {
+                second = first;
+                secondVolume = firstVolume;
+                first = (int)i;
+                firstVolume = volume;
+                firstWeight = weight;
+            }
+            else if (second == NO_BAKED_PROBE || volume < secondVolume)
+            {
+                second = (int)i;
+                secondVolume = volume;
+            }
+        }
+        if (second == NO_BAKED_PROBE || firstWeight >= 1.0f)
+            return first | (NO_BAKED_PROBE << 8);
+        int blend = (int)((1.0f - firstWeight) * 255.0f + 0.5f);
+        return first | (second << 8) | (blend << 16);
+    }
+
+    size_t Count() const
+    {
+        return this->probes.size();
+    }
+
+    // The array with its mips
+    size_t MemoryBytes() const
+    {
+        if (this->Stats.compressed)
+            return this->blockBytes();
+        size_t texels = 0;
+        for (int level = 0; level < this->levels; level++)
+            texels += (size_t)(this->Settings.resolution >> level) * (this->Settings.resolution >> level);
+        return texels * 6 * this->probes.size() * 4;
+    }
+
+private:
+    std::vector<BakedProbe> probes;
+    ReflectionProbes capture;
+    bool capturing = false;
+    bool ready = false;
+    int levels = 0;
+    std::uint64_t key = 0;
+    GLuint dataBuffer = 0;
+
+    // 1 well inside the box, falling to 0 at its faces across the blend distance; 0 outside
+    static float influence(const BakedProbe& probe, const glm::vec3& position)
+    {
+        float weight = 1.0f;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float inside = std::min(position[axis] - probe.boxMin[axis], probe.boxMax[axis] - position[axis]);
+            if (inside < 0.0f)
+                return 0.0f;
+            if (probe.blendDistance[axis] > 0.0f)
+                weight = std::min(weight, inside / probe.blendDistance[axis]);
+        }
+        return weight;
+    }
+
+    std::uint64_t cacheKey(std::uint64_t sceneKey) const
+    {
+        std::uint64_t hash = DiskCache::Hash("baked probes v1");
+        hash = DiskCache::HashBytes(&this->Settings, sizeof(BakedProbeSettings), hash);
+        hash = DiskCache::HashBytes(this->probes.data(), this->probes.size() * sizeof(BakedProbe), hash);
+        return DiskCache::HashBytes(&sceneKey, sizeof(sceneKey), hash);
+    }
+
+    // Every level, each with all the layers, 8 bytes per 4x4 block
+    size_t blockBytes() const
+    {
+        size_t bytes = 0;
+        for (int level = 0; level < this->levels; level++)
+        {
+            size_t blocks = (size_t)(this->Settings.resolution >> level) / 4;
+            bytes += blocks * blocks * 8 * 6 * this->probes.size();
+        }
+        return bytes;
+    }
+
+    // Marks the probes ready and writes their count into the block, so shaders that pick a probe per pixel
+    // see the sky until then
+    void publish()
+    {
+        int count = (int)this->probes.size();
+        glBindBuffer(GL_UNIFORM_BUFFER, this->dataBuffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, offsetof(BakedProbeData, count), sizeof(int), &count);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        this->ready = true;
+    }
+
+    // Reads the captured cubes back, builds the mips and the blocks, caches and uploads them
+    void finish()
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        int resolution = this->Settings.resolution;
+        int layers = (int)this->probes.size() * 6;
+        std::vector<std::vector<float> > faces(layers, std::vector<float>((size_t)resolution * resolution * 3));
+        GLState& state = GLState::Instance();
+        for (size_t probe = 0; probe < this->probes.size(); probe++)
+        {
+            state.BindTexture(0, GL_TEXTURE_CUBE_MAP, this->capture.Texture((int)probe));
+            for (int face = 0; face < 6; face++)
+                glGetTexImage(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_RGB, GL_FLOAT, faces[probe * 6 + face].data());
+        }
+        this->capture.Destroy();
+        this->capturing = false;
+
+        // layer by layer: the square root, then each level from the one above, compressed
+        std::vector<size_t> offsets(this->levels);
+        size_t bytes = 0;
+        for (int level = 0; level < this->levels; level++)
+        {
+            offsets[level] = bytes;
+            size_t blocks = (size_t)(resolution >> level) / 4;
+            bytes += blocks * blocks * 8 * layers;
+        }
+        std::vector<char> blob(bytes);
+        ThreadPool::Instance().ParallelFor(layers, 1, [&](int begin, int end) {
+            for (int layer = begin; layer < end; layer++)
+            {
+                std::vector<float>& texels = faces[layer];
+                for (float& value : texels)
+                    value = std::sqrt(glm::clamp(value, 0.0f, 1.0f));
+                for (int level = 0, size = resolution; level < this->levels; level++, size /= 2)
+                {
+                    if (level > 0)
+                        texels = halve(texels, size * 2);
+                    size_t blocks = (size_t)size / 4;
+                    char* destination = blob.data() + offsets[level] + blocks * blocks * 8 * layer;
+                    for (int by = 0; by < size / 4; by++)
+                        for (int bx = 0; bx < size / 4; bx++)
+                            encodeBlock(texels.data(), size, bx * 4, by * 4, destination + ((size_t)by * blocks + bx) * 8);
+                }
+            }
+        });
+        DiskCache::Write("baked_probes", this->key, blob.data(), blob.size());
+        this->upload(blob);
+        this->publish();
+        this->Stats.compressMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void upload(const std::vector<char>& blob)
+    {
+        GLState& state = GLState::Instance();
+        state.BindTexture(0, GL_TEXTURE_2D_ARRAY, this->Texture);
+        int layers = (int)this->probes.size() * 6;
+        const char* source = blob.data();
+        for (int level = 0; level < this->levels; level++)
+        {
+            int size = this->Settings.resolution >> level;
+            size_t bytes = (size_t)(size / 4) * (size / 4) * 8 * layers;
+            if (this->Stats.compressed)
+                glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, size, size, layers, 0, (GLsizei)bytes, source);
+            else
+            {
+                std::vector<unsigned char> pixels((size_t)size * size * layers * 4);
+                for (int layer = 0; layer < layers; layer++)
+                    for (int by = 0; by < size / 4; by++)
+                        for (int bx = 0; bx < size / 4; bx++)
+                            decodeBlock(source + (((size_t)layer * (size / 4) + by) * (size / 4) + bx) * 8,
+                                &pixels[(((size_t)layer * size + by * 4) * size + bx * 4) * 4], size);
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, level, GL_RGBA8, size, size, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+            }
+            source += bytes;
+        }
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, this->levels - 1);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    // 2x2 box filter of a square RGB level
+    static std::vector<float> halve(const std::vector<float>& texels, int size)
+    {
+        int half = size / 2;
+        std::vector<float> result((size_t)half * half * 3);
+        for (int y = 0; y < half; y++)
+            for (int x = 0; x < half; x++)
+                for (int channel = 0; channel < 3; channel++)
+                {
+                    const float* row = &texels[((size_t)(2 * y) * size + 2 * x) * 3 + channel];
+                    result[((size_t)y * half + x) * 3 + channel] = 0.25f * (row[0] + row[3] + row[(size_t)size * 3] + row[(size_t)size * 3 + 3]);
+                }
+        return result;
+    }
+
+    static std::uint16_t packRgb565(const glm::vec3& color)
+    {
+        glm::vec3 c = glm::clamp(color, glm::vec3(0.0f), glm::vec3(1.0f));
+        return (std::uint16_t)(((int)(c.r * 31.0f + 0.5f) << 11) | ((int)(c.g * 63.0f + 0.5f) << 5) | (int)(c.b * 31.0f + 0.5f));
+    }
+
+    static glm::vec3 unpackRgb565(std::uint16_t color)
+    {
+        return glm::vec3((color >> 11) / 31.0f, ((color >> 5) & 63) / 63.0f, (color & 31) / 31.0f);
+    }
+
+    // The four colors of a block with c0 > c1: the endpoints and the two thirds between them
+    static void palette(std::uint16_t c0, std::uint16_t c1, glm::vec3* colors)
+    {
+        colors[0] = unpackRgb565(c0);
+        colors[1] = unpackRgb565(c1);
+        colors[2] = (2.0f * colors[0] + colors[1]) / 3.0f;
+        colors[3] = (colors[0] + 2.0f * colors[1]) / 3.0f;
+    }
+
+    // BC1 block at (x, y) of a square RGB level: the endpoints span the texels along their principal axis,
+    // found by a few power iterations of the covariance, and each texel takes the nearest of the four colors
+    static void encodeBlock(const float* texels, int size, int x, int y, char* destination)
+    {
+        glm::vec3 block[16], mean(0.0f);
+        for (int i = 0; i < 16; i++)
+        {
+            const float* texel = &texels[((size_t)(y + i / 4) * size + x + i % 4) * 3];
+            block[i] = glm::vec3(texel[0], texel[1], texel[2]);
+            mean += block[i] / 16.0f;
+        }
+        glm::mat3 covariance(0.0f);
+        for (int i = 0; i < 16; i++)
+        {
+            glm::vec3 d = block[i] - mean;
+            covariance += glm::outerProduct(d, d);
+        }
+        glm::vec3 axis(0.577f);
+        for (int iteration = 0; iteration < 4; iteration++)
+        {
+            axis = covariance * axis;
+            float length = glm::length(axis);
+            if (length < 1e-12f)
+                break;
+            axis /= length;
+        }
+        float low = 0.0f, high = 0.0f;
+        for (int i = 0; i < 16; i++)
+        {
+            float t = glm::dot(block[i] - mean, axis);
+            low = std::min(low, t);
+            high = std::max(high, t);
+        }
+        std::uint16_t c0 = packRgb565(mean + axis * high), c1 = packRgb565(mean + axis * low);
+        if (c0 < c1)
+            std::swap(c0, c1);
+        std::uint32_t indices = 0;
+        // equal endpoints are the three color mode, index 0 still reads c0
+        if (c0 != c1)
+        {
+            glm::vec3 colors[4];
+            palette(c0, c1, colors);
+            for (int i = 0; i < 16; i++)
+            {
+                int best = 0;
+                float bestDistance = 1e30f;
+                for (int k = 0; k < 4; k++)
+                {
+                    glm::vec3 d = block[i] - colors[k];
+                    float distance = glm::dot(d, d);
+                    if (distance < bestDistance)
+                    {
+                        bestDistance = distance;
+                        best = k;
+                    }
+                }
+                indices |= (std::uint32_t)best << (2 * i);
+            }
+        }
+        std::memcpy(destination, &c0, 2);
+        std::memcpy(destination + 2, &c1, 2);
+        std::memcpy(destination + 4, &indices, 4);
+    }
+
+    // The 4x4 texels of a block into RGBA8 rows of the given width
+    static void decodeBlock(const char* source, unsigned char* pixels, int width)
+    {
+        std::uint16_t c0, c1;
+        std::uint32_t indices;
+        std::memcpy(&c0, source, 2);
+        std::memcpy(&c1, source + 2, 2);
+        std::memcpy(&indices, source + 4, 4);
+        glm::vec3 colors[4];
+        palette(c0, c1, colors);
+        for (int i = 0; i < 16; i++)
+        {
+            glm::vec3 color = c0 > c1 ? colors[(indices >> (2 * i)) & 3] : colors[0];
+            unsigned char* pixel = pixels + ((size_t)(i / 4) * width + i % 4) * 4;
+            for (int channel = 0; channel < 3; channel++)
+                pixel[channel] = (unsigned char)(color[channel] * 255.0f + 0.5f);
+            pixel[3] = 255;
+        }
+    }
+};
@@ -0,0 +1,294 @@
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// SSE2, part of every x86-64 target
+#include <emmintrin.h>
+
+// GL Includes
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "GLState.h"
+#include "SpriteAtlas.h"
+#include "StreamBuffer.h"
+#include "ThreadPool.h"
+
+// What billboard.vs reads per instance: center and size, then the sprite's rectangle and page in the atlas
+struct BillboardInstance
+{
+    glm::vec4 position;         // xyz, size
+    glm::u16vec4 rect;
+    float layer;
+    float padding;
+};
+
+// Counters of the last Update()
+struct BillboardStats
+{
+    unsigned int count = 0;             // billboards in the arrays
+    unsigned int visible = 0;           // in front of the camera and inside the far plane, drawn
+    unsigned int sortPasses = 0;        // radix passes run, a digit shared by every key is skipped
+    double depthMilliseconds = 0.0;     // view depth, culling and keys
+    double sortMilliseconds = 0.0;
+    double uploadMilliseconds = 0.0;    // sorted instances into the stream buffer
+};
+
+// Camera facing, alpha blended quads drawn back to front in one instanced draw.
+// Positions and sizes live in flat arrays, one per component, so the view depth of four billboards is one
+// SSE multiply-add over the camera's front vector. The depth is quantized into a 24 bit key, inverted so the
+// farthest sorts first, and the keys with their indices go through an LSD radix sort of three 8 bit digits
+// into buffers that only grow with the count: no per-frame allocation and no comparisons. The sorted
+// (position, size) instances are streamed into a ring, and billboard.vs spans each quad along the camera's
+// right and up vectors, so the whole set costs one draw whatever its size. Each billboard also picks a sprite of
+// a SpriteAtlas, whose page and rectangle go with its instance, so a mix of sprites is still that one draw.
+class BillboardRenderer
+{
+public:
+    BillboardStats Stats;
+    GLuint VertexArray = 0;
+
+    // quadBuffer holds the six (position, coordinates) vertices of the unit quad; capacity bounds the count
+    void Create(GLuint quadBuffer, int capacity)
+    {
+        this->capacity = capacity;
+        this->instanceRing.Create(GL_ARRAY_BUFFER, (GLsizeiptr)capacity * sizeof(BillboardInstance));
+        this->VertexArray = CreateVertexArray(quadBuffer, this->instanceRing.Buffer);
+    }
+
+    // The sprites the billboards pick from, by index
+    void SetFrames(const std::vector<SpriteFrame>& frames)
+    {
+        this->frames = frames;
+    }
+
+    // The vertex array billboard.vs reads: the quad, and one BillboardInstance per instance from instanceBuffer
+    static GLuint CreateVertexArray(GLuint quadBuffer, GLuint instanceBuffer)
+    {
+        GLState& state = GLState::Instance();
+        GLuint vertexArray;
+        glGenVertexArrays(1, &vertexArray);
+        state.BindVertexArray(vertexArray);
+        glBindBuffer(GL_ARRAY_BUFFER, quadBuffer);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
+        glEnableVertexAttribArray(1);
+        for (GLuint attribute = 2; attribute <= 4; attribute++)
+        {
+            glVertexAttribDivisor(attribute, 1);
+            glEnableVertexAttribArray(attribute);
+        }
+        state.BindVertexArray(0);
+        PointInstances(vertexArray, instanceBuffer, 0);
+        return vertexArray;
+    }
+
+    // Points the instance attribute at offset, the start of this frame's slice of a ring
+    static void PointInstances(GLuint vertexArray, GLuint instanceBuffer, GLintptr offset)
+    {
+        GLState& state = GLState::Instance();
+        state.BindVertexArray(vertexArray);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        const GLsizei stride = sizeof(BillboardInstance);
+        glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, stride, (void*)(offset + offsetof(BillboardInstance, position)));
+        glVertexAttribPointer(3, 4, GL_UNSIGNED_SHORT, GL_TRUE, stride, (void*)(offset + offsetof(BillboardInstance, rect)));
+        glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, stride, (void*)(offset + offsetof(BillboardInstance, layer)));
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        state.BindVertexArray(0);
+    }
+
+    void Destroy()
+    {
+        GLState::Instance().DeleteVertexArrays(1, &this->VertexArray);
+        this->instanceRing.Destroy();
+    }
+
+    // Keeps the first count billboards, new ones start at the origin
+    void Resize(int count)
+    {
+        count = std::min(count, this->capacity);
+        this->x.resize(count);
+        this->y.resize(count);
+        this->z.resize(count);
+        this->size.resize(count, 1.0f);
+        this->sprite.resize(count, 0);
+        this->keys.resize(count);
+        this->indices.resize(count);
+        this->sortedKeys.resize(count);
+        this->sortedIndices.resize(count);
+    }
+
+    void Set(int i, const glm::vec3& position, float size = 1.0f, int sprite = 0)
+    {
+        this->x[i] = position.x;
+        this->y[i] = position.y;
+        this->z[i] = position.z;
+        this->size[i] = size;
+        this->sprite[i] = (std::uint16_t)sprite;
+    }
+
+    int Count() const
+    {
+        return (int)this->x.size();
+    }
+
+    // Billboards to draw this frame, the instance count of the draw
+    int Visible() const
+    {
+        return (int)this->Stats.visible;
+    }
+
+    // Culls and sorts the billboards back to front for this view and streams the instances of the visible ones;
+    // blended in any order (weighted blended transparency) the sort is skipped and they keep their array order
+    void Update(const glm::vec3& eye, const glm::vec3& front, float farPlane, bool sortBackToFront = true)
+    {
+        this->Stats = BillboardStats();
+        this->Stats.count = (unsigned int)this->Count();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        int visible = this->depthKeys(eye, front, farPlane);
+        std::chrono::steady_clock::time_point sorted = std::chrono::steady_clock::now();
+        const std::uint32_t* order = sortBackToFront ? this->radixSort(visible) : this->indices.data();
+        std::chrono::steady_clock::time_point uploaded = std::chrono::steady_clock::now();
+        this->Stats.visible = (unsigned int)visible;
+        this->Stats.depthMilliseconds = std::chrono::duration<double, std::milli>(sorted - start).count();
+        this->Stats.sortMilliseconds = std::chrono::duration<double, std::milli>(uploaded - sorted).count();
+        if (visible == 0)
+            return;
+
+        // gather the instances in sorted order, the writes are sequential in every chunk
+        BillboardInstance* instances = (BillboardInstance*)this->instanceRing.Map();
+        ThreadPool::Instance().ParallelFor(visible, 1 << 14, [&](int begin, int end) {
+            for (int i = begin; i < end; i++)
+            {
+                std::uint32_t index = order[i];
+                const SpriteFrame& frame = this->frames[this->sprite[index]];
+                BillboardInstance& instance = instances[i];
+                instance.position = glm::vec4(this->x[index], this->y[index], this->z[index], this->size[index]);
+                instance.rect = frame.rect;
+                instance.layer = frame.layer;
+            }
+        });
+        this->instanceRing.Unmap();
+        PointInstances(this->VertexArray, this->instanceRing.Buffer, this->instanceRing.Offset());
+        this->Stats.uploadMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - uploaded).count();
+    }
+
+    // Call once the draw reading this frame's instances is submitted
+    void EndFrame()
+    {
+        this->instanceRing.EndFrame();
+    }
+
+private:
+    static const int KEY_BITS = 24;
+    static const int DIGIT_BITS = 8;
+    static const int DIGITS = KEY_BITS / DIGIT_BITS;
+    static const int BUCKETS = 1 << DIGIT_BITS;
+
+    int capacity = 0;
+    std::vector<float> x, y, z, size;
+    std::vector<std::uint16_t> sprite;
+    std::vector<SpriteFrame> frames = std::vector<SpriteFrame>(1);
+    std::vector<std::uint32_t> keys, indices, sortedKeys, sortedIndices;
+    StreamBuffer instanceRing;
+
+    // View depth of every billboard, four at a time; the ones in range get a key and their index appended.
+    // Returns how many
+    int depthKeys(const glm::vec3& eye, const glm::vec3& front, float farPlane)
+    {
+        const int count = this->Count();
+        // the scale rounds up in float, so a depth clamped to 0 would make a key one past KEY_BITS; keys are capped
+        const float keyMax = (float)((1 << KEY_BITS) - 1);
+        const float keyScale = keyMax / farPlane;
+        // a quad still reaches into view while its center is up to its size behind the camera, the key clamps it to 0
+        const float nearest = -1.0f;
+        // depth = dot(p, front) - dot(eye, front)
+        const float offset = -glm::dot(eye, front);
+        const __m128 frontX = _mm_set1_ps(front.x), frontY = _mm_set1_ps(front.y), frontZ = _mm_set1_ps(front.z);
+        const __m128 offsets = _mm_set1_ps(offset), nearPlanes = _mm_set1_ps(nearest), farPlanes = _mm_set1_ps(farPlane);
+        const __m128 zeros = _mm_setzero_ps(), scales = _mm_set1_ps(keyScale), keyMaxes = _mm_set1_ps(keyMax);
+        std::uint32_t* keys = this->keys.data();
+        std::uint32_t* indices = this->indices.data();
+        int visible = 0;
+        int i = 0;
+        alignas(16) std::uint32_t quad[4];
+        for (; i + 4 <= count; i += 4)
+        {
+            __m128 depth = _mm_add_ps(offsets, _mm_mul_ps(_mm_loadu_ps(&this->x[i]), frontX));
+            depth = _mm_add_ps(depth, _mm_mul_ps(_mm_loadu_ps(&this->y[i]), frontY));
+            depth = _mm_add_ps(depth, _mm_mul_ps(_mm_loadu_ps(&this->z[i]), frontZ));
+            int mask = _mm_movemask_ps(_mm_and_ps(_mm_cmpgt_ps(depth, nearPlanes), _mm_cmplt_ps(depth, farPlanes)));
+            if (mask == 0)
+                continue;
+            // farther is smaller: far plane - depth, clamped at the camera
+            __m128 inverted = _mm_sub_ps(farPlanes, _mm_max_ps(depth, zeros));
+            _mm_store_si128((__m128i*)quad, _mm_cvttps_epi32(_mm_min_ps(_mm_mul_ps(inverted, scales), keyMaxes)));
+            for (int lane = 0; lane < 4; lane++)
+                if (mask & (1 << lane))
+                {
+                    keys[visible] = quad[lane];
+                    indices[visible] = (std::uint32_t)(i + lane);
+                    visible++;
+                }
+        }
+        for (; i < count; i++)
+        {
+            float depth = this->x[i] * front.x + this->y[i] * front.y + this->z[i] * front.z + offset;
+            if (depth <= nearest || depth >= farPlane)
+                continue;
+            keys[visible] = (std::uint32_t)std::min((farPlane - std::max(depth, 0.0f)) * keyScale, keyMax);
+            indices[visible] = (std::uint32_t)i;
+            visible++;
+        }
+        return visible;
+    }
+
+    // Sorts the first count keys with their indices, ascending; one counting pass builds the histograms of all
+    // digits, then every digit scatters between the two buffer pairs. Returns the sorted indices
+    const std::uint32_t* radixSort(int count)
+    {
+        std::uint32_t histograms[DIGITS][BUCKETS] = {};
+        for (int i = 0; i < count; i++)
+        {
+            std::uint32_t key = this->keys[i];
+            for (int digit = 0; digit < DIGITS; digit++)
+                histograms[digit][(key >> (digit * DIGIT_BITS)) & (BUCKETS - 1)]++;
+        }
+        std::uint32_t* keys = this->keys.data();
+        std::uint32_t* indices = this->indices.data();
+        std::uint32_t* otherKeys = this->sortedKeys.data();
+        std::uint32_t* otherIndices = this->sortedIndices.data();
+        for (int digit = 0; digit < DIGITS; digit++)
+        {
+            std::uint32_t* histogram = histograms[digit];
+            const int shift = digit * DIGIT_BITS;
+            // every key has the same digit, the order stays as it is
+            if (count == 0 || histogram[(keys[0] >> shift) & (BUCKETS - 1)] == (std::uint32_t)count)
+                continue;
+            std::uint32_t offset = 0;
+            for (int bucket = 0; bucket < BUCKETS; bucket++)
+            {
+                std::uint32_t bucketCount = histogram[bucket];
+                histogram[bucket] = offset;
+                offset += bucketCount;
+            }
+            for (int i = 0; i < count; i++)
+            {
+                std::uint32_t key = keys[i];
+                std::uint32_t slot = histogram[(key >> shift) & (BUCKETS - 1)]++;
+                otherKeys[slot] = key;
+                otherIndices[slot] = indices[i];
+            }
+            std::swap(keys, otherKeys);
+            std::swap(indices, otherIndices);
+            this->Stats.sortPasses++;
+        }
+        return indices;
+    }
+};
@@ -0,0 +1,86 @@
+#pragma once
+
+// Std. Includes
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// Content-keyed blob storage under ../cache, shared by everything that caches derived data on disk.
+// Each file carries its key in the header, so a stale or foreign file is treated as a miss.
+class DiskCache
+{
+public:
+    // 64-bit FNV-1a, chainable through the seed
+    static std::uint64_t HashBytes(const void* data, size_t size, std::uint64_t seed = 14695981039346656037ull)
+    {
+        const unsigned char* bytes = (const unsigned char*)data;
+        std::uint64_t hash = seed;
+        for (size_t i = 0; i < size; i++)
+        {
+            hash ^= bytes[i];
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+    static std::uint64_t Hash(const std::string& text, std::uint64_t seed = 14695981039346656037ull)
+    {
+        return HashBytes(text.data(), text.size(), seed);
+    }
+
+    static std::string Path(const std::string& name, std::uint64_t key)
+    {
+        char hex[17];
+        std::snprintf(hex, sizeof(hex), "%016llx", (unsigned long long)key);
+        return std::string(CACHE_DIRECTORY) + "/" + name + "_" + hex + ".bin";
+    }
+
+    // Returns false when the file is missing, truncated or was written for another key
+    static bool Read(const std::string& name, std::uint64_t key, std::vector<char>& data)
+    {
+        FILE* file = std::fopen(Path(name, key).c_str(), "rb");
+        if (!file)
+            return false;
+        Header header;
+        bool valid = std::fread(&header, sizeof(header), 1, file) == 1 && header.magic == MAGIC && header.key == key;
+        if (valid)
+        {
+            data.resize((size_t)header.size);
+            valid = header.size == 0 || std::fread(data.data(), (size_t)header.size, 1, file) == 1;
+        }
+        std::fclose(file);
+        return valid;
+    }
+
+    static bool Write(const std::string& name, std::uint64_t key, const void* data, size_t size)
+    {
+#ifdef _WIN32
+        _mkdir(CACHE_DIRECTORY);
+#else
+        mkdir(CACHE_DIRECTORY, 0755);
+#endif
+        FILE* file = std::fopen(Path(name, key).c_str(), "wb");
+        if (!file)
+            return false;
+        Header header = { MAGIC, key, (std::uint64_t)size };
+        bool written = std::fwrite(&header, sizeof(header), 1, file) == 1 && (size == 0 || std::fwrite(data, size, 1, file) == 1);
+        std::fclose(file);
+        return written;
+    }
+
+private:
+    static constexpr const char* CACHE_DIRECTORY = "../cache";
+    static constexpr std::uint64_t MAGIC = 0x31484341434b5347ull;      // "GSKCACH1"
+
+    struct Header
+    {
+        std::uint64_t magic;
+        std::uint64_t key;
+        std::uint64_t size;
+    };
+};
@@ -0,0 +1,77 @@
+#pragma once
+
+// GL Includes
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "StreamBuffer.h"
+
+// Binding point of the per-frame block, the same for every program
+const GLuint FRAME_DATA_BINDING = 0;
+// Size of the cascade arrays in the block, MAX_CASCADES in shaders/frame_data.glsl
+const int MAX_SHADOW_CASCADES = 4;
+// Spherical harmonics up to l = 2 for the sky's irradiance (ImageBasedLighting.h)
+const int FRAME_IRRADIANCE_COEFFICIENTS = 9;
+
+// std140 mirror of the FrameData block in shaders/frame_data.glsl. vec3 members are padded to vec4
+struct DirectLightData
+{
+    glm::vec4 direction;
+    glm::vec4 ambient;
+    glm::vec4 diffuse;
+    glm::vec4 specular;
+};
+
+struct FrameData
+{
+    glm::mat4 viewMat;
+    glm::mat4 projectionMat;
+    glm::mat4 cascadeMatrices[MAX_SHADOW_CASCADES];     // light space of each cascade
+    glm::vec4 cascadeSplits;                            // far view depth of each cascade
+    glm::vec3 viewPos;
+    float time;
+    DirectLightData directLight;
+    int transformBase;      // first texel of this frame's slice of the transform buffer
+    int cascadeCount;
+    float environmentScale;     // 1 / average luminance of the sky, normalizes the prefiltered environment
+    float environmentMaxLevel;  // level of the roughest reflection
+    glm::vec4 irradianceSH[FRAME_IRRADIANCE_COEFFICIENTS];
+};
+static_assert(sizeof(DirectLightData) == 64 && sizeof(FrameData) == 640, "FrameData must follow std140 layout");
+
+// Writes the frame block once into its ring slice and binds that slice for every program
+class FrameUniforms
+{
+public:
+    FrameData Data;
+
+    void Create()
+    {
+        this->ring.Create(GL_UNIFORM_BUFFER, sizeof(FrameData));
+    }
+
+    void Destroy()
+    {
+        this->ring.Destroy();
+    }
+
+    void Upload()
+    {
+        std::memcpy(this->ring.Map(), &this->Data, sizeof(FrameData));
+        this->ring.Unmap();
+        glBindBufferRange(GL_UNIFORM_BUFFER, FRAME_DATA_BINDING, this->ring.Buffer, this->ring.Offset(), sizeof(FrameData));
+    }
+
+    void EndFrame()
+    {
+        this->ring.EndFrame();
+    }
+
+    const StreamBuffer& Ring() const
+    {
+        return this->ring;
+    }
+
+private:
+    StreamBuffer ring;
+};
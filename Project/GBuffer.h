@@ -0,0 +1,121 @@
+#pragma once
+
+// Std. Includes
+#include <iostream>
+
+// GL Includes
+#include <glad/glad.h>
+
+#include "GLState.h"
+
+// Render targets of the deferred pipeline. The geometry pass writes two 32-bit targets next to a depth-stencil
+// texture (layout in shaders/gbuffer.glsl):
+//   albedo   RGBA8     albedo, specular intensity
+//   normal   RGB10_A2  octahedral normal (10 + 10 bits), shininess / 256, lighting model (2 bits)
+// and the position is rebuilt from depth. The lighting pass reads them on units 0-2 and writes the lit color
+// into a target of its own; the forward passes after it (outlines, sky, transparent) draw on top of that color
+// with the geometry's depth and stencil, and Present() copies the result to the default framebuffer. The
+// lighting pass gets a framebuffer without the depth attachment, it samples the depth texture.
+class GBuffer
+{
+public:
+    GLuint AlbedoTexture = 0;
+    GLuint NormalTexture = 0;
+    GLuint DepthTexture = 0;            // DEPTH24_STENCIL8
+    GLuint ColorTexture = 0;            // lit result, RGBA8
+    GLuint Framebuffer = 0;             // geometry pass: albedo, normal, depth-stencil
+    GLuint LightingFramebuffer = 0;     // lighting pass: color only
+    GLuint SceneFramebuffer = 0;        // passes after the lighting: color with the geometry's depth-stencil
+
+    void Create(int width, int height)
+    {
+        this->width = width;
+        this->height = height;
+        this->AlbedoTexture = this->createTarget(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+        this->NormalTexture = this->createTarget(GL_RGB10_A2, GL_RGBA, GL_UNSIGNED_INT_2_10_10_10_REV);
+        this->DepthTexture = this->createTarget(GL_DEPTH24_STENCIL8, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8);
+        this->ColorTexture = this->createTarget(GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+
+        GLState& state = GLState::Instance();
+        glGenFramebuffers(1, &this->Framebuffer);
+        state.BindFramebuffer(this->Framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->AlbedoTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, this->NormalTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, this->DepthTexture, 0);
+        const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, drawBuffers);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::GBUFFER::FRAMEBUFFER_INCOMPLETE" << std::endl;
+
+        glGenFramebuffers(1, &this->LightingFramebuffer);
+        state.BindFramebuffer(this->LightingFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->ColorTexture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::GBUFFER::LIGHTING_FRAMEBUFFER_INCOMPLETE" << std::endl;
+
+        glGenFramebuffers(1, &this->SceneFramebuffer);
+        state.BindFramebuffer(this->SceneFramebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->ColorTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, this->DepthTexture, 0);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::GBUFFER::SCENE_FRAMEBUFFER_INCOMPLETE" << std::endl;
+        state.BindFramebuffer(0);
+    }
+
+    void Destroy()
+    {
+        GLState& state = GLState::Instance();
+        state.DeleteFramebuffers(1, &this->Framebuffer);
+        state.DeleteFramebuffers(1, &this->LightingFramebuffer);
+        state.DeleteFramebuffers(1, &this->SceneFramebuffer);
+        GLuint textures[] = { this->AlbedoTexture, this->NormalTexture, this->DepthTexture, this->ColorTexture };
+        state.DeleteTextures(4, textures);
+    }
+
+    // Binds the geometry targets and clears them, depth and stencil included
+    void BeginGeometryPass()
+    {
+        GLState::Instance().BindFramebuffer(this->Framebuffer);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+    }
+
+    // Binds the lit color alone and clears it to the current clear color, pixels without geometry keep it
+    void BeginLightingPass()
+    {
+        GLState::Instance().BindFramebuffer(this->LightingFramebuffer);
+        glClear(GL_COLOR_BUFFER_BIT);
+    }
+
+    // Copies the lit color to the default framebuffer and leaves that bound
+    void Present()
+    {
+        GLState& state = GLState::Instance();
+        state.BindFramebuffer(GL_READ_FRAMEBUFFER, this->SceneFramebuffer);
+        state.BindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+        glBlitFramebuffer(0, 0, this->width, this->height, 0, 0, this->width, this->height, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        state.BindFramebuffer(0);
+    }
+
+    // The geometry targets and the lit color
+    size_t MemoryBytes() const
+    {
+        return (size_t)this->width * this->height * (4 + 4 + 4 + 4);
+    }
+
+private:
+    int width = 0, height = 0;
+
+    // Read texel by texel, no filtering or mipmaps
+    GLuint createTarget(GLenum internalFormat, GLenum format, GLenum type)
+    {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        GLState::Instance().BindTexture(0, GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, this->width, this->height, 0, format, type, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return texture;
+    }
+};
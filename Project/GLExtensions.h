@@ -0,0 +1,106 @@
+#pragma once
+
+// GL Includes
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+// glad is generated for the 3.3 core profile only. Entry points from newer versions or extensions
+// are loaded here through GLFW and stay null when the driver doesn't expose them, so every user must
+// check the matching flag and keep a 3.3 fallback.
+
+// GL 4.1 / ARB_get_program_binary
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#define GL_PROGRAM_BINARY_FORMATS 0x87FF
+#endif
+// GL 4.4 / ARB_buffer_storage
+#ifndef GL_MAP_PERSISTENT_BIT
+#define GL_MAP_PERSISTENT_BIT 0x0040
+#define GL_MAP_COHERENT_BIT 0x0080
+#define GL_DYNAMIC_STORAGE_BIT 0x0100
+#endif
+
+// KHR_parallel_shader_compile / ARB_parallel_shader_compile
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+// EXT_texture_compression_s3tc
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+
+struct GLExtensions
+{
+    // GL 4.1 / ARB_get_program_binary
+    bool programBinary = false;
+    void (APIENTRY* GetProgramBinary)(GLuint program, GLsizei bufSize, GLsizei* length, GLenum* binaryFormat, void* binary) = nullptr;
+    void (APIENTRY* ProgramBinary)(GLuint program, GLenum binaryFormat, const void* binary, GLsizei length) = nullptr;
+    void (APIENTRY* ProgramParameteri)(GLuint program, GLenum pname, GLint value) = nullptr;
+    // GL 4.4 / ARB_buffer_storage
+    bool bufferStorage = false;
+    void (APIENTRY* BufferStorage)(GLenum target, GLsizeiptr size, const void* data, GLbitfield flags) = nullptr;
+    // KHR_parallel_shader_compile / ARB_parallel_shader_compile
+    bool parallelShaderCompile = false;
+    void (APIENTRY* MaxShaderCompilerThreads)(GLuint count) = nullptr;
+    // GL 4.3 / ARB_copy_image
+    bool copyImage = false;
+    void (APIENTRY* CopyImageSubData)(GLuint srcName, GLenum srcTarget, GLint srcLevel, GLint srcX, GLint srcY, GLint srcZ,
+        GLuint dstName, GLenum dstTarget, GLint dstLevel, GLint dstX, GLint dstY, GLint dstZ,
+        GLsizei srcWidth, GLsizei srcHeight, GLsizei srcDepth) = nullptr;
+    // EXT_texture_compression_s3tc, no entry points: BC1 blocks go through glCompressedTexImage
+    bool textureCompressionS3tc = false;
+};
+
+inline GLExtensions& glExtensions()
+{
+    static GLExtensions extensions;
+    return extensions;
+}
+
+inline bool glVersionAtLeast(int major, int minor)
+{
+    GLint contextMajor = 0, contextMinor = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &contextMajor);
+    glGetIntegerv(GL_MINOR_VERSION, &contextMinor);
+    return contextMajor > major || (contextMajor == major && contextMinor >= minor);
+}
+
+// Must be called once after gladLoadGLLoader, with the context current
+inline void loadGLExtensions()
+{
+    GLExtensions& ext = glExtensions();
+
+    if (glVersionAtLeast(4, 1) || glfwExtensionSupported("GL_ARB_get_program_binary"))
+    {
+        ext.GetProgramBinary = (void (APIENTRY*)(GLuint, GLsizei, GLsizei*, GLenum*, void*))glfwGetProcAddress("glGetProgramBinary");
+        ext.ProgramBinary = (void (APIENTRY*)(GLuint, GLenum, const void*, GLsizei))glfwGetProcAddress("glProgramBinary");
+        ext.ProgramParameteri = (void (APIENTRY*)(GLuint, GLenum, GLint))glfwGetProcAddress("glProgramParameteri");
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        ext.programBinary = ext.GetProgramBinary && ext.ProgramBinary && ext.ProgramParameteri && formats > 0;
+    }
+    if (glVersionAtLeast(4, 4) || glfwExtensionSupported("GL_ARB_buffer_storage"))
+    {
+        ext.BufferStorage = (void (APIENTRY*)(GLenum, GLsizeiptr, const void*, GLbitfield))glfwGetProcAddress("glBufferStorage");
+        ext.bufferStorage = ext.BufferStorage != nullptr;
+    }
+    if (glfwExtensionSupported("GL_KHR_parallel_shader_compile"))
+        ext.MaxShaderCompilerThreads = (void (APIENTRY*)(GLuint))glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+    else if (glfwExtensionSupported("GL_ARB_parallel_shader_compile"))
+        ext.MaxShaderCompilerThreads = (void (APIENTRY*)(GLuint))glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+    if (ext.MaxShaderCompilerThreads)
+    {
+        // let the driver use as many compiler threads as it likes
+        ext.MaxShaderCompilerThreads(0xFFFFFFFFu);
+        ext.parallelShaderCompile = true;
+    }
+    if (glVersionAtLeast(4, 3) || glfwExtensionSupported("GL_ARB_copy_image"))
+    {
+        ext.CopyImageSubData = (void (APIENTRY*)(GLuint, GLenum, GLint, GLint, GLint, GLint, GLuint, GLenum, GLint, GLint, GLint, GLint,
+            GLsizei, GLsizei, GLsizei))glfwGetProcAddress("glCopyImageSubData");
+        ext.copyImage = ext.CopyImageSubData != nullptr;
+    }
+    ext.textureCompressionS3tc = glfwExtensionSupported("GL_EXT_texture_compression_s3tc") != 0;
+}
@@ -0,0 +1,360 @@
+#pragma once
+
+// GL Includes
+#include <glad/glad.h>
+
+// Per-frame counters of the state cache, calls that reached the driver vs. calls dropped as redundant
+struct GLStateStats
+{
+    unsigned int issued = 0;
+    unsigned int elided = 0;
+};
+
+// Shadow copy of the GL state the renderer touches. Every bind and state change goes through here and
+// is dropped when it would not change anything. The shadow starts unknown, so the first call of each
+// kind always reaches the driver; call Invalidate() after any code that changes state behind its back.
+class GLState
+{
+public:
+    static const int MAX_TEXTURE_UNITS = 16;
+    GLStateStats Stats;
+
+    static GLState& Instance()
+    {
+        static GLState state;
+        return state;
+    }
+
+    // Forgets everything, the next call of each kind is issued
+    void Invalidate()
+    {
+        this->program = UNKNOWN;
+        this->vertexArray = UNKNOWN;
+        this->activeUnit = UNKNOWN;
+        for (int unit = 0; unit < MAX_TEXTURE_UNITS; unit++)
+        {
+            for (int target = 0; target < TEXTURE_TARGETS; target++)
+                this->textures[unit][target] = UNKNOWN;
+            this->samplers[unit] = UNKNOWN;
+        }
+        for (int cap = 0; cap < CAPABILITIES; cap++)
+            this->capabilities[cap] = -1;
+        this->drawFramebuffer = UNKNOWN;
+        this->readFramebuffer = UNKNOWN;
+        this->blend[0] = UNKNOWN;
+        this->blendEquation = UNKNOWN;
+        this->depthFunc = UNKNOWN;
+        this->depthMask = -1;
+        this->stencilFunc[0] = UNKNOWN;
+        this->stencilOp[0] = UNKNOWN;
+        this->stencilMask = UNKNOWN;
+        this->colorMask = -1;
+        this->cullFace = UNKNOWN;
+        this->viewport[2] = -1;
+    }
+
+    void ResetStats()
+    {
+        this->Stats = GLStateStats();
+    }
+
+    // objects
+    // ------------------------------------------------------------------------
+    void UseProgram(GLuint program)
+    {
+        if (this->changed(this->program, program))
+            glUseProgram(program);
+    }
+
+    void BindVertexArray(GLuint vertexArray)
+    {
+        if (this->changed(this->vertexArray, vertexArray))
+            glBindVertexArray(vertexArray);
+    }
+
+    // Binds the texture to the unit and leaves the unit active even when the bind itself is elided, so texture
+    // commands issued after it (glTexImage*, glTexParameter*, glGenerateMipmap, ...) always edit this texture
+    void BindTexture(GLuint unit, GLenum target, GLuint texture)
+    {
+        int slot = textureSlot(target);
+        this->ActiveTexture(unit);
+        if (unit >= MAX_TEXTURE_UNITS || slot < 0)
+        {
+            this->Stats.issued++;
+            glBindTexture(target, texture);
+            return;
+        }
+        if (this->textures[unit][slot] == texture)
+        {
+            this->Stats.elided++;
+            return;
+        }
+        this->textures[unit][slot] = texture;
+        this->Stats.issued++;
+        glBindTexture(target, texture);
+    }
+
+    void ActiveTexture(GLuint unit)
+    {
+        if (this->changed(this->activeUnit, unit))
+            glActiveTexture(GL_TEXTURE0 + unit);
+    }
+
+    void BindSampler(GLuint unit, GLuint sampler)
+    {
+        if (unit >= MAX_TEXTURE_UNITS)
+        {
+            this->Stats.issued++;
+            glBindSampler(unit, sampler);
+        }
+        else if (this->changed(this->samplers[unit], sampler))
+            glBindSampler(unit, sampler);
+    }
+
+    // Binds both the draw and the read framebuffer
+    void BindFramebuffer(GLuint framebuffer)
+    {
+        if (this->drawFramebuffer == framebuffer && this->readFramebuffer == framebuffer)
+        {
+            this->Stats.elided++;
+            return;
+        }
+        this->drawFramebuffer = this->readFramebuffer = framebuffer;
+        this->Stats.issued++;
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    }
+
+    void BindFramebuffer(GLenum target, GLuint framebuffer)
+    {
+        if (target == GL_FRAMEBUFFER)
+            this->BindFramebuffer(framebuffer);
+        else if (this->changed(target == GL_DRAW_FRAMEBUFFER ? this->drawFramebuffer : this->readFramebuffer, framebuffer))
+            glBindFramebuffer(target, framebuffer);
+    }
+
+    // Deleting an object unbinds it, and GL may hand its name out again, so the shadow must forget it
+    void DeleteTextures(GLsizei count, const GLuint* names)
+    {
+        for (GLsizei i = 0; i < count; i++)
+            for (int unit = 0; unit < MAX_TEXTURE_UNITS; unit++)
+                for (int target = 0; target < TEXTURE_TARGETS; target++)
+                    if (this->textures[unit][target] == names[i])
+                        this->textures[unit][target] = 0;
+        glDeleteTextures(count, names);
+    }
+
+    void DeleteVertexArrays(GLsizei count, const GLuint* names)
+    {
+        for (GLsizei i = 0; i < count; i++)
+            if (this->vertexArray == names[i])
+                this->vertexArray = 0;
+        glDeleteVertexArrays(count, names);
+    }
+
+    void DeleteFramebuffers(GLsizei count, const GLuint* names)
+    {
+        for (GLsizei i = 0; i < count; i++)
+        {
+            if (this->drawFramebuffer == names[i])
+                this->drawFramebuffer = 0;
+            if (this->readFramebuffer == names[i])
+                this->readFramebuffer = 0;
+        }
+        glDeleteFramebuffers(count, names);
+    }
+
+    // fixed function state
+    // ------------------------------------------------------------------------
+    void Enable(GLenum capability)
+    {
+        this->setCapability(capability, true);
+    }
+
+    void Disable(GLenum capability)
+    {
+        this->setCapability(capability, false);
+    }
+
+    void BlendFunc(GLenum source, GLenum destination)
+    {
+        this->BlendFuncSeparate(source, destination, source, destination);
+    }
+
+    void BlendFuncSeparate(GLenum sourceRGB, GLenum destinationRGB, GLenum sourceAlpha, GLenum destinationAlpha)
+    {
+        GLuint blend[4] = { sourceRGB, destinationRGB, sourceAlpha, destinationAlpha };
+        if (this->changed(this->blend, blend, 4))
+            glBlendFuncSeparate(sourceRGB, destinationRGB, sourceAlpha, destinationAlpha);
+    }
+
+    void BlendEquation(GLenum mode)
+    {
+        if (this->changed(this->blendEquation, mode))
+            glBlendEquation(mode);
+    }
+
+    void DepthFunc(GLenum func)
+    {
+        if (this->changed(this->depthFunc, func))
+            glDepthFunc(func);
+    }
+
+    void DepthMask(GLboolean flag)
+    {
+        if (this->changed(this->depthMask, flag ? 1 : 0))
+            glDepthMask(flag);
+    }
+
+    void ColorMask(GLboolean red, GLboolean green, GLboolean blue, GLboolean alpha)
+    {
+        int mask = (red ? 1 : 0) | (green ? 2 : 0) | (blue ? 4 : 0) | (alpha ? 8 : 0);
+        if (this->changed(this->colorMask, mask))
+            glColorMask(red, green, blue, alpha);
+    }
+
+    void StencilFunc(GLenum func, GLint ref, GLuint mask)
+    {
+        GLuint stencilFunc[3] = { func, (GLuint)ref, mask };
+        if (this->changed(this->stencilFunc, stencilFunc, 3))
+            glStencilFunc(func, ref, mask);
+    }
+
+    void StencilOp(GLenum stencilFail, GLenum depthFail, GLenum depthPass)
+    {
+        GLuint stencilOp[3] = { stencilFail, depthFail, depthPass };
+        if (this->changed(this->stencilOp, stencilOp, 3))
+            glStencilOp(stencilFail, depthFail, depthPass);
+    }
+
+    void StencilMask(GLuint mask)
+    {
+        if (this->changed(this->stencilMask, mask))
+            glStencilMask(mask);
+    }
+
+    void CullFace(GLenum mode)
+    {
+        if (this->changed(this->cullFace, mode))
+            glCullFace(mode);
+    }
+
+    void Viewport(GLint x, GLint y, GLsizei width, GLsizei height)
+    {
+        GLint viewport[4] = { x, y, width, height };
+        bool same = true;
+        for (int i = 0; i < 4; i++)
+            same = same && this->viewport[i] == viewport[i];
+        if (same)
+        {
+            this->Stats.elided++;
+            return;
+        }
+        for (int i = 0; i < 4; i++)
+            this->viewport[i] = viewport[i];
+        this->Stats.issued++;
+        glViewport(x, y, width, height);
+    }
+
+private:
+    static const GLuint UNKNOWN = 0xFFFFFFFFu;
+    static const int TEXTURE_TARGETS = 5;
+    static const int CAPABILITIES = 13;
+
+    GLuint program, vertexArray, activeUnit;
+    GLuint textures[MAX_TEXTURE_UNITS][TEXTURE_TARGETS];
+    GLuint samplers[MAX_TEXTURE_UNITS];
+    signed char capabilities[CAPABILITIES];
+    GLuint drawFramebuffer, readFramebuffer;
+    GLuint blend[4];
+    GLuint blendEquation, depthFunc;
+    GLuint stencilFunc[3], stencilOp[3];
+    GLuint stencilMask, cullFace;
+    int depthMask, colorMask;
+    GLint viewport[4];
+
+    GLState()
+    {
+        this->Invalidate();
+    }
+
+    static int textureSlot(GLenum target)
+    {
+        switch (target)
+        {
+        case GL_TEXTURE_2D: return 0;
+        case GL_TEXTURE_CUBE_MAP: return 1;
+        case GL_TEXTURE_2D_ARRAY: return 2;
+        case GL_TEXTURE_3D: return 3;
+        case GL_TEXTURE_BUFFER: return 4;
+        default: return -1;
+        }
+    }
+
+    static int capabilitySlot(GLenum capability)
+    {
+        switch (capability)
+        {
+        case GL_DEPTH_TEST: return 0;
+        case GL_STENCIL_TEST: return 1;
+        case GL_BLEND: return 2;
+        case GL_CULL_FACE: return 3;
+        case GL_POLYGON_OFFSET_FILL: return 4;
+        case GL_SCISSOR_TEST: return 5;
+        case GL_FRAMEBUFFER_SRGB: return 6;
+        case GL_TEXTURE_CUBE_MAP_SEAMLESS: return 7;
+        case GL_DEPTH_CLAMP: return 8;
+        case GL_CLIP_DISTANCE0: return 9;
+        case GL_CLIP_DISTANCE1: return 10;
+        case GL_CLIP_DISTANCE2: return 11;
+        case GL_CLIP_DISTANCE3: return 12;
+        default: return -1;
+        }
+    }
+
+    void setCapability(GLenum capability, bool enabled)
+    {
+        int slot = capabilitySlot(capability);
+        if (slot >= 0 && this->capabilities[slot] == (enabled ? 1 : 0))
+        {
+            this->Stats.elided++;
+            return;
+        }
+        if (slot >= 0)
+            this->capabilities[slot] = enabled ? 1 : 0;
+        this->Stats.issued++;
+        if (enabled)
+            glEnable(capability);
+        else
+            glDisable(capability);
+    }
+
+    // Updates the shadow value and counts the call, returns true when it has to reach the driver
+    template <typename T>
+    bool changed(T& current, T value)
+    {
+        if (current == value)
+        {
+            this->Stats.elided++;
+            return false;
+        }
+        current = value;
+        this->Stats.issued++;
+        return true;
+    }
+
+    bool changed(GLuint* current, const GLuint* values, int count)
+    {
+        bool same = true;
+        for (int i = 0; i < count; i++)
+            same = same && current[i] == values[i];
+        if (same)
+        {
+            this->Stats.elided++;
+            return false;
+        }
+        for (int i = 0; i < count; i++)
+            current[i] = values[i];
+        this->Stats.issued++;
+        return true;
+    }
+};
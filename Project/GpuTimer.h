@@ -0,0 +1,93 @@
+#pragma once
+
+// GL Includes
+#include <glad/glad.h>
+
+#include "StreamBuffer.h"
+
+// GPU time of a stretch of commands, measured with GL_TIME_ELAPSED queries (core since 3.3). Each frame uses
+// its own query of a ring as deep as the stream buffers', so a result is read back frames after it was issued
+// and the CPU never waits for it. A measurement can be tagged, e.g. with the mode that was active, and the
+// last result of every tag is kept. Timers must not overlap, GL allows one elapsed time query at a time; a timer
+// created nested writes two GL_TIMESTAMP counters around its stretch instead, so it may run inside another's.
+class GpuTimer
+{
+public:
+    static const int MAX_TAGS = 8;
+    static const int QUERIES = StreamBuffer::FRAMES + 1;
+
+    void Create(bool nested = false)
+    {
+        this->nested = nested;
+        glGenQueries(QUERIES, this->queries);
+        if (nested)
+            glGenQueries(QUERIES, this->ends);
+    }
+
+    void Destroy()
+    {
+        glDeleteQueries(QUERIES, this->queries);
+        if (this->nested)
+            glDeleteQueries(QUERIES, this->ends);
+    }
+
+    // Collects the oldest query if it finished, then starts measuring into it
+    void Begin(int tag = 0)
+    {
+        this->collect();
+        if (this->nested)
+            glQueryCounter(this->queries[this->next], GL_TIMESTAMP);
+        else
+            glBeginQuery(GL_TIME_ELAPSED, this->queries[this->next]);
+        this->tags[this->next] = tag;
+    }
+
+    void End()
+    {
+        if (this->nested)
+            glQueryCounter(this->ends[this->next], GL_TIMESTAMP);
+        else
+            glEndQuery(GL_TIME_ELAPSED);
+        this->pending[this->next] = true;
+        this->next = (this->next + 1) % QUERIES;
+    }
+
+    // Last result measured under the tag, 0 when there is none yet
+    double Milliseconds(int tag = 0) const
+    {
+        return this->milliseconds[tag];
+    }
+
+private:
+    GLuint queries[QUERIES] = {};
+    GLuint ends[QUERIES] = {};      // nested only, the counter at End()
+    bool nested = false;
+    int tags[QUERIES] = {};
+    bool pending[QUERIES] = {};
+    int next = 0;
+    double milliseconds[MAX_TAGS] = {};
+
+    void collect()
+    {
+        if (!this->pending[this->next])
+            return;
+        // the end counter was written last, once it is there the start is too
+        GLuint last = this->nested ? this->ends[this->next] : this->queries[this->next];
+        GLint available = 0;
+        glGetQueryObjectiv(last, GL_QUERY_RESULT_AVAILABLE, &available);
+        // a result that is still not there is dropped rather than waited for
+        if (available)
+        {
+            GLuint64 nanoseconds = 0;
+            glGetQueryObjectui64v(last, GL_QUERY_RESULT, &nanoseconds);
+            if (this->nested)
+            {
+                GLuint64 start = 0;
+                glGetQueryObjectui64v(this->queries[this->next], GL_QUERY_RESULT, &start);
+                nanoseconds -= start;
+            }
+            this->milliseconds[this->tags[this->next]] = nanoseconds / 1.0e6;
+        }
+        this->pending[this->next] = false;
+    }
+};
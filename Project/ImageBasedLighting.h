@@ -0,0 +1,620 @@
+#pragma once
+
+// Std. Includes
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// GL Includes
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "GLState.h"
+#include "DiskCache.h"
+#include "FrameUniforms.h"
+#include "ThreadPool.h"
+
+// Texture units the lighting shaders sample the environment at (shaders/environment.glsl)
+const GLuint ENVIRONMENT_TEXTURE_UNIT = 9;
+const GLuint BRDF_LUT_TEXTURE_UNIT = 10;
+// Coefficients of the irradiance in the frame block, l <= 2
+const int IRRADIANCE_SH_COEFFICIENTS = FRAME_IRRADIANCE_COEFFICIENTS;
+
+// The six faces of a cube map as decoded, RGB8 rows from the top, in GL's face order (+X, -X, +Y, -Y, +Z, -Z)
+struct CubeFaces
+{
+    int size = 0;
+    std::vector<std::vector<unsigned char> > pixels;
+};
+
+struct ImageBasedLightingSettings
+{
+    int size = 256;             // first level of the prefiltered cube, the source is box filtered down to it
+    int levels = 6;             // level i holds roughness i / (levels - 1)
+    int samples = 64;           // GGX samples per texel of the rough levels
+    int lutSize = 128;          // BRDF table, n.v across and roughness down
+    int lutSamples = 256;
+};
+
+// What Create() did, for the startup line
+struct ImageBasedLightingStats
+{
+    bool environmentCached = false;     // irradiance and prefiltered cube came from the disk cache
+    bool lutCached = false;
+    double hashMilliseconds = 0.0;      // of the source faces, the cache key
+    double environmentMilliseconds = 0.0;
+    double lutMilliseconds = 0.0;
+};
+
+// Image based lighting precomputed from the skybox on the CPU, spread over the thread pool:
+//  - the irradiance as spherical harmonics up to l = 2, projected from the cube with per-texel solid angles and
+//    convolved with the cosine lobe, 9 RGB coefficients for the frame block
+//  - a prefiltered specular cube, GGX importance sampled per level with the roughness rising level by level;
+//    each sample reads a box filtered pyramid of the source at the level matching its solid angle, so a few
+//    dozen samples do without fireflies
+//  - the split-sum BRDF table, scale and bias of F0 by n.v and roughness
+// Both are written to the disk cache, the environment keyed by the hashes of the source faces and the settings,
+// the table (which doesn't depend on the sky) by the settings alone, so later runs only upload them.
+// The irradiance and the prefiltered cube are divided by the sky's average luminance: the lighting scales
+// them by the direct light's ambient color, which keeps the scene's brightness and adds direction and tint.
+class ImageBasedLighting
+{
+public:
+    ImageBasedLightingSettings Settings;
+    ImageBasedLightingStats Stats;
+    GLuint EnvironmentTexture = 0;  // RGB16F cube map, Settings.levels levels
+    GLuint BrdfLut = 0;             // RG16F
+    glm::vec4 Irradiance[IRRADIANCE_SH_COEFFICIENTS];   // E(n) / pi, over the average luminance
+    float Scale = 1.0f;             // 1 / average luminance of the sky
+
+    void Create(const CubeFaces& faces, const ImageBasedLightingSettings& settings)
+    {
+        this->Settings = settings;
+        this->Stats = ImageBasedLightingStats();
+        if (faces.size <= 0 || faces.pixels.size() != 6)
+        {
+            std::cout << "ERROR::IMAGE_BASED_LIGHTING::NO_SOURCE_FACES" << std::endl;
+            CubeFaces grey;
+            grey.size = 1;
+            grey.pixels.assign(6, std::vector<unsigned char>(3, 128));
+            this->Create(grey, settings);
+            return;
+        }
+        this->Settings.size = std::min(this->Settings.size, faces.size);
+        this->Settings.levels = std::max(1, std::min(this->Settings.levels, levelCount(this->Settings.size)));
+
+        // the environment: from the cache when these faces were seen with these settings, computed otherwise
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::uint64_t key = this->environmentKey(faces);
+        std::chrono::steady_clock::time_point hashed = std::chrono::steady_clock::now();
+        this->Stats.hashMilliseconds = std::chrono::duration<double, std::milli>(hashed - start).count();
+        std::vector<CubeLevel> prefiltered;
+        std::vector<char> blob;
+        this->Stats.environmentCached = DiskCache::Read("environment", key, blob) && this->readEnvironment(blob, prefiltered);
+        if (!this->Stats.environmentCached)
+        {
+            std::vector<CubeLevel> pyramid = buildPyramid(downsample(faces, this->Settings.size));
+            this->projectIrradiance(pyramid[0]);
+            prefiltered = this->prefilter(pyramid);
+            this->writeEnvironment(prefiltered, blob);
+            DiskCache::Write("environment", key, blob.data(), blob.size());
+        }
+        this->EnvironmentTexture = uploadCube(prefiltered);
+        std::chrono::steady_clock::time_point environmentDone = std::chrono::steady_clock::now();
+        this->Stats.environmentMilliseconds = std::chrono::duration<double, std::milli>(environmentDone - hashed).count();
+
+        // the table
+        int lutSize = this->Settings.lutSize;
+        std::uint64_t lutKey = DiskCache::Hash("brdf lut v1");
+        lutKey = DiskCache::HashBytes(&this->Settings.lutSize, sizeof(int), lutKey);
+        lutKey = DiskCache::HashBytes(&this->Settings.lutSamples, sizeof(int), lutKey);
+        std::vector<float> lut;
+        this->Stats.lutCached = DiskCache::Read("brdf_lut", lutKey, blob) && blob.size() == (size_t)lutSize * lutSize * 2 * sizeof(float);
+        if (this->Stats.lutCached)
+        {
+            lut.resize((size_t)lutSize * lutSize * 2);
+            std::memcpy(lut.data(), blob.data(), blob.size());
+        }
+        else
+        {
+            lut = integrateBrdf(lutSize, this->Settings.lutSamples);
+            DiskCache::Write("brdf_lut", lutKey, lut.data(), lut.size() * sizeof(float));
+        }
+        glGenTextures(1, &this->BrdfLut);
+        GLState::Instance().BindTexture(0, GL_TEXTURE_2D, this->BrdfLut);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, lutSize, lutSize, 0, GL_RG, GL_FLOAT, lut.data());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        this->Stats.lutMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - environmentDone).count();
+    }
+
+    void Destroy()
+    {
+        GLState& state = GLState::Instance();
+        state.DeleteTextures(1, &this->EnvironmentTexture);
+        state.DeleteTextures(1, &this->BrdfLut);
+    }
+
+    // Irradiance coefficients, luminance scale and the level of the roughest reflection into the frame block
+    void Fill(FrameData& frame) const
+    {
+        for (int i = 0; i < IRRADIANCE_SH_COEFFICIENTS; i++)
+            frame.irradianceSH[i] = this->Irradiance[i];
+        frame.environmentScale = this->Scale;
+        frame.environmentMaxLevel = (float)(this->Settings.levels - 1);
+    }
+
+    // What environmentIrradiance() returns in the shaders: the sky's cosine-weighted light around n, 1 on average
+    glm::vec3 IrradianceAt(const glm::vec3& n) const
+    {
+        float basis[IRRADIANCE_SH_COEFFICIENTS];
+        shBasis(n, basis);
+        glm::vec3 irradiance(0.0f);
+        for (int i = 0; i < IRRADIANCE_SH_COEFFICIENTS; i++)
+            irradiance += glm::vec3(this->Irradiance[i]) * basis[i];
+        return glm::max(irradiance, glm::vec3(0.0f));
+    }
+
+    void Bind() const
+    {
+        GLState& state = GLState::Instance();
+        state.BindTexture(ENVIRONMENT_TEXTURE_UNIT, GL_TEXTURE_CUBE_MAP, this->EnvironmentTexture);
+        state.BindTexture(BRDF_LUT_TEXTURE_UNIT, GL_TEXTURE_2D, this->BrdfLut);
+    }
+
+    // Prefiltered cube and table on the GPU
+    size_t MemoryBytes() const
+    {
+        size_t bytes = (size_t)this->Settings.lutSize * this->Settings.lutSize * 4;
+        for (int level = 0; level < this->Settings.levels; level++)
+        {
+            size_t size = (size_t)std::max(this->Settings.size >> level, 1);
+            bytes += 6 * size * size * 6;
+        }
+        return bytes;
+    }
+
+private:
+    // One level of a cube on the CPU, RGB floats face after face, rows from the top
+    struct CubeLevel
+    {
+        int size = 0;
+        std::vector<float> texels;
+
+        float* texel(int face, int x, int y)
+        {
+            return &this->texels[(((size_t)face * this->size + y) * this->size + x) * 3];
+        }
+        const float* texel(int face, int x, int y) const
+        {
+            return &this->texels[(((size_t)face * this->size + y) * this->size + x) * 3];
+        }
+    };
+
+    // A GGX sample around the z axis, shared by every texel of a level
+    struct LobeSample
+    {
+        glm::vec3 direction;
+        float weight;
+        float level;    // of the source pyramid
+    };
+
+    struct EnvironmentHeader
+    {
+        std::int32_t size;
+        std::int32_t levels;
+        float scale;
+        float irradiance[IRRADIANCE_SH_COEFFICIENTS * 3];
+    };
+
+    static int levelCount(int size)
+    {
+        int levels = 1;
+        while (size > 1)
+        {
+            size /= 2;
+            levels++;
+        }
+        return levels;
+    }
+
+    std::uint64_t environmentKey(const CubeFaces& faces) const
+    {
+        std::uint64_t faceHashes[6];
+        size_t bytes = (size_t)faces.size * faces.size * 3;
+        ThreadPool::Instance().ParallelFor(6, 1, [&](int begin, int end) {
+            for (int face = begin; face < end; face++)
+                faceHashes[face] = DiskCache::HashBytes(faces.pixels[face].data(), std::min(bytes, faces.pixels[face].size()));
+        });
+        std::uint64_t key = DiskCache::Hash("image based lighting v1");
+        const int settings[] = { faces.size, this->Settings.size, this->Settings.levels, this->Settings.samples };
+        key = DiskCache::HashBytes(settings, sizeof(settings), key);
+        return DiskCache::HashBytes(faceHashes, sizeof(faceHashes), key);
+    }
+
+    // Face and texture coordinates in [0, 1] of a direction, as GL picks them
+    static int cubeFace(const glm::vec3& d, float& s, float& t)
+    {
+        glm::vec3 a = glm::abs(d);
+        int face;
+        float major, sc, tc;
+        if (a.x >= a.y && a.x >= a.z)
+        {
+            face = d.x > 0.0f ? 0 : 1;
+            major = a.x;
+            sc = d.x > 0.0f ? -d.z : d.z;
+            tc = -d.y;
+        }
+        else if (a.y >= a.z)
+        {
+            face = d.y > 0.0f ? 2 : 3;
+            major = a.y;
+            sc = d.x;
+            tc = d.y > 0.0f ? d.z : -d.z;
+        }
+        else
+        {
+            face = d.z > 0.0f ? 4 : 5;
+            major = a.z;
+            sc = d.z > 0.0f ? d.x : -d.x;
+            tc = -d.y;
+        }
+        s = 0.5f * (sc / major + 1.0f);
+        t = 0.5f * (tc / major + 1.0f);
+        return face;
+    }
+
+    // Inverse of cubeFace(), sc and tc in [-1, 1], not normalized
+    static glm::vec3 faceDirection(int face, float sc, float tc)
+    {
+        switch (face)
+        {
+        case 0: return glm::vec3(1.0f, -tc, -sc);
+        case 1: return glm::vec3(-1.0f, -tc, sc);
+        case 2: return glm::vec3(sc, 1.0f, tc);
+        case 3: return glm::vec3(sc, -1.0f, -tc);
+        case 4: return glm::vec3(sc, -tc, 1.0f);
+        default: return glm::vec3(-sc, -tc, -1.0f);
+        }
+    }
+
+    // Bilinear inside a face, clamped at its edges
+    static glm::vec3 sampleFace(const CubeLevel& level, int face, float s, float t)
+    {
+        float x = s * level.size - 0.5f, y = t * level.size - 0.5f;
+        int x0 = (int)std::floor(x), y0 = (int)std::floor(y);
+        float fx = x - x0, fy = y - y0;
+        int x1 = std::min(std::max(x0 + 1, 0), level.size - 1), y1 = std::min(std::max(y0 + 1, 0), level.size - 1);
+        x0 = std::min(std::max(x0, 0), level.size - 1);
+        y0 = std::min(std::max(y0, 0), level.size - 1);
+        const float* a = level.texel(face, x0, y0);
+        const float* b = level.texel(face, x1, y0);
+        const float* c = level.texel(face, x0, y1);
+        const float* d = level.texel(face, x1, y1);
+        glm::vec3 top = glm::mix(glm::vec3(a[0], a[1], a[2]), glm::vec3(b[0], b[1], b[2]), fx);
+        glm::vec3 bottom = glm::mix(glm::vec3(c[0], c[1], c[2]), glm::vec3(d[0], d[1], d[2]), fx);
+        return glm::mix(top, bottom, fy);
+    }
+
+    // Trilinear between the pyramid levels around level
+    static glm::vec3 sampleCube(const std::vector<CubeLevel>& pyramid, const glm::vec3& direction, float level)
+    {
+        float s, t;
+        int face = cubeFace(direction, s, t);
+        level = glm::clamp(level, 0.0f, (float)(pyramid.size() - 1));
+        int lower = (int)level;
+        int upper = std::min(lower + 1, (int)pyramid.size() - 1);
+        glm::vec3 a = sampleFace(pyramid[lower], face, s, t);
+        if (upper == lower)
+            return a;
+        return glm::mix(a, sampleFace(pyramid[upper], face, s, t), level - lower);
+    }
+
+    // Box filters the 8-bit faces down to size, in [0, 1]
+    static CubeLevel downsample(const CubeFaces& faces, int size)
+    {
+        CubeLevel level;
+        level.size = size;
+        level.texels.resize((size_t)6 * size * size * 3);
+        int factor = faces.size / size;
+        float norm = 1.0f / (255.0f * factor * factor);
+        ThreadPool::Instance().ParallelFor(6 * size, 16, [&](int begin, int end) {
+            for (int row = begin; row < end; row++)
+            {
+                int face = row / size, y = row % size;
+                const unsigned char* source = faces.pixels[face].data();
+                for (int x = 0; x < size; x++)
+                {
+                    float sum[3] = { 0.0f, 0.0f, 0.0f };
+                    for (int sy = y * factor; sy < (y + 1) * factor; sy++)
+                        for (int sx = x * factor; sx < (x + 1) * factor; sx++)
+                        {
+                            const unsigned char* pixel = source + ((size_t)sy * faces.size + sx) * 3;
+                            sum[0] += pixel[0];
+                            sum[1] += pixel[1];
+                            sum[2] += pixel[2];
+                        }
+                    float* texel = level.texel(face, x, y);
+                    texel[0] = sum[0] * norm;
+                    texel[1] = sum[1] * norm;
+                    texel[2] = sum[2] * norm;
+                }
+            }
+        });
+        return level;
+    }
+
+    // Halves the base down to 1x1, 2x2 box per level
+    static std::vector<CubeLevel> buildPyramid(CubeLevel base)
+    {
+        std::vector<CubeLevel> pyramid;
+        pyramid.push_back(std::move(base));
+        while (pyramid.back().size > 1)
+        {
+            const CubeLevel& above = pyramid.back();
+            CubeLevel level;
+            level.size = above.size / 2;
+            level.texels.resize((size_t)6 * level.size * level.size * 3);
+            for (int face = 0; face < 6; face++)
+                for (int y = 0; y < level.size; y++)
+                    for (int x = 0; x < level.size; x++)
+                        for (int c = 0; c < 3; c++)
+                            level.texel(face, x, y)[c] = 0.25f * (above.texel(face, 2 * x, 2 * y)[c] + above.texel(face, 2 * x + 1, 2 * y)[c]
+                                + above.texel(face, 2 * x, 2 * y + 1)[c] + above.texel(face, 2 * x + 1, 2 * y + 1)[c]);
+            pyramid.push_back(std::move(level));
+        }
+        return pyramid;
+    }
+
+    // Real SH basis up to l = 2
+    static void shBasis(const glm::vec3& n, float basis[IRRADIANCE_SH_COEFFICIENTS])
+    {
+        basis[0] = 0.282095f;
+        basis[1] = 0.488603f * n.y;
+        basis[2] = 0.488603f * n.z;
+        basis[3] = 0.488603f * n.x;
+        basis[4] = 1.092548f * n.x * n.y;
+        basis[5] = 1.092548f * n.y * n.z;
+        basis[6] = 0.315392f * (3.0f * n.z * n.z - 1.0f);
+        basis[7] = 1.092548f * n.x * n.z;
+        basis[8] = 0.546274f * (n.x * n.x - n.y * n.y);
+    }
+
+    // Projects the radiance onto the basis row by row, then sums the rows and convolves with the cosine lobe
+    void projectIrradiance(const CubeLevel& level)
+    {
+        int size = level.size, rows = 6 * size;
+        std::vector<double> partial((size_t)rows * IRRADIANCE_SH_COEFFICIENTS * 3, 0.0);
+        ThreadPool::Instance().ParallelFor(rows, 16, [&](int begin, int end) {
+            float basis[IRRADIANCE_SH_COEFFICIENTS];
+            for (int row = begin; row < end; row++)
+            {
+                int face = row / size, y = row % size;
+                double* sums = &partial[(size_t)row * IRRADIANCE_SH_COEFFICIENTS * 3];
+                float tc = 2.0f * (y + 0.5f) / size - 1.0f;
+                for (int x = 0; x < size; x++)
+                {
+                    float sc = 2.0f * (x + 0.5f) / size - 1.0f;
+                    // solid angle of the texel: its area on the unit cube face over the cube of the distance
+                    float d2 = 1.0f + sc * sc + tc * tc;
+                    float solidAngle = (4.0f / ((float)size * size)) / (d2 * std::sqrt(d2));
+                    shBasis(glm::normalize(faceDirection(face, sc, tc)), basis);
+                    const float* texel = level.texel(face, x, y);
+                    for (int i = 0; i < IRRADIANCE_SH_COEFFICIENTS; i++)
+                        for (int c = 0; c < 3; c++)
+                            sums[i * 3 + c] += (double)texel[c] * basis[i] * solidAngle;
+                }
+            }
+        });
+        double radiance[IRRADIANCE_SH_COEFFICIENTS * 3] = {};
+        for (int row = 0; row < rows; row++)
+            for (int i = 0; i < IRRADIANCE_SH_COEFFICIENTS * 3; i++)
+                radiance[i] += partial[(size_t)row * IRRADIANCE_SH_COEFFICIENTS * 3 + i];
+        // the average radiance is L00 * Y00, its luminance normalizes everything
+        glm::vec3 average = glm::vec3((float)radiance[0], (float)radiance[1], (float)radiance[2]) * 0.282095f;
+        this->Scale = 1.0f / std::max(glm::dot(average, glm::vec3(0.2126f, 0.7152f, 0.0722f)), 1e-4f);
+        // the cosine lobe per band (pi, 2 pi / 3, pi / 4), and / pi for the reflected radiance of a white surface
+        const float band[IRRADIANCE_SH_COEFFICIENTS] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+        for (int i = 0; i < IRRADIANCE_SH_COEFFICIENTS; i++)
+            this->Irradiance[i] = glm::vec4(glm::vec3((float)radiance[i * 3], (float)radiance[i * 3 + 1], (float)radiance[i * 3 + 2])
+                * band[i] * this->Scale, 0.0f);
+    }
+
+    static glm::vec2 hammersley(unsigned int i, unsigned int count)
+    {
+        unsigned int bits = i;
+        bits = (bits << 16u) | (bits >> 16u);
+        bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+        bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+        bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+        bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+        return glm::vec2((float)i / count, bits * 2.3283064365386963e-10f);
+    }
+
+    // Half vector around z distributed like GGX with alpha = roughness^2
+    static glm::vec3 importanceSampleGgx(const glm::vec2& xi, float roughness)
+    {
+        float alpha = roughness * roughness;
+        float phi = 6.2831853f * xi.x;
+        float cosTheta = std::sqrt((1.0f - xi.y) / (1.0f + (alpha * alpha - 1.0f) * xi.y));
+        float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+        return glm::vec3(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+    }
+
+    // The samples of one roughness, with n = v = z; each reads the pyramid level whose texels cover about
+    // the solid angle it stands for
+    std::vector<LobeSample> lobeSamples(float roughness, int sourceSize) const
+    {
+        std::vector<LobeSample> samples;
+        float alpha2 = roughness * roughness * roughness * roughness;
+        float texelSolidAngle = 4.0f * 3.14159265f / (6.0f * sourceSize * sourceSize);
+        for (int i = 0; i < this->Settings.samples; i++)
+        {
+            glm::vec3 h = importanceSampleGgx(hammersley((unsigned int)i, (unsigned int)this->Settings.samples), roughness);
+            glm::vec3 l = 2.0f * h.z * h - glm::vec3(0.0f, 0.0f, 1.0f);
+            if (l.z <= 0.0f)
+                continue;
+            float denominator = h.z * h.z * (alpha2 - 1.0f) + 1.0f;
+            float distribution = alpha2 / (3.14159265f * denominator * denominator);
+            // pdf of l is D(h) (n.h) / (4 v.h), and n.h = v.h here
+            float pdf = 0.25f * distribution;
+            float sampleSolidAngle = 1.0f / (this->Settings.samples * pdf + 1e-4f);
+            LobeSample sample;
+            sample.direction = l;
+            sample.weight = l.z;
+            sample.level = std::max(0.5f * std::log2(sampleSolidAngle / texelSolidAngle) + 1.0f, 0.0f);
+            samples.push_back(sample);
+        }
+        return samples;
+    }
+
+    // Level 0 is the source itself, every further level halves the size and convolves with a rougher lobe
+    std::vector<CubeLevel> prefilter(const std::vector<CubeLevel>& pyramid) const
+    {
+        std::vector<CubeLevel> levels(this->Settings.levels);
+        levels[0] = pyramid[0];
+        for (int index = 1; index < this->Settings.levels; index++)
+        {
+            CubeLevel& level = levels[index];
+            level.size = std::max(pyramid[0].size >> index, 1);
+            level.texels.resize((size_t)6 * level.size * level.size * 3);
+            float roughness = (float)index / (this->Settings.levels - 1);
+            std::vector<LobeSample> samples = this->lobeSamples(roughness, pyramid[0].size);
+            int size = level.size;
+            ThreadPool::Instance().ParallelFor(6 * size, 4, [&](int begin, int end) {
+                for (int row = begin; row < end; row++)
+                {
+                    int face = row / size, y = row % size;
+                    float tc = 2.0f * (y + 0.5f) / size - 1.0f;
+                    for (int x = 0; x < size; x++)
+                    {
+                        float sc = 2.0f * (x + 0.5f) / size - 1.0f;
+                        glm::vec3 n = glm::normalize(faceDirection(face, sc, tc));
+                        glm::vec3 up = std::abs(n.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+                        glm::vec3 tangent = glm::normalize(glm::cross(up, n));
+                        glm::vec3 bitangent = glm::cross(n, tangent);
+                        glm::vec3 sum(0.0f);
+                        float weight = 0.0f;
+                        for (const LobeSample& sample : samples)
+                        {
+                            glm::vec3 l = tangent * sample.direction.x + bitangent * sample.direction.y + n * sample.direction.z;
+                            sum += sampleCube(pyramid, l, sample.level) * sample.weight;
+                            weight += sample.weight;
+                        }
+                        sum /= std::max(weight, 1e-4f);
+                        float* texel = level.texel(face, x, y);
+                        texel[0] = sum.x;
+                        texel[1] = sum.y;
+                        texel[2] = sum.z;
+                    }
+                }
+            });
+        }
+        return levels;
+    }
+
+    // Split-sum table: the specular integral of a white environment as F0 * x + y, Schlick-GGX visibility with k = alpha / 2
+    static std::vector<float> integrateBrdf(int size, int sampleCount)
+    {
+        std::vector<float> lut((size_t)size * size * 2);
+        ThreadPool::Instance().ParallelFor(size, 8, [&](int begin, int end) {
+            for (int y = begin; y < end; y++)
+            {
+                float roughness = (y + 0.5f) / size;
+                float k = 0.5f * roughness * roughness;
+                for (int x = 0; x < size; x++)
+                {
+                    float nDotV = (x + 0.5f) / size;
+                    glm::vec3 v(std::sqrt(1.0f - nDotV * nDotV), 0.0f, nDotV);
+                    float scale = 0.0f, bias = 0.0f;
+                    for (int i = 0; i < sampleCount; i++)
+                    {
+                        glm::vec3 h = importanceSampleGgx(hammersley((unsigned int)i, (unsigned int)sampleCount), roughness);
+                        float vDotH = glm::dot(v, h);
+                        glm::vec3 l = 2.0f * vDotH * h - v;
+                        if (l.z <= 0.0f)
+                            continue;
+                        float g = (nDotV / (nDotV * (1.0f - k) + k)) * (l.z / (l.z * (1.0f - k) + k));
+                        float visibility = g * std::max(vDotH, 0.0f) / (h.z * nDotV);
+                        float fresnel = std::pow(1.0f - std::max(vDotH, 0.0f), 5.0f);
+                        scale += (1.0f - fresnel) * visibility;
+                        bias += fresnel * visibility;
+                    }
+                    lut[((size_t)y * size + x) * 2] = scale / sampleCount;
+                    lut[((size_t)y * size + x) * 2 + 1] = bias / sampleCount;
+                }
+            }
+        });
+        return lut;
+    }
+
+    void writeEnvironment(const std::vector<CubeLevel>& levels, std::vector<char>& blob) const
+    {
+        EnvironmentHeader header;
+        header.size = this->Settings.size;
+        header.levels = this->Settings.levels;
+        header.scale = this->Scale;
+        for (int i = 0; i < IRRADIANCE_SH_COEFFICIENTS; i++)
+            for (int c = 0; c < 3; c++)
+                header.irradiance[i * 3 + c] = this->Irradiance[i][c];
+        blob.assign((const char*)&header, (const char*)&header + sizeof(header));
+        for (const CubeLevel& level : levels)
+            blob.insert(blob.end(), (const char*)level.texels.data(), (const char*)(level.texels.data() + level.texels.size()));
+    }
+
+    // false when the blob doesn't match the settings
+    bool readEnvironment(const std::vector<char>& blob, std::vector<CubeLevel>& levels)
+    {
+        EnvironmentHeader header;
+        if (blob.size() < sizeof(header))
+            return false;
+        std::memcpy(&header, blob.data(), sizeof(header));
+        if (header.size != this->Settings.size || header.levels != this->Settings.levels)
+            return false;
+        size_t offset = sizeof(header);
+        levels.resize(header.levels);
+        for (int index = 0; index < header.levels; index++)
+        {
+            levels[index].size = std::max(header.size >> index, 1);
+            size_t floats = (size_t)6 * levels[index].size * levels[index].size * 3;
+            if (offset + floats * sizeof(float) > blob.size())
+                return false;
+            levels[index].texels.resize(floats);
+            std::memcpy(levels[index].texels.data(), blob.data() + offset, floats * sizeof(float));
+            offset += floats * sizeof(float);
+        }
+        this->Scale = header.scale;
+        for (int i = 0; i < IRRADIANCE_SH_COEFFICIENTS; i++)
+            this->Irradiance[i] = glm::vec4(header.irradiance[i * 3], header.irradiance[i * 3 + 1], header.irradiance[i * 3 + 2], 0.0f);
+        return true;
+    }
+
+    static GLuint uploadCube(const std::vector<CubeLevel>& levels)
+    {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        GLState::Instance().BindTexture(0, GL_TEXTURE_CUBE_MAP, texture);
+        for (size_t index = 0; index < levels.size(); index++)
+        {
+            const CubeLevel& level = levels[index];
+            size_t faceFloats = (size_t)level.size * level.size * 3;
+            for (int face = 0; face < 6; face++)
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, (GLint)index, GL_RGB16F, level.size, level.size, 0, GL_RGB, GL_FLOAT,
+                    level.texels.data() + face * faceFloats);
+        }
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size() - 1);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        return texture;
+    }
+};
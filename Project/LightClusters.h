@@ -0,0 +1,343 @@
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+// GL Includes
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "GLState.h"
+#include "LightUniforms.h"
+#include "StreamBuffer.h"
+#include "ThreadPool.h"
+
+// Texture units of the cluster grid and light index list usamplerBuffers
+const GLuint LIGHT_CLUSTER_TEXTURE_UNIT = 7;
+const GLuint LIGHT_INDEX_TEXTURE_UNIT = 8;
+// Froxels of one depth slice, their index takes the upper 16 bits of a sort pair
+const int MAX_SLICE_TILES = 1 << 16;
+
+struct ClusterSettings
+{
+    int tileSize = 32;              // pixels per cluster across and down
+    int slices = 24;                // depth slices, exponentially spaced between the planes
+    float nearPlane = 0.1f;
+    float farPlane = 100.0f;
+    int maxIndices = 1 << 20;       // room of the index list, per frame
+};
+
+// Counters of the last Build()
+struct ClusterStats
+{
+    unsigned int lights = 0;        // in front of the camera and inside the far plane
+    unsigned int indices = 0;       // light references in all lists
+    unsigned int occupied = 0;      // clusters with at least one light
+    unsigned int maxLights = 0;     // in one cluster
+    bool overflow = false;          // the index list ran out of room, lights were dropped
+    double milliseconds = 0.0;      // CPU, bounds to upload
+};
+
+// Clustered forward shading. The view frustum is cut into a grid of froxels: screen tiles of tileSize
+// pixels, and depth slices whose thickness grows with the distance so froxels stay roughly cubic. Every
+// frame each light is assigned to the froxels its sphere of influence touches, and the lit shaders only loop
+// over the lights of the fragment's froxel (lightCluster() in shaders/light_data.glsl), so the cost per pixel
+// follows the local light density instead of the number of lights in the scene.
+// Assignment runs on the CPU: the screen bounds and depth slices of each light first, then every depth slice
+// independently on the thread pool, each light's candidate froxels tested against its sphere. The result is
+// a grid of (offset, count) pairs and one compact list of light indices, both streamed into texture buffers
+// (SSBOs and compute shaders would need GL 4.3).
+class LightClusters
+{
+public:
+    ClusterSettings Settings;
+    ClusterStats Stats;
+    GLuint GridTexture = 0;
+    GLuint IndexTexture = 0;
+
+    void Create(int width, int height, const ClusterSettings& settings)
+    {
+        this->Settings = settings;
+        this->width = width;
+        this->height = height;
+        // assignSlice() packs a froxel of the slice and a light into 16 bits each, grow the tiles until they fit
+        while (this->tileCount(this->Settings.tileSize) > MAX_SLICE_TILES)
+            this->Settings.tileSize *= 2;
+        if (this->Settings.tileSize != settings.tileSize)
+            std::cout << "LIGHT_CLUSTERS::TILE_SIZE " << settings.tileSize << " grown to " << this->Settings.tileSize
+                << ", a slice holds at most " << MAX_SLICE_TILES << " froxels" << std::endl;
+        this->tilesX = (width + this->Settings.tileSize - 1) / this->Settings.tileSize;
+        this->tilesY = (height + this->Settings.tileSize - 1) / this->Settings.tileSize;
+        this->sliceScale = settings.slices / std::log(settings.farPlane / settings.nearPlane);
+        this->sliceLists.assign(settings.slices, std::vector<std::uint16_t>());
+        this->slicePairs.assign(settings.slices, std::vector<std::uint32_t>());
+        this->sliceCounts.assign(settings.slices, std::vector<std::uint32_t>(this->tilesX * this->tilesY));
+
+        GLState& state = GLState::Instance();
+        this->gridRing.Create(GL_TEXTURE_BUFFER, (GLsizeiptr)this->clusterCount() * 2 * sizeof(std::uint32_t));
+        glGenTextures(1, &this->GridTexture);
+        state.BindTexture(LIGHT_CLUSTER_TEXTURE_UNIT, GL_TEXTURE_BUFFER, this->GridTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, this->gridRing.Buffer);
+        // light indices fit 16 bits, MAX_LOCAL_LIGHTS is far below that
+        this->indexRing.Create(GL_TEXTURE_BUFFER, (GLsizeiptr)settings.maxIndices * sizeof(std::uint16_t));
+        glGenTextures(1, &this->IndexTexture);
+        state.BindTexture(LIGHT_INDEX_TEXTURE_UNIT, GL_TEXTURE_BUFFER, this->IndexTexture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_R16UI, this->indexRing.Buffer);
+    }
+
+    void Destroy()
+    {
+        GLState& state = GLState::Instance();
+        state.DeleteTextures(1, &this->GridTexture);
+        state.DeleteTextures(1, &this->IndexTexture);
+        this->gridRing.Destroy();
+        this->indexRing.Destroy();
+    }
+
+    // Assigns the lights to the froxels of this view and streams grid and lists; writes the grid layout and
+    // where this frame's slices start into the light block
+    void Build(const std::vector<LocalLightData>& lights, const glm::mat4& view, const glm::mat4& projection, LightData& data)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        this->Stats = ClusterStats();
+        const int slices = this->Settings.slices;
+        const int tiles = this->tilesX * this->tilesY;
+        ThreadPool& pool = ThreadPool::Instance();
+
+        // view space sphere, screen tiles and depth slices of every light
+        this->bounds.resize(lights.size());
+        pool.ParallelFor((int)lights.size(), 256, [&](int begin, int end) {
+            for (int i = begin; i < end; i++)
+                this->bounds[i] = this->lightBounds(lights[i], view, projection);
+        });
+        // the tile edges as x / depth and y / depth ratios, the froxel boxes are built from them
+        this->tileRatiosX.resize(this->tilesX + 1);
+        this->tileRatiosY.resize(this->tilesY + 1);
+        for (int x = 0; x <= this->tilesX; x++)
+            this->tileRatiosX[x] = (2.0f * std::min(x * this->Settings.tileSize, this->width) / this->width - 1.0f) / projection[0][0];
+        for (int y = 0; y <= this->tilesY; y++)
+            this->tileRatiosY[y] = (2.0f * std::min(y * this->Settings.tileSize, this->height) / this->height - 1.0f) / projection[1][1];
+
+        // every slice on its own: candidate froxels of each light tested against its sphere, then sorted into
+        // one list per froxel by counting
+        pool.ParallelFor(slices, 1, [&](int begin, int end) {
+            for (int slice = begin; slice < end; slice++)
+                this->assignSlice(slice);
+        });
+
+        // each slice's lists follow the previous slice's, both buffers are written in parallel
+        std::vector<std::uint32_t> sliceOffsets(slices + 1, 0);
+        for (int slice = 0; slice < slices; slice++)
+            sliceOffsets[slice + 1] = sliceOffsets[slice] + (std::uint32_t)this->sliceLists[slice].size();
+        const std::uint32_t room = (std::uint32_t)this->Settings.maxIndices;
+        this->Stats.overflow = sliceOffsets[slices] > room;
+        std::uint32_t* grid = (std::uint32_t*)this->gridRing.Map();
+        std::uint16_t* indices = sliceOffsets[slices] > 0 ? (std::uint16_t*)this->indexRing.Map() : nullptr;
+        pool.ParallelFor(slices, 1, [&](int begin, int end) {
+            for (int slice = begin; slice < end; slice++)
+            {
+                std::uint32_t offset = sliceOffsets[slice];
+                std::uint32_t* cell = grid + 2 * slice * tiles;
+                const std::vector<std::uint32_t>& counts = this->sliceCounts[slice];
+                for (int tile = 0; tile < tiles; tile++)
+                {
+                    std::uint32_t count = offset < room ? std::min(counts[tile], room - offset) : 0;
+                    cell[2 * tile] = offset;
+                    cell[2 * tile + 1] = count;
+                    offset += counts[tile];
+                }
+                std::uint32_t size = (std::uint32_t)this->sliceLists[slice].size();
+                if (size > 0 && sliceOffsets[slice] < room)
+                    std::memcpy(indices + sliceOffsets[slice], this->sliceLists[slice].data(),
+                        std::min(size, room - sliceOffsets[slice]) * sizeof(std::uint16_t));
+            }
+        });
+        this->gridRing.Unmap();
+        if (indices)
+            this->indexRing.Unmap();
+
+        data.clusterGrid = glm::ivec4(this->tilesX, this->tilesY, slices, this->Settings.tileSize);
+        data.clusterDepth = glm::vec4(this->Settings.nearPlane, this->sliceScale, 0.0f, 0.0f);
+        data.clusterBase = (int)(this->gridRing.Offset() / (2 * sizeof(std::uint32_t)));
+        data.lightIndexBase = (int)(this->indexRing.Offset() / sizeof(std::uint16_t));
+
+        for (const LightBounds& light : this->bounds)
+            this->Stats.lights += light.visible ? 1 : 0;
+        this->Stats.indices = std::min(sliceOffsets[slices], room);
+        for (int slice = 0; slice < slices; slice++)
+            for (std::uint32_t count : this->sliceCounts[slice])
+            {
+                this->Stats.occupied += count > 0 ? 1 : 0;
+                this->Stats.maxLights = std::max(this->Stats.maxLights, count);
+            }
+        this->Stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void EndFrame()
+    {
+        this->gridRing.EndFrame();
+        this->indexRing.EndFrame();
+    }
+
+    int ClusterCount() const
+    {
+        return this->clusterCount();
+    }
+
+private:
+    // A light in view space, with the range of froxels it may touch
+    struct LightBounds
+    {
+        glm::vec3 center;           // view space, depth along -z made positive
+        float radius;
+        int x0, x1, y0, y1, z0, z1; // inclusive
+        bool visible;
+    };
+
+    int width = 0, height = 0;
+    int tilesX = 0, tilesY = 0;
+    float sliceScale = 1.0f;        // slices per unit of log depth
+    StreamBuffer gridRing, indexRing;
+    std::vector<LightBounds> bounds;
+    std::vector<float> tileRatiosX, tileRatiosY;
+    std::vector<std::vector<std::uint32_t> > slicePairs;    // froxel in the slice << 16 | light, before sorting
+    std::vector<std::vector<std::uint32_t> > sliceCounts;   // lights of each froxel of a slice
+    std::vector<std::vector<std::uint16_t> > sliceLists;    // a slice's lists, froxel after froxel
+
+    int clusterCount() const
+    {
+        return this->tilesX * this->tilesY * this->Settings.slices;
+    }
+
+    int sliceOf(float depth) const
+    {
+        int slice = (int)std::floor(std::log(std::max(depth, this->Settings.nearPlane) / this->Settings.nearPlane) * this->sliceScale);
+        return glm::clamp(slice, 0, this->Settings.slices - 1);
+    }
+
+    // Tangents from the eye to the sphere along one axis, as ratios coordinate / depth. The sphere lies
+    // entirely in front of the eye
+    static void projectedRange(float center, float depth, float radius, float& low, float& high)
+    {
+        float tangent = std::sqrt(center * center + depth * depth - radius * radius);
+        float denominator = depth * depth - radius * radius;
+        low = (center * depth - radius * tangent) / denominator;
+        high = (center * depth + radius * tangent) / denominator;
+    }
+
+    LightBounds lightBounds(const LocalLightData& light, const glm::mat4& view, const glm::mat4& projection) const
+    {
+        LightBounds result;
+        // a spot light only reaches as far as the bounding sphere of its cone
+        glm::vec3 position = light.position;
+        float radius = light.range;
+        if (light.type == LIGHT_SPOT)
+        {
+            float cosine = glm::clamp(light.outerCutOff, 0.0f, 1.0f);
+            if (cosine > 0.7071f)
+            {
+                radius = light.range / (2.0f * cosine);
+                position += light.direction * radius;
+            }
+            else
+            {
+                radius = light.range * std::sqrt(1.0f - cosine * cosine);
+                position += light.direction * (light.range * cosine);
+            }
+        }
+        glm::vec3 center = glm::vec3(view * glm::vec4(position, 1.0f));
+        result.center = glm::vec3(center.x, center.y, -center.z);
+        result.radius = radius;
+        float nearest = result.center.z - radius, farthest = result.center.z + radius;
+        result.visible = farthest > this->Settings.nearPlane && nearest < this->Settings.farPlane;
+        if (!result.visible)
+            return result;
+        result.z0 = this->sliceOf(nearest);
+        result.z1 = this->sliceOf(farthest);
+        result.x0 = result.y0 = 0;
+        result.x1 = this->tilesX - 1;
+        result.y1 = this->tilesY - 1;
+        // a sphere that reaches behind the near plane may cover any part of the screen
+        if (nearest <= this->Settings.nearPlane)
+            return result;
+        float lowX, highX, lowY, highY;
+        projectedRange(result.center.x, result.center.z, radius, lowX, highX);
+        projectedRange(result.center.y, result.center.z, radius, lowY, highY);
+        lowX *= projection[0][0];
+        highX *= projection[0][0];
+        lowY *= projection[1][1];
+        highY *= projection[1][1];
+        result.visible = highX >= -1.0f && lowX <= 1.0f && highY >= -1.0f && lowY <= 1.0f;
+        result.x0 = this->tileOf(lowX, this->width, this->tilesX);
+        result.x1 = this->tileOf(highX, this->width, this->tilesX);
+        result.y0 = this->tileOf(lowY, this->height, this->tilesY);
+        result.y1 = this->tileOf(highY, this->height, this->tilesY);
+        return result;
+    }
+
+    int tileCount(int tileSize) const
+    {
+        return ((this->width + tileSize - 1) / tileSize) * ((this->height + tileSize - 1) / tileSize);
+    }
+
+    int tileOf(float ndc, int pixels, int tiles) const
+    {
+        int tile = (int)std::floor((ndc * 0.5f + 0.5f) * pixels / this->Settings.tileSize);
+        return glm::clamp(tile, 0, tiles - 1);
+    }
+
+    void assignSlice(int slice)
+    {
+        std::vector<std::uint32_t>& pairs = this->slicePairs[slice];
+        std::vector<std::uint32_t>& counts = this->sliceCounts[slice];
+        std::vector<std::uint16_t>& list = this->sliceLists[slice];
+        pairs.clear();
+        std::fill(counts.begin(), counts.end(), 0u);
+        const float nearPlane = this->Settings.nearPlane;
+        float depth0 = nearPlane * std::exp(slice / this->sliceScale);
+        float depth1 = nearPlane * std::exp((slice + 1) / this->sliceScale);
+        for (size_t i = 0; i < this->bounds.size(); i++)
+        {
+            const LightBounds& light = this->bounds[i];
+            if (!light.visible || slice < light.z0 || slice > light.z1)
+                continue;
+            // distance along depth to the slice, then to each froxel's box across
+            float dz = std::max(std::max(depth0 - light.center.z, light.center.z - depth1), 0.0f);
+            float remaining = light.radius * light.radius - dz * dz;
+            if (remaining < 0.0f)
+                continue;
+            for (int y = light.y0; y <= light.y1; y++)
+            {
+                float low = std::min(this->tileRatiosY[y] * depth0, this->tileRatiosY[y] * depth1);
+                float high = std::max(this->tileRatiosY[y + 1] * depth0, this->tileRatiosY[y + 1] * depth1);
+                float dy = std::max(std::max(low - light.center.y, light.center.y - high), 0.0f);
+                if (dy * dy > remaining)
+                    continue;
+                for (int x = light.x0; x <= light.x1; x++)
+                {
+                    low = std::min(this->tileRatiosX[x] * depth0, this->tileRatiosX[x] * depth1);
+                    high = std::max(this->tileRatiosX[x + 1] * depth0, this->tileRatiosX[x + 1] * depth1);
+                    float dx = std::max(std::max(low - light.center.x, light.center.x - high), 0.0f);
+                    if (dx * dx + dy * dy > remaining)
+                        continue;
+                    std::uint32_t tile = (std::uint32_t)(y * this->tilesX + x);
+                    pairs.push_back(tile << 16 | (std::uint32_t)i);
+                    counts[tile]++;
+                }
+            }
+        }
+        // counting sort by froxel, lights stay in index order within a froxel
+        std::vector<std::uint32_t> starts(counts.size() + 1, 0);
+        for (size_t tile = 0; tile < counts.size(); tile++)
+            starts[tile + 1] = starts[tile] + counts[tile];
+        list.resize(pairs.size());
+        for (std::uint32_t pair : pairs)
+            list[starts[pair >> 16]++] = (std::uint16_t)(pair & 0xFFFF);
+    }
+};
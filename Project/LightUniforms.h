@@ -0,0 +1,153 @@
+#pragma once
+
+// Std. Includes
+#include <vector>
+#include <cstring>
+
+// GL Includes
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "GLState.h"
+#include "StreamBuffer.h"
+
+// Binding point of the local light block, the same for every program
+const GLuint LIGHT_DATA_BINDING = 1;
+// Texture unit of the lights samplerBuffer
+const GLuint LIGHT_BUFFER_TEXTURE_UNIT = 6;
+// Lights of a frame, and sizes of the arrays in the block, as in shaders/light_data.glsl
+const int MAX_LOCAL_LIGHTS = 4096;
+const int MAX_SHADOW_TILES = 32;
+const int MAX_POINT_SHADOWS = 4;
+
+enum LocalLightType { LIGHT_POINT = 0, LIGHT_SPOT = 1 };
+
+// A point or spot light of the scene as the application describes it
+struct LocalLight
+{
+    int type = LIGHT_POINT;
+    glm::vec3 position = glm::vec3(0.0f);
+    glm::vec3 direction = glm::vec3(0.0f, -1.0f, 0.0f);    // spot lights only
+    glm::vec3 color = glm::vec3(1.0f);
+    float range = 10.0f;                // no light and no shadow past it
+    float linear = 0.09f;               // attenuation 1 / (1 + linear * d + quadratic * d^2), faded out at range
+    float quadratic = 0.032f;
+    float innerCutOff = 1.0f;           // cosines of the spot cone
+    float outerCutOff = 0.0f;
+    bool castsShadow = true;
+    bool enabled = true;
+};
+
+// One light in the lights texture buffer, 4 RGBA32F texels; the ints are read back with floatBitsToInt
+struct LocalLightData
+{
+    glm::vec3 position;
+    float range;
+    glm::vec3 color;
+    float linear;
+    glm::vec3 direction;
+    float quadratic;
+    float innerCutOff;
+    float outerCutOff;
+    int shadowTile;         // spot: its tile in shadowTiles, point: its point shadow slot, -1 without shadow
+    int type;
+};
+
+struct ShadowTileData
+{
+    glm::mat4 matrix;       // world to the tile's clip space
+    glm::vec4 rect;         // offset and size in atlas texture coordinates
+};
+
+// std140 mirror of the LightData block in shaders/light_data.glsl
+struct LightData
+{
+    ShadowTileData shadowTiles[MAX_SHADOW_TILES];
+    glm::mat4 pointShadowMatrices[MAX_POINT_SHADOWS * 6];  // 6 cube faces per slot, layer = 6 * slot + face
+    glm::ivec4 clusterGrid;         // clusters across, down and deep, tile size in pixels (LightClusters.h)
+    glm::vec4 clusterDepth;         // near plane, slices per unit of log depth
+    int lightBase;                  // first texel of this frame's slice of each texture buffer
+    int clusterBase;
+    int lightIndexBase;
+    int lightCount;
+};
+static_assert(sizeof(LocalLightData) == 64 && sizeof(ShadowTileData) == 80 && sizeof(LightData) == 4144, "LightData must follow std140 layout");
+
+// The enabled lights of the frame, streamed into a texture buffer so their number isn't bound by the size of a
+// uniform block; the block, streamed like the frame block, holds the shadow matrices and where to read
+class LightUniforms
+{
+public:
+    LightData Data;
+    std::vector<LocalLightData> Lights;     // this frame's, in the order the shaders index them
+    GLuint Texture = 0;
+
+    void Create()
+    {
+        this->ring.Create(GL_UNIFORM_BUFFER, sizeof(LightData));
+        this->lightRing.Create(GL_TEXTURE_BUFFER, MAX_LOCAL_LIGHTS * sizeof(LocalLightData));
+        glGenTextures(1, &this->Texture);
+        GLState::Instance().BindTexture(LIGHT_BUFFER_TEXTURE_UNIT, GL_TEXTURE_BUFFER, this->Texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, this->lightRing.Buffer);
+        this->Lights.reserve(MAX_LOCAL_LIGHTS);
+    }
+
+    void Destroy()
+    {
+        GLState::Instance().DeleteTextures(1, &this->Texture);
+        this->lightRing.Destroy();
+        this->ring.Destroy();
+    }
+
+    // Enabled lights in order, without shadows; returns the index of each light in Lights, -1 when it is left out
+    std::vector<int> SetLights(const std::vector<LocalLight>& lights)
+    {
+        std::vector<int> indices(lights.size(), -1);
+        this->Lights.clear();
+        for (size_t i = 0; i < lights.size(); i++)
+        {
+            const LocalLight& light = lights[i];
+            if (!light.enabled || this->Lights.size() == MAX_LOCAL_LIGHTS)
+                continue;
+            LocalLightData data;
+            data.position = light.position;
+            data.range = light.range;
+            data.color = light.color;
+            data.linear = light.linear;
+            data.direction = glm::normalize(light.direction);
+            data.quadratic = light.quadratic;
+            data.innerCutOff = light.innerCutOff;
+            data.outerCutOff = light.outerCutOff;
+            data.shadowTile = -1;
+            data.type = light.type;
+            indices[i] = (int)this->Lights.size();
+            this->Lights.push_back(data);
+        }
+        return indices;
+    }
+
+    // Streams the lights and then the block, which points at them
+    void Upload()
+    {
+        if (!this->Lights.empty())
+        {
+            std::memcpy(this->lightRing.Map(), this->Lights.data(), this->Lights.size() * sizeof(LocalLightData));
+            this->lightRing.Unmap();
+        }
+        this->Data.lightBase = (int)(this->lightRing.Offset() / (4 * sizeof(float)));
+        this->Data.lightCount = (int)this->Lights.size();
+        std::memcpy(this->ring.Map(), &this->Data, sizeof(LightData));
+        this->ring.Unmap();
+        glBindBufferRange(GL_UNIFORM_BUFFER, LIGHT_DATA_BINDING, this->ring.Buffer, this->ring.Offset(), sizeof(LightData));
+    }
+
+    void EndFrame()
+    {
+        this->ring.EndFrame();
+        this->lightRing.EndFrame();
+    }
+
+private:
+    StreamBuffer ring;
+    StreamBuffer lightRing;
+};
@@ -0,0 +1,654 @@
+#pragma once
+
+// Std. Includes
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// GL Includes
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "GLState.h"
+#include "DiskCache.h"
+#include "ImageBasedLighting.h"
+#include "ThreadPool.h"
+
+// Texture units the lightmap variant of the default program samples (shaders/default.fs)
+const GLuint LIGHTMAP_TEXTURE_UNIT = 11;
+const GLuint SHADOW_MASK_TEXTURE_UNIT = 12;
+
+struct LightmapSettings
+{
+    int width = 512;            // of the atlas, its height is what the charts need
+    float density = 16.0f;      // texels per world unit
+    int padding = 1;            // texels around every chart, filled from its edge
+    int samples = 32;           // paths per texel
+    int bounces = 2;            // diffuse bounces per path before the sky's unoccluded irradiance ends it
+};
+
+// What Bake() did, for the startup line
+struct LightmapStats
+{
+    bool cached = false;        // texels came from the disk cache
+    int triangles = 0;
+    int bvhNodes = 0;
+    int charts = 0;
+    int texels = 0;             // inside charts
+    int invalidTexels = 0;      // buried inside other geometry, filled from their neighbours
+    double chartMilliseconds = 0.0;
+    double bakeMilliseconds = 0.0;  // path tracing or loading
+};
+
+// The direct light and sky the lightmap bakes, as the frame block has them
+struct LightmapLighting
+{
+    glm::vec3 direction;        // the light's, from the light towards the scene
+    glm::vec3 diffuse;
+    glm::vec3 ambient;          // scales the sky's normalized irradiance
+};
+
+// Baked lighting of the static surfaces. Every planar quad (two coplanar triangles, a single triangle otherwise)
+// becomes a chart sized by its world extent, shelf packed into one atlas, so the generated coordinates never
+// overlap. Each texel then traces paths on the CPU against a BVH of every static triangle, spread over the thread
+// pool: the direct light with its shadow ray, and cosine-weighted bounces off the other surfaces' average albedo
+// that escape into the sky's irradiance. Texels inside other geometry (most of their paths hit back faces) and
+// the padding are filled from their neighbours, the noisy indirect part is box filtered inside its chart.
+// The result is irradiance / pi, what multiplies the albedo, packed RGB9_E5; the direct light's visibility goes
+// into an R8 shadow mask for its highlight. Both are cached on disk, keyed by the triangles, albedos, lighting,
+// sky and settings.
+class Lightmap
+{
+public:
+    LightmapSettings Settings;
+    LightmapStats Stats;
+    GLuint Texture = 0;         // RGB9_E5
+    GLuint ShadowMask = 0;      // R8
+    int Width = 0, Height = 0;
+    std::uint64_t CacheKey = 0; // of the baked texels, what is derived from them keys on it too
+
+    // Triangles from interleaved vertices, position at 0 and normal at normalOffset (in floats), placed by model.
+    // Returns the surface index Coordinates() takes
+    int AddSurface(const float* vertices, int vertexCount, int stride, int normalOffset, const glm::mat4& model, const glm::vec3& albedo)
+    {
+        glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+        int surface = (int)this->surfaces.size();
+        Surface entry;
+        entry.firstTriangle = (int)this->triangles.size();
+        for (int i = 0; i + 2 < vertexCount; i += 3)
+        {
+            Triangle triangle;
+            for (int k = 0; k < 3; k++)
+            {
+                const float* vertex = vertices + (size_t)(i + k) * stride;
+                triangle.p[k] = glm::vec3(model * glm::vec4(vertex[0], vertex[1], vertex[2], 1.0f));
+            }
+            const float* normal = vertices + (size_t)i * stride + normalOffset;
+            triangle.normal = glm::normalize(normalMatrix * glm::vec3(normal[0], normal[1], normal[2]));
+            triangle.albedo = albedo;
+            this->triangles.push_back(triangle);
+        }
+        entry.triangleCount = (int)this->triangles.size() - entry.firstTriangle;
+        this->surfaces.push_back(entry);
+        return surface;
+    }
+
+    // Lightmap coordinates of a surface's vertices, valid after Bake()
+    const std::vector<glm::vec2>& Coordinates(int surface) const
+    {
+        return this->surfaces[surface].coordinates;
+    }
+
+    void Bake(const LightmapSettings& settings, const LightmapLighting& lighting, const ImageBasedLighting& environment)
+    {
+        this->Settings = settings;
+        this->Stats = LightmapStats();
+        this->Stats.triangles = (int)this->triangles.size();
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        this->buildCharts();
+        this->buildBvh();
+        std::chrono::steady_clock::time_point charted = std::chrono::steady_clock::now();
+        this->Stats.chartMilliseconds = std::chrono::duration<double, std::milli>(charted - start).count();
+
+        size_t texelCount = (size_t)this->Width * this->Height;
+        std::vector<std::uint32_t> packed(texelCount, 0u);
+        std::vector<unsigned char> mask(texelCount, 255);
+        std::uint64_t key = this->CacheKey = this->cacheKey(lighting, environment);
+        std::vector<char> blob;
+        this->Stats.cached = DiskCache::Read("lightmap", key, blob) && blob.size() == texelCount * 5;
+        if (this->Stats.cached)
+        {
+            std::memcpy(packed.data(), blob.data(), texelCount * 4);
+            std::memcpy(mask.data(), blob.data() + texelCount * 4, texelCount);
+        }
+        else
+        {
+            this->trace(lighting, environment, packed, mask);
+            blob.resize(texelCount * 5);
+            std::memcpy(blob.data(), packed.data(), texelCount * 4);
+            std::memcpy(blob.data() + texelCount * 4, mask.data(), texelCount);
+            DiskCache::Write("lightmap", key, blob.data(), blob.size());
+        }
+
+        GLState& state = GLState::Instance();
+        glGenTextures(1, &this->Texture);
+        state.BindTexture(0, GL_TEXTURE_2D, this->Texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB9_E5, this->Width, this->Height, 0, GL_RGB, GL_UNSIGNED_INT_5_9_9_9_REV, packed.data());
+        setFilter();
+        glGenTextures(1, &this->ShadowMask);
+        state.BindTexture(0, GL_TEXTURE_2D, this->ShadowMask);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, this->Width, this->Height, 0, GL_RED, GL_UNSIGNED_BYTE, mask.data());
+        setFilter();
+        this->Stats.bakeMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - charted).count();
+    }
+
+    void Destroy()
+    {
+        GLState& state = GLState::Instance();
+        state.DeleteTextures(1, &this->Texture);
+        state.DeleteTextures(1, &this->ShadowMask);
+    }
+
+    void Bind() const
+    {
+        GLState& state = GLState::Instance();
+        state.BindTexture(LIGHTMAP_TEXTURE_UNIT, GL_TEXTURE_2D, this->Texture);
+        state.BindTexture(SHADOW_MASK_TEXTURE_UNIT, GL_TEXTURE_2D, this->ShadowMask);
+    }
+
+    size_t MemoryBytes() const
+    {
+        return (size_t)this->Width * this->Height * 5;
+    }
+
+private:
+    struct Triangle
+    {
+        glm::vec3 p[3];
+        glm::vec3 normal;
+        glm::vec3 albedo;
+    };
+
+    struct Surface
+    {
+        int firstTriangle;
+        int triangleCount;
+        std::vector<glm::vec2> coordinates;
+    };
+
+    // A planar rectangle of the atlas: texel (i, j) inside it sits at origin + u * (i + 0.5) / w * extent.x + v * ...
+    struct Chart
+    {
+        int firstTriangle, triangleCount;
+        glm::vec3 origin, u, v, normal;
+        glm::vec2 extent;
+        int x, y;       // first texel inside the padding
+        int w, h;
+    };
+
+    // Children of an inner node are this + 1 and right, a leaf holds count triangles from first on
+    struct BvhNode
+    {
+        glm::vec3 min;
+        int first;
+        glm::vec3 max;
+        int count;
+        int right;
+    };
+
+    struct Hit
+    {
+        float t;
+        int triangle;
+    };
+
+    std::vector<Triangle> triangles;
+    std::vector<Surface> surfaces;
+    std::vector<Chart> charts;
+    std::vector<int> triangleOrder;     // triangles as the BVH leaves list them
+    std::vector<BvhNode> nodes;
+
+    static void setFilter()
+    {
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+
+    std::uint64_t cacheKey(const LightmapLighting& lighting, const ImageBasedLighting& environment) const
+    {
+        std::uint64_t key = DiskCache::Hash("lightmap v1");
+        key = DiskCache::HashBytes(&this->Settings, sizeof(LightmapSettings), key);
+        key = DiskCache::HashBytes(this->triangles.data(), this->triangles.size() * sizeof(Triangle), key);
+        key = DiskCache::HashBytes(&lighting, sizeof(LightmapLighting), key);
+        return DiskCache::HashBytes(environment.Irradiance, sizeof(environment.Irradiance), key);
+    }
+
+    // One chart per planar quad, sized by its extent, then shelf packed tallest first
+    void buildCharts()
+    {
+        this->charts.clear();
+        int padding = this->Settings.padding;
+        for (const Surface& surface : this->surfaces)
+            for (int t = surface.firstTriangle; t < surface.firstTriangle + surface.triangleCount; )
+            {
+                const Triangle& first = this->triangles[t];
+                Chart chart;
+                chart.firstTriangle = t;
+                chart.triangleCount = 1;
+                if (t + 1 < surface.firstTriangle + surface.triangleCount)
+                {
+                    const Triangle& second = this->triangles[t + 1];
+                    if (glm::dot(first.normal, second.normal) > 0.999f && std::abs(glm::dot(second.p[0] - first.p[0], first.normal)) < 1e-4f)
+                        chart.triangleCount = 2;
+                }
+                chart.normal = first.normal;
+                // along the shortest edge: a leg of the right triangles that make up a rectangle, not its diagonal
+                glm::vec3 edges[3] = { first.p[1] - first.p[0], first.p[2] - first.p[1], first.p[0] - first.p[2] };
+                glm::vec3 edge = edges[0];
+                for (int k = 1; k < 3; k++)
+                    if (glm::dot(edges[k], edges[k]) < glm::dot(edge, edge))
+                        edge = edges[k];
+                chart.u = glm::normalize(edge);
+                chart.u = glm::normalize(chart.u - chart.normal * glm::dot(chart.u, chart.normal));
+                chart.v = glm::cross(chart.normal, chart.u);
+                glm::vec2 low(1e30f), high(-1e30f);
+                for (int i = t; i < t + chart.triangleCount; i++)
+                    for (int k = 0; k < 3; k++)
+                    {
+                        glm::vec2 projected(glm::dot(this->triangles[i].p[k], chart.u), glm::dot(this->triangles[i].p[k], chart.v));
+                        low = glm::min(low, projected);
+                        high = glm::max(high, projected);
+                    }
+                float depth = glm::dot(first.p[0], chart.normal);
+                chart.origin = chart.u * low.x + chart.v * low.y + chart.normal * depth;
+                chart.extent = glm::max(high - low, glm::vec2(1e-4f));
+                int maxSize = this->Settings.width - 2 * padding;
+                chart.w = std::min(std::max((int)std::ceil(chart.extent.x * this->Settings.density), 1), maxSize);
+                chart.h = std::min(std::max((int)std::ceil(chart.extent.y * this->Settings.density), 1), maxSize);
+                this->charts.push_back(chart);
+                t += chart.triangleCount;
+            }
+
+        std::vector<int> order(this->charts.size());
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = (int)i;
+        std::stable_sort(order.begin(), order.end(), [this](int a, int b) { return this->charts[a].h > this->charts[b].h; });
+        int x = 0, y = 0, shelf = 0;
+        for (int index : order)
+        {
+            Chart& chart = this->charts[index];
+            if (x + chart.w + 2 * padding > this->Settings.width)
+            {
+                x = 0;
+                y += shelf;
+                shelf = 0;
+            }
+            chart.x = x + padding;
+            chart.y = y + padding;
+            x += chart.w + 2 * padding;
+            shelf = std::max(shelf, chart.h + 2 * padding);
+        }
+        this->Width = this->Settings.width;
+        this->Height = std::max((y + shelf + 3) / 4 * 4, 4);
+        this->Stats.charts = (int)this->charts.size();
+        this->Stats.texels = 0;
+        for (const Chart& chart : this->charts)
+            this->Stats.texels += chart.w * chart.h;
+
+        // every vertex's coordinates in its chart
+        std::vector<int> chartOf(this->triangles.size());
+        for (size_t c = 0; c < this->charts.size(); c++)
+            for (int i = this->charts[c].firstTriangle; i < this->charts[c].firstTriangle + this->charts[c].triangleCount; i++)
+                chartOf[i] = (int)c;
+        for (Surface& surface : this->surfaces)
+        {
+            surface.coordinates.clear();
+            for (int i = surface.firstTriangle; i < surface.firstTriangle + surface.triangleCount; i++)
+            {
+                const Chart& chart = this->charts[chartOf[i]];
+                for (int k = 0; k < 3; k++)
+                {
+                    glm::vec3 local = this->triangles[i].p[k] - chart.origin;
+                    glm::vec2 texel(chart.x + glm::dot(local, chart.u) / chart.extent.x * chart.w,
+                        chart.y + glm::dot(local, chart.v) / chart.extent.y * chart.h);
+                    surface.coordinates.push_back(texel / glm::vec2((float)this->Width, (float)this->Height));
+                }
+            }
+        }
+    }
+
+    // Median split on the longest axis of the centroids, up to 4 triangles per leaf
+    void buildBvh()
+    {
+        this->triangleOrder.resize(this->triangles.size());
+        for (size_t i = 0; i < this->triangleOrder.size(); i++)
+            this->triangleOrder[i] = (int)i;
+        this->nodes.clear();
+        if (!this->triangles.empty())
+            this->buildNode(0, (int)this->triangles.size());
+        this->Stats.bvhNodes = (int)this->nodes.size();
+    }
+
+    int buildNode(int first, int count)
+    {
+        int index = (int)this->nodes.size();
+        this->nodes.push_back(BvhNode());
+        glm::vec3 low(1e30f), high(-1e30f), centroidLow(1e30f), centroidHigh(-1e30f);
+        for (int i = first; i < first + count; i++)
+        {
+            const Triangle& triangle = this->triangles[this->triangleOrder[i]];
+            glm::vec3 centroid = (triangle.p[0] + triangle.p[1] + triangle.p[2]) / 3.0f;
+            centroidLow = glm::min(centroidLow, centroid);
+            centroidHigh = glm::max(centroidHigh, centroid);
+            for (int k = 0; k < 3; k++)
+            {
+                low = glm::min(low, triangle.p[k]);
+                high = glm::max(high, triangle.p[k]);
+            }
+        }
+        this->nodes[index].min = low;
+        this->nodes[index].max = high;
+        if (count <= 4)
+        {
+            this->nodes[index].first = first;
+            this->nodes[index].count = count;
+            this->nodes[index].right = -1;
+            return index;
+        }
+        glm::vec3 size = centroidHigh - centroidLow;
+        int axis = size.x > size.y && size.x > size.z ? 0 : (size.y > size.z ? 1 : 2);
+        int middle = first + count / 2;
+        std::nth_element(this->triangleOrder.begin() + first, this->triangleOrder.begin() + middle, this->triangleOrder.begin() + first + count,
+            [this, axis](int a, int b) {
+                const Triangle& ta = this->triangles[a];
+                const Triangle& tb = this->triangles[b];
+                return ta.p[0][axis] + ta.p[1][axis] + ta.p[2][axis] < tb.p[0][axis] + tb.p[1][axis] + tb.p[2][axis];
+            });
+        this->buildNode(first, middle - first);
+        int right = this->buildNode(middle, first + count - middle);
+        this->nodes[index].first = first;
+        this->nodes[index].count = 0;
+        this->nodes[index].right = right;
+        return index;
+    }
+
+    static bool hitBox(const BvhNode& node, const glm::vec3& origin, const glm::vec3& inverse, float tMax)
+    {
+        glm::vec3 t0 = (node.min - origin) * inverse;
+        glm::vec3 t1 = (node.max - origin) * inverse;
+        glm::vec3 near = glm::min(t0, t1), far = glm::max(t0, t1);
+        float enter = std::max(std::max(near.x, near.y), std::max(near.z, 0.0f));
+        float exit = std::min(std::min(far.x, far.y), std::min(far.z, tMax));
+        return enter <= exit;
+    }
+
+    // Moller-Trumbore, both sides
+    static bool hitTriangle(const Triangle& triangle, const glm::vec3& origin, const glm::vec3& direction, float& t)
+    {
+        glm::vec3 e1 = triangle.p[1] - triangle.p[0], e2 = triangle.p[2] - triangle.p[0];
+        glm::vec3 p = glm::cross(direction, e2);
+        float determinant = glm::dot(e1, p);
+        if (std::abs(determinant) < 1e-9f)
+            return false;
+        float inverse = 1.0f / determinant;
+        glm::vec3 s = origin - triangle.p[0];
+        float u = glm::dot(s, p) * inverse;
+        if (u < 0.0f || u > 1.0f)
+            return false;
+        glm::vec3 q = glm::cross(s, e1);
+        float v = glm::dot(direction, q) * inverse;
+        if (v < 0.0f || u + v > 1.0f)
+            return false;
+        t = glm::dot(e2, q) * inverse;
+        return t > 0.0f;
+    }
+
+    // Closest hit, or with anyHit the first one found (shadow rays)
+    bool intersect(const glm::vec3& origin, const glm::vec3& direction, float tMax, bool anyHit, Hit& hit) const
+    {
+        if (this->nodes.empty())
+            return false;
+        glm::vec3 inverse = 1.0f / glm::vec3(std::abs(direction.x) > 1e-12f ? direction.x : 1e-12f,
+            std::abs(direction.y) > 1e-12f ? direction.y : 1e-12f, std::abs(direction.z) > 1e-12f ? direction.z : 1e-12f);
+        int stack[64];
+        int top = 0;
+        stack[top++] = 0;
+        hit.t = tMax;
+        hit.triangle = -1;
+        while (top > 0)
+        {
+            const BvhNode& node = this->nodes[stack[--top]];
+            if (!hitBox(node, origin, inverse, hit.t))
+                continue;
+            if (node.count > 0)
+            {
+                for (int i = node.first; i < node.first + node.count; i++)
+                {
+                    float t;
+                    int triangle = this->triangleOrder[i];
+                    if (hitTriangle(this->triangles[triangle], origin, direction, t) && t < hit.t)
+                    {
+                        hit.t = t;
+                        hit.triangle = triangle;
+                        if (anyHit)
+                            return true;
+                    }
+                }
+                continue;
+            }
+            int index = (int)(&node - this->nodes.data());
+            stack[top++] = node.right;
+            stack[top++] = index + 1;
+        }
+        return hit.triangle >= 0;
+    }
+
+    static std::uint32_t nextRandom(std::uint32_t& state)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        return state;
+    }
+    static float random01(std::uint32_t& state)
+    {
+        return (nextRandom(state) >> 8) * (1.0f / 16777216.0f);
+    }
+
+    static glm::vec3 cosineDirection(const glm::vec3& n, std::uint32_t& state)
+    {
+        float r = std::sqrt(random01(state));
+        float phi = 6.2831853f * random01(state);
+        glm::vec3 up = std::abs(n.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+        glm::vec3 tangent = glm::normalize(glm::cross(up, n));
+        glm::vec3 bitangent = glm::cross(n, tangent);
+        return tangent * (r * std::cos(phi)) + bitangent * (r * std::sin(phi)) + n * std::sqrt(std::max(1.0f - r * r, 0.0f));
+    }
+
+    // Direct light reaching a point, irradiance / pi
+    glm::vec3 directLight(const glm::vec3& position, const glm::vec3& normal, const LightmapLighting& lighting, float& visibility) const
+    {
+        glm::vec3 toLight = glm::normalize(-lighting.direction);
+        float nDotL = glm::dot(normal, toLight);
+        visibility = 0.0f;
+        Hit hit;
+        if (!this->intersect(position + normal * 1e-3f, toLight, 1e30f, true, hit))
+            visibility = 1.0f;
+        return lighting.diffuse * std::max(nDotL, 0.0f) * visibility;
+    }
+
+    // Radiance arriving along direction; backFace tells a path that starts inside other geometry
+    glm::vec3 incoming(const glm::vec3& origin, const glm::vec3& direction, int bounce, const LightmapLighting& lighting,
+        const ImageBasedLighting& environment, std::uint32_t& state, bool& backFace) const
+    {
+        Hit hit;
+        if (!this->intersect(origin, direction, 1e30f, false, hit))
+            return lighting.ambient * environment.IrradianceAt(direction);
+        const Triangle& triangle = this->triangles[hit.triangle];
+        if (glm::dot(triangle.normal, direction) > 0.0f)
+        {
+            backFace = true;
+            return glm::vec3(0.0f);
+        }
+        glm::vec3 position = origin + direction * hit.t + triangle.normal * 1e-3f;
+        float visibility;
+        glm::vec3 irradiance = this->directLight(position, triangle.normal, lighting, visibility);
+        if (bounce + 1 < this->Settings.bounces)
+        {
+            bool ignored = false;
+            irradiance += this->incoming(position, cosineDirection(triangle.normal, state), bounce + 1, lighting, environment, state, ignored);
+        }
+        else
+            irradiance += lighting.ambient * environment.IrradianceAt(triangle.normal);
+        return triangle.albedo * irradiance;
+    }
+
+    // Every chart texel's paths, then the fill and filter passes and the packing
+    void trace(const LightmapLighting& lighting, const ImageBasedLighting& environment, std::vector<std::uint32_t>& packed,
+        std::vector<unsigned char>& mask)
+    {
+        size_t texelCount = (size_t)this->Width * this->Height;
+        std::vector<glm::vec3> direct(texelCount, glm::vec3(0.0f)), indirect(texelCount, glm::vec3(0.0f));
+        std::vector<float> visibility(texelCount, 1.0f);
+        std::vector<int> owner(texelCount, -1);     // chart of a valid texel
+        // rows of every chart, the unit of work
+        std::vector<glm::ivec2> rows;
+        for (size_t c = 0; c < this->charts.size(); c++)
+            for (int j = 0; j < this->charts[c].h; j++)
+                rows.push_back(glm::ivec2((int)c, j));
+        int samples = std::max(this->Settings.samples, 1);
+        ThreadPool::Instance().ParallelFor((int)rows.size(), 4, [&](int begin, int end) {
+            for (int r = begin; r < end; r++)
+            {
+                const Chart& chart = this->charts[rows[r].x];
+                int j = rows[r].y;
+                for (int i = 0; i < chart.w; i++)
+                {
+                    size_t texel = (size_t)(chart.y + j) * this->Width + chart.x + i;
+                    std::uint32_t state = (std::uint32_t)(texel * 2654435761u) ^ 0x9E3779B9u;
+                    glm::vec3 directSum(0.0f), indirectSum(0.0f);
+                    float visibleSum = 0.0f;
+                    int backFaces = 0;
+                    for (int s = 0; s < samples; s++)
+                    {
+                        // jittered inside the texel
+                        float a = (i + random01(state)) / chart.w * chart.extent.x;
+                        float b = (j + random01(state)) / chart.h * chart.extent.y;
+                        glm::vec3 position = chart.origin + chart.u * a + chart.v * b;
+                        float visible;
+                        directSum += this->directLight(position, chart.normal, lighting, visible);
+                        visibleSum += visible;
+                        bool backFace = false;
+                        indirectSum += this->incoming(position + chart.normal * 1e-3f, cosineDirection(chart.normal, state), 0, lighting,
+                            environment, state, backFace);
+                        backFaces += backFace ? 1 : 0;
+                    }
+                    direct[texel] = directSum / (float)samples;
+                    indirect[texel] = indirectSum / (float)samples;
+                    visibility[texel] = visibleSum / samples;
+                    if (backFaces * 4 < samples)
+                        owner[texel] = rows[r].x;
+                }
+            }
+        });
+        for (const Chart& chart : this->charts)
+            for (int j = 0; j < chart.h; j++)
+                for (int i = 0; i < chart.w; i++)
+                    if (owner[(size_t)(chart.y + j) * this->Width + chart.x + i] < 0)
+                        this->Stats.invalidTexels++;
+
+        // the indirect light is noisy but smooth: 3x3 box inside its chart
+        std::vector<glm::vec3> filtered(indirect);
+        for (size_t texel = 0; texel < texelCount; texel++)
+        {
+            if (owner[texel] < 0)
+                continue;
+            int x = (int)(texel % this->Width), y = (int)(texel / this->Width);
+            glm::vec3 sum(0.0f);
+            int count = 0;
+            for (int dy = -1; dy <= 1; dy++)
+                for (int dx = -1; dx <= 1; dx++)
+                {
+                    int nx = x + dx, ny = y + dy;
+                    if (nx < 0 || ny < 0 || nx >= this->Width || ny >= this->Height)
+                        continue;
+                    size_t neighbour = (size_t)ny * this->Width + nx;
+                    if (owner[neighbour] != owner[texel])
+                        continue;
+                    sum += indirect[neighbour];
+                    count++;
+                }
+            filtered[texel] = sum / (float)count;
+        }
+
+        // invalid texels and the padding take the average of their valid neighbours, ring by ring
+        std::vector<glm::vec3> color(texelCount);
+        std::vector<char> valid(texelCount);
+        for (size_t texel = 0; texel < texelCount; texel++)
+        {
+            color[texel] = direct[texel] + filtered[texel];
+            valid[texel] = owner[texel] >= 0;
+        }
+        for (int pass = 0; pass < this->Settings.padding + 2; pass++)
+        {
+            std::vector<char> grown(valid);
+            for (size_t texel = 0; texel < texelCount; texel++)
+            {
+                if (valid[texel])
+                    continue;
+                int x = (int)(texel % this->Width), y = (int)(texel / this->Width);
+                glm::vec3 sum(0.0f);
+                float visible = 0.0f;
+                int count = 0;
+                for (int dy = -1; dy <= 1; dy++)
+                    for (int dx = -1; dx <= 1; dx++)
+                    {
+                        int nx = x + dx, ny = y + dy;
+                        if (nx < 0 || ny < 0 || nx >= this->Width || ny >= this->Height || !valid[(size_t)ny * this->Width + nx])
+                            continue;
+                        sum += color[(size_t)ny * this->Width + nx];
+                        visible += visibility[(size_t)ny * this->Width + nx];
+                        count++;
+                    }
+                if (count == 0)
+                    continue;
+                color[texel] = sum / (float)count;
+                visibility[texel] = visible / count;
+                grown[texel] = 1;
+            }
+            valid.swap(grown);
+        }
+        for (size_t texel = 0; texel < texelCount; texel++)
+        {
+            packed[texel] = packRgb9e5(color[texel]);
+            mask[texel] = (unsigned char)(glm::clamp(visibility[texel], 0.0f, 1.0f) * 255.0f + 0.5f);
+        }
+    }
+
+    // Shared exponent format of GL_RGB9_E5: 9-bit mantissas, 5-bit exponent with bias 15
+    static std::uint32_t packRgb9e5(const glm::vec3& color)
+    {
+        const float largest = 65408.0f;
+        glm::vec3 c = glm::clamp(color, glm::vec3(0.0f), glm::vec3(largest));
+        float maximum = std::max(c.x, std::max(c.y, c.z));
+        if (maximum < 1e-7f)
+            return 0u;
+        int exponent = std::max(-16, (int)std::floor(std::log2(maximum))) + 1 + 15;
+        float scale = std::ldexp(1.0f, exponent - 15 - 9);
+        if ((int)std::floor(maximum / scale + 0.5f) == 512)
+        {
+            scale *= 2.0f;
+            exponent++;
+        }
+        std::uint32_t r = (std::uint32_t)std::min((int)std::floor(c.x / scale + 0.5f), 511);
+        std::uint32_t g = (std::uint32_t)std::min((int)std::floor(c.y / scale + 0.5f), 511);
+        std::uint32_t b = (std::uint32_t)std::min((int)std::floor(c.z / scale + 0.5f), 511);
+        return r | (g << 9) | (b << 18) | ((std::uint32_t)exponent << 27);
+    }
+};
@@ -0,0 +1,365 @@
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// SSE2 always, AVX2 when the compiler targets it (/arch:AVX2, -mavx2)
+#include <emmintrin.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+// GL Includes
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "BillboardRenderer.h"
+#include "GLState.h"
+#include "StreamBuffer.h"
+#include "ThreadPool.h"
+
+struct ParticleSettings
+{
+    int capacity = 1 << 16;
+    int chunkSize = 1 << 14;        // particles per thread pool job, a multiple of the SIMD width
+    glm::vec3 gravity = glm::vec3(0.0f, -9.81f, 0.0f);
+    float drag = 0.3f;              // fraction of the velocity lost per second
+    float floorHeight = -0.5f;
+    float bounce = 0.4f;            // velocity kept across the floor, reversed
+};
+
+// Where and how new particles start
+struct ParticleEmitter
+{
+    glm::vec3 position = glm::vec3(0.0f);
+    float rate = 1000.0f;           // particles per second
+    float speed = 5.0f;             // upwards
+    float spread = 1.2f;            // sideways
+    float minLife = 1.5f, maxLife = 3.0f;
+    float minSize = 0.05f, maxSize = 0.1f;
+};
+
+// Counters of the last Update()
+struct ParticleStats
+{
+    unsigned int live = 0;
+    unsigned int emitted = 0;
+    unsigned int died = 0;
+    double simulateMilliseconds = 0.0;  // integration, aging and compaction inside each chunk
+    double compactMilliseconds = 0.0;   // closing the gaps between the chunks, emission
+    double uploadMilliseconds = 0.0;
+};
+
+// Particles simulated on the CPU and drawn as camera facing quads by billboard.vs.
+// Every attribute is its own array, so the update kernel loads, integrates (gravity, drag, a bounce off the
+// floor) and ages SIMD-width particles at a time, 8 with AVX2 and 4 with SSE2. The arrays are cut into chunks
+// on the thread pool; each chunk drops its dead particles by moving the live ones down inside the chunk, then
+// the chunks are closed up in order so the live particles stay contiguous and keep their order. Emission
+// appends at the end. The instances, (position, size) with the size shrinking over the last part of a
+// particle's life, are written four at a time by a 4x4 transpose into a stream buffer ring, also in chunks.
+class ParticleSystem
+{
+public:
+    ParticleSettings Settings;
+    ParticleEmitter Emitter;
+    ParticleStats Stats;
+    GLuint VertexArray = 0;
+    SpriteFrame Sprite;             // in the atlas the billboards come from, see SpritePixels()
+
+    // quadBuffer holds the six (position, coordinates) vertices of the billboard quad
+    void Create(GLuint quadBuffer, const ParticleSettings& settings)
+    {
+        this->Settings = settings;
+        const size_t capacity = (size_t)settings.capacity;
+        for (std::vector<float>* attribute : this->attributes)
+            attribute->assign(capacity, 0.0f);
+        this->chunkLive.resize((capacity + settings.chunkSize - 1) / settings.chunkSize);
+        this->instanceRing.Create(GL_ARRAY_BUFFER, (GLsizeiptr)capacity * sizeof(BillboardInstance));
+        this->VertexArray = BillboardRenderer::CreateVertexArray(quadBuffer, this->instanceRing.Buffer);
+    }
+
+    void Destroy()
+    {
+        GLState::Instance().DeleteVertexArrays(1, &this->VertexArray);
+        this->instanceRing.Destroy();
+    }
+
+    int Live() const
+    {
+        return this->count;
+    }
+
+    // Kills every particle and spawns count as if the emitter had been running: random ages, each on its
+    // ballistic path, so a benchmark starts at its steady state
+    void Prewarm(int count)
+    {
+        this->count = 0;
+        this->emitAccumulator = 0.0f;
+        int first = this->emit(count);
+        for (int i = first; i < this->count; i++)
+        {
+            float age = this->random() * this->life[i];
+            this->age[i] = age;
+            this->px[i] += this->vx[i] * age;
+            this->py[i] = std::max(this->py[i] + (this->vy[i] + 0.5f * this->Settings.gravity.y * age) * age, this->Settings.floorHeight);
+            this->pz[i] += this->vz[i] * age;
+            this->vy[i] += this->Settings.gravity.y * age;
+        }
+    }
+
+    // Advances the particles by deltaTime, drops the dead ones, emits and streams this frame's instances
+    void Update(float deltaTime)
+    {
+        this->Stats = ParticleStats();
+        ThreadPool& pool = ThreadPool::Instance();
+        const int chunkSize = this->Settings.chunkSize;
+        const int chunks = (this->count + chunkSize - 1) / chunkSize;
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        pool.ParallelFor(this->count, chunkSize, [&](int begin, int end) {
+            this->simulate(begin, end, deltaTime);
+            this->chunkLive[begin / chunkSize] = this->compactChunk(begin, end);
+        });
+        std::chrono::steady_clock::time_point simulated = std::chrono::steady_clock::now();
+
+        // each chunk's survivors follow the previous chunk's, they only ever move down
+        int live = 0;
+        for (int chunk = 0; chunk < chunks; chunk++)
+        {
+            int begin = chunk * chunkSize;
+            int survivors = this->chunkLive[chunk];
+            if (begin != live && survivors > 0)
+                for (std::vector<float>* attribute : this->attributes)
+                    std::memmove(attribute->data() + live, attribute->data() + begin, survivors * sizeof(float));
+            live += survivors;
+        }
+        this->Stats.died = (unsigned int)(this->count - live);
+        this->count = live;
+        this->emitAccumulator += this->Emitter.rate * deltaTime;
+        int emitted = (int)this->emitAccumulator;
+        this->emitAccumulator -= (float)emitted;
+        int firstEmitted = this->emit(emitted);
+        this->Stats.emitted = (unsigned int)(this->count - firstEmitted);
+        std::chrono::steady_clock::time_point compacted = std::chrono::steady_clock::now();
+
+        if (this->count > 0)
+        {
+            BillboardInstance* instances = (BillboardInstance*)this->instanceRing.Map();
+            pool.ParallelFor(this->count, chunkSize, [&](int begin, int end) {
+                this->writeInstances(instances, begin, end);
+            });
+            this->instanceRing.Unmap();
+            BillboardRenderer::PointInstances(this->VertexArray, this->instanceRing.Buffer, this->instanceRing.Offset());
+        }
+        this->Stats.live = (unsigned int)this->count;
+        this->Stats.simulateMilliseconds = std::chrono::duration<double, std::milli>(simulated - start).count();
+        this->Stats.compactMilliseconds = std::chrono::duration<double, std::milli>(compacted - simulated).count();
+        this->Stats.uploadMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - compacted).count();
+    }
+
+    // Call once the draw reading this frame's instances is submitted
+    void EndFrame()
+    {
+        this->instanceRing.EndFrame();
+    }
+
+    // Particles integrated per instruction
+    static int SimdWidth()
+    {
+        return Lanes::WIDTH;
+    }
+
+    size_t MemoryBytes() const
+    {
+        return (size_t)this->Settings.capacity * (9 * sizeof(float) + StreamBuffer::FRAMES * sizeof(BillboardInstance));
+    }
+
+    // A warm glow fading out towards the edge, alpha carries the falloff; RGBA8 for the sprite atlas
+    static std::vector<unsigned char> SpritePixels(int resolution)
+    {
+        std::vector<unsigned char> pixels((size_t)resolution * resolution * 4);
+        for (int y = 0; y < resolution; y++)
+            for (int x = 0; x < resolution; x++)
+            {
+                float u = (x + 0.5f) / resolution * 2.0f - 1.0f, v = (y + 0.5f) / resolution * 2.0f - 1.0f;
+                float falloff = std::max(0.0f, 1.0f - std::sqrt(u * u + v * v));
+                unsigned char* pixel = &pixels[((size_t)y * resolution + x) * 4];
+                pixel[0] = 255;
+                pixel[1] = (unsigned char)(140.0f + 115.0f * falloff);
+                pixel[2] = (unsigned char)(60.0f + 120.0f * falloff * falloff);
+                pixel[3] = (unsigned char)(255.0f * falloff * falloff);
+            }
+        return pixels;
+    }
+
+private:
+    // The few operations the update kernel needs, on the widest registers the target has
+#if defined(__AVX2__)
+    struct Lanes
+    {
+        static const int WIDTH = 8;
+        typedef __m256 Type;
+        static Type Load(const float* p) { return _mm256_loadu_ps(p); }
+        static void Store(float* p, Type a) { _mm256_storeu_ps(p, a); }
+        static Type Set(float a) { return _mm256_set1_ps(a); }
+        static Type Add(Type a, Type b) { return _mm256_add_ps(a, b); }
+        static Type Sub(Type a, Type b) { return _mm256_sub_ps(a, b); }
+        static Type Mul(Type a, Type b) { return _mm256_mul_ps(a, b); }
+        static Type Less(Type a, Type b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+        static Type Select(Type mask, Type a, Type b) { return _mm256_blendv_ps(b, a, mask); }
+    };
+#else
+    struct Lanes
+    {
+        static const int WIDTH = 4;
+        typedef __m128 Type;
+        static Type Load(const float* p) { return _mm_loadu_ps(p); }
+        static void Store(float* p, Type a) { _mm_storeu_ps(p, a); }
+        static Type Set(float a) { return _mm_set1_ps(a); }
+        static Type Add(Type a, Type b) { return _mm_add_ps(a, b); }
+        static Type Sub(Type a, Type b) { return _mm_sub_ps(a, b); }
+        static Type Mul(Type a, Type b) { return _mm_mul_ps(a, b); }
+        static Type Less(Type a, Type b) { return _mm_cmplt_ps(a, b); }
+        static Type Select(Type mask, Type a, Type b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+    };
+#endif
+
+    std::vector<float> px, py, pz, vx, vy, vz, age, life, size;
+    std::vector<int> chunkLive;
+    StreamBuffer instanceRing;
+    int count = 0;
+    float emitAccumulator = 0.0f;
+    std::uint32_t seed = 2463534242u;
+
+    // every array, for what is done to all of them alike
+    std::vector<float>* const attributes[9] = { &px, &py, &pz, &vx, &vy, &vz, &age, &life, &size };
+
+    // xorshift32, [0, 1)
+    float random()
+    {
+        this->seed ^= this->seed << 13;
+        this->seed ^= this->seed >> 17;
+        this->seed ^= this->seed << 5;
+        return (this->seed >> 8) * (1.0f / 16777216.0f);
+    }
+
+    // Appends up to count new particles at the emitter, as many as there is room for; returns the first
+    int emit(int count)
+    {
+        const ParticleEmitter& emitter = this->Emitter;
+        int first = this->count;
+        count = std::min(count, this->Settings.capacity - first);
+        for (int i = first; i < first + count; i++)
+        {
+            float angle = 6.2832f * this->random();
+            float radial = emitter.spread * std::sqrt(this->random());
+            this->px[i] = emitter.position.x;
+            this->py[i] = emitter.position.y;
+            this->pz[i] = emitter.position.z;
+            this->vx[i] = radial * std::cos(angle);
+            this->vy[i] = emitter.speed * (0.8f + 0.4f * this->random());
+            this->vz[i] = radial * std::sin(angle);
+            this->age[i] = 0.0f;
+            this->life[i] = emitter.minLife + (emitter.maxLife - emitter.minLife) * this->random();
+            this->size[i] = emitter.minSize + (emitter.maxSize - emitter.minSize) * this->random();
+        }
+        this->count = first + count;
+        return first;
+    }
+
+    // Gravity and drag, then the position; a particle under the floor is mirrored above it and bounces
+    void simulate(int begin, int end, float deltaTime)
+    {
+        typedef Lanes::Type Type;
+        const ParticleSettings& settings = this->Settings;
+        const float damping = std::max(0.0f, 1.0f - settings.drag * deltaTime);
+        const Type dt = Lanes::Set(deltaTime), damp = Lanes::Set(damping), bounce = Lanes::Set(-settings.bounce);
+        const Type gx = Lanes::Set(settings.gravity.x * deltaTime), gy = Lanes::Set(settings.gravity.y * deltaTime);
+        const Type gz = Lanes::Set(settings.gravity.z * deltaTime);
+        const Type floor = Lanes::Set(settings.floorHeight), floor2 = Lanes::Set(2.0f * settings.floorHeight);
+        int i = begin;
+        for (; i + Lanes::WIDTH <= end; i += Lanes::WIDTH)
+        {
+            Type velocityX = Lanes::Add(Lanes::Mul(Lanes::Load(&this->vx[i]), damp), gx);
+            Type velocityY = Lanes::Add(Lanes::Mul(Lanes::Load(&this->vy[i]), damp), gy);
+            Type velocityZ = Lanes::Add(Lanes::Mul(Lanes::Load(&this->vz[i]), damp), gz);
+            Type positionY = Lanes::Add(Lanes::Load(&this->py[i]), Lanes::Mul(velocityY, dt));
+            Type below = Lanes::Less(positionY, floor);
+            Lanes::Store(&this->py[i], Lanes::Select(below, Lanes::Sub(floor2, positionY), positionY));
+            Lanes::Store(&this->vy[i], Lanes::Select(below, Lanes::Mul(velocityY, bounce), velocityY));
+            Lanes::Store(&this->px[i], Lanes::Add(Lanes::Load(&this->px[i]), Lanes::Mul(velocityX, dt)));
+            Lanes::Store(&this->pz[i], Lanes::Add(Lanes::Load(&this->pz[i]), Lanes::Mul(velocityZ, dt)));
+            Lanes::Store(&this->vx[i], velocityX);
+            Lanes::Store(&this->vz[i], velocityZ);
+            Lanes::Store(&this->age[i], Lanes::Add(Lanes::Load(&this->age[i]), dt));
+        }
+        for (; i < end; i++)
+        {
+            this->vx[i] = this->vx[i] * damping + settings.gravity.x * deltaTime;
+            this->vy[i] = this->vy[i] * damping + settings.gravity.y * deltaTime;
+            this->vz[i] = this->vz[i] * damping + settings.gravity.z * deltaTime;
+            this->px[i] += this->vx[i] * deltaTime;
+            this->py[i] += this->vy[i] * deltaTime;
+            this->pz[i] += this->vz[i] * deltaTime;
+            if (this->py[i] < settings.floorHeight)
+            {
+                this->py[i] = 2.0f * settings.floorHeight - this->py[i];
+                this->vy[i] *= -settings.bounce;
+            }
+            this->age[i] += deltaTime;
+        }
+    }
+
+    // Moves the live particles of [begin, end) down to begin, in order; returns how many there are
+    int compactChunk(int begin, int end)
+    {
+        int live = begin;
+        for (int i = begin; i < end; i++)
+        {
+            if (this->age[i] >= this->life[i])
+                continue;
+            if (live != i)
+                for (std::vector<float>* attribute : this->attributes)
+                    (*attribute)[live] = (*attribute)[i];
+            live++;
+        }
+        return live - begin;
+    }
+
+    // (position, size) of [begin, end), the size shrinks to nothing over the last third of the life; every
+    // particle shows the same sprite
+    void writeInstances(BillboardInstance* instances, int begin, int end)
+    {
+        const __m128 zeros = _mm_setzero_ps(), ones = _mm_set1_ps(1.0f), fadeScale = _mm_set1_ps(3.0f);
+        BillboardInstance spriteHalf = BillboardInstance();
+        spriteHalf.rect = this->Sprite.rect;
+        spriteHalf.layer = this->Sprite.layer;
+        const __m128i sprite = _mm_loadu_si128((const __m128i*)&spriteHalf.rect);
+        int i = begin;
+        for (; i + 4 <= end; i += 4)
+        {
+            __m128 remaining = _mm_sub_ps(_mm_loadu_ps(&this->life[i]), _mm_loadu_ps(&this->age[i]));
+            __m128 fade = _mm_min_ps(ones, _mm_max_ps(zeros, _mm_div_ps(_mm_mul_ps(remaining, fadeScale), _mm_loadu_ps(&this->life[i]))));
+            __m128 x = _mm_loadu_ps(&this->px[i]), y = _mm_loadu_ps(&this->py[i]), z = _mm_loadu_ps(&this->pz[i]);
+            __m128 w = _mm_mul_ps(_mm_loadu_ps(&this->size[i]), fade);
+            _MM_TRANSPOSE4_PS(x, y, z, w);
+            _mm_storeu_ps(&instances[i].position.x, x);
+            _mm_storeu_ps(&instances[i + 1].position.x, y);
+            _mm_storeu_ps(&instances[i + 2].position.x, z);
+            _mm_storeu_ps(&instances[i + 3].position.x, w);
+            for (int lane = 0; lane < 4; lane++)
+                _mm_storeu_si128((__m128i*)&instances[i + lane].rect, sprite);
+        }
+        for (; i < end; i++)
+        {
+            float fade = std::min(1.0f, std::max(0.0f, 3.0f * (this->life[i] - this->age[i]) / this->life[i]));
+            instances[i].position = glm::vec4(this->px[i], this->py[i], this->pz[i], this->size[i] * fade);
+            _mm_storeu_si128((__m128i*)&instances[i].rect, sprite);
+        }
+    }
+};
@@ -0,0 +1,244 @@
+#pragma once
+
+// Std. Includes
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <cmath>
+
+// GL Includes
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "GLState.h"
+#include "LightUniforms.h"
+#include "ShadowAtlas.h"
+
+// Texture unit the lighting shaders sample the point shadows at
+const GLuint POINT_SHADOW_TEXTURE_UNIT = 5;
+
+// Counters of the last Update() and of the casters submitted for it
+struct PointShadowStats
+{
+    unsigned int lights = 0;        // point lights that got a slot
+    unsigned int redrawn = 0;       // of them rendered this frame
+    unsigned int reused = 0;        // kept from an earlier frame
+    unsigned int dropped = 0;       // shadow casting point lights left without a slot, culled or out of slots
+    unsigned int casters = 0;       // caster draws inside the redrawn lights' ranges
+    unsigned int culled = 0;        // caster draws skipped because they are out of range
+};
+
+// Cube shadows of the point lights. A cube map array would need GL 4.0, so the cubes are six consecutive
+// layers of one depth texture array instead: a light owns a slot, layers 6 * slot .. 6 * slot + 5 in the face
+// order +X, -X, +Y, -Y, +Z, -Z, and the lighting shader picks the face by the major axis itself. Each light is
+// rendered in one pass, the geometry shader (shaders/shadow_point.gs) sends every triangle to the faces it
+// can touch through gl_Layer, and only casters whose bounding sphere reaches into the light's range are
+// submitted for it. Like the atlas tiles, a slot stays with its light and is only rendered again when it is
+// new, the light moved, or a dynamic caster is inside the range.
+class PointShadows
+{
+public:
+    // A light whose slot is out of date this frame
+    struct DirtyLight
+    {
+        int slot;
+        glm::vec3 position;
+        float range;
+    };
+
+    int Resolution = 512;           // of every face
+    GLuint Texture = 0;
+    GLuint Framebuffer = 0;         // layered, over the whole array
+    PointShadowStats Stats;
+
+    void Create(int resolution)
+    {
+        this->Resolution = resolution;
+        for (Slot& slot : this->slots)
+            slot = Slot();
+
+        glGenTextures(1, &this->Texture);
+        GLState& state = GLState::Instance();
+        state.BindTexture(0, GL_TEXTURE_2D_ARRAY, this->Texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, resolution, resolution, 6 * MAX_POINT_SHADOWS, 0,
+            GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        // only ever read through comparisons, each fetch filters 2x2 texels
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+        glGenFramebuffers(1, &this->Framebuffer);
+        state.BindFramebuffer(this->Framebuffer);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, this->Texture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::POINT_SHADOWS::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        glGenFramebuffers(1, &this->layerFramebuffer);
+        state.BindFramebuffer(this->layerFramebuffer);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        state.BindFramebuffer(0);
+    }
+
+    void Destroy()
+    {
+        GLState& state = GLState::Instance();
+        state.DeleteFramebuffers(1, &this->Framebuffer);
+        state.DeleteFramebuffers(1, &this->layerFramebuffer);
+        state.DeleteTextures(1, &this->Texture);
+    }
+
+    // The static casters changed, every slot is redrawn next frame
+    void InvalidateAll()
+    {
+        for (Slot& slot : this->slots)
+            slot.drawn = false;
+    }
+
+    // Gives the frame's shadow casting point lights their slots, nearest to the camera first, and writes the
+    // face matrices into the light block and the slots into the lights. Arguments as for ShadowAtlas::Update()
+    void Update(const std::vector<LocalLight>& lights, const std::vector<int>& blockIndices, const glm::mat4& view,
+        const glm::mat4& projection, const std::vector<glm::vec4>& dynamicCasters, LightUniforms& uniforms)
+    {
+        this->Stats = PointShadowStats();
+        this->dirtyLights.clear();
+
+        glm::mat4 viewProjection = projection * view;
+        glm::vec3 cameraPosition = glm::vec3(glm::inverse(view)[3]);
+        std::vector<int> wanted;
+        for (size_t i = 0; i < lights.size(); i++)
+        {
+            const LocalLight& light = lights[i];
+            if (light.type != LIGHT_POINT || !light.enabled || !light.castsShadow || blockIndices[i] < 0)
+                continue;
+            if (sphereInFrustum(viewProjection, light.position, light.range))
+                wanted.push_back((int)i);
+            else
+                this->Stats.dropped++;
+        }
+        // the lights whose ranges come closest to the camera keep their shadows when there are too many
+        std::sort(wanted.begin(), wanted.end(), [&](int a, int b) {
+            return glm::length(lights[a].position - cameraPosition) - lights[a].range
+                < glm::length(lights[b].position - cameraPosition) - lights[b].range;
+        });
+        if (wanted.size() > (size_t)MAX_POINT_SHADOWS)
+        {
+            this->Stats.dropped += (unsigned int)wanted.size() - MAX_POINT_SHADOWS;
+            wanted.resize(MAX_POINT_SHADOWS);
+        }
+
+        // lights keep the slot they had, the others take the free ones
+        for (Slot& slot : this->slots)
+            if (slot.light >= 0 && std::find(wanted.begin(), wanted.end(), slot.light) == wanted.end())
+                slot = Slot();
+        for (int light : wanted)
+        {
+            int slot = this->slotOf(light);
+            if (slot < 0)
+            {
+                slot = this->slotOf(-1);
+                this->slots[slot].light = light;
+            }
+            const LocalLight& source = lights[light];
+            Slot& target = this->slots[slot];
+            glm::mat4 matrices[6];
+            faceMatrices(source, matrices);
+            bool dirty = !target.drawn;
+            for (int face = 0; face < 6; face++)
+                dirty = dirty || matrices[face] != target.matrices[face];
+            for (const glm::vec4& caster : dynamicCasters)
+                dirty = dirty || glm::length(glm::vec3(caster) - source.position) < source.range + caster.w;
+
+            uniforms.Lights[blockIndices[light]].shadowTile = slot;
+            for (int face = 0; face < 6; face++)
+            {
+                target.matrices[face] = matrices[face];
+                uniforms.Data.pointShadowMatrices[6 * slot + face] = matrices[face];
+            }
+            if (dirty)
+            {
+                DirtyLight redraw = { slot, source.position, source.range };
+                this->dirtyLights.push_back(redraw);
+            }
+            target.drawn = true;
+            this->Stats.lights++;
+            if (dirty)
+                this->Stats.redrawn++;
+            else
+                this->Stats.reused++;
+        }
+    }
+
+    // The lights to render this frame, one pass each
+    const std::vector<DirtyLight>& DirtyLights() const
+    {
+        return this->dirtyLights;
+    }
+
+    // Whether a caster's bounding sphere (center, radius) reaches into a dirty light's range, counted in Stats
+    bool InRange(const DirtyLight& light, const glm::vec4& bounds)
+    {
+        bool inside = glm::length(glm::vec3(bounds) - light.position) < light.range + bounds.w;
+        if (inside)
+            this->Stats.casters++;
+        else
+            this->Stats.culled++;
+        return inside;
+    }
+
+    // Clears the six layers of every dirty light and binds the whole array. Draw each light's casters with the
+    // point shadow shader's slot set to its DirtyLight::slot
+    void BeginPass()
+    {
+        GLState& state = GLState::Instance();
+        state.Viewport(0, 0, this->Resolution, this->Resolution);
+        state.BindFramebuffer(this->layerFramebuffer);
+        for (const DirtyLight& light : this->dirtyLights)
+            for (int face = 0; face < 6; face++)
+            {
+                glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, this->Texture, 0, 6 * light.slot + face);
+                glClear(GL_DEPTH_BUFFER_BIT);
+            }
+        state.BindFramebuffer(this->Framebuffer);
+    }
+
+    size_t MemoryBytes() const
+    {
+        return (size_t)this->Resolution * this->Resolution * 6 * MAX_POINT_SHADOWS * 4;
+    }
+
+private:
+    struct Slot
+    {
+        int light = -1;             // index into the lights Update() gets, -1 when free
+        glm::mat4 matrices[6];
+        bool drawn = false;
+    };
+    Slot slots[MAX_POINT_SHADOWS];
+    std::vector<DirtyLight> dirtyLights;
+    GLuint layerFramebuffer = 0;    // single-layer attachment, for the clears
+
+    int slotOf(int light) const
+    {
+        for (int slot = 0; slot < MAX_POINT_SHADOWS; slot++)
+            if (this->slots[slot].light == light)
+                return slot;
+        return -1;
+    }
+
+    // Six 90 degree views down the axes, +X, -X, +Y, -Y, +Z, -Z
+    static void faceMatrices(const LocalLight& light, glm::mat4* matrices)
+    {
+        const float nearPlane = 0.05f;
+        static const glm::vec3 directions[6] = { glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1) };
+        static const glm::vec3 ups[6] = { glm::vec3(0, -1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1), glm::vec3(0, -1, 0), glm::vec3(0, -1, 0) };
+        glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, nearPlane, light.range);
+        for (int face = 0; face < 6; face++)
+            matrices[face] = projection * glm::lookAt(light.position, light.position + directions[face], ups[face]);
+    }
+};
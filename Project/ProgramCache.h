@@ -0,0 +1,132 @@
+#pragma once
+
+// Std. Includes
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// GL Includes
+#include <glad/glad.h>
+
+#include "DiskCache.h"
+#include "GLExtensions.h"
+
+// Startup counters of the program binary cache
+struct ProgramCacheStats
+{
+    unsigned int hits = 0;
+    unsigned int misses = 0;
+    unsigned int rejected = 0;      // binaries found on disk that the driver refused, counted as misses too
+    double loadMilliseconds = 0.0;
+    double compileMilliseconds = 0.0;
+};
+
+// Linked program binaries kept on disk, keyed by the shader sources, the driver and its binary formats.
+// A stale or rejected binary just falls back to a source compile, which then refreshes the cache.
+class ProgramCache
+{
+public:
+    ProgramCacheStats Stats;
+
+    static ProgramCache& Instance()
+    {
+        static ProgramCache cache;
+        return cache;
+    }
+
+    bool Enabled() const
+    {
+        return glExtensions().programBinary;
+    }
+
+    std::uint64_t Key(const std::string& vertexCode, const std::string& fragmentCode, const std::string& geometryCode = std::string()) const
+    {
+        std::uint64_t key = DiskCache::Hash(vertexCode, this->driverKey);
+        key = DiskCache::Hash("\n--fragment--\n", key);
+        key = DiskCache::Hash(fragmentCode, key);
+        if (geometryCode.empty())
+            return key;
+        key = DiskCache::Hash("\n--geometry--\n", key);
+        return DiskCache::Hash(geometryCode, key);
+    }
+
+    // Must be called before glLinkProgram, otherwise the driver may not keep a retrievable binary
+    void PrepareLink(GLuint program) const
+    {
+        if (this->Enabled())
+            glExtensions().ProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+
+    // Hands a cached binary to the driver and returns true when there was one to hand over.
+    // Whether the driver took it is only known from Accepted(), which may wait for the driver
+    bool Load(GLuint program, std::uint64_t key)
+    {
+        if (!this->Enabled())
+            return false;
+        std::vector<char> blob;
+        if (!DiskCache::Read("program", key, blob) || blob.size() <= sizeof(GLenum))
+            return false;
+        GLenum format;
+        std::memcpy(&format, blob.data(), sizeof(GLenum));
+        bool known = false;
+        for (GLint supported : this->formats)
+            known = known || (GLenum)supported == format;
+        if (!known)
+        {
+            this->Stats.rejected++;
+            return false;
+        }
+        glExtensions().ProgramBinary(program, format, blob.data() + sizeof(GLenum), (GLsizei)(blob.size() - sizeof(GLenum)));
+        return true;
+    }
+
+    bool Accepted(GLuint program)
+    {
+        GLint success = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success)
+            this->Stats.rejected++;
+        return success == GL_TRUE;
+    }
+
+    void Store(GLuint program, std::uint64_t key) const
+    {
+        if (!this->Enabled())
+            return;
+        GLint length = 0;
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (length <= 0)
+            return;
+        std::vector<char> blob(sizeof(GLenum) + length);
+        GLenum format = GL_NONE;
+        glExtensions().GetProgramBinary(program, length, NULL, &format, blob.data() + sizeof(GLenum));
+        std::memcpy(blob.data(), &format, sizeof(GLenum));
+        DiskCache::Write("program", key, blob.data(), blob.size());
+    }
+
+private:
+    std::uint64_t driverKey = 0;
+    std::vector<GLint> formats;
+
+    ProgramCache()
+    {
+        // the driver identity and the binary formats it accepts are part of every key
+        const char* strings[] = {
+            (const char*)glGetString(GL_VENDOR),
+            (const char*)glGetString(GL_RENDERER),
+            (const char*)glGetString(GL_VERSION)
+        };
+        this->driverKey = DiskCache::Hash("program binary v1");
+        for (const char* text : strings)
+            this->driverKey = DiskCache::Hash(std::string(text ? text : ""), this->driverKey);
+        if (this->Enabled())
+        {
+            GLint count = 0;
+            glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &count);
+            this->formats.resize(count);
+            glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, this->formats.data());
+            this->driverKey = DiskCache::HashBytes(this->formats.data(), this->formats.size() * sizeof(GLint), this->driverKey);
+        }
+    }
+};
@@ -0,0 +1,326 @@
+#pragma once
+
+// Std. Includes
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <cmath>
+
+// GL Includes
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "GLState.h"
+
+struct ReflectionProbeSettings
+{
+    int resolution = 128;       // of every face
+    int facesPerFrame = 2;      // the budget, 0 leaves the probes as they are
+    float nearPlane = 0.05f;
+    float farPlane = 50.0f;
+};
+
+// What the last Update() scheduled
+struct ReflectionProbeStats
+{
+    int probe = -1;             // rendered this frame, -1 when none
+    int faces = 0;              // of it rendered this frame
+    int dirty = 0;              // faces of every probe that were out of date before the frame
+    int oldest = 0;             // frames the most out of date face has waited
+};
+
+// Environment cubes rendered live around points of the scene, the reflections of the mirror cubes. A probe is
+// an R11F_G11F_B10F cube map with a full mip chain, box filtered by glGenerateMipmap for rough reflections.
+// Rendering is time sliced: a face is only out of date when it was never drawn, its probe moved, or a moving
+// object is (or was, at its last render) inside its 90 degree frustum, and each frame only the budget's worth
+// of them is rendered. The scheduler weighs every dirty face by the frames it has waited, the moving objects
+// it sees and how close its probe is to the camera, takes the probe of the most urgent one and renders that
+// probe's most urgent faces in one layered pass: the geometry shader (shaders/probe.gs) sends each triangle
+// to the faces in FaceMask() through gl_Layer. A probe that was never drawn gets its six faces at once.
+// One pass a frame means one color cube to attach, the depth cube is shared by all probes.
+class ReflectionProbes
+{
+public:
+    ReflectionProbeSettings Settings;
+    ReflectionProbeStats Stats;
+    GLuint Framebuffer = 0;     // layered over the rendered probe's cube
+
+    // Probes are added before Create(); range is how far a moving object can be and still be reflected
+    int Add(const glm::vec3& position, float range)
+    {
+        Probe probe;
+        probe.position = position;
+        probe.range = range;
+        this->probes.push_back(probe);
+        return (int)this->probes.size() - 1;
+    }
+
+    void Create(const ReflectionProbeSettings& settings)
+    {
+        this->Settings = settings;
+        for (Probe& probe : this->probes)
+            glGenTextures(1, &probe.texture);
+        glGenTextures(1, &this->depthTexture);
+        this->allocate();
+
+        GLState& state = GLState::Instance();
+        glGenFramebuffers(1, &this->Framebuffer);
+        glGenFramebuffers(1, &this->faceFramebuffer);
+        if (!this->probes.empty())
+        {
+            state.BindFramebuffer(this->Framebuffer);
+            glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, this->probes[0].texture, 0);
+            glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, this->depthTexture, 0);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+                std::cout << "ERROR::REFLECTION_PROBES::FRAMEBUFFER_INCOMPLETE" << std::endl;
+            state.BindFramebuffer(0);
+        }
+    }
+
+    // New storage for every cube under the same texture names, so materials holding them stay valid; every face
+    // is out of date afterwards
+    void SetResolution(int resolution)
+    {
+        this->Settings.resolution = resolution;
+        this->allocate();
+    }
+
+    void Destroy()
+    {
+        GLState& state = GLState::Instance();
+        state.DeleteFramebuffers(1, &this->Framebuffer);
+        state.DeleteFramebuffers(1, &this->faceFramebuffer);
+        for (Probe& probe : this->probes)
+            state.DeleteTextures(1, &probe.texture);
+        state.DeleteTextures(1, &this->depthTexture);
+    }
+
+    GLuint Texture(int probe) const
+    {
+        return this->probes[probe].texture;
+    }
+
+    // The mip level a roughness of 1 reads, the 4x4 level; the smaller ones are only averages
+    int MaxLevel() const
+    {
+        int level = 0;
+        while ((this->Settings.resolution >> (level + 1)) >= 4)
+            level++;
+        return level;
+    }
+
+    void Move(int probe, const glm::vec3& position)
+    {
+        this->probes[probe].position = position;
+    }
+
+    // Marks the faces out of date and picks this frame's probe and faces. movers are the bounding spheres
+    // (center, radius) of the reflected objects that move; the probes' own objects must not be among them
+    void Update(const glm::vec3& cameraPosition, const std::vector<glm::vec4>& movers)
+    {
+        this->Stats = ReflectionProbeStats();
+        this->active = -1;
+        this->faceMask = 0;
+        float best = 0.0f;
+        for (size_t i = 0; i < this->probes.size(); i++)
+        {
+            Probe& probe = this->probes[i];
+            int seen[6] = {};
+            for (const glm::vec4& mover : movers)
+                for (int face = 0; face < 6; face++)
+                    if (this->faceSees(probe, face, mover))
+                        seen[face]++;
+            // nearer probes cover more of the screen, their faces win ties
+            float distance = glm::length(probe.position - cameraPosition) / probe.range;
+            for (int face = 0; face < 6; face++)
+            {
+                Face& current = probe.faces[face];
+                current.age++;
+                current.seen = seen[face];
+                current.priority = 0.0f;
+                if (current.drawn && current.position == probe.position && seen[face] == 0 && !current.sawMovers)
+                    continue;
+                current.priority = current.drawn ? (float)current.age * (1.0f + seen[face]) / (1.0f + distance) : 1.0e30f;
+                this->Stats.dirty++;
+                this->Stats.oldest = std::max(this->Stats.oldest, current.age);
+                if (current.priority > best)
+                {
+                    best = current.priority;
+                    this->active = (int)i;
+                }
+            }
+        }
+        if (this->active < 0 || this->Settings.facesPerFrame <= 0)
+        {
+            this->active = -1;
+            return;
+        }
+
+        Probe& probe = this->probes[this->active];
+        int order[6] = { 0, 1, 2, 3, 4, 5 };
+        std::sort(order, order + 6, [&](int a, int b) { return probe.faces[a].priority > probe.faces[b].priority; });
+        bool complete = true;
+        for (int face = 0; face < 6; face++)
+            complete = complete && probe.faces[face].drawn;
+        int budget = complete ? this->Settings.facesPerFrame : 6;
+        for (int i = 0; i < 6 && this->Stats.faces < budget; i++)
+        {
+            Face& face = probe.faces[order[i]];
+            if (face.priority <= 0.0f)
+                break;
+            this->faceMask |= 1 << order[i];
+            face.drawn = true;
+            face.position = probe.position;
+            face.age = 0;
+            face.sawMovers = face.seen > 0;
+            this->Stats.faces++;
+        }
+        faceMatrices(probe.position, this->Settings, this->matrices);
+        this->Stats.probe = this->active;
+    }
+
+    // The probe to render this frame, -1 when there is nothing to do
+    int Active() const
+    {
+        return this->active;
+    }
+
+    glm::vec3 ActivePosition() const
+    {
+        return this->probes[this->active].position;
+    }
+
+    // Bit per face (+X, -X, +Y, -Y, +Z, -Z) to render into
+    int FaceMask() const
+    {
+        return this->faceMask;
+    }
+
+    // view-projection of each face of the active probe
+    const glm::mat4* FaceMatrices() const
+    {
+        return this->matrices;
+    }
+
+    // Clears the faces to render and binds the active probe's cube layered
+    void BeginPass()
+    {
+        GLState& state = GLState::Instance();
+        GLuint texture = this->probes[this->active].texture;
+        state.Viewport(0, 0, this->Settings.resolution, this->Settings.resolution);
+        state.BindFramebuffer(this->faceFramebuffer);
+        for (int face = 0; face < 6; face++)
+        {
+            if ((this->faceMask & (1 << face)) == 0)
+                continue;
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, texture, 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, this->depthTexture, 0);
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        }
+        state.BindFramebuffer(this->Framebuffer);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, texture, 0);
+    }
+
+    // Rebuilds the rendered probe's mip chain
+    void EndPass()
+    {
+        GLState::Instance().BindTexture(0, GL_TEXTURE_CUBE_MAP, this->probes[this->active].texture);
+        glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+    }
+
+    size_t Count() const
+    {
+        return this->probes.size();
+    }
+
+    // Color cubes with their mips, and the shared depth cube
+    size_t MemoryBytes() const
+    {
+        size_t texels = (size_t)this->Settings.resolution * this->Settings.resolution * 6;
+        return this->probes.size() * texels * 4 * 4 / 3 + texels * 4;
+    }
+
+private:
+    struct Face
+    {
+        bool drawn = false;
+        bool sawMovers = false;     // at its last render, so it is drawn once more after they left
+        glm::vec3 position;         // of the probe at its last render
+        int age = 0;                // frames since it was drawn
+        int seen = 0;               // movers inside it this frame
+        float priority = 0.0f;
+    };
+    struct Probe
+    {
+        glm::vec3 position;
+        float range;
+        GLuint texture = 0;
+        Face faces[6];
+    };
+    std::vector<Probe> probes;
+    GLuint depthTexture = 0;
+    GLuint faceFramebuffer = 0;     // single-face attachments, for the clears
+    int active = -1;
+    int faceMask = 0;
+    glm::mat4 matrices[6];
+
+    void allocate()
+    {
+        int resolution = this->Settings.resolution;
+        GLState& state = GLState::Instance();
+        for (Probe& probe : this->probes)
+        {
+            state.BindTexture(0, GL_TEXTURE_CUBE_MAP, probe.texture);
+            for (int level = 0; (resolution >> level) > 0; level++)
+                for (int face = 0; face < 6; face++)
+                    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, level, GL_R11F_G11F_B10F, resolution >> level, resolution >> level,
+                        0, GL_RGB, GL_FLOAT, NULL);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+            for (int face = 0; face < 6; face++)
+                probe.faces[face] = Face();
+        }
+        state.BindTexture(0, GL_TEXTURE_CUBE_MAP, this->depthTexture);
+        for (int face = 0; face < 6; face++)
+            glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, 0, GL_DEPTH_COMPONENT24, resolution, resolution, 0, GL_DEPTH_COMPONENT,
+                GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, 0);
+        this->active = -1;
+        this->faceMask = 0;
+    }
+
+    // Whether a sphere reaches into a face's frustum within the probe's range: for +X that is x >= |y| and
+    // x >= |z|, four planes through the center at 45 degrees
+    bool faceSees(const Probe& probe, int face, const glm::vec4& sphere) const
+    {
+        glm::vec3 offset = glm::vec3(sphere) - probe.position;
+        float distance = glm::length(offset);
+        if (distance - sphere.w > probe.range)
+            return false;
+        if (distance < sphere.w)
+            return true;
+        int axis = face / 2;
+        float along = face % 2 == 0 ? offset[axis] : -offset[axis];
+        float margin = sphere.w * 1.41421356f;
+        for (int other = 0; other < 3; other++)
+            if (other != axis && (along - offset[other] < -margin || along + offset[other] < -margin))
+                return false;
+        return true;
+    }
+
+    // Six 90 degree views down the axes, +X, -X, +Y, -Y, +Z, -Z, upright as GL samples cube faces
+    static void faceMatrices(const glm::vec3& position, const ReflectionProbeSettings& settings, glm::mat4* matrices)
+    {
+        static const glm::vec3 directions[6] = { glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1) };
+        static const glm::vec3 ups[6] = { glm::vec3(0, -1, 0), glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1), glm::vec3(0, -1, 0), glm::vec3(0, -1, 0) };
+        glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, settings.nearPlane, settings.farPlane);
+        for (int face = 0; face < 6; face++)
+            matrices[face] = projection * glm::lookAt(position, position + directions[face], ups[face]);
+    }
+};
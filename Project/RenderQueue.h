@@ -0,0 +1,212 @@
+#pragma once
+
+// Std. Includes
+#include <cstdint>
+#include <vector>
+#include <chrono>
+#include <functional>
+
+// GL Includes
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "GLState.h"
+#include "Shader.h"
+
+// One texture per unit, unit = index in Material::textures
+struct TextureBinding
+{
+    GLenum target;
+    GLuint texture;
+};
+
+// What a draw binds besides its program and geometry
+struct Material
+{
+    std::vector<TextureBinding> textures;
+    bool writeStencil = true;   // opaque items mark the stencil for the outline pass
+    bool weightedBlended = false;   // transparent items go to PASS_WEIGHTED, blended without sorting
+};
+
+struct DrawItem
+{
+    std::uint64_t key;
+    Shader* shader;
+    Uniform<int> objectUniform;
+    int object;
+    int material;
+    GLuint vertexArray;
+    GLsizei vertexCount;
+    GLsizei instances;          // consecutive objects from object on, drawn in one call
+    Uniform<int> viewUniform;   // picks one of several views a pass renders, e.g. the light of a point shadow
+    int view;
+};
+
+// Per-frame counters of the queue
+struct RenderQueueStats
+{
+    unsigned int items = 0;
+    unsigned int drawCalls = 0;
+    unsigned int instances = 0;         // objects drawn by those calls
+    unsigned int passDrawCalls[16] = {};// draw calls of each RenderQueue::Pass, as many as the key has room for
+    double buildMilliseconds = 0.0;     // from Begin() to Sort()
+    double sortMilliseconds = 0.0;
+    unsigned int programChanges = 0;
+    unsigned int materialChanges = 0;
+    unsigned int vertexArrayChanges = 0;
+};
+
+// Draw items collected for the frame, radix sorted by a 64-bit key and executed in key order.
+// Key layout, most significant first:
+//   pass (4) | transparent (1) | opaque:      program (12) | material (12) | VAO (11) | depth (24, front to back)
+//                              | transparent: depth (24, back to front) | program (12) | material (12) | VAO (11)
+// so passes run in order, opaque draws are grouped by state and then go front to back for early-Z, and
+// transparent draws go back to front whatever their state. PASS_WEIGHTED items (transparent items of a
+// weightedBlended material) take the opaque layout: their order doesn't matter, only the state changes do.
+class RenderQueue
+{
+public:
+    // prefixed, windows.h defines OPAQUE and TRANSPARENT
+    // PASS_LIGHTING is the deferred pipeline's full screen lighting, between its geometry (PASS_OPAQUE) and the forward passes;
+    // PASS_WEIGHTED accumulates order-independent transparency, see WeightedTransparency.h; PASS_PROBE renders the faces of
+    // a reflection probe, see ReflectionProbes.h
+    enum Pass { PASS_SHADOW_STATIC = 0, PASS_SHADOW = 1, PASS_SHADOW_ATLAS = 2, PASS_SHADOW_POINT = 3, PASS_PROBE = 4, PASS_OPAQUE = 5,
+        PASS_LIGHTING = 6, PASS_OUTLINE = 7, PASS_SKY = 8, PASS_TRANSPARENT = 9, PASS_WEIGHTED = 10 };
+    RenderQueueStats Stats;
+
+    // Materials live for the whole run, their index goes into the sort key
+    int AddMaterial(const Material& material)
+    {
+        this->materials.push_back(material);
+        return (int)this->materials.size() - 1;
+    }
+
+    // Starts a frame. Depth is measured along the view direction and quantized over [0, farPlane]
+    void Begin(const glm::vec3& viewPos, const glm::vec3& viewDir, float farPlane)
+    {
+        this->items.clear();
+        this->viewPos = viewPos;
+        this->viewDir = viewDir;
+        this->farPlane = farPlane;
+        this->Stats = RenderQueueStats();
+        this->buildStart = std::chrono::steady_clock::now();
+    }
+
+    // An item with several instances draws objects object .. object + instances - 1 of the transform buffer,
+    // sorted by the position given for the whole batch. viewUniform, when given, is set to view before the draw;
+    // items of the same state keep their submission order, so submitting view by view groups them by view.
+    // Transparent items of a weightedBlended material are moved to PASS_WEIGHTED
+    void Submit(Pass pass, Shader& shader, Uniform<int> objectUniform, int object, int material, GLuint vertexArray,
+        GLsizei vertexCount, const glm::vec3& position, GLsizei instances = 1, Uniform<int> viewUniform = Uniform<int>(), int view = 0)
+    {
+        const std::uint64_t DEPTH_MAX = (1 << 24) - 1;
+        if (pass == PASS_TRANSPARENT && this->materials[material].weightedBlended)
+            pass = PASS_WEIGHTED;
+        float depth = glm::dot(position - this->viewPos, this->viewDir) / this->farPlane;
+        std::uint64_t quantized = (std::uint64_t)(glm::clamp(depth, 0.0f, 1.0f) * DEPTH_MAX);
+        std::uint64_t program = shader.Program & 0xFFF;
+        std::uint64_t materialId = (std::uint64_t)material & 0xFFF;
+        std::uint64_t vao = vertexArray & 0x7FF;
+        std::uint64_t key = (std::uint64_t)pass << 60;
+        if (pass == PASS_TRANSPARENT)
+            key |= 1ull << 59 | (DEPTH_MAX - quantized) << 35 | program << 23 | materialId << 11 | vao;
+        else
+            key |= program << 47 | materialId << 35 | vao << 24 | quantized;
+        DrawItem item = { key, &shader, objectUniform, object, material, vertexArray, vertexCount, instances, viewUniform, view };
+        this->items.push_back(item);
+    }
+
+    // LSD radix sort on the keys, 8 bits per pass; passes where every key has the same byte are skipped
+    void Sort()
+    {
+        std::chrono::steady_clock::time_point sortStart = std::chrono::steady_clock::now();
+        this->Stats.buildMilliseconds = std::chrono::duration<double, std::milli>(sortStart - this->buildStart).count();
+        this->Stats.items = (unsigned int)this->items.size();
+        this->scratch.resize(this->items.size());
+        for (int shift = 0; shift < 64; shift += 8)
+        {
+            size_t histogram[256] = {};
+            for (const DrawItem& item : this->items)
+                histogram[(item.key >> shift) & 0xFF]++;
+            if (histogram[(this->items.empty() ? 0 : this->items[0].key >> shift) & 0xFF] == this->items.size())
+                continue;
+            size_t offset = 0;
+            for (int digit = 0; digit < 256; digit++)
+            {
+                size_t count = histogram[digit];
+                histogram[digit] = offset;
+                offset += count;
+            }
+            for (const DrawItem& item : this->items)
+                this->scratch[histogram[(item.key >> shift) & 0xFF]++] = item;
+            this->items.swap(this->scratch);
+        }
+        this->Stats.sortMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - sortStart).count();
+    }
+
+    // Draws the sorted items. beginPass is called whenever the pass changes, to set framebuffer and pass-wide state
+    void Execute(const std::function<void(Pass)>& beginPass)
+    {
+        GLState& state = GLState::Instance();
+        int pass = -1, material = -1, view = -1;
+        Shader* shader = nullptr;
+        GLuint vertexArray = 0xFFFFFFFFu;
+        for (const DrawItem& item : this->items)
+        {
+            int itemPass = (int)(item.key >> 60);
+            if (itemPass != pass)
+            {
+                pass = itemPass;
+                beginPass((Pass)pass);
+                // the pass may have touched anything, bind everything again through the state cache
+                shader = nullptr;
+                material = -1;
+                vertexArray = 0xFFFFFFFFu;
+            }
+            if (item.shader != shader)
+            {
+                shader = item.shader;
+                shader->Use();
+                view = -1;
+                this->Stats.programChanges++;
+            }
+            if (item.material != material)
+            {
+                material = item.material;
+                const Material& bound = this->materials[material];
+                for (size_t unit = 0; unit < bound.textures.size(); unit++)
+                    state.BindTexture((GLuint)unit, bound.textures[unit].target, bound.textures[unit].texture);
+                if (pass == PASS_OPAQUE)
+                    state.StencilMask(bound.writeStencil ? 0xFF : 0x00);
+                this->Stats.materialChanges++;
+            }
+            if (item.vertexArray != vertexArray)
+            {
+                vertexArray = item.vertexArray;
+                state.BindVertexArray(vertexArray);
+                this->Stats.vertexArrayChanges++;
+            }
+            if (item.objectUniform.location >= 0)
+                shader->set(item.objectUniform, item.object);
+            if (item.viewUniform.location >= 0 && item.view != view)
+            {
+                view = item.view;
+                shader->set(item.viewUniform, view);
+            }
+            if (item.instances > 1)
+                glDrawArraysInstanced(GL_TRIANGLES, 0, item.vertexCount, item.instances);
+            else
+                glDrawArrays(GL_TRIANGLES, 0, item.vertexCount);
+            this->Stats.drawCalls++;
+            this->Stats.passDrawCalls[pass]++;
+            this->Stats.instances += item.instances;
+        }
+    }
+
+private:
+    std::vector<Material> materials;
+    std::vector<DrawItem> items, scratch;
+    glm::vec3 viewPos, viewDir;
+    float farPlane = 100.0f;
+    std::chrono::steady_clock::time_point buildStart;
+};
@@ -0,0 +1,262 @@
+#pragma once
+
+// Std. Includes
+#include <iostream>
+#include <algorithm>
+
+// GL Includes
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "GLState.h"
+#include "Shader.h"
+#include "ShaderVariants.h"
+#include "GBuffer.h"
+
+// Texture unit the deferred lighting pass samples the resolved reflections at
+const GLuint SCREEN_SPACE_REFLECTION_TEXTURE_UNIT = 14;
+
+struct ScreenSpaceReflectionSettings
+{
+    int divisor = 2;                // full resolution texels per traced texel along each axis, 2 half, 4 quarter
+    int maxSteps = 64;              // pyramid cells a ray visits at most
+    float thickness = 0.3f;         // view depth behind a surface a ray still hits it
+    float maxDistance = 30.0f;      // world units a ray reaches
+    float historyWeight = 0.85f;    // share of the reprojected history in the resolve
+};
+
+// Reflections of the visible scene on the G-buffer's reflective pixels (LIGHTING_MODEL_REFLECTIVE), found in
+// screen space instead of rendering the scene again. The geometry pass's depth is reduced into a pyramid of
+// R32F levels, each texel the nearest depth of the texels under it, so a ray skips whole cells that are
+// behind it and the steps grow with the empty space it crosses; no ray takes more than maxSteps. Rays are
+// traced at half or quarter resolution, one per texel through a microfacet normal of the surface's lobe,
+// and read the previous frame's final color where they hit, which is still in the G-buffer's color target
+// when the lighting pass starts. Misses take the baked reflection probes or the sky, so the cost is a few
+// full screen passes whatever the scene holds. The traced texels are blended with their reprojected history,
+// clamped to the current neighborhood, and the lighting pass adds the result at full resolution.
+class ScreenSpaceReflections
+{
+public:
+    ScreenSpaceReflectionSettings Settings;
+
+    ScreenSpaceReflections()
+        : hiZVariants("../shaders/fullscreen.vs", "../shaders/hiz.fs", [](Shader& shader) {
+            shader.Use();
+            shader.setInt("source", 0);
+        }),
+        traceVariants("../shaders/fullscreen.vs", "../shaders/ssr_trace.fs", [](Shader& shader) {
+            shader.Use();
+            shader.setInt("gNormalMap", 0);
+            shader.setInt("gDepthMap", 1);
+            shader.setInt("hiZ", 2);
+            // unit 3 holds the shadow the lighting pass samples next, the result's unit is free until the resolve
+            shader.setInt("previousColor", SCREEN_SPACE_REFLECTION_TEXTURE_UNIT);
+        }),
+        resolveVariants("../shaders/fullscreen.vs", "../shaders/ssr_resolve.fs", [](Shader& shader) {
+            shader.Use();
+            shader.setInt("current", 0);
+            shader.setInt("history", 1);
+            shader.setInt("gDepthMap", 2);
+        })
+    {
+    }
+
+    void Create(int width, int height, const ScreenSpaceReflectionSettings& settings)
+    {
+        this->width = width;
+        this->height = height;
+        this->Settings = settings;
+        this->hiZVariants.Submit(ShaderKey().Define("COPY_DEPTH"));
+        this->hiZVariants.Submit();
+        this->traceVariants.Submit();
+        this->resolveVariants.Submit();
+        glGenVertexArrays(1, &this->emptyVertexArray);
+        glGenFramebuffers(1, &this->framebuffer);
+
+        this->levels = 1;
+        while ((std::max(width, height) >> this->levels) > 0)
+            this->levels++;
+        glGenTextures(1, &this->hiZTexture);
+        GLState& state = GLState::Instance();
+        state.BindTexture(0, GL_TEXTURE_2D, this->hiZTexture);
+        for (int level = 0; level < this->levels; level++)
+            glTexImage2D(GL_TEXTURE_2D, level, GL_R32F, std::max(width >> level, 1), std::max(height >> level, 1), 0, GL_RED, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, this->levels - 1);
+        this->createTargets();
+    }
+
+    void Destroy()
+    {
+        GLState& state = GLState::Instance();
+        this->destroyTargets();
+        state.DeleteTextures(1, &this->hiZTexture);
+        state.DeleteFramebuffers(1, &this->framebuffer);
+        state.DeleteVertexArrays(1, &this->emptyVertexArray);
+    }
+
+    // The traced targets follow the divisor, their history starts over
+    void SetDivisor(int divisor)
+    {
+        if (divisor == this->Settings.divisor)
+            return;
+        this->Settings.divisor = divisor;
+        this->destroyTargets();
+        this->createTargets();
+    }
+
+    // Builds the pyramid from the finished geometry pass, traces and resolves, and binds the result for the
+    // lighting pass. gBuffer's color target must still hold the last frame; viewProjection is this frame's
+    void Trace(const GBuffer& gBuffer, const glm::mat4& viewProjection)
+    {
+        GLState& state = GLState::Instance();
+        glm::mat4 inverseViewProjection = glm::inverse(viewProjection);
+        glm::mat4 reprojection = this->previousViewProjection * inverseViewProjection;
+        state.BindFramebuffer(this->framebuffer);
+        state.Disable(GL_BLEND);
+        state.BindVertexArray(this->emptyVertexArray);
+        state.BindSampler(0, 0);
+        this->buildHiZ(gBuffer);
+
+        int traceWidth = this->TraceWidth(), traceHeight = this->TraceHeight();
+        state.Viewport(0, 0, traceWidth, traceHeight);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->traceTexture, 0);
+        Shader& trace = this->traceVariants.Get();
+        trace.Use();
+        trace.setMat4("inverseViewProjection", inverseViewProjection);
+        trace.setMat4("reprojection", reprojection);
+        trace.setInt("divisor", this->Settings.divisor);
+        trace.setInt("frame", this->frame);
+        trace.setInt("maxSteps", this->Settings.maxSteps);
+        trace.setInt("hiZLevels", this->levels);
+        trace.setFloat("thickness", this->Settings.thickness);
+        trace.setFloat("maxDistance", this->Settings.maxDistance);
+        state.BindTexture(0, GL_TEXTURE_2D, gBuffer.NormalTexture);
+        state.BindTexture(1, GL_TEXTURE_2D, gBuffer.DepthTexture);
+        state.BindTexture(2, GL_TEXTURE_2D, this->hiZTexture);
+        state.BindTexture(SCREEN_SPACE_REFLECTION_TEXTURE_UNIT, GL_TEXTURE_2D, gBuffer.ColorTexture);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        // into the history target the last frame didn't write
+        int current = this->frame & 1;
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->historyTextures[current], 0);
+        Shader& resolve = this->resolveVariants.Get();
+        resolve.Use();
+        resolve.setMat4("reprojection", reprojection);
+        resolve.setInt("divisor", this->Settings.divisor);
+        resolve.setFloat("historyWeight", this->Settings.historyWeight);
+        state.BindTexture(0, GL_TEXTURE_2D, this->traceTexture);
+        state.BindTexture(1, GL_TEXTURE_2D, this->historyTextures[1 - current]);
+        state.BindTexture(2, GL_TEXTURE_2D, gBuffer.DepthTexture);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+
+        state.BindTexture(SCREEN_SPACE_REFLECTION_TEXTURE_UNIT, GL_TEXTURE_2D, this->historyTextures[current]);
+        state.Viewport(0, 0, this->width, this->height);
+        state.Enable(GL_BLEND);
+        this->previousViewProjection = viewProjection;
+        this->frame++;
+    }
+
+    int TraceWidth() const
+    {
+        return (this->width + this->Settings.divisor - 1) / this->Settings.divisor;
+    }
+
+    int TraceHeight() const
+    {
+        return (this->height + this->Settings.divisor - 1) / this->Settings.divisor;
+    }
+
+    int Levels() const
+    {
+        return this->levels;
+    }
+
+    // The pyramid, the trace and both history targets
+    size_t MemoryBytes() const
+    {
+        size_t bytes = 0;
+        for (int level = 0; level < this->levels; level++)
+            bytes += (size_t)std::max(this->width >> level, 1) * std::max(this->height >> level, 1) * 4;
+        return bytes + (size_t)this->TraceWidth() * this->TraceHeight() * 8 * 3;
+    }
+
+private:
+    ShaderVariants hiZVariants, traceVariants, resolveVariants;
+    GLuint hiZTexture = 0;
+    GLuint traceTexture = 0;            // RGBA16F, premultiplied by coverage
+    GLuint historyTextures[2] = {};     // resolved, written on alternate frames
+    GLuint framebuffer = 0;
+    GLuint emptyVertexArray = 0;
+    int width = 0, height = 0;
+    int levels = 0;
+    int frame = 0;
+    glm::mat4 previousViewProjection = glm::mat4(1.0f);
+
+    // Level 0 copied from the depth texture, then each level from the one above; the level read is the only
+    // one the sampler sees meanwhile, so the pass never samples what it renders to
+    void buildHiZ(const GBuffer& gBuffer)
+    {
+        GLState& state = GLState::Instance();
+        Shader& copy = this->hiZVariants.Get(ShaderKey().Define("COPY_DEPTH"));
+        Shader& reduce = this->hiZVariants.Get();
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->hiZTexture, 0);
+        state.Viewport(0, 0, this->width, this->height);
+        copy.Use();
+        state.BindTexture(0, GL_TEXTURE_2D, gBuffer.DepthTexture);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        reduce.Use();
+        state.BindTexture(0, GL_TEXTURE_2D, this->hiZTexture);
+        for (int level = 1; level < this->levels; level++)
+        {
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, level - 1);
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, level - 1);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->hiZTexture, level);
+            state.Viewport(0, 0, std::max(this->width >> level, 1), std::max(this->height >> level, 1));
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, this->levels - 1);
+    }
+
+    void createTargets()
+    {
+        this->traceTexture = this->createTarget();
+        this->historyTextures[0] = this->createTarget();
+        this->historyTextures[1] = this->createTarget();
+        // nothing to blend with yet
+        const GLfloat empty[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        GLState& state = GLState::Instance();
+        state.BindFramebuffer(this->framebuffer);
+        for (GLuint texture : this->historyTextures)
+        {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texture, 0);
+            glClearBufferfv(GL_COLOR, 0, empty);
+        }
+        state.BindFramebuffer(0);
+    }
+
+    void destroyTargets()
+    {
+        GLuint textures[] = { this->traceTexture, this->historyTextures[0], this->historyTextures[1] };
+        GLState::Instance().DeleteTextures(3, textures);
+    }
+
+    // Bilinear, the resolve reads its history and the lighting pass the result between texels
+    GLuint createTarget()
+    {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        GLState::Instance().BindTexture(0, GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, this->TraceWidth(), this->TraceHeight(), 0, GL_RGBA, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return texture;
+    }
+};
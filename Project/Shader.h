@@ -5,153 +5,486 @@
 #include <fstream>
 #include <sstream>
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <map>
 
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include "GLState.h"
+#include "ProgramCache.h"
+
+// Reflected description of one active uniform, filled once after the program is linked
+struct UniformInfo
+{
+    std::string name;
+    GLint location;
+    GLenum type;
+};
+
+// Typed handle to a uniform location. Resolve it once with Shader::uniform<T>() and reuse it every frame
+template <typename T>
+struct Uniform
+{
+    GLint location = -1;
+};
+
+// Per-frame uniform counters, shared by all programs
+struct UniformStats
+{
+    unsigned int handleSets = 0;    // set through a cached handle: no string compare, no driver lookup
+    unsigned int nameSets = 0;      // set by name: table search, still no driver lookup
+};
+
 class Shader
 {
 public:
     GLuint Program;
-    // Constructor generates the shader on the fly
-    Shader(const GLchar* vertexPath, const GLchar* fragmentPath)
+    // Constructor submits the program and returns without waiting for the driver: sources are compiled and
+    // linked (or the cached binary is handed over) but no status is queried until the program is first needed,
+    // so several programs can build in parallel with other startup work.
+    // defines ("#define NAME VALUE" lines) go right after #version
+    Shader(const GLchar* vertexPath, const GLchar* fragmentPath, const std::string& defines = std::string())
     {
         // 1. Retrieve the vertex/fragment source code from filePath
-        std::string vertexCode;
-        std::string fragmentCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        // ensures ifstream objects can throw exceptions:
-        vShaderFile.exceptions(std::ifstream::badbit);
-        fShaderFile.exceptions(std::ifstream::badbit);
-        try
-        {
-            // Open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // Read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // Convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
-        }
-        catch (std::ifstream::failure e)
-        {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
-        }
-        const GLchar* vShaderCode = vertexCode.c_str();
-        const GLchar* fShaderCode = fragmentCode.c_str();
-        // 2. Compile shaders
-        GLuint vertex, fragment;
-        GLint success;
-        GLchar infoLog[512];
-        // Vertex Shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        // Print compile errors if any
-        glGetShaderiv(vertex, GL_COMPILE_STATUS, &success);
-        if (!success)
+        this->vertexCode = injectDefines(loadSource(vertexPath), defines);
+        this->fragmentCode = injectDefines(loadSource(fragmentPath), defines);
+        this->submit();
+    }
+    // Same with a geometry stage between the two
+    Shader(const GLchar* vertexPath, const GLchar* fragmentPath, const GLchar* geometryPath, const std::string& defines = std::string())
+    {
+        this->vertexCode = injectDefines(loadSource(vertexPath), defines);
+        this->fragmentCode = injectDefines(loadSource(fragmentPath), defines);
+        this->geometryCode = injectDefines(loadSource(geometryPath), defines);
+        this->submit();
+    }
+    // True once the driver has finished the program, so Resolve() will not block. Without
+    // KHR_parallel_shader_compile there is no way to ask, and the program always reports ready
+    bool Ready() const
+    {
+        if (this->resolved || !glExtensions().parallelShaderCompile)
+            return true;
+        GLint done = GL_FALSE;
+        glGetProgramiv(this->Program, GL_COMPLETION_STATUS_KHR, &done);
+        return done == GL_TRUE;
+    }
+    // Waits for the program, reports errors and reflects its uniforms. Called implicitly on first use
+    void Resolve()
+    {
+        if (this->resolved)
+            return;
+        this->resolved = true;
+        ProgramCache& cache = ProgramCache::Instance();
+        std::chrono::steady_clock::time_point waitStart = std::chrono::steady_clock::now();
+        if (this->fromBinary && cache.Accepted(this->Program))
         {
-            glGetShaderInfoLog(vertex, 512, NULL, infoLog);
-            std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
+            cache.Stats.hits++;
+            cache.Stats.loadMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - waitStart).count();
         }
-        // Fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        // Print compile errors if any
-        glGetShaderiv(fragment, GL_COMPILE_STATUS, &success);
-        if (!success)
+        else
         {
-            glGetShaderInfoLog(fragment, 512, NULL, infoLog);
-            std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+            // a rejected binary falls back to the sources, now synchronously
+            if (this->fromBinary)
+            {
+                glDeleteProgram(this->Program);
+                this->Program = glCreateProgram();
+                this->compile();
+            }
+            cache.Stats.misses++;
+            // 3. Check for errors only now, the status query is what blocks on the driver
+            GLint success;
+            GLchar infoLog[512];
+            glGetProgramiv(this->Program, GL_LINK_STATUS, &success);
+            if (!success)
+            {
+                // Print compile errors if any
+                glGetShaderiv(this->vertex, GL_COMPILE_STATUS, &success);
+                if (!success)
+                {
+                    glGetShaderInfoLog(this->vertex, 512, NULL, infoLog);
+                    std::cout << "ERROR::SHADER::VERTEX::COMPILATION_FAILED\n" << infoLog << std::endl;
+                }
+                glGetShaderiv(this->fragment, GL_COMPILE_STATUS, &success);
+                if (!success)
+                {
+                    glGetShaderInfoLog(this->fragment, 512, NULL, infoLog);
+                    std::cout << "ERROR::SHADER::FRAGMENT::COMPILATION_FAILED\n" << infoLog << std::endl;
+                }
+                if (this->geometry)
+                {
+                    glGetShaderiv(this->geometry, GL_COMPILE_STATUS, &success);
+                    if (!success)
+                    {
+                        glGetShaderInfoLog(this->geometry, 512, NULL, infoLog);
+                        std::cout << "ERROR::SHADER::GEOMETRY::COMPILATION_FAILED\n" << infoLog << std::endl;
+                    }
+                }
+                // Print linking errors if any
+                glGetProgramInfoLog(this->Program, 512, NULL, infoLog);
+                std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+            }
+            else
+                cache.Store(this->Program, this->cacheKey);
+            // Delete the shaders as they're linked into our program now and no longer necessery
+            glDeleteShader(this->vertex);
+            glDeleteShader(this->fragment);
+            if (this->geometry)
+                glDeleteShader(this->geometry);
+            this->vertex = this->fragment = this->geometry = 0;
+            cache.Stats.compileMilliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - waitStart).count();
         }
-        // Shader Program
-        this->Program = glCreateProgram();
-        glAttachShader(this->Program, vertex);
-        glAttachShader(this->Program, fragment);
-        glLinkProgram(this->Program);
-        // Print linking errors if any
-        glGetProgramiv(this->Program, GL_LINK_STATUS, &success);
-        if (!success)
+        this->vertexCode.clear();
+        this->fragmentCode.clear();
+        this->geometryCode.clear();
+        this->reflectUniforms();
+    }
+    // Uses the current shader, skipped when it is already bound
+    void Use()
+    {
+        if (!this->resolved)
+            this->Resolve();
+        GLState::Instance().UseProgram(this->Program);
+    }
+    // uniform reflection
+    // ------------------------------------------------------------------------
+    // Resolves a typed handle from the reflected table. Call once after linking, not per frame
+    template <typename T>
+    Uniform<T> uniform(const std::string& name)
+    {
+        this->Resolve();
+        Uniform<T> handle;
+        const UniformInfo* info = this->find(name);
+        if (info)
         {
-            glGetProgramInfoLog(this->Program, 512, NULL, infoLog);
-            std::cout << "ERROR::SHADER::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+            if (!typeMatches(info->type, (T*)nullptr))
+                std::cout << "WARNING::SHADER::UNIFORM_TYPE_MISMATCH " << name << std::endl;
+            handle.location = info->location;
         }
-        // Delete the shaders as they're linked into our program now and no longer necessery
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
-
+        return handle;
     }
-    // Uses the current shader
-    void Use()
+    // Programs declaring a uniform block with this name get it bound to the binding point when linked
+    static void registerUniformBlock(const std::string& name, GLuint binding)
+    {
+        uniformBlockBindings()[name] = binding;
+    }
+    // Programs declaring a sampler with this name get it pointed at the texture unit when linked
+    static void registerSampler(const std::string& name, GLuint unit)
+    {
+        samplerUnits()[name] = unit;
+    }
+    // Active uniforms of the program, sorted by name
+    const std::vector<UniformInfo>& uniforms()
+    {
+        this->Resolve();
+        return this->uniformTable;
+    }
+    static UniformStats& stats()
+    {
+        static UniformStats frameStats;
+        return frameStats;
+    }
+    static void resetStats()
+    {
+        stats() = UniformStats();
+    }
+    // handle uniform functions
+    // ------------------------------------------------------------------------
+    void set(Uniform<bool> u, bool value) const
+    {
+        stats().handleSets++;
+        glUniform1i(u.location, (int)value);
+    }
+    void set(Uniform<int> u, int value) const
+    {
+        stats().handleSets++;
+        glUniform1i(u.location, value);
+    }
+    void set(Uniform<float> u, float value) const
+    {
+        stats().handleSets++;
+        glUniform1f(u.location, value);
+    }
+    void set(Uniform<glm::vec2> u, const glm::vec2& value) const
+    {
+        stats().handleSets++;
+        glUniform2fv(u.location, 1, &value[0]);
+    }
+    void set(Uniform<glm::vec3> u, const glm::vec3& value) const
+    {
+        stats().handleSets++;
+        glUniform3fv(u.location, 1, &value[0]);
+    }
+    void set(Uniform<glm::vec4> u, const glm::vec4& value) const
     {
-        glUseProgram(this->Program);
+        stats().handleSets++;
+        glUniform4fv(u.location, 1, &value[0]);
+    }
+    void set(Uniform<glm::mat3> u, const glm::mat3& mat) const
+    {
+        stats().handleSets++;
+        glUniformMatrix3fv(u.location, 1, GL_FALSE, &mat[0][0]);
+    }
+    void set(Uniform<glm::mat4> u, const glm::mat4& mat) const
+    {
+        stats().handleSets++;
+        glUniformMatrix4fv(u.location, 1, GL_FALSE, &mat[0][0]);
     }
     // utility uniform functions
     // ------------------------------------------------------------------------
     void setBool(const std::string& name, bool value) const
     {
-        glUniform1i(glGetUniformLocation(Program, name.c_str()), (int)value);
+        glUniform1i(location(name), (int)value);
     }
     // ------------------------------------------------------------------------
     void setInt(const std::string& name, int value) const
     {
-        glUniform1i(glGetUniformLocation(Program, name.c_str()), value);
+        glUniform1i(location(name), value);
     }
     // ------------------------------------------------------------------------
     void setFloat(const std::string& name, float value) const
     {
-        glUniform1f(glGetUniformLocation(Program, name.c_str()), value);
+        glUniform1f(location(name), value);
     }
     // ------------------------------------------------------------------------
     void setVec2(const std::string& name, const glm::vec2& value) const
     {
-        glUniform2fv(glGetUniformLocation(Program, name.c_str()), 1, &value[0]);
+        glUniform2fv(location(name), 1, &value[0]);
     }
     void setVec2(const std::string& name, float x, float y) const
     {
-        glUniform2f(glGetUniformLocation(Program, name.c_str()), x, y);
+        glUniform2f(location(name), x, y);
     }
     // ------------------------------------------------------------------------
     void setVec3(const std::string& name, const glm::vec3& value) const
     {
-        glUniform3fv(glGetUniformLocation(Program, name.c_str()), 1, &value[0]);
+        glUniform3fv(location(name), 1, &value[0]);
     }
     void setVec3(const std::string& name, float x, float y, float z) const
     {
-        glUniform3f(glGetUniformLocation(Program, name.c_str()), x, y, z);
+        glUniform3f(location(name), x, y, z);
     }
     // ------------------------------------------------------------------------
     void setVec4(const std::string& name, const glm::vec4& value) const
     {
-        glUniform4fv(glGetUniformLocation(Program, name.c_str()), 1, &value[0]);
+        glUniform4fv(location(name), 1, &value[0]);
     }
     void setVec4(const std::string& name, float x, float y, float z, float w)
     {
-        glUniform4f(glGetUniformLocation(Program, name.c_str()), x, y, z, w);
+        glUniform4f(location(name), x, y, z, w);
     }
     // ------------------------------------------------------------------------
     void setMat2(const std::string& name, const glm::mat2& mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(Program, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix2fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat3(const std::string& name, const glm::mat3& mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(Program, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix3fv(location(name), 1, GL_FALSE, &mat[0][0]);
     }
     // ------------------------------------------------------------------------
     void setMat4(const std::string& name, const glm::mat4& mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(Program, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        glUniformMatrix4fv(location(name), 1, GL_FALSE, &mat[0][0]);
+    }
+
+private:
+    std::vector<UniformInfo> uniformTable;
+    // build state between submit and Resolve()
+    std::string vertexCode, fragmentCode, geometryCode;
+    std::uint64_t cacheKey = 0;
+    GLuint vertex = 0, fragment = 0, geometry = 0;
+    bool fromBinary = false;
+    bool resolved = false;
+
+    // 2. Link from the program binary cache when the driver still accepts it, otherwise compile
+    void submit()
+    {
+        ProgramCache& cache = ProgramCache::Instance();
+        this->cacheKey = cache.Key(this->vertexCode, this->fragmentCode, this->geometryCode);
+        std::chrono::steady_clock::time_point submitStart = std::chrono::steady_clock::now();
+        this->Program = glCreateProgram();
+        this->fromBinary = cache.Load(this->Program, this->cacheKey);
+        if (!this->fromBinary)
+            this->compile();
+        double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - submitStart).count();
+        (this->fromBinary ? cache.Stats.loadMilliseconds : cache.Stats.compileMilliseconds) += elapsed;
+    }
+
+    // Issues compile and link without asking for their status
+    void compile()
+    {
+        const GLchar* vShaderCode = this->vertexCode.c_str();
+        const GLchar* fShaderCode = this->fragmentCode.c_str();
+        // Vertex Shader
+        this->vertex = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(this->vertex, 1, &vShaderCode, NULL);
+        glCompileShader(this->vertex);
+        // Fragment Shader
+        this->fragment = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(this->fragment, 1, &fShaderCode, NULL);
+        glCompileShader(this->fragment);
+        // Geometry Shader, when there is one
+        if (!this->geometryCode.empty())
+        {
+            const GLchar* gShaderCode = this->geometryCode.c_str();
+            this->geometry = glCreateShader(GL_GEOMETRY_SHADER);
+            glShaderSource(this->geometry, 1, &gShaderCode, NULL);
+            glCompileShader(this->geometry);
+        }
+        // Shader Program
+        glAttachShader(this->Program, this->vertex);
+        glAttachShader(this->Program, this->fragment);
+        if (this->geometry)
+            glAttachShader(this->Program, this->geometry);
+        ProgramCache::Instance().PrepareLink(this->Program);
+        glLinkProgram(this->Program);
+    }
+
+    static std::map<std::string, GLuint>& uniformBlockBindings()
+    {
+        static std::map<std::string, GLuint> bindings;
+        return bindings;
+    }
+
+    static std::map<std::string, GLuint>& samplerUnits()
+    {
+        static std::map<std::string, GLuint> units;
+        return units;
+    }
+
+    // Reads a shader file and expands its #include "file" lines, resolved next to the including file
+    static std::string loadSource(const std::string& path)
+    {
+        std::string code;
+        std::ifstream shaderFile;
+        // ensures ifstream objects can throw exceptions:
+        shaderFile.exceptions(std::ifstream::badbit);
+        try
+        {
+            shaderFile.open(path);
+            if (!shaderFile.is_open())
+                throw std::ifstream::failure(path);
+            std::stringstream shaderStream;
+            shaderStream << shaderFile.rdbuf();
+            shaderFile.close();
+            code = shaderStream.str();
+        }
+        catch (std::ifstream::failure e)
+        {
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ " << path << std::endl;
+            return code;
+        }
+        std::string directory = path.substr(0, path.find_last_of("/\\") + 1);
+        std::string expanded;
+        std::istringstream lines(code);
+        std::string line;
+        while (std::getline(lines, line))
+        {
+            std::string::size_type directive = line.find("#include");
+            std::string::size_type open = line.find('"');
+            std::string::size_type close = line.rfind('"');
+            if (directive != std::string::npos && line.find_first_not_of(" \t") == directive && open != close)
+                expanded += loadSource(directory + line.substr(open + 1, close - open - 1));
+            else
+                expanded += line + "\n";
+        }
+        return expanded;
+    }
+
+    // #version must stay the first statement, so the defines follow its line
+    static std::string injectDefines(const std::string& code, const std::string& defines)
+    {
+        if (defines.empty())
+            return code;
+        std::string::size_type version = code.find("#version");
+        std::string::size_type lineEnd = version == std::string::npos ? std::string::npos : code.find('\n', version);
+        if (lineEnd == std::string::npos)
+            return defines + code;
+        return code.substr(0, lineEnd + 1) + defines + code.substr(lineEnd + 1);
+    }
+
+    // Enumerates the active uniforms and blocks once, so no glGetUniformLocation is needed afterwards
+    void reflectUniforms()
+    {
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(this->Program, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(this->Program, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::vector<GLchar> nameBuffer(maxLength + 1);
+        for (GLint i = 0; i < count; i++)
+        {
+            GLint size = 0;
+            GLenum type = GL_NONE;
+            glGetActiveUniform(this->Program, (GLuint)i, (GLsizei)nameBuffer.size(), NULL, &size, &type, nameBuffer.data());
+            std::string name(nameBuffer.data());
+            GLint location = glGetUniformLocation(this->Program, name.c_str());
+            if (location < 0)
+                continue;       //uniform block members have no location
+            //arrays are reported as "name[0]": keep the bare name and one entry per element
+            std::string::size_type bracket = name.rfind("[0]");
+            if (bracket != std::string::npos && bracket + 3 == name.size())
+            {
+                std::string base = name.substr(0, bracket);
+                this->uniformTable.push_back({ base, location, type });
+                for (GLint element = 0; element < size; element++)
+                {
+                    std::string elementName = base + "[" + std::to_string(element) + "]";
+                    this->uniformTable.push_back({ elementName, glGetUniformLocation(this->Program, elementName.c_str()), type });
+                }
+            }
+            else
+                this->uniformTable.push_back({ name, location, type });
+        }
+        std::sort(this->uniformTable.begin(), this->uniformTable.end(),
+            [](const UniformInfo& a, const UniformInfo& b) { return a.name < b.name; });
+
+        GLint blockCount = 0;
+        glGetProgramiv(this->Program, GL_ACTIVE_UNIFORM_BLOCKS, &blockCount);
+        for (GLint i = 0; i < blockCount; i++)
+        {
+            GLchar blockName[256];
+            glGetActiveUniformBlockName(this->Program, (GLuint)i, sizeof(blockName), NULL, blockName);
+            std::map<std::string, GLuint>::const_iterator binding = uniformBlockBindings().find(blockName);
+            if (binding != uniformBlockBindings().end())
+                glUniformBlockBinding(this->Program, (GLuint)i, binding->second);
+        }
+        for (const std::pair<const std::string, GLuint>& sampler : samplerUnits())
+        {
+            const UniformInfo* info = this->find(sampler.first);
+            if (!info)
+                continue;
+            GLState::Instance().UseProgram(this->Program);
+            glUniform1i(info->location, (GLint)sampler.second);
+        }
     }
+
+    const UniformInfo* find(const std::string& name) const
+    {
+        std::vector<UniformInfo>::const_iterator it = std::lower_bound(this->uniformTable.begin(), this->uniformTable.end(), name,
+            [](const UniformInfo& info, const std::string& key) { return info.name < key; });
+        if (it == this->uniformTable.end() || it->name != name)
+            return nullptr;
+        return &*it;
+    }
+
+    GLint location(const std::string& name) const
+    {
+        stats().nameSets++;
+        const UniformInfo* info = this->find(name);
+        return info ? info->location : -1;
+    }
+
+    static bool typeMatches(GLenum type, const bool*) { return type == GL_BOOL; }
+    static bool typeMatches(GLenum type, const int*) { return type != GL_FLOAT && type != GL_FLOAT_VEC2 && type != GL_FLOAT_VEC3 && type != GL_FLOAT_VEC4; }
+    static bool typeMatches(GLenum type, const float*) { return type == GL_FLOAT; }
+    static bool typeMatches(GLenum type, const glm::vec2*) { return type == GL_FLOAT_VEC2; }
+    static bool typeMatches(GLenum type, const glm::vec3*) { return type == GL_FLOAT_VEC3; }
+    static bool typeMatches(GLenum type, const glm::vec4*) { return type == GL_FLOAT_VEC4; }
+    static bool typeMatches(GLenum type, const glm::mat3*) { return type == GL_FLOAT_MAT3; }
+    static bool typeMatches(GLenum type, const glm::mat4*) { return type == GL_FLOAT_MAT4; }
 };
 
 #endif
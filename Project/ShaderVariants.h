@@ -0,0 +1,113 @@
+#pragma once
+
+// Std. Includes
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <functional>
+#include <utility>
+
+#include "Shader.h"
+
+// The set of #define keys selecting one permutation of a shader family. The same keys give the same
+// variant whatever order they were defined in
+class ShaderKey
+{
+public:
+    ShaderKey& Define(const std::string& name, int value = 1)
+    {
+        std::vector<std::pair<std::string, int> >::iterator it = this->defines.begin();
+        while (it != this->defines.end() && it->first < name)
+            ++it;
+        if (it != this->defines.end() && it->first == name)
+            it->second = value;
+        else
+            this->defines.insert(it, std::make_pair(name, value));
+        return *this;
+    }
+
+    // "#define NAME VALUE" lines, sorted by name
+    std::string Defines() const
+    {
+        std::string text;
+        for (const std::pair<std::string, int>& define : this->defines)
+            text += "#define " + define.first + " " + std::to_string(define.second) + "\n";
+        return text;
+    }
+
+private:
+    std::vector<std::pair<std::string, int> > defines;
+};
+
+// One vertex/fragment source pair compiled into specialised programs, one per key. A variant is built the
+// first time it is requested and kept for the lifetime of the family; setup runs once on every variant,
+// when it is first handed out by Get(), to set what the draw code doesn't touch per frame (sampler units,
+// constant material values). Submit() starts a build early without waiting for it.
+class ShaderVariants
+{
+public:
+    ShaderVariants(const std::string& vertexPath, const std::string& fragmentPath, std::function<void(Shader&)> setup = nullptr)
+        : vertexPath(vertexPath), fragmentPath(fragmentPath), setup(setup)
+    {
+    }
+
+    // Starts building the variant if it doesn't exist yet, without waiting for the driver
+    void Submit(const ShaderKey& key = ShaderKey())
+    {
+        this->variant(key.Defines());
+    }
+
+    // Returns the program for the key, compiling (or loading from the program cache) on first use.
+    // Resolve uniform handles on the returned program, they differ between variants
+    Shader& Get(const ShaderKey& key = ShaderKey())
+    {
+        Variant& variant = this->variant(key.Defines());
+        if (!variant.ready)
+        {
+            variant.shader->Resolve();
+            if (this->setup)
+                this->setup(*variant.shader);
+            variant.ready = true;
+        }
+        return *variant.shader;
+    }
+
+    size_t Count() const
+    {
+        return this->variants.size();
+    }
+
+    // Variants built by every family since startup
+    static unsigned int Built()
+    {
+        return built();
+    }
+
+private:
+    std::string vertexPath, fragmentPath;
+    std::function<void(Shader&)> setup;
+    struct Variant
+    {
+        std::unique_ptr<Shader> shader;
+        bool ready = false;
+    };
+    std::map<std::string, Variant> variants;
+
+    Variant& variant(const std::string& defines)
+    {
+        Variant& variant = this->variants[defines];
+        if (!variant.shader)
+        {
+            variant.shader.reset(new Shader(this->vertexPath.c_str(), this->fragmentPath.c_str(), defines));
+            built()++;
+        }
+        return variant;
+    }
+
+    static unsigned int& built()
+    {
+        static unsigned int count = 0;
+        return count;
+    }
+};
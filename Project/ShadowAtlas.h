@@ -0,0 +1,395 @@
+#pragma once
+
+// Std. Includes
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <cmath>
+
+// GL Includes
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "GLState.h"
+#include "LightUniforms.h"
+
+// Texture unit the lighting shaders sample the atlas at
+const GLuint SHADOW_ATLAS_TEXTURE_UNIT = 4;
+
+// Square power of two tiles carved out of a square power of two area, a quadtree buddy allocator: a tile is
+// taken from the free list of its size, or split off a larger free tile, and merges back with its three
+// siblings once they are all free again
+class AtlasAllocator
+{
+public:
+    struct Tile
+    {
+        int x = 0, y = 0, size = 0;
+    };
+
+    void Reset(int size, int minTile)
+    {
+        this->size = size;
+        int levels = 1;
+        for (int tile = size; tile > minTile; tile /= 2)
+            levels++;
+        this->free.assign(levels, std::vector<glm::ivec2>());
+        this->free[0].push_back(glm::ivec2(0));
+        this->UsedTexels = 0;
+    }
+
+    bool Allocate(int tileSize, Tile& tile)
+    {
+        int level = this->levelOf(tileSize);
+        glm::ivec2 position;
+        if (level >= (int)this->free.size() || !this->take(level, position))
+            return false;
+        tile.x = position.x;
+        tile.y = position.y;
+        tile.size = tileSize;
+        this->UsedTexels += (size_t)tileSize * tileSize;
+        return true;
+    }
+
+    void Free(const Tile& tile)
+    {
+        this->release(this->levelOf(tile.size), glm::ivec2(tile.x, tile.y));
+        this->UsedTexels -= (size_t)tile.size * tile.size;
+    }
+
+    size_t UsedTexels = 0;
+
+private:
+    int size = 0;
+    std::vector<std::vector<glm::ivec2> > free;     // free tiles of each level, level 0 is the whole area
+
+    int levelOf(int tileSize) const
+    {
+        int level = 0;
+        for (int tile = this->size; tile > tileSize; tile /= 2)
+            level++;
+        return level;
+    }
+
+    bool take(int level, glm::ivec2& position)
+    {
+        if (level < 0)
+            return false;
+        std::vector<glm::ivec2>& list = this->free[level];
+        if (!list.empty())
+        {
+            position = list.back();
+            list.pop_back();
+            return true;
+        }
+        glm::ivec2 parent;
+        if (!this->take(level - 1, parent))
+            return false;
+        int half = this->size >> level;
+        list.push_back(parent + glm::ivec2(half, half));
+        list.push_back(parent + glm::ivec2(0, half));
+        list.push_back(parent + glm::ivec2(half, 0));
+        position = parent;
+        return true;
+    }
+
+    void release(int level, const glm::ivec2& position)
+    {
+        std::vector<glm::ivec2>& list = this->free[level];
+        if (level > 0)
+        {
+            int tile = this->size >> level;
+            glm::ivec2 parent = position / (2 * tile) * (2 * tile);
+            std::vector<std::vector<glm::ivec2>::iterator> siblings;
+            for (std::vector<glm::ivec2>::iterator it = list.begin(); it != list.end(); ++it)
+                if (*it / (2 * tile) * (2 * tile) == parent)
+                    siblings.push_back(it);
+            if (siblings.size() == 3)
+            {
+                // erase from the back so the earlier iterators stay valid
+                for (int i = 2; i >= 0; i--)
+                    list.erase(siblings[i]);
+                this->release(level - 1, parent);
+                return;
+            }
+        }
+        list.push_back(position);
+    }
+};
+
+// Sphere against the six planes of the clip space of viewProjection
+inline bool sphereInFrustum(const glm::mat4& viewProjection, const glm::vec3& center, float radius)
+{
+    glm::vec4 rows[4];
+    for (int row = 0; row < 4; row++)
+        rows[row] = glm::vec4(viewProjection[0][row], viewProjection[1][row], viewProjection[2][row], viewProjection[3][row]);
+    for (int plane = 0; plane < 6; plane++)
+    {
+        glm::vec4 p = plane % 2 == 0 ? rows[3] + rows[plane / 2] : rows[3] - rows[plane / 2];
+        if (glm::dot(glm::vec3(p), center) + p.w < -radius * glm::length(glm::vec3(p)))
+            return false;
+    }
+    return true;
+}
+
+struct ShadowAtlasSettings
+{
+    int size = 4096;        // of the whole depth texture, the memory budget of all spot shadows
+    int minTile = 128;
+    int maxTile = 1024;
+};
+
+// Counters of the last Update()
+struct ShadowAtlasStats
+{
+    unsigned int tiles = 0;         // one per light that got a tile
+    unsigned int redrawn = 0;       // tiles rendered this frame
+    unsigned int reused = 0;        // tiles kept from an earlier frame
+    unsigned int dropped = 0;       // shadow casting spot lights left without tiles, culled or out of room
+};
+
+// Shadows of the spot lights, all in one depth texture (point lights have their own, PointShadows.h). Every
+// shadow casting spot light gets a tile sized by how much of the screen its range covers, so near and large
+// lights get the texels and the whole set never outgrows the texture. Tiles stay with their light between frames; one
+// is only rendered again when it is new, the light moved, or a dynamic caster is inside the light's range.
+// The dirty tiles are drawn together in one pass: casters are instanced over the tiles and the vertex shader
+// moves each instance into its tile, clip distances cut it at the tile's edges (shaders/shadow_atlas.vs).
+class ShadowAtlas
+{
+public:
+    ShadowAtlasSettings Settings;
+    GLuint Texture = 0;
+    GLuint Framebuffer = 0;
+    ShadowAtlasStats Stats;
+
+    void Create(const ShadowAtlasSettings& settings)
+    {
+        this->Settings = settings;
+        this->allocator.Reset(settings.size, settings.minTile);
+        this->slots.clear();
+
+        glGenTextures(1, &this->Texture);
+        GLState& state = GLState::Instance();
+        state.BindTexture(0, GL_TEXTURE_2D, this->Texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, settings.size, settings.size, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        // only ever read through comparisons, each fetch filters 2x2 texels
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+        glGenFramebuffers(1, &this->Framebuffer);
+        state.BindFramebuffer(this->Framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, this->Texture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::SHADOW_ATLAS::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        state.BindFramebuffer(0);
+    }
+
+    void Destroy()
+    {
+        GLState& state = GLState::Instance();
+        state.DeleteFramebuffers(1, &this->Framebuffer);
+        state.DeleteTextures(1, &this->Texture);
+    }
+
+    // The static casters changed, every tile is redrawn next frame
+    void InvalidateAll()
+    {
+        for (Slot& slot : this->slots)
+            slot.drawn = false;
+    }
+
+    // Gives the frame's shadow casting spot lights their tiles and writes tiles into the light block and tile
+    // indices into the lights. blockIndices maps each light to its entry in uniforms.Lights (SetLights()), view and
+    // projection are the camera's, dynamicCasters the bounding spheres (center, radius) of moving casters
+    void Update(const std::vector<LocalLight>& lights, const std::vector<int>& blockIndices, const glm::mat4& view,
+        const glm::mat4& projection, int screenHeight, const std::vector<glm::vec4>& dynamicCasters, LightUniforms& uniforms)
+    {
+        this->Stats = ShadowAtlasStats();
+        this->dirtyTiles.clear();
+        this->dirtyRects.clear();
+        this->slots.resize(lights.size());
+
+        // requested tile size of every light, 0 for none
+        glm::mat4 viewProjection = projection * view;
+        glm::vec3 cameraPosition = glm::vec3(glm::inverse(view)[3]);
+        float tanHalfFovy = 1.0f / projection[1][1];
+        std::vector<int> requests(lights.size(), 0);
+        for (size_t i = 0; i < lights.size(); i++)
+        {
+            const LocalLight& light = lights[i];
+            if (light.type != LIGHT_SPOT || !light.enabled || !light.castsShadow || blockIndices[i] < 0)
+                continue;
+            if (!sphereInFrustum(viewProjection, light.position, light.range))
+            {
+                this->Stats.dropped++;
+                continue;
+            }
+            // screen height covered by the light's range, the whole screen once the camera is inside it
+            float distance = glm::length(light.position - cameraPosition);
+            float coverage = 1.0f;
+            if (distance > light.range)
+                coverage = std::min(light.range / (std::sqrt(distance * distance - light.range * light.range) * tanHalfFovy), 1.0f);
+            requests[i] = this->tileSize(coverage * screenHeight);
+        }
+
+        // give back tiles of lights that are gone or changed size; growing is immediate, shrinking waits for
+        // two sizes of difference so a light on the edge between sizes doesn't reallocate every frame
+        for (size_t i = 0; i < lights.size(); i++)
+        {
+            Slot& slot = this->slots[i];
+            if (!slot.allocated)
+                continue;
+            if (requests[i] == 0 || requests[i] > slot.size || requests[i] * 4 <= slot.size)
+                this->release(slot);
+        }
+
+        // then the lights without tiles, largest first; one that doesn't fit tries smaller tiles
+        std::vector<int> order;
+        for (size_t i = 0; i < lights.size(); i++)
+            if (requests[i] > 0 && !this->slots[i].allocated)
+                order.push_back((int)i);
+        std::sort(order.begin(), order.end(), [&](int a, int b) { return requests[a] > requests[b]; });
+        for (int i : order)
+        {
+            Slot& slot = this->slots[i];
+            for (int size = requests[i]; size >= this->Settings.minTile && !slot.allocated; size /= 2)
+                if (this->allocator.Allocate(size, slot.tile))
+                {
+                    slot.allocated = true;
+                    slot.size = size;
+                }
+            if (!slot.allocated)
+                this->Stats.dropped++;
+        }
+
+        // light matrices, and what has to be drawn again
+        int tileIndex = 0;
+        const float texel = 1.0f / this->Settings.size;
+        for (size_t i = 0; i < lights.size(); i++)
+        {
+            Slot& slot = this->slots[i];
+            if (!slot.allocated)
+                continue;
+            if (tileIndex == MAX_SHADOW_TILES)
+            {
+                this->release(slot);
+                this->Stats.dropped++;
+                continue;
+            }
+            const LocalLight& light = lights[i];
+            glm::mat4 matrix = lightMatrix(light);
+            bool dirty = !slot.drawn || matrix != slot.matrix;
+            for (const glm::vec4& caster : dynamicCasters)
+                dirty = dirty || glm::length(glm::vec3(caster) - light.position) < light.range + caster.w;
+
+            const AtlasAllocator::Tile& tile = slot.tile;
+            uniforms.Lights[blockIndices[i]].shadowTile = tileIndex;
+            uniforms.Data.shadowTiles[tileIndex].matrix = matrix;
+            uniforms.Data.shadowTiles[tileIndex].rect = glm::vec4(tile.x * texel, tile.y * texel, tile.size * texel, tile.size * texel);
+            if (dirty)
+            {
+                this->dirtyTiles.push_back(tileIndex);
+                this->dirtyRects.push_back(tile);
+            }
+            tileIndex++;
+            slot.matrix = matrix;
+            slot.drawn = true;
+            this->Stats.tiles++;
+            if (dirty)
+                this->Stats.redrawn++;
+            else
+                this->Stats.reused++;
+        }
+    }
+
+    // Indices into LightData::shadowTiles of the tiles to render this frame
+    const std::vector<int>& DirtyTiles() const
+    {
+        return this->dirtyTiles;
+    }
+
+    // Binds the atlas and clears the dirty tiles. Draw the casters with the atlas shader, instanced over
+    // DirtyTiles(), then call EndPass()
+    void BeginPass()
+    {
+        GLState& state = GLState::Instance();
+        state.BindFramebuffer(this->Framebuffer);
+        state.Viewport(0, 0, this->Settings.size, this->Settings.size);
+        state.Enable(GL_SCISSOR_TEST);
+        for (const AtlasAllocator::Tile& tile : this->dirtyRects)
+        {
+            glScissor(tile.x, tile.y, tile.size, tile.size);
+            glClear(GL_DEPTH_BUFFER_BIT);
+        }
+        state.Disable(GL_SCISSOR_TEST);
+        for (int plane = 0; plane < 4; plane++)
+            state.Enable(GL_CLIP_DISTANCE0 + plane);
+    }
+
+    void EndPass()
+    {
+        GLState& state = GLState::Instance();
+        for (int plane = 0; plane < 4; plane++)
+            state.Disable(GL_CLIP_DISTANCE0 + plane);
+    }
+
+    // Share of the atlas the tiles take
+    float Occupancy() const
+    {
+        return (float)this->allocator.UsedTexels / ((float)this->Settings.size * this->Settings.size);
+    }
+
+    size_t MemoryBytes() const
+    {
+        return (size_t)this->Settings.size * this->Settings.size * 4;
+    }
+
+private:
+    struct Slot
+    {
+        int size = 0;
+        bool allocated = false;
+        AtlasAllocator::Tile tile;
+        glm::mat4 matrix;
+        bool drawn = false;
+    };
+    AtlasAllocator allocator;
+    std::vector<Slot> slots;        // one per light, in the order Update() gets them
+    std::vector<int> dirtyTiles;
+    std::vector<AtlasAllocator::Tile> dirtyRects;
+
+    void release(Slot& slot)
+    {
+        if (slot.allocated)
+            this->allocator.Free(slot.tile);
+        slot.allocated = false;
+        slot.size = 0;
+        slot.drawn = false;
+    }
+
+    // Next power of two of the screen size, within the tile limits
+    int tileSize(float pixels) const
+    {
+        int size = this->Settings.minTile;
+        while (size < pixels && size < this->Settings.maxTile)
+            size *= 2;
+        return size;
+    }
+
+    // The spot light looks down its cone
+    static glm::mat4 lightMatrix(const LocalLight& light)
+    {
+        const float nearPlane = 0.05f;
+        glm::vec3 direction = glm::normalize(light.direction);
+        glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        float fovy = 2.0f * std::acos(glm::clamp(light.outerCutOff, 0.0f, 1.0f));
+        return glm::perspective(fovy, 1.0f, nearPlane, light.range) * glm::lookAt(light.position, light.position + direction, up);
+    }
+};
@@ -0,0 +1,237 @@
+#pragma once
+
+// Std. Includes
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+// GL Includes
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "GLExtensions.h"
+#include "GLState.h"
+#include "FrameUniforms.h"
+
+// How the directional shadow is split
+struct CascadeSettings
+{
+    int count = 3;                  // 1 .. MAX_SHADOW_CASCADES
+    int resolution = 1024;          // of every layer
+    float splitLambda = 0.75f;      // practical split scheme: 0 is uniform, 1 is logarithmic
+    float shadowDistance = 60.0f;   // view depth the last cascade ends at
+    float casterMargin = 30.0f;     // how far towards the light casters outside a cascade are still caught
+};
+
+// Cascaded shadow maps of the directional light. Every cascade is one layer of a depth texture array and
+// covers a slice of the view frustum; the whole array is rendered in one pass, the shadow geometry shader
+// sends each triangle to every layer. The light matrices are fitted to the bounding sphere of each slice, so
+// their size does not change while the camera turns, and snapped to whole texels so they don't shimmer
+// while it moves.
+// Casters are split into static and dynamic ones. Static casters go into a second array that is kept between
+// frames; a cascade's cached layer is redrawn only when its light matrix changes (the light moved, or the
+// camera moved the snapped cascade) or the static set was invalidated. Each frame the cache is copied into
+// the shadow array and only the dynamic casters are drawn on top.
+class ShadowCascades
+{
+public:
+    CascadeSettings Settings;
+    GLuint Texture = 0;
+    GLuint Framebuffer = 0;
+    GLuint StaticTexture = 0;
+    GLuint StaticFramebuffer = 0;
+    glm::mat4 Matrices[MAX_SHADOW_CASCADES];
+    float Splits[MAX_SHADOW_CASCADES] = {};     // far view depth of each cascade
+    unsigned int StaticRedraws = 0;             // cascade layers re-rendered from static casters since startup
+
+    void Create(const CascadeSettings& settings)
+    {
+        this->Settings = settings;
+        this->Settings.count = glm::clamp(settings.count, 1, MAX_SHADOW_CASCADES);
+        this->Texture = this->createDepthArray();
+        this->StaticTexture = this->createDepthArray();
+        this->Framebuffer = this->createFramebuffer(this->Texture);
+        this->StaticFramebuffer = this->createFramebuffer(this->StaticTexture);
+        glGenFramebuffers(2, this->layerFramebuffers);
+        // depth only: without a color buffer to draw or read they are incomplete on strict drivers
+        GLState& state = GLState::Instance();
+        for (GLuint framebuffer : this->layerFramebuffers)
+        {
+            state.BindFramebuffer(framebuffer);
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+        }
+        state.BindFramebuffer(0);
+        this->InvalidateStatic();
+    }
+
+    void Destroy()
+    {
+        GLState& state = GLState::Instance();
+        state.DeleteFramebuffers(1, &this->Framebuffer);
+        state.DeleteFramebuffers(1, &this->StaticFramebuffer);
+        state.DeleteFramebuffers(2, this->layerFramebuffers);
+        state.DeleteTextures(1, &this->Texture);
+        state.DeleteTextures(1, &this->StaticTexture);
+    }
+
+    // The static casters changed, every cached layer is redrawn next frame
+    void InvalidateStatic()
+    {
+        for (int cascade = 0; cascade < MAX_SHADOW_CASCADES; cascade++)
+            this->staticValid[cascade] = false;
+    }
+
+    // Bit per cascade whose cached static layer is out of date this frame, valid after Update()
+    unsigned int StaticDirtyMask() const
+    {
+        return this->dirtyMask;
+    }
+
+    // Clears the out of date cached layers and binds the cache for the static casters. Draw them with the
+    // shadow shader's cascadeMask set to StaticDirtyMask()
+    void BeginStaticPass()
+    {
+        GLState& state = GLState::Instance();
+        for (int cascade = 0; cascade < this->Settings.count; cascade++)
+        {
+            if (!(this->dirtyMask & (1u << cascade)))
+                continue;
+            state.BindFramebuffer(this->layerFramebuffers[0]);
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, this->StaticTexture, 0, cascade);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            this->staticMatrices[cascade] = this->Matrices[cascade];
+            this->staticValid[cascade] = true;
+            this->StaticRedraws++;
+        }
+        state.BindFramebuffer(this->StaticFramebuffer);
+    }
+
+    // Copies the cache into the shadow array and binds it for the dynamic casters, which are drawn without
+    // clearing. ARB_copy_image copies all layers at once, otherwise each layer is blitted
+    void BeginDynamicPass()
+    {
+        GLState& state = GLState::Instance();
+        const int size = this->Settings.resolution;
+        if (glExtensions().copyImage)
+            glExtensions().CopyImageSubData(this->StaticTexture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+                this->Texture, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, size, size, this->Settings.count);
+        else
+        {
+            state.BindFramebuffer(GL_READ_FRAMEBUFFER, this->layerFramebuffers[0]);
+            state.BindFramebuffer(GL_DRAW_FRAMEBUFFER, this->layerFramebuffers[1]);
+            for (int cascade = 0; cascade < this->Settings.count; cascade++)
+            {
+                glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, this->StaticTexture, 0, cascade);
+                glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, this->Texture, 0, cascade);
+                glBlitFramebuffer(0, 0, size, size, 0, 0, size, size, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+            }
+        }
+        state.BindFramebuffer(this->Framebuffer);
+    }
+
+    // Splits the view frustum and fits a light matrix to every slice. view and the perspective parameters are
+    // the camera's, lightDirection is the direction the light travels in
+    void Update(const glm::mat4& view, float fovy, float aspect, float nearPlane, const glm::vec3& lightDirection)
+    {
+        const int count = this->Settings.count;
+        const float farPlane = this->Settings.shadowDistance;
+        glm::mat4 inverseView = glm::inverse(view);
+        glm::vec3 up = std::abs(glm::normalize(lightDirection).y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), lightDirection, up);
+        float sliceNear = nearPlane;
+        for (int cascade = 0; cascade < count; cascade++)
+        {
+            // practical split scheme, a blend of logarithmic and uniform splits
+            float fraction = (float)(cascade + 1) / count;
+            float logSplit = nearPlane * std::pow(farPlane / nearPlane, fraction);
+            float uniformSplit = nearPlane + (farPlane - nearPlane) * fraction;
+            float sliceFar = this->Settings.splitLambda * logSplit + (1.0f - this->Settings.splitLambda) * uniformSplit;
+            this->Splits[cascade] = sliceFar;
+
+            // bounding sphere of the slice, in view space it lies on the view axis
+            float tanY = std::tan(0.5f * fovy), tanX = tanY * aspect;
+            float diagonal2 = tanX * tanX + tanY * tanY;
+            // the center depth that minimizes the radius, clamped to the slice
+            float centerDepth = glm::clamp(0.5f * (sliceNear + sliceFar) * (1.0f + diagonal2), sliceNear, sliceFar);
+            float radiusNear = std::sqrt(std::pow(centerDepth - sliceNear, 2.0f) + sliceNear * sliceNear * diagonal2);
+            float radiusFar = std::sqrt(std::pow(sliceFar - centerDepth, 2.0f) + sliceFar * sliceFar * diagonal2);
+            float radius = std::ceil(std::max(radiusNear, radiusFar) * 16.0f) / 16.0f;
+            glm::vec3 center = glm::vec3(inverseView * glm::vec4(0.0f, 0.0f, -centerDepth, 1.0f));
+
+            // snap the center to whole texels of the light's view
+            float texel = 2.0f * radius / this->Settings.resolution;
+            glm::vec3 lightCenter = glm::vec3(lightView * glm::vec4(center, 1.0f));
+            lightCenter.x = std::floor(lightCenter.x / texel) * texel;
+            lightCenter.y = std::floor(lightCenter.y / texel) * texel;
+            // and the depth range to a coarser step, widened by one step, so the static cache survives small moves
+            float depthStep = 0.25f * radius;
+            lightCenter.z = std::floor(lightCenter.z / depthStep) * depthStep;
+            glm::mat4 projection = glm::ortho(lightCenter.x - radius, lightCenter.x + radius, lightCenter.y - radius, lightCenter.y + radius,
+                -lightCenter.z - radius - depthStep - this->Settings.casterMargin, -lightCenter.z + radius + depthStep);
+            this->Matrices[cascade] = projection * lightView;
+            sliceNear = sliceFar;
+        }
+
+        this->dirtyMask = 0;
+        for (int cascade = 0; cascade < count; cascade++)
+            if (!this->staticValid[cascade] || this->Matrices[cascade] != this->staticMatrices[cascade])
+                this->dirtyMask |= 1u << cascade;
+    }
+
+    // Writes matrices, splits and count into the frame block
+    void Fill(FrameData& frame) const
+    {
+        for (int cascade = 0; cascade < MAX_SHADOW_CASCADES; cascade++)
+        {
+            frame.cascadeMatrices[cascade] = this->Matrices[cascade];
+            frame.cascadeSplits[cascade] = cascade < this->Settings.count ? this->Splits[cascade] : 0.0f;
+        }
+        frame.cascadeCount = this->Settings.count;
+    }
+
+    // Texture memory of all layers, shadow array and static cache, 24-bit depth is stored in 4 bytes
+    size_t MemoryBytes() const
+    {
+        return 2 * (size_t)this->Settings.resolution * this->Settings.resolution * this->Settings.count * 4;
+    }
+
+private:
+    GLuint layerFramebuffers[2] = {};       // single-layer attachments, for clears and blits
+    glm::mat4 staticMatrices[MAX_SHADOW_CASCADES];
+    bool staticValid[MAX_SHADOW_CASCADES] = {};
+    unsigned int dirtyMask = 0;
+
+    GLuint createDepthArray()
+    {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        GLState::Instance().BindTexture(0, GL_TEXTURE_2D_ARRAY, texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, this->Settings.resolution, this->Settings.resolution,
+            this->Settings.count, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        float borderColor[] = { 1.0, 1.0, 1.0, 1.0 };
+        glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+        return texture;
+    }
+
+    // Layered framebuffer over every layer of the array, for the geometry shader's gl_Layer
+    GLuint createFramebuffer(GLuint texture)
+    {
+        GLState& state = GLState::Instance();
+        GLuint framebuffer;
+        glGenFramebuffers(1, &framebuffer);
+        state.BindFramebuffer(framebuffer);
+        glFramebufferTexture(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, texture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::SHADOW_CASCADES::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        state.BindFramebuffer(0);
+        return framebuffer;
+    }
+};
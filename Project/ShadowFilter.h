@@ -0,0 +1,172 @@
+#pragma once
+
+// Std. Includes
+#include <iostream>
+#include <algorithm>
+#include <cmath>
+
+// GL Includes
+#include <glad/glad.h>
+
+#include "GLState.h"
+#include "Shader.h"
+#include "ShaderVariants.h"
+#include "ShadowCascades.h"
+
+// The filters the default shader's SHADOW_FILTER key selects, same numbers as in shaders/default.fs
+enum ShadowFilterMode
+{
+    SHADOW_FILTER_PCF = 0,          // manual depth comparisons on a grid
+    SHADOW_FILTER_HARDWARE = 1,     // the grid through a comparison sampler, 2x2 texels per tap
+    SHADOW_FILTER_POISSON = 2,      // rotated Poisson disk through the comparison sampler
+    SHADOW_FILTER_EVSM = 3,         // prefiltered exponential variance shadow map, one fetch
+    SHADOW_FILTER_MODES = 4
+};
+
+// Texture unit the lighting shaders sample the shadow at
+const GLuint SHADOW_TEXTURE_UNIT = 3;
+// Exponents of the depth warp, as in shaders/shadow_moments.glsl
+const float EVSM_POSITIVE = 40.0f;
+const float EVSM_NEGATIVE = 5.0f;
+
+inline const char* shadowFilterName(int mode)
+{
+    static const char* names[SHADOW_FILTER_MODES] = { "PCF", "hardware PCF", "Poisson", "EVSM" };
+    return names[mode];
+}
+
+// What the lighting pass samples for each shadow filter. The comparison modes read the cascade depth array
+// through a sampler object with GL_COMPARE_REF_TO_TEXTURE and linear filtering, so one fetch compares and
+// blends four texels. EVSM reads moments instead: each cascade is converted into warped depth moments at
+// half resolution and blurred by two separable passes, so the softness costs a few texels per shadow map
+// texel once per frame instead of more taps at every shaded pixel.
+class ShadowFilter
+{
+public:
+    int Mode = SHADOW_FILTER_HARDWARE;
+    int BlurRadius = 1;             // EVSM blur taps on each side, in moment texels
+    GLuint CompareSampler = 0;
+    GLuint MomentTexture = 0;       // RGBA32F array, one layer per cascade
+
+    ShadowFilter()
+        : prefilterVariants("../shaders/fullscreen.vs", "../shaders/shadow_prefilter.fs", [](Shader& shader) {
+            shader.Use();
+            shader.setInt("source", 0);
+        })
+    {
+    }
+
+    // The moment arrays follow the cascades' count and resolution, create again when those change
+    void Create(const ShadowCascades& cascades)
+    {
+        this->resolution = std::max(cascades.Settings.resolution / 2, 1);
+        this->count = cascades.Settings.count;
+        glGenSamplers(1, &this->CompareSampler);
+        glSamplerParameteri(this->CompareSampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glSamplerParameteri(this->CompareSampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glSamplerParameteri(this->CompareSampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glSamplerParameteri(this->CompareSampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        glSamplerParameterfv(this->CompareSampler, GL_TEXTURE_BORDER_COLOR, borderColor);
+        glSamplerParameteri(this->CompareSampler, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glSamplerParameteri(this->CompareSampler, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glGenVertexArrays(1, &this->emptyVertexArray);
+        this->prefilterVariants.Submit(ShaderKey().Define("EVSM_CONVERT"));
+        this->prefilterVariants.Submit();
+        this->MomentTexture = this->createMomentArray(this->count);
+        this->blurTexture = this->createMomentArray(1);
+        glGenFramebuffers(1, &this->framebuffer);
+    }
+
+    void Destroy()
+    {
+        GLState& state = GLState::Instance();
+        state.DeleteFramebuffers(1, &this->framebuffer);
+        state.DeleteTextures(1, &this->MomentTexture);
+        state.DeleteTextures(1, &this->blurTexture);
+        state.DeleteVertexArrays(1, &this->emptyVertexArray);
+        state.BindSampler(SHADOW_TEXTURE_UNIT, 0);
+        glDeleteSamplers(1, &this->CompareSampler);
+    }
+
+    // Turns the finished cascade depth into blurred moments; does nothing unless the mode samples them
+    void Prefilter(const ShadowCascades& cascades)
+    {
+        if (this->Mode != SHADOW_FILTER_EVSM)
+            return;
+        GLState& state = GLState::Instance();
+        Shader& convert = this->prefilterVariants.Get(ShaderKey().Define("EVSM_CONVERT"));
+        Shader& blur = this->prefilterVariants.Get();
+        state.BindFramebuffer(this->framebuffer);
+        state.Viewport(0, 0, this->resolution, this->resolution);
+        // blending would mix the moments with what the layer held before
+        state.Disable(GL_BLEND);
+        state.BindVertexArray(this->emptyVertexArray);
+        state.BindSampler(0, 0);
+        for (int cascade = 0; cascade < this->count; cascade++)
+        {
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, this->MomentTexture, 0, cascade);
+            convert.Use();
+            convert.setInt("layer", cascade);
+            state.BindTexture(0, GL_TEXTURE_2D_ARRAY, cascades.Texture);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            if (this->BlurRadius <= 0)
+                continue;
+            blur.Use();
+            blur.setInt("blurRadius", this->BlurRadius);
+            // horizontally into the scratch layer, vertically back into the cascade's layer
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, this->blurTexture, 0, 0);
+            blur.setInt("layer", cascade);
+            blur.setInt("blurAxis", 0);
+            state.BindTexture(0, GL_TEXTURE_2D_ARRAY, this->MomentTexture);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, this->MomentTexture, 0, cascade);
+            blur.setInt("layer", 0);
+            blur.setInt("blurAxis", 1);
+            state.BindTexture(0, GL_TEXTURE_2D_ARRAY, this->blurTexture);
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+        }
+        state.Enable(GL_BLEND);
+    }
+
+    // Binds what the current mode's shader variant samples as shadowMap
+    void Bind(const ShadowCascades& cascades)
+    {
+        const GLuint unit = SHADOW_TEXTURE_UNIT;
+        GLState& state = GLState::Instance();
+        bool compare = this->Mode == SHADOW_FILTER_HARDWARE || this->Mode == SHADOW_FILTER_POISSON;
+        state.BindTexture(unit, GL_TEXTURE_2D_ARRAY, this->Mode == SHADOW_FILTER_EVSM ? this->MomentTexture : cascades.Texture);
+        state.BindSampler(unit, compare ? this->CompareSampler : 0);
+    }
+
+    // Moment array and blur scratch layer
+    size_t MemoryBytes() const
+    {
+        return (size_t)this->resolution * this->resolution * (this->count + 1) * 16;
+    }
+
+private:
+    ShaderVariants prefilterVariants;
+    GLuint blurTexture = 0;
+    GLuint framebuffer = 0;
+    GLuint emptyVertexArray = 0;    // the full screen triangle needs no attributes, but core GL needs a VAO
+    int resolution = 0;
+    int count = 0;
+
+    GLuint createMomentArray(int layers)
+    {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        GLState::Instance().BindTexture(0, GL_TEXTURE_2D_ARRAY, texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA32F, this->resolution, this->resolution, layers, 0, GL_RGBA, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        // outside the map nothing occludes, the moments of the far plane
+        float positive = std::exp(EVSM_POSITIVE), negative = -std::exp(-EVSM_NEGATIVE);
+        float borderColor[] = { positive, positive * positive, negative, negative * negative };
+        glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, borderColor);
+        return texture;
+    }
+};
@@ -10,8 +10,31 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "GLExtensions.h"
+#include "GLState.h"
 #include "Shader.h"
+#include "ShaderVariants.h"
 #include "Camera.h"
+#include "FrameUniforms.h"
+#include "TransformBuffer.h"
+#include "RenderQueue.h"
+#include "ShadowCascades.h"
+#include "ShadowFilter.h"
+#include "LightUniforms.h"
+#include "ShadowAtlas.h"
+#include "PointShadows.h"
+#include "LightClusters.h"
+#include "GBuffer.h"
+#include "ScreenSpaceReflections.h"
+#include "ImageBasedLighting.h"
+#include "ReflectionProbes.h"
+#include "BakedReflectionProbes.h"
+#include "Lightmap.h"
+#include "SpriteAtlas.h"
+#include "BillboardRenderer.h"
+#include "WeightedTransparency.h"
+#include "ParticleSystem.h"
+#include "GpuTimer.h"
 #include "stb_image.h"
 //#define DEBUG
 
@@ -28,11 +51,142 @@ GLfloat lastY = (GLfloat)HEIGHT / 2.0;
 bool firstMouse = true;
 //lighting
 glm::vec3 directLightPos(-11.0f, -2.0f, -5.0f);
+const glm::vec3 directLightAmbient(0.05f), directLightDiffuse(0.7f), directLightSpecular(1.0f);
 glm::vec3 mirrorCubePos(-2.5f, 1.5f, 2.0f);
 const int numberOfPointLights = 2;
+//local lights: the camera flashlight (toggled with F), the point lights and a spot light; spot shadows come from
+//one atlas, point shadows from a cube per light
+LightUniforms lightUniforms;
+std::vector<LocalLight> sceneLights;
+ShadowAtlas shadowAtlas;
+PointShadows pointShadows;
+//bounding spheres (center, radius) of the casters that move, their lights' shadows are redrawn every frame
+std::vector<glm::vec4> dynamicCasters;
+//bounding spheres of the scene cubes and of the whole benchmark grid, point lights skip the casters out of range
+glm::vec4 sceneCubeBounds[3];
+glm::vec4 benchmarkBounds;
+//clustered forward shading: lights sorted into froxels, J toggles it against looping over every light;
+//L cycles the stress lights, small unshadowed point lights drifting over the floor after the scene's own
+LightClusters lightClusters;
+bool clusteredLighting = true;
+const int STRESS_LIGHT_COUNTS[] = { 0, 256, 1024, 4000 };
+int stressLevel = 0;
+size_t sceneLightCount = 0;
+//deferred shading, toggled with G: the opaque surfaces go into a G-buffer and are lit once per pixel by a full
+//screen pass; outlines, sky and transparent draws stay forward on top of its result
+GBuffer gBuffer;
+bool deferredShading = false;
+//screen-space reflections on the floor, traced through a min-depth pyramid of the G-buffer's depth, so deferred only;
+//Q cycles them off, at half and at quarter resolution. GPU time of the pyramid, trace and resolve per resolution
+ScreenSpaceReflections screenSpaceReflections;
+const int SSR_DIVISORS[] = { 0, 2, 4 };
+int ssrLevel = 1;
+GpuTimer ssrTimer;
+//image based lighting precomputed from the skybox (and cached on disk), the ambient light of every lit surface;
+//R cycles the roughness of the mirror and glass cubes
+ImageBasedLighting imageBasedLighting;
+const float MIRROR_ROUGHNESSES[] = { 0.0f, 0.25f, 0.5f, 0.75f };
+int mirrorRoughnessLevel = 0;
+//live environment cubes of the mirror and glass cubes, the scheduler renders a few of their faces a frame; U cycles
+//that budget, from the static sky up to all six, Y the faces' resolution
+ReflectionProbes reflectionProbes;
+const int PROBE_FACE_BUDGETS[] = { 0, 1, 2, 6 };
+int probeBudgetLevel = 2;
+const int PROBE_RESOLUTIONS[] = { 64, 128, 256 };
+int probeResolutionLevel = 1;
+bool probesChanged = false;
+//bounding spheres of the moving objects the probes see, the mirror cubes aren't drawn into them
+std::vector<glm::vec4> probeMovers;
+//reflection probes of the static scene, captured in the first frames (or read from the disk cache) into one compressed
+//array; the chrome cubes standing on the floor each pick theirs and reflect it parallax corrected, E toggles that
+//against the sky. Until the capture is done the frame's probe pass renders its faces instead of the live probes'
+BakedReflectionProbes bakedProbes;
+bool useBakedProbes = true;
+const int CHROME_CUBE_COUNT = 8;
+ReflectionProbes* renderedProbes = &reflectionProbes;
+//baked lighting of the floor and the scene's cubes, which never move; M toggles it against lighting them like every
+//other surface. Forward only, deferred they go through the G-buffer as before. Only static casters are baked, the
+//moving ones don't shadow lightmapped surfaces. The cubes are drawn from one batch already in world space, it
+//carries their lightmap coordinates
+Lightmap lightmap;
+bool useLightmap = true;
+//the sprites of every billboard and particle, packed into the pages of one texture array at load
+SpriteAtlas spriteAtlas;
+//camera facing windows, culled and radix sorted back to front on the CPU, then drawn in one instanced draw;
+//N cycles extra ones scattered over the scene to benchmark the sort and the upload
+BillboardRenderer billboardRenderer;
+const int BILLBOARD_COUNTS[] = { 0, 10000, 100000, 1000000 };
+int billboardLevel = 0;
+bool billboardsChanged = true;
+//weighted blended order-independent transparency, O switches the billboards to its material: no sort on the CPU,
+//the layers add up in any order and are composited over the scene once the queue is done
+WeightedTransparency weightedTransparency;
+bool useWeightedBlending = false;
+//a fountain of particles beside the cubes, always weighted blended so they need no sort; T cycles how many are
+//alive, up to millions, to benchmark the update and the upload
+ParticleSystem particles;
+const int PARTICLE_COUNTS[] = { 2000, 100000, 1000000, 2000000 };
+int particleLevel = 0;
+bool particlesChanged = true;
 //deltatime-time between current frame and last frame
 GLfloat deltaTime = 0.0f;
 GLfloat lastFrame = 0.0f;
+//per-frame statistics, toggled with P
+bool showStats = false;
+GLfloat lastStatsTime = 0.0f;
+//shadow of the bound GL state, every bind and state change goes through it
+GLState& glState = GLState::Instance();
+//per-frame block shared by every program (camera, projection, lights)
+FrameUniforms frameUniforms;
+//model, normal and MVP matrices of every object, computed once per frame
+TransformBuffer transforms;
+//indices of this frame's objects in the transform buffer, runs of consecutive objects start at outlines and cubes
+struct SceneObjects
+{
+    int floor, outlines, cubes, cubeCount, staticCubes, mirror, refract, chrome, nMap, parallax;
+} objects;
+//uniform handles, resolved once after the programs are linked
+Uniform<int> defaultObjectUniform, outlineObjectUniform, mirrorObjectUniform;
+Uniform<int> nMapObjectUniform, parallaxObjectUniform, depthObjectUniform, depthCascadeMaskUniform;
+Uniform<int> refractObjectUniform, atlasObjectUniform, atlasTileCountUniform, atlasTilesUniform;
+Uniform<int> pointObjectUniform, pointShadowUniform, lightmapObjectUniform, floorObjectUniform;
+Uniform<glm::mat4> inverseViewProjectionUniform;
+Uniform<float> mirrorRoughnessUniform, refractRoughnessUniform;
+Uniform<int> chromeObjectUniform, chromeSelectionUniform;
+Uniform<float> chromeRoughnessUniform;
+Uniform<int> mirrorProbeLevelUniform, refractProbeLevelUniform, probeObjectUniform, probeTangentObjectUniform, probeLightmapObjectUniform;
+//per reflection probe program: surfaces, the normal mapping planes, the lightmapped surfaces, the sky
+Uniform<glm::mat4> probeFaceMatricesUniforms[4];
+Uniform<int> probeFaceMaskUniforms[4];
+Uniform<glm::vec3> probeSkyPositionUniform;
+//directional light shadow, cascade count cycled with V, split scheme with K
+ShadowCascades cascades;
+const float SPLIT_LAMBDAS[] = { 0.0f, 0.5f, 0.75f, 1.0f };
+int splitLevel = 2;
+bool cascadesChanged = false;
+//what the lighting pass samples the cascades through, cycled with H; GPU time of depth, prefilter and lighting per filter,
+//lighting (everything from the opaque pass on) per filter and pipeline
+ShadowFilter shadowFilter;
+GpuTimer shadowTimer, prefilterTimer, lightingTimer;
+//GPU time of the reflection probe faces rendered this frame
+GpuTimer probeTimer;
+//draw items of the frame, sorted by pass, state and depth before they are executed
+RenderQueue queue;
+//material indices in the render queue
+struct SceneMaterials
+{
+    int none, floor, cubes, mirror, mirrorProbe, refractProbe, skybox, nMap, parallax, billboards, billboardsWeighted, gBuffer;
+} materials;
+//flashlight toggled with F; shader variants of the default program, shadow filter taps (and EVSM blur) cycled with C
+bool useSpotlight = false;
+int shadowPcfTaps = 9;
+bool variantChanged = true;
+//benchmark: extra cubes after the scene's three, count cycled with B; I toggles one instanced draw per batch vs. one draw per cube
+const int BENCHMARK_COUNTS[] = { 0, 1000, 10000, 50000 };
+//transforms of the scene besides the benchmark cubes: floor, 3 outlines, 3 cubes, the static batch, mirror, refract, chrome, nMap, parallax
+const int SCENE_TRANSFORMS = 1 + 3 + 3 + 1 + 2 + CHROME_CUBE_COUNT + 2;
+int benchmarkLevel = 0;
+bool useInstancing = true;
 //================================================================================
 //======================================FUNCTIONS=================================
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mode)
@@ -48,6 +202,76 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
         else if (action == GLFW_RELEASE)
             keys[key] = false;
     }
+    if (key == GLFW_KEY_P && action == GLFW_PRESS)
+        showStats = !showStats;
+    if (key == GLFW_KEY_F && action == GLFW_PRESS)
+        useSpotlight = !useSpotlight;
+    if (key == GLFW_KEY_C && action == GLFW_PRESS)
+    {
+        shadowPcfTaps = shadowPcfTaps == 1 ? 9 : (shadowPcfTaps == 9 ? 25 : 1);
+        variantChanged = true;
+    }
+    if (key == GLFW_KEY_H && action == GLFW_PRESS)
+    {
+        shadowFilter.Mode = (shadowFilter.Mode + 1) % SHADOW_FILTER_MODES;
+        variantChanged = true;
+    }
+    if (key == GLFW_KEY_B && action == GLFW_PRESS)
+        benchmarkLevel = (benchmarkLevel + 1) % 4;
+    if (key == GLFW_KEY_I && action == GLFW_PRESS)
+        useInstancing = !useInstancing;
+    if (key == GLFW_KEY_V && action == GLFW_PRESS)
+        cascadesChanged = true;
+    if (key == GLFW_KEY_K && action == GLFW_PRESS)
+        splitLevel = (splitLevel + 1) % 4;
+    if (key == GLFW_KEY_J && action == GLFW_PRESS)
+    {
+        clusteredLighting = !clusteredLighting;
+        variantChanged = true;
+    }
+    if (key == GLFW_KEY_L && action == GLFW_PRESS)
+        stressLevel = (stressLevel + 1) % 4;
+    if (key == GLFW_KEY_G && action == GLFW_PRESS)
+    {
+        deferredShading = !deferredShading;
+        variantChanged = true;
+    }
+    if (key == GLFW_KEY_M && action == GLFW_PRESS)
+    {
+        useLightmap = !useLightmap;
+        variantChanged = true;
+    }
+    if (key == GLFW_KEY_R && action == GLFW_PRESS)
+    {
+        mirrorRoughnessLevel = (mirrorRoughnessLevel + 1) % 4;
+        variantChanged = true;
+    }
+    if (key == GLFW_KEY_N && action == GLFW_PRESS)
+    {
+        billboardLevel = (billboardLevel + 1) % 4;
+        billboardsChanged = true;
+    }
+    if (key == GLFW_KEY_O && action == GLFW_PRESS)
+        useWeightedBlending = !useWeightedBlending;
+    if (key == GLFW_KEY_T && action == GLFW_PRESS)
+    {
+        particleLevel = (particleLevel + 1) % 4;
+        particlesChanged = true;
+    }
+    if (key == GLFW_KEY_U && action == GLFW_PRESS)
+        probeBudgetLevel = (probeBudgetLevel + 1) % 4;
+    if (key == GLFW_KEY_Y && action == GLFW_PRESS)
+    {
+        probeResolutionLevel = (probeResolutionLevel + 1) % 3;
+        probesChanged = true;
+    }
+    if (key == GLFW_KEY_E && action == GLFW_PRESS)
+        useBakedProbes = !useBakedProbes;
+    if (key == GLFW_KEY_Q && action == GLFW_PRESS)
+    {
+        ssrLevel = (ssrLevel + 1) % 3;
+        variantChanged = true;
+    }
 }
 
 void moveCamera(){
@@ -104,7 +328,7 @@ unsigned int loadTexture(char const* path)
         else if (nrComponents == 4)
             format = GL_RGBA;
 
-        glBindTexture(GL_TEXTURE_2D, textureID);
+        glState.BindTexture(0, GL_TEXTURE_2D, textureID);
         glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
         glGenerateMipmap(GL_TEXTURE_2D);
 
@@ -124,11 +348,46 @@ unsigned int loadTexture(char const* path)
     return textureID;
 }
 
-unsigned int loadSkybox(std::vector<std::string> faces)
+//queues an image in the sprite atlas as RGBA, a white texel if it can't be read; rows top down like the
+//billboard quad's texture coordinates, so unlike the other textures it isn't flipped
+int loadSprite(SpriteAtlas& atlas, char const* path)
+{
+    int width, height, nrComponents;
+    stbi_set_flip_vertically_on_load(false);
+    unsigned char* data = stbi_load(path, &width, &height, &nrComponents, 4);
+    stbi_set_flip_vertically_on_load(true);
+    if (!data)
+    {
+        std::cout << "Sprite failed to load at path: " << path << std::endl;
+        const unsigned char white[] = { 255, 255, 255, 255 };
+        return atlas.Add(white, 1, 1);
+    }
+    int sprite = atlas.Add(data, width, height);
+    stbi_image_free(data);
+    return sprite;
+}
+
+//the mean color of a mipmapped texture, its last level
+glm::vec3 averageTextureColor(unsigned int texture)
+{
+    glState.BindTexture(0, GL_TEXTURE_2D, texture);
+    GLint width = 1, height = 1;
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH, &width);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+    int level = 0;
+    while ((width >> level) > 1 || (height >> level) > 1)
+        level++;
+    float color[4] = { 0.5f, 0.5f, 0.5f, 1.0f };
+    glGetTexImage(GL_TEXTURE_2D, level, GL_RGBA, GL_FLOAT, color);
+    return glm::vec3(color[0], color[1], color[2]);
+}
+
+//the decoded faces stay in pixels for the image based lighting
+unsigned int loadSkybox(std::vector<std::string> faces, CubeFaces& pixels)
 {
     unsigned int textureID;
     glGenTextures(1, &textureID);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+    glState.BindTexture(0, GL_TEXTURE_CUBE_MAP, textureID);
 
     int width, height, nrChannels;
     for (unsigned int i = 0; i < faces.size(); i++)
@@ -139,6 +398,11 @@ unsigned int loadSkybox(std::vector<std::string> faces)
             glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
                 0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data
             );
+            if (nrChannels == 3 && width == height)
+            {
+                pixels.size = width;
+                pixels.pixels.push_back(std::vector<unsigned char>(data, data + (size_t)width * height * 3));
+            }
             stbi_image_free(data);
         }
         else
@@ -156,290 +420,428 @@ unsigned int loadSkybox(std::vector<std::string> faces)
     return textureID;
 }
 
-void drawFloor(const glm::mat4 projectionMat, const unsigned int planeVAO, Shader myShader, const unsigned int floorTexture)
+//the default program's permutation for the current keys
+ShaderKey defaultVariantKey()
 {
-    glm::mat4 modelMat = glm::mat4(1.0f);
-    glm::mat4 viewMat = camera.GetViewMatrix();
-
-    glStencilMask(0x00);
-
-    myShader.setMat4("viewMat", viewMat);
-    myShader.setMat4("projectionMat", projectionMat);
-    myShader.Use();
-    glBindVertexArray(planeVAO);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, floorTexture);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, floorTexture);
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    modelMat = glm::translate(modelMat, glm::vec3(0.0f, -0.01f, 0.0f));
-    myShader.setMat4("modelMat", modelMat);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-    glBindVertexArray(0);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, 0);
-
-    glStencilMask(0xFF);
+    ShaderKey key;
+    key.Define("SHADOW_FILTER", shadowFilter.Mode);
+    key.Define("SHADOW_PCF_TAPS", shadowPcfTaps);
+    key.Define("CLUSTERED_LIGHTS", clusteredLighting ? 1 : 0);
+    return key;
 }
 
-void drawNMap(const glm::mat4 projectionMat, const unsigned int nMapVAO, Shader shader, const unsigned int diffuseMap, const unsigned int normalMap)
+//tag of the lighting timer for the current shadow filter and pipeline
+int lightingTag()
 {
-    glm::mat4 viewMat = camera.GetViewMatrix();
-    shader.Use();
-    shader.setMat4("projectionMat", projectionMat);
-    shader.setMat4("viewMat", viewMat);
-    glm::mat4 modelMat = glm::mat4(1.0f);
-    modelMat = glm::translate(modelMat, glm::vec3(5.0f, 0.5f, 2.0f));
-    modelMat = glm::rotate(modelMat, glm::radians((float)glfwGetTime() * -10.0f), glm::normalize(glm::vec3(1.0, 0.0, 1.0)));
-    modelMat = glm::scale(modelMat, glm::vec3(0.7f));
-    shader.setMat4("modelMat", modelMat);
-    shader.setVec3("viewPos", camera.Position);
-    shader.setVec3("lightPos", -directLightPos);
-    //shader.setVec3("lightAmbient", glm::vec3(0.05f));
-    //shader.setVec3("lightDiffuse", glm::vec3(0.7f));
-    //shader.setVec3("lightSpecular", glm::vec3(1.0f));
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, diffuseMap);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, normalMap);
-    glBindVertexArray(nMapVAO);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-    glBindVertexArray(0);
+    return shadowFilter.Mode + (deferredShading ? SHADOW_FILTER_MODES : 0);
+}
+
+//keeps the stress lights after the scene's lights, each circling its own spot over the floor
+void updateStressLights(float time)
+{
+    size_t count = (size_t)STRESS_LIGHT_COUNTS[stressLevel];
+    if (sceneLights.size() != sceneLightCount + count)
+        sceneLights.resize(sceneLightCount + count);
+    for (size_t i = 0; i < count; i++)
+    {
+        //fixed pseudo-random spot, color and speed per light, from a hash of its index
+        unsigned int hash = (unsigned int)i * 2654435761u;
+        unsigned int mixed = (hash ^ (hash >> 15)) * 0x5bd1e995u;
+        float u = (hash & 0xFFFF) / 65535.0f, v = ((hash >> 16) & 0xFFFF) / 65535.0f, w = ((mixed >> 8) & 0xFFFF) / 65535.0f;
+        float angle = time * (0.3f + 0.7f * w) + 6.2832f * u;
+        LocalLight& light = sceneLights[sceneLightCount + i];
+        light.type = LIGHT_POINT;
+        light.position = glm::vec3(-9.0f + 18.0f * u + 0.8f * std::cos(angle), -0.3f + 0.5f * w, -9.0f + 18.0f * v + 0.8f * std::sin(angle));
+        light.color = 0.6f * glm::abs(glm::vec3(std::sin(6.2832f * w), std::sin(6.2832f * (w + 0.33f)), std::sin(6.2832f * (w + 0.67f))));
+        light.range = 0.5f + 0.4f * w;
+        light.linear = 1.0f;
+        light.quadratic = 4.0f;
+        light.castsShadow = false;
+    }
 }
 
-void drawParallax(const glm::mat4 projectionMat, const unsigned int parallaxVAO, Shader shader, const unsigned int diffuseMap,
-    const unsigned int normalMap, const unsigned int heightMap)
+//a ring of chrome cubes around the scene, resting on the floor
+glm::vec3 chromeCubePosition(int i)
 {
-    glm::mat4 viewMat = camera.GetViewMatrix();
-    shader.Use();
-    shader.setMat4("projectionMat", projectionMat);
-    shader.setMat4("viewMat", viewMat);
-    glm::mat4 modelMat = glm::mat4(1.0f);
-    modelMat = glm::translate(modelMat, glm::vec3(3.0f, 0.5f, -2.0f));
-    modelMat = glm::rotate(modelMat, glm::radians(sin((float)glfwGetTime()) * 10.0f + 90.0f), glm::normalize(glm::vec3(0.0, 1.0, 0.0)));
-    modelMat = glm::scale(modelMat, glm::vec3(0.7f));
-    shader.setMat4("modelMat", modelMat);
-    shader.setVec3("viewPos", camera.Position);
-    shader.setVec3("lightPos", -directLightPos);
-    shader.setFloat("heightScale", 0.1f);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, diffuseMap);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, normalMap);
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, heightMap);
-    glBindVertexArray(parallaxVAO);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-    glBindVertexArray(0);
+    float angle = 6.2832f * i / CHROME_CUBE_COUNT;
+    return glm::vec3(4.5f * std::cos(angle), -0.25f, 4.5f * std::sin(angle));
 }
 
-void drawCubesAndOutline(const glm::mat4 projectionMat, const unsigned int containerVAO, Shader myShader, Shader outlineShader, glm::vec3* cubePositions,
-    const unsigned int diffuseMap, const unsigned int specularMap, const unsigned int emissionMap)
+void addSceneTransforms(glm::vec3* cubePositions, float time)
 {
-    glm::mat4 viewMat = camera.GetViewMatrix();
-
-    myShader.Use();
-    myShader.setMat4("viewMat", viewMat);
-    myShader.setMat4("projectionMat", projectionMat);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, diffuseMap);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, specularMap);
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, emissionMap);
-
-    //Draw figures
-    glStencilFunc(GL_ALWAYS, 1, 0xFF);
-    glStencilMask(0xFF);
-
-    glBindVertexArray(containerVAO);
+    transforms.Clear();
+    //floor
+    objects.floor = transforms.Add(glm::vec3(0.0f, -0.01f, 0.0f));
+    //outlines of the cubes, slightly larger, then the cubes and the benchmark cubes in one run
+    objects.outlines = transforms.Add(cubePositions[0], glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(1.005f));
+    for (unsigned int i = 1; i < 3; i++)
+        transforms.Add(cubePositions[i], glm::quat(1.0f, 0.0f, 0.0f, 0.0f), glm::vec3(1.005f));
+    objects.cubes = transforms.Add(cubePositions[0]);
+    for (unsigned int i = 1; i < 3; i++)
+        transforms.Add(cubePositions[i]);
     for (unsigned int i = 0; i < 3; i++)
+        sceneCubeBounds[i] = glm::vec4(cubePositions[i], 0.87f);
+    //benchmark cubes: a spinning grid above the scene, trimmed to what the buffer holds so every scene Add() gets an index
+    int benchmarkCount = std::min(BENCHMARK_COUNTS[benchmarkLevel], transforms.Capacity() - SCENE_TRANSFORMS);
+    int side = (int)std::ceil(std::cbrt((float)benchmarkCount));
+    for (int i = 0; i < benchmarkCount; i++)
     {
-        glm::mat4 modelMat = glm::mat4(1.0f);
-        modelMat = glm::translate(modelMat, cubePositions[i]);
-        myShader.setMat4("modelMat", modelMat);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
+        glm::vec3 cell((float)(i % side), (float)(i / side % side), (float)(i / (side * side)));
+        glm::vec3 position = glm::vec3(-0.5f * side, 4.0f, -0.5f * side) + cell;
+        glm::quat rotation = glm::angleAxis(time + 0.1f * i, glm::normalize(glm::vec3(1.0f, 1.0f, 0.0f)));
+        transforms.Add(position, rotation, glm::vec3(0.3f));
     }
-    glBindVertexArray(0);
-
-    //draw outline
-    glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
-    glStencilMask(0x00);
-    //glDisable(GL_DEPTH_TEST);
-    outlineShader.Use();
-    float scale = 1.005f;
-
-    outlineShader.setVec3("outlineColor", glm::vec3(0.0f, 0.0f, 1.0f));
-    outlineShader.setMat4("viewMat", viewMat);
-    outlineShader.setMat4("projectionMat", projectionMat);
+    objects.cubeCount = transforms.Count() - objects.cubes;
+    //the lightmapped batch of the scene's cubes, its vertices are in world space already
+    objects.staticCubes = transforms.Add(glm::vec3(0.0f));
+    dynamicCasters.clear();
+    benchmarkBounds = glm::vec4(0.0f, 4.0f + 0.5f * side, 0.0f, 0.9f * side);
+    if (benchmarkCount > 0)
+        dynamicCasters.push_back(benchmarkBounds);
+    //mirror and refracting cubes
+    glm::quat mirrorRotation = glm::angleAxis(glm::radians(time * 20.0f), glm::normalize(glm::vec3(-1.0, 1.0, -1.0)));
+    objects.mirror = transforms.Add(mirrorCubePos, mirrorRotation, glm::vec3(0.7f));
+    objects.refract = transforms.Add(mirrorCubePos + glm::vec3(0.0f, 1.0f, 1.0f), mirrorRotation, glm::vec3(0.7f));
+    dynamicCasters.push_back(glm::vec4(mirrorCubePos, 0.61f));
+    dynamicCasters.push_back(glm::vec4(mirrorCubePos + glm::vec3(0.0f, 1.0f, 1.0f), 0.61f));
+    //the chrome cubes, in one run
+    objects.chrome = transforms.Add(chromeCubePosition(0), glm::angleAxis(0.0f, glm::vec3(0.0f, 1.0f, 0.0f)), glm::vec3(0.5f));
+    for (int i = 1; i < CHROME_CUBE_COUNT; i++)
+        transforms.Add(chromeCubePosition(i), glm::angleAxis(0.4f * i, glm::vec3(0.0f, 1.0f, 0.0f)), glm::vec3(0.5f));
+    //normal mapping and parallax planes
+    objects.nMap = transforms.Add(glm::vec3(5.0f, 0.5f, 2.0f),
+        glm::angleAxis(glm::radians(time * -10.0f), glm::normalize(glm::vec3(1.0, 0.0, 1.0))), glm::vec3(0.7f));
+    objects.parallax = transforms.Add(glm::vec3(3.0f, 0.5f, -2.0f),
+        glm::angleAxis(glm::radians(sin(time) * 10.0f + 90.0f), glm::vec3(0.0, 1.0, 0.0)), glm::vec3(0.7f));
+    dynamicCasters.push_back(glm::vec4(5.0f, 0.5f, 2.0f, 1.0f));
+    dynamicCasters.push_back(glm::vec4(3.0f, 0.5f, -2.0f, 1.0f));
+    //what the reflection probes see move: every dynamic caster but the mirror cubes
+    probeMovers.clear();
+    for (const glm::vec4& caster : dynamicCasters)
+        if (glm::vec3(caster) != mirrorCubePos && glm::vec3(caster) != mirrorCubePos + glm::vec3(0.0f, 1.0f, 1.0f))
+            probeMovers.push_back(caster);
+}
 
-    glBindVertexArray(containerVAO);
-    for (unsigned int i = 0; i < 3; i++)
+//the scene's billboards first, then the benchmark ones, small and scattered over the scene and cycling through the sprites
+void placeBillboards(const std::vector<glm::vec3>& billboards)
+{
+    int count = BILLBOARD_COUNTS[billboardLevel];
+    int first = (int)billboards.size();
+    billboardRenderer.Resize(first + count);
+    for (int i = 0; i < first; i++)
+        billboardRenderer.Set(i, billboards[i]);
+    for (int i = 0; i < count; i++)
     {
-        glm::mat4 modelMat = glm::mat4(1.0f);
-        modelMat = glm::translate(modelMat, cubePositions[i]);
-        modelMat = glm::scale(modelMat, glm::vec3(scale));
-        outlineShader.setMat4("modelMat", modelMat);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
+        //fixed pseudo-random spot per billboard, from a hash of its index
+        unsigned int hash = (unsigned int)i * 2654435761u;
+        unsigned int mixed = (hash ^ (hash >> 15)) * 0x5bd1e995u;
+        mixed ^= mixed >> 13;
+        float u = (hash & 0xFFFF) / 65535.0f, v = ((mixed >> 16) & 0xFFFF) / 65535.0f, w = (mixed & 0xFFFF) / 65535.0f;
+        billboardRenderer.Set(first + i, glm::vec3(-20.0f + 40.0f * u, 0.5f + 7.5f * w, -20.0f + 40.0f * v), 0.2f,
+            i % (int)spriteAtlas.Frames.size());
     }
-    glBindVertexArray(0);
+}
 
-    glStencilFunc(GL_ALWAYS, 1, 0xFF);
-    glStencilMask(0xFF);
+void submitFloor(const unsigned int planeVAO, Shader& shader, Uniform<int> objectUniform)
+{
+    queue.Submit(RenderQueue::PASS_OPAQUE, shader, objectUniform, objects.floor, materials.floor, planeVAO, 6,
+        glm::vec3(0.0f, -0.01f, 0.0f));
 }
 
-void drawSkyboxAndCubes(const glm::mat4 projectionMat, const unsigned int skyboxVAO, const unsigned int mirrorVAO, Shader skyboxShader, Shader mirrorShader,
-    const unsigned int skyboxTexture)
+void submitNMap(const unsigned int nMapVAO, Shader& shader)
 {
-    glm::mat4 viewMat = glm::mat4(1.0f);
-    glm::mat4 modelMat = glm::mat4(1.0f);
+    queue.Submit(RenderQueue::PASS_OPAQUE, shader, nMapObjectUniform, objects.nMap, materials.nMap, nMapVAO, 6,
+        glm::vec3(5.0f, 0.5f, 2.0f));
+}
 
-    //draw skybox
-    glDepthFunc(GL_LEQUAL);
-    skyboxShader.Use();
-    viewMat = glm::mat4(glm::mat3(camera.GetViewMatrix()));     //we will F' up view matrix to get rid of translation, but we will only do it for skybox
-    skyboxShader.setMat4("viewMat", viewMat);
-    skyboxShader.setMat4("projectionMat", projectionMat);
-    glBindVertexArray(skyboxVAO);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-    glBindVertexArray(0);
-    glDepthFunc(GL_LESS);
-    viewMat = camera.GetViewMatrix();               //here we are "restoring" the "right" view matrix
-
-    //draw mirror cube
-    mirrorShader.Use();
-    glm::mat4 mirrorModelMat = glm::mat4(1.0f);
-    mirrorModelMat = glm::translate(mirrorModelMat, mirrorCubePos);
-    mirrorModelMat = glm::rotate(mirrorModelMat, glm::radians((float)glfwGetTime() * 20.0f), glm::normalize(glm::vec3(-1.0, 1.0, -1.0)));
-    mirrorModelMat = glm::scale(mirrorModelMat, glm::vec3(0.7f));
-    mirrorShader.setMat4("modelMat", mirrorModelMat);
-    mirrorShader.setMat4("viewMat", viewMat);
-    mirrorShader.setMat4("projectionMat", projectionMat);
-    mirrorShader.setVec3("cameraPos", camera.Position);
-    mirrorShader.setBool("refractFlag", false);
-    glBindVertexArray(mirrorVAO);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-    glBindVertexArray(0);
-
-    mirrorShader.Use();
-    mirrorModelMat = glm::mat4(1.0f);
-    mirrorModelMat = glm::translate(mirrorModelMat, mirrorCubePos + glm::vec3(0.0f, 1.0f, 1.0f));
-    mirrorModelMat = glm::rotate(mirrorModelMat, glm::radians((float)glfwGetTime() * 20.0f), glm::normalize(glm::vec3(-1.0, 1.0, -1.0)));
-    mirrorModelMat = glm::scale(mirrorModelMat, glm::vec3(0.7f));
-    mirrorShader.setMat4("modelMat", mirrorModelMat);
-    mirrorShader.setMat4("viewMat", viewMat);
-    mirrorShader.setMat4("projectionMat", projectionMat);
-    mirrorShader.setVec3("cameraPos", camera.Position);
-    mirrorShader.setBool("refractFlag", true);
-    glBindVertexArray(mirrorVAO);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_CUBE_MAP, skyboxTexture);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-    glBindVertexArray(0);
+void submitParallax(const unsigned int parallaxVAO, Shader& shader)
+{
+    queue.Submit(RenderQueue::PASS_OPAQUE, shader, parallaxObjectUniform, objects.parallax, materials.parallax, parallaxVAO, 6,
+        glm::vec3(3.0f, 0.5f, -2.0f));
+}
+
+void submitCubesAndOutline(const unsigned int containerVAO, const unsigned int staticCubesVAO, Shader& myShader, Shader* lightmapShader,
+    Shader& outlineShader, glm::vec3* cubePositions)
+{
+    //cubes mark the stencil, their outlines draw where it is not marked once every opaque item is done;
+    //lightmapped, the scene's three come from their batch and only the benchmark cubes are drawn per object
+    int first = 0;
+    if (lightmapShader)
+    {
+        queue.Submit(RenderQueue::PASS_OPAQUE, *lightmapShader, lightmapObjectUniform, objects.staticCubes, materials.cubes, staticCubesVAO,
+            3 * 36, cubePositions[0]);
+        first = 3;
+    }
+    if (useInstancing)
+    {
+        if (objects.cubeCount > first)
+            queue.Submit(RenderQueue::PASS_OPAQUE, myShader, defaultObjectUniform, objects.cubes + first, materials.cubes, containerVAO, 36,
+                first < 3 ? cubePositions[first] : glm::vec3(0.0f, 4.0f, 0.0f), objects.cubeCount - first);
+        queue.Submit(RenderQueue::PASS_OUTLINE, outlineShader, outlineObjectUniform, objects.outlines, materials.none, containerVAO, 36,
+            cubePositions[0], 3);
+        return;
+    }
+    for (int i = first; i < objects.cubeCount; i++)
+        queue.Submit(RenderQueue::PASS_OPAQUE, myShader, defaultObjectUniform, objects.cubes + i, materials.cubes, containerVAO, 36,
+            i < 3 ? cubePositions[i] : glm::vec3(0.0f, 4.0f, 0.0f));
+    for (int i = 0; i < 3; i++)
+        queue.Submit(RenderQueue::PASS_OUTLINE, outlineShader, outlineObjectUniform, objects.outlines + i, materials.none, containerVAO, 36,
+            cubePositions[i]);
 }
 
-void drawBillboards(const glm::mat4 projectionMat, const unsigned int transparentVAO, Shader billboardShader, std::vector<glm::vec3> billboards,
-    const unsigned int billboardTexture)
+void submitSkyboxAndCubes(const unsigned int skyboxVAO, const unsigned int mirrorVAO, Shader& skyboxShader, Shader& mirrorShader,
+    Shader& refractShader)
 {
-    glm::mat4 viewMat = camera.GetViewMatrix();
-    glm::mat4 modelMat = glm::mat4(1.0f);
+    //skybox (skybox.vs drops the translation of the view matrix), no object index
+    queue.Submit(RenderQueue::PASS_SKY, skyboxShader, Uniform<int>(), 0, materials.skybox, skyboxVAO, 36, camera.Position);
+
+    //mirror cube and the refracting cube, REFRACT variant with the same VAO; each sees its reflection probe unless the
+    //probes are off, then both see the sky
+    bool probes = PROBE_FACE_BUDGETS[probeBudgetLevel] > 0;
+    int probeLevel = probes ? reflectionProbes.MaxLevel() : 0;
+    queue.Submit(RenderQueue::PASS_OPAQUE, mirrorShader, mirrorObjectUniform, objects.mirror, probes ? materials.mirrorProbe : materials.mirror,
+        mirrorVAO, 36, mirrorCubePos, 1, mirrorProbeLevelUniform, probeLevel);
+    queue.Submit(RenderQueue::PASS_OPAQUE, refractShader, refractObjectUniform, objects.refract, probes ? materials.refractProbe : materials.mirror,
+        mirrorVAO, 36, mirrorCubePos + glm::vec3(0.0f, 1.0f, 1.0f), 1, refractProbeLevelUniform, probeLevel);
+}
 
-    //sorting billboards by distance
-    std::multimap<float, glm::vec3> sortedBillboards;
-    for (unsigned int i = 0; i < billboards.size(); i++)
+void submitChromeCubes(const unsigned int mirrorVAO, Shader& chromeShader)
+{
+    //one program and no material textures for all of them, only the probes they reflect change from one to the next
+    for (int i = 0; i < CHROME_CUBE_COUNT; i++)
+    {
+        glm::vec3 position = chromeCubePosition(i);
+        queue.Submit(RenderQueue::PASS_OPAQUE, chromeShader, chromeObjectUniform, objects.chrome + i, materials.none, mirrorVAO, 36, position, 1,
+            chromeSelectionUniform, useBakedProbes ? bakedProbes.Selection(position) : NO_BAKED_PROBE);
+    }
+}
+
+void submitReflectionProbe(Shader& shader, Shader& tangentShader, Shader& lightmapShader, Shader& skyShader, const unsigned int floorVAO,
+    const unsigned int staticCubesVAO, const unsigned int containerVAO, const unsigned int nMapVAO, const unsigned int skyboxVAO)
+{
+    //the faces of this frame's probe in one layered pass: every opaque surface but the mirror and chrome cubes, the
+    //floor and the scene's cubes under their baked light, the benchmark cubes in one instanced draw, then the sky around
+    //the probe (no object index). The baked probes only see what never moves
+    if (renderedProbes->Active() < 0)
+        return;
+    glm::vec3 position = renderedProbes->ActivePosition();
+    queue.Submit(RenderQueue::PASS_PROBE, lightmapShader, probeLightmapObjectUniform, objects.floor, materials.floor, floorVAO, 6, position);
+    queue.Submit(RenderQueue::PASS_PROBE, lightmapShader, probeLightmapObjectUniform, objects.staticCubes, materials.cubes, staticCubesVAO,
+        3 * 36, position);
+    if (!bakedProbes.Capturing())
     {
-        float distance = glm::length(camera.Position - billboards[i]);
-        sortedBillboards.insert(std::make_pair(distance, billboards[i]));
+        if (objects.cubeCount > 3)
+            queue.Submit(RenderQueue::PASS_PROBE, shader, probeObjectUniform, objects.cubes + 3, materials.cubes, containerVAO, 36, position,
+                objects.cubeCount - 3);
+        queue.Submit(RenderQueue::PASS_PROBE, tangentShader, probeTangentObjectUniform, objects.nMap, materials.nMap, nMapVAO, 6, position);
+        queue.Submit(RenderQueue::PASS_PROBE, tangentShader, probeTangentObjectUniform, objects.parallax, materials.parallax, nMapVAO, 6, position);
     }
+    queue.Submit(RenderQueue::PASS_PROBE, skyShader, Uniform<int>(), 0, materials.skybox, skyboxVAO, 36, position);
+}
 
+void submitDeferredLighting(const unsigned int emptyVAO, Shader& lightingShader)
+{
+    //one full screen triangle over the G-buffer, no object index
+    queue.Submit(RenderQueue::PASS_LIGHTING, lightingShader, Uniform<int>(), 0, materials.gBuffer, emptyVAO, 3, camera.Position);
+}
 
-    //drawing billboards
-    billboardShader.Use();
-    glBindVertexArray(transparentVAO);
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, billboardTexture);
-    //billboardShader.setVec3("cameraPos", camera.Position);
-    billboardShader.setMat4("viewMat", viewMat);
-    billboardShader.setMat4("projectionMat", projectionMat);
-    for (std::map<float, glm::vec3>::reverse_iterator it = sortedBillboards.rbegin(); it != sortedBillboards.rend(); ++it)
-    {
-        modelMat = glm::mat4(1.0f);
-        modelMat = glm::translate(modelMat, it->second);
-        billboardShader.setMat4("modelMat", modelMat);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
-    }
-    glBindVertexArray(0);
+void submitBillboards(Shader& billboardShader, Shader& weightedShader, const glm::vec3& position)
+{
+    //all of them in one instanced draw, billboardRenderer sorted them back to front already unless their material
+    //is weighted blended; no object index
+    if (billboardRenderer.Visible() > 0)
+        queue.Submit(RenderQueue::PASS_TRANSPARENT, useWeightedBlending ? weightedShader : billboardShader, Uniform<int>(), 0,
+            useWeightedBlending ? materials.billboardsWeighted : materials.billboards, billboardRenderer.VertexArray, 6, position,
+            billboardRenderer.Visible());
 }
 
-void drawSceneForShadows(Shader shader, const unsigned int planeVAO, const unsigned int containerVAO, const unsigned int mirrorVAO,
-    const unsigned int nMapVAO, glm::vec3 *cubePositions)
+void submitParticles(Shader& weightedShader)
 {
-    //floor
-    glm::mat4 modelMat = glm::mat4(1.0f);
-    modelMat = glm::translate(modelMat, glm::vec3(0.0f, -0.01f, 0.0f));
-    shader.setMat4("modelMat", modelMat);
-    glBindVertexArray(planeVAO);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-
-    //cubes
-    glBindVertexArray(containerVAO);
-    for (unsigned int i = 0; i < 3; i++)
+    //every live particle in one instanced draw, unsorted: they share the billboards' weighted blended material; no object index
+    if (particles.Live() > 0)
+        queue.Submit(RenderQueue::PASS_TRANSPARENT, weightedShader, Uniform<int>(), 0, materials.billboardsWeighted, particles.VertexArray, 6,
+            particles.Emitter.position, particles.Live());
+}
+
+void submitSceneForShadows(Shader& shader, Shader& atlasShader, Shader& pointShader, const unsigned int planeVAO,
+    const unsigned int containerVAO, const unsigned int mirrorVAO, const unsigned int nMapVAO)
+{
+    //depth only, no textures and the order inside the pass only groups the VAOs
+    //static casters (floor, the scene's cubes, the chrome cubes) are drawn only into the cached layers that are out of date
+    if (cascades.StaticDirtyMask())
     {
-        modelMat = glm::mat4(1.0f);
-        modelMat = glm::translate(modelMat, cubePositions[i]);
-        shader.setMat4("modelMat", modelMat);
-        glDrawArrays(GL_TRIANGLES, 0, 36);
+        queue.Submit(RenderQueue::PASS_SHADOW_STATIC, shader, depthObjectUniform, objects.floor, materials.none, planeVAO, 6, glm::vec3(0.0f));
+        queue.Submit(RenderQueue::PASS_SHADOW_STATIC, shader, depthObjectUniform, objects.cubes, materials.none, containerVAO, 36, glm::vec3(0.0f), 3);
+        queue.Submit(RenderQueue::PASS_SHADOW_STATIC, shader, depthObjectUniform, objects.chrome, materials.none, mirrorVAO, 36, glm::vec3(0.0f),
+            CHROME_CUBE_COUNT);
     }
-    glBindVertexArray(0);
-    
-    //mirror cube
-    glm::mat4 mirrorModelMat = glm::mat4(1.0f);
-    mirrorModelMat = glm::translate(mirrorModelMat, mirrorCubePos);
-    mirrorModelMat = glm::rotate(mirrorModelMat, glm::radians((float)glfwGetTime() * 20.0f), glm::normalize(glm::vec3(-1.0, 1.0, -1.0)));
-    mirrorModelMat = glm::scale(mirrorModelMat, glm::vec3(0.7f));
-    shader.setMat4("modelMat", mirrorModelMat);
-    glBindVertexArray(mirrorVAO);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-    glBindVertexArray(0);
-    
-    //refracting cube
-    mirrorModelMat = glm::mat4(1.0f);
-    mirrorModelMat = glm::translate(mirrorModelMat, mirrorCubePos + glm::vec3(0.0f, 1.0f, 1.0f));
-    mirrorModelMat = glm::rotate(mirrorModelMat, glm::radians((float)glfwGetTime() * 20.0f), glm::normalize(glm::vec3(-1.0, 1.0, -1.0)));
-    mirrorModelMat = glm::scale(mirrorModelMat, glm::vec3(0.7f));
-    shader.setMat4("modelMat", mirrorModelMat);
-    glBindVertexArray(mirrorVAO);
-    glDrawArrays(GL_TRIANGLES, 0, 36);
-    glBindVertexArray(0);
-    
-    //normal mapping plane
-    modelMat = glm::mat4(1.0f);
-    modelMat = glm::translate(modelMat, glm::vec3(5.0f, 0.5f, 2.0f));
-    modelMat = glm::rotate(modelMat, glm::radians((float)glfwGetTime() * -10.0f), glm::normalize(glm::vec3(1.0, 0.0, 1.0)));
-    modelMat = glm::scale(modelMat, glm::vec3(0.7f));
-    shader.setMat4("modelMat", modelMat);
-    glBindVertexArray(nMapVAO);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-    glBindVertexArray(0);
-    
-    //parallax mapping plane
-    modelMat = glm::mat4(1.0f);
-    modelMat = glm::translate(modelMat, glm::vec3(3.0f, 0.5f, -2.0f));
-    modelMat = glm::rotate(modelMat, glm::radians(sin((float)glfwGetTime()) * 10.0f + 90.0f), glm::normalize(glm::vec3(0.0, 1.0, 0.0)));
-    modelMat = glm::scale(modelMat, glm::vec3(0.7f));
-    shader.setMat4("modelMat", modelMat);
-    glBindVertexArray(nMapVAO);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-    glBindVertexArray(0);
+    //dynamic casters every frame: benchmark cubes, the rotating mirror cubes and the normal and parallax mapping planes
+    int benchmarkCubes = objects.cubeCount - 3;
+    if (useInstancing && benchmarkCubes > 0)
+        queue.Submit(RenderQueue::PASS_SHADOW, shader, depthObjectUniform, objects.cubes + 3, materials.none, containerVAO, 36, glm::vec3(0.0f),
+            benchmarkCubes);
+    else
+        for (int i = 0; i < benchmarkCubes; i++)
+            queue.Submit(RenderQueue::PASS_SHADOW, shader, depthObjectUniform, objects.cubes + 3 + i, materials.none, containerVAO, 36, glm::vec3(0.0f));
+    queue.Submit(RenderQueue::PASS_SHADOW, shader, depthObjectUniform, objects.mirror, materials.none, mirrorVAO, 36, glm::vec3(0.0f));
+    queue.Submit(RenderQueue::PASS_SHADOW, shader, depthObjectUniform, objects.refract, materials.none, mirrorVAO, 36, glm::vec3(0.0f));
+    queue.Submit(RenderQueue::PASS_SHADOW, shader, depthObjectUniform, objects.nMap, materials.none, nMapVAO, 6, glm::vec3(0.0f));
+    queue.Submit(RenderQueue::PASS_SHADOW, shader, depthObjectUniform, objects.parallax, materials.none, nMapVAO, 6, glm::vec3(0.0f));
+    //the spot lights' atlas tiles that are out of date: every caster but the floor, instanced over the tiles
+    GLsizei tiles = (GLsizei)shadowAtlas.DirtyTiles().size();
+    if (tiles > 0)
+    {
+        queue.Submit(RenderQueue::PASS_SHADOW_ATLAS, atlasShader, atlasObjectUniform, objects.cubes, materials.none, containerVAO, 36,
+            glm::vec3(0.0f), objects.cubeCount * tiles);
+        queue.Submit(RenderQueue::PASS_SHADOW_ATLAS, atlasShader, atlasObjectUniform, objects.mirror, materials.none, mirrorVAO, 36, glm::vec3(0.0f), tiles);
+        queue.Submit(RenderQueue::PASS_SHADOW_ATLAS, atlasShader, atlasObjectUniform, objects.refract, materials.none, mirrorVAO, 36, glm::vec3(0.0f), tiles);
+        queue.Submit(RenderQueue::PASS_SHADOW_ATLAS, atlasShader, atlasObjectUniform, objects.nMap, materials.none, nMapVAO, 6, glm::vec3(0.0f), tiles);
+        queue.Submit(RenderQueue::PASS_SHADOW_ATLAS, atlasShader, atlasObjectUniform, objects.parallax, materials.none, nMapVAO, 6, glm::vec3(0.0f), tiles);
+    }
+    //the point lights' cubes that are out of date, one pass each with only the casters inside the light's range
+    struct Caster
+    {
+        int object;
+        GLsizei instances;
+        GLuint vertexArray;
+        GLsizei vertexCount;
+        glm::vec4 bounds;
+    };
+    const Caster casters[] = {
+        { objects.cubes, 1, containerVAO, 36, sceneCubeBounds[0] },
+        { objects.cubes + 1, 1, containerVAO, 36, sceneCubeBounds[1] },
+        { objects.cubes + 2, 1, containerVAO, 36, sceneCubeBounds[2] },
+        { objects.cubes + 3, benchmarkCubes, containerVAO, 36, benchmarkBounds },
+        { objects.mirror, 1, mirrorVAO, 36, glm::vec4(mirrorCubePos, 0.61f) },
+        { objects.refract, 1, mirrorVAO, 36, glm::vec4(mirrorCubePos + glm::vec3(0.0f, 1.0f, 1.0f), 0.61f) },
+        { objects.nMap, 1, nMapVAO, 6, glm::vec4(5.0f, 0.5f, 2.0f, 1.0f) },
+        { objects.parallax, 1, nMapVAO, 6, glm::vec4(3.0f, 0.5f, -2.0f, 1.0f) },
+    };
+    for (const PointShadows::DirtyLight& light : pointShadows.DirtyLights())
+        for (const Caster& caster : casters)
+        {
+            if (caster.instances == 0 || !pointShadows.InRange(light, caster.bounds))
+                continue;
+            if (useInstancing || caster.instances == 1)
+                queue.Submit(RenderQueue::PASS_SHADOW_POINT, pointShader, pointObjectUniform, caster.object, materials.none, caster.vertexArray,
+                    caster.vertexCount, glm::vec3(0.0f), caster.instances, pointShadowUniform, light.slot);
+            else
+                for (int i = 0; i < caster.instances; i++)
+                    queue.Submit(RenderQueue::PASS_SHADOW_POINT, pointShader, pointObjectUniform, caster.object + i, materials.none,
+                        caster.vertexArray, caster.vertexCount, glm::vec3(0.0f), 1, pointShadowUniform, light.slot);
+        }
+}
+
+void printFrameStats()
+{
+    const UniformStats& uniformStats = Shader::stats();
+    std::cout << "frame " << deltaTime * 1000.0f << " ms" << std::endl;
+    std::cout << "  uniforms: " << uniformStats.handleSets << " set through handles, " << uniformStats.nameSets << " by name, "
+        << uniformStats.handleSets + uniformStats.nameSets << " driver lookups avoided" << std::endl;
+    std::cout << "  frame block: " << sizeof(FrameData) << " bytes in 1 upload ("
+        << (frameUniforms.Ring().Persistent() ? "persistent" : "mapped") << " ring, " << frameUniforms.Ring().Stalls << " stalls)" << std::endl;
+    std::cout << "  shader variants: " << ShaderVariants::Built() << " built, PCF " << shadowPcfTaps << " taps, flashlight "
+        << (useSpotlight ? "on" : "off") << std::endl;
+    std::cout << "  shadows: " << cascades.Settings.count << " cascades of " << cascades.Settings.resolution << "x"
+        << cascades.Settings.resolution << ", " << cascades.MemoryBytes() / (1024.0 * 1024.0) << " MB, split lambda "
+        << cascades.Settings.splitLambda << ", splits at";
+    for (int i = 0; i < cascades.Settings.count; i++)
+        std::cout << " " << cascades.Splits[i];
+    std::cout << std::endl;
+    std::cout << "  shadow casters: " << queue.Stats.passDrawCalls[RenderQueue::PASS_SHADOW_STATIC] << " static draws, "
+        << queue.Stats.passDrawCalls[RenderQueue::PASS_SHADOW] << " dynamic draws, " << cascades.StaticRedraws
+        << " cached layers redrawn since startup (" << (glExtensions().copyImage ? "copy image" : "blit") << ")" << std::endl;
+    std::cout << "  shadow filter: " << shadowFilterName(shadowFilter.Mode) << ", " << shadowPcfTaps << " taps, EVSM blur radius "
+        << shadowFilter.BlurRadius << ", " << shadowFilter.MemoryBytes() / (1024.0 * 1024.0) << " MB of moments" << std::endl;
+    std::cout << "  shadow GPU ms (depth / prefilter / lighting):";
+    for (int mode = 0; mode < SHADOW_FILTER_MODES; mode++)
+        std::cout << " " << shadowFilterName(mode) << " " << shadowTimer.Milliseconds(mode) << " / "
+            << prefilterTimer.Milliseconds(mode) << " / " << lightingTimer.Milliseconds(mode + lightingTag() - shadowFilter.Mode)
+            << (mode + 1 < SHADOW_FILTER_MODES ? "," : "");
+    std::cout << std::endl;
+    const ShadowAtlasStats& atlasStats = shadowAtlas.Stats;
+    std::cout << "  shadow atlas: " << atlasStats.tiles << " spot light tiles (" << atlasStats.redrawn << " redrawn, "
+        << atlasStats.reused << " reused), " << atlasStats.dropped << " dropped, " << shadowAtlas.Occupancy() * 100.0f << "% of "
+        << shadowAtlas.Settings.size << "x" << shadowAtlas.Settings.size << " (" << shadowAtlas.MemoryBytes() / (1024.0 * 1024.0) << " MB) used, "
+        << queue.Stats.passDrawCalls[RenderQueue::PASS_SHADOW_ATLAS] << " draws" << std::endl;
+    const PointShadowStats& pointStats = pointShadows.Stats;
+    std::cout << "  point shadows: " << pointStats.lights << " of " << MAX_POINT_SHADOWS << " cubes (" << pointStats.redrawn << " redrawn, "
+        << pointStats.reused << " reused), " << pointStats.dropped << " dropped, " << pointStats.casters << " casters in range, "
+        << pointStats.culled << " culled, " << queue.Stats.passDrawCalls[RenderQueue::PASS_SHADOW_POINT] << " draws, "
+        << pointShadows.MemoryBytes() / (1024.0 * 1024.0) << " MB" << std::endl;
+    const ClusterStats& clusterStats = lightClusters.Stats;
+    std::cout << "  light clusters: " << (clusteredLighting ? "on" : "off, every light per pixel") << ", " << lightUniforms.Lights.size()
+        << " lights (" << clusterStats.lights << " visible) in " << lightClusters.ClusterCount() << " froxels, " << clusterStats.occupied
+        << " occupied, " << clusterStats.indices << " indices" << (clusterStats.overflow ? " (overflow)" : "") << ", "
+        << (clusterStats.occupied ? (float)clusterStats.indices / clusterStats.occupied : 0.0f) << " average / " << clusterStats.maxLights
+        << " max per froxel, " << clusterStats.milliseconds << " ms on " << ThreadPool::Instance().Threads() << " threads, lighting GPU "
+        << lightingTimer.Milliseconds(lightingTag()) << " ms" << std::endl;
+    std::cout << "  pipeline: " << (deferredShading ? "deferred" : "forward") << ", G-buffer " << WIDTH << "x" << HEIGHT << " ("
+        << gBuffer.MemoryBytes() / (1024.0 * 1024.0) << " MB), " << queue.Stats.passDrawCalls[RenderQueue::PASS_OPAQUE] << " opaque draws, "
+        << shadowFilterName(shadowFilter.Mode) << " lighting GPU ms forward " << lightingTimer.Milliseconds(shadowFilter.Mode)
+        << " / deferred " << lightingTimer.Milliseconds(shadowFilter.Mode + SHADOW_FILTER_MODES) << std::endl;
+    std::cout << "  screen-space reflections: ";
+    if (ssrLevel == 0)
+        std::cout << "off";
+    else
+        std::cout << (ssrLevel == 1 ? "half" : "quarter") << " resolution, " << screenSpaceReflections.TraceWidth() << "x"
+            << screenSpaceReflections.TraceHeight() << " rays of at most " << screenSpaceReflections.Settings.maxSteps << " steps through "
+            << screenSpaceReflections.Levels() << " depth levels (" << screenSpaceReflections.MemoryBytes() / (1024.0 * 1024.0) << " MB)"
+            << (deferredShading ? "" : ", idle until G switches to the deferred pipeline");
+    std::cout << ", GPU ms half " << ssrTimer.Milliseconds(1) << " / quarter " << ssrTimer.Milliseconds(2) << std::endl;
+    std::cout << "  environment: " << imageBasedLighting.MemoryBytes() / (1024.0 * 1024.0) << " MB prefiltered and BRDF table, "
+        << (imageBasedLighting.Stats.environmentCached ? "from the cache" : "computed this run") << ", mirror roughness "
+        << MIRROR_ROUGHNESSES[mirrorRoughnessLevel] << std::endl;
+    const ReflectionProbeStats& probeStats = reflectionProbes.Stats;
+    std::cout << "  reflection probes: " << reflectionProbes.Count() << " cubes of " << reflectionProbes.Settings.resolution << "x"
+        << reflectionProbes.Settings.resolution << " (" << reflectionProbes.MemoryBytes() / (1024.0 * 1024.0) << " MB), ";
+    if (PROBE_FACE_BUDGETS[probeBudgetLevel] == 0)
+        std::cout << "off, the mirror cubes see the sky";
+    else
+        std::cout << PROBE_FACE_BUDGETS[probeBudgetLevel] << " faces per frame, " << probeStats.faces << " of probe " << probeStats.probe
+            << " rendered, " << probeStats.dirty << " out of date, oldest waited " << probeStats.oldest << " frames, GPU "
+            << probeTimer.Milliseconds() << " ms";
+    std::cout << std::endl;
+    const BakedProbeStats& bakedStats = bakedProbes.Stats;
+    int blending = 0;
+    for (int i = 0; i < CHROME_CUBE_COUNT; i++)
+        blending += bakedProbes.Selection(chromeCubePosition(i)) >> 16 ? 1 : 0;
+    std::cout << "  baked probes: " << bakedProbes.Count() << " of " << bakedProbes.Settings.resolution << "x" << bakedProbes.Settings.resolution
+        << " in " << (bakedStats.compressed ? "BC1" : "RGBA8, no S3TC") << " (" << bakedProbes.MemoryBytes() / (1024.0 * 1024.0) << " MB), ";
+    if (bakedProbes.Capturing())
+        std::cout << "capturing, frame " << bakedStats.captureFrames;
+    else
+        std::cout << (bakedStats.cached ? "loaded from the cache in " : "captured over " + std::to_string(bakedStats.captureFrames)
+            + " frames, compressed in ") << bakedStats.compressMilliseconds << " ms";
+    std::cout << ", " << CHROME_CUBE_COUNT << " chrome cubes " << (useBakedProbes ? "reflect them, " + std::to_string(blending)
+        + " blending two" : std::string("see the sky")) << std::endl;
+    std::cout << "  lightmap: " << (useLightmap ? (deferredShading ? "on, unused by the deferred pipeline" : "on") : "off") << ", "
+        << lightmap.Width << "x" << lightmap.Height << " (" << lightmap.MemoryBytes() / (1024.0 * 1024.0) << " MB with the shadow mask), "
+        << lightmap.Stats.charts << " charts, " << (lightmap.Stats.cached ? "from the cache" : "baked this run") << std::endl;
+    const BillboardStats& billboardStats = billboardRenderer.Stats;
+    std::cout << "  billboards: " << billboardStats.visible << " of " << billboardStats.count << " drawn in 1 instanced draw, "
+        << billboardStats.depthMilliseconds << " ms depth, " << billboardStats.sortMilliseconds << " ms radix sort ("
+        << billboardStats.sortPasses << " passes), " << billboardStats.uploadMilliseconds << " ms upload" << std::endl;
+    std::cout << "  transparency: " << (useWeightedBlending ? "weighted blended, unsorted" : "sorted back to front") << ", "
+        << queue.Stats.passDrawCalls[RenderQueue::PASS_TRANSPARENT] << " sorted / " << queue.Stats.passDrawCalls[RenderQueue::PASS_WEIGHTED]
+        << " weighted draws, " << weightedTransparency.MemoryBytes() / (1024.0 * 1024.0) << " MB of weighted targets" << std::endl;
+    std::cout << "  sprite atlas: " << spriteAtlas.Stats.sprites << " sprites on " << spriteAtlas.Stats.pages << " pages of "
+        << spriteAtlas.Settings.pageSize << "x" << spriteAtlas.Settings.pageSize << ", " << spriteAtlas.Stats.occupancy * 100.0f << "% used, "
+        << spriteAtlas.MemoryBytes() / (1024.0 * 1024.0) << " MB, built in " << spriteAtlas.Stats.milliseconds << " ms" << std::endl;
+    const ParticleStats& particleStats = particles.Stats;
+    std::cout << "  particles: " << particleStats.live << " live (" << particleStats.emitted << " emitted, " << particleStats.died
+        << " died), " << particleStats.simulateMilliseconds << " ms simulating, " << particleStats.compactMilliseconds << " ms compacting, "
+        << particleStats.uploadMilliseconds << " ms upload, " << ParticleSystem::SimdWidth() << " wide SIMD on "
+        << ThreadPool::Instance().Threads() << " threads, " << particles.MemoryBytes() / (1024.0 * 1024.0) << " MB" << std::endl;
+    std::cout << "  transforms: " << transforms.Count() << " objects in " << transforms.Milliseconds << " ms" << std::endl;
+    const RenderQueueStats& queueStats = queue.Stats;
+    std::cout << "  render queue: " << queueStats.items << " items, " << queueStats.buildMilliseconds << " ms build, "
+        << queueStats.sortMilliseconds << " ms sort, " << queueStats.programChanges << " program / " << queueStats.materialChanges
+        << " material / " << queueStats.vertexArrayChanges << " VAO switches" << std::endl;
+    std::cout << "  draws: " << queueStats.drawCalls << " calls for " << queueStats.instances << " objects, "
+        << BENCHMARK_COUNTS[benchmarkLevel] << " benchmark cubes, instancing " << (useInstancing ? "on" : "off") << std::endl;
+    const GLStateStats& stateStats = glState.Stats;
+    std::cout << "  gl state: " << stateStats.issued << " calls issued, " << stateStats.elided << " elided" << std::endl;
 }
 
 #ifdef DEBUG
@@ -458,7 +860,7 @@ void renderQuad()
         };
         glGenVertexArrays(1, &quadVAO);
         glGenBuffers(1, &quadVBO);
-        glBindVertexArray(quadVAO);
+        glState.BindVertexArray(quadVAO);
         glBindBuffer(GL_ARRAY_BUFFER, quadVBO);
         glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
         glEnableVertexAttribArray(0);
@@ -466,9 +868,8 @@ void renderQuad()
         glEnableVertexAttribArray(1);
         glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
     }
-    glBindVertexArray(quadVAO);
+    glState.BindVertexArray(quadVAO);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-    glBindVertexArray(0);
 }
 #endif
 //=====================================================================================================================================================================================================
@@ -483,6 +884,9 @@ int main()
     glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     glfwWindowHint(GLFW_RESIZABLE, GL_FALSE);
+    //a 24/8 depth stencil buffer, the weighted transparency pass blits its depth into a DEPTH24_STENCIL8 target
+    glfwWindowHint(GLFW_DEPTH_BITS, 24);
+    glfwWindowHint(GLFW_STENCIL_BITS, 8);
 
 #ifdef __APPLE__
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
@@ -506,32 +910,111 @@ int main()
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    loadGLExtensions();
 
     glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
 
     int width, height;
     glfwGetFramebufferSize(window, &width, &height);
-    glViewport(0, 0, width, height);
-
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_STENCIL_TEST);
-    glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
-    glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-
-    //Build and compile our shader programs
-    Shader myShader("../shaders/default.vs", "../shaders/default.fs");
+    glState.Viewport(0, 0, width, height);
+
+    glState.Enable(GL_DEPTH_TEST);
+    glState.Enable(GL_STENCIL_TEST);
+    glState.StencilFunc(GL_NOTEQUAL, 1, 0xFF);
+    glState.StencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+    glState.Enable(GL_BLEND);
+    glState.BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glState.DepthFunc(GL_LESS);
+    //the prefiltered environment's rough levels would show the face edges otherwise
+    glState.Enable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+
+    //Build and compile our shader programs. Everything is submitted first and only resolved after the
+    //textures are decoded, so the driver compiles while we load
+    GLfloat submitStart = glfwGetTime();
+    Shader::registerUniformBlock("FrameData", FRAME_DATA_BINDING);
+    Shader::registerUniformBlock("LightData", LIGHT_DATA_BINDING);
+    Shader::registerUniformBlock("BakedProbeData", BAKED_PROBE_DATA_BINDING);
+    Shader::registerSampler("transforms", TRANSFORM_TEXTURE_UNIT);
+    Shader::registerSampler("shadowAtlas", SHADOW_ATLAS_TEXTURE_UNIT);
+    Shader::registerSampler("pointShadowMap", POINT_SHADOW_TEXTURE_UNIT);
+    Shader::registerSampler("lights", LIGHT_BUFFER_TEXTURE_UNIT);
+    Shader::registerSampler("lightClusters", LIGHT_CLUSTER_TEXTURE_UNIT);
+    Shader::registerSampler("lightIndices", LIGHT_INDEX_TEXTURE_UNIT);
+    Shader::registerSampler("environmentMap", ENVIRONMENT_TEXTURE_UNIT);
+    Shader::registerSampler("brdfLut", BRDF_LUT_TEXTURE_UNIT);
+    Shader::registerSampler("lightmap", LIGHTMAP_TEXTURE_UNIT);
+    Shader::registerSampler("shadowMask", SHADOW_MASK_TEXTURE_UNIT);
+    Shader::registerSampler("bakedProbes", BAKED_PROBE_TEXTURE_UNIT);
+    Shader::registerSampler("screenSpaceReflections", SCREEN_SPACE_REFLECTION_TEXTURE_UNIT);
+    //families compiled into one program per #define key, texture units are set once per variant
+    ShaderVariants defaultVariants("../shaders/default.vs", "../shaders/default.fs", [](Shader& shader) {
+        shader.Use();
+        shader.setInt("material.diffuse", 0);
+        shader.setInt("material.specular", 1);
+        shader.setInt("material.emission", 2);
+        shader.setInt("shadowMap", SHADOW_TEXTURE_UNIT);
+        shader.setFloat("material.shininess", 64.0f);
+    });
+    ShaderVariants mirrorVariants("../shaders/mirrorCube.vs", "../shaders/mirrorCube.fs", [](Shader& shader) {
+        shader.Use();
+        shader.setInt("skybox", 0);
+    });
+    ShaderVariants nMapVariants("../shaders/normal_mapping.vs", "../shaders/normal_mapping.fs", [](Shader& shader) {
+        shader.Use();
+        shader.setInt("diffuseMap", 0);
+        shader.setInt("normalMap", 1);
+    });
+    ShaderVariants parallaxVariants("../shaders/parallax.vs", "../shaders/parallax.fs", [](Shader& shader) {
+        shader.Use();
+        shader.setInt("diffuseMap", 0);
+        shader.setInt("normalMap", 1);
+        shader.setInt("depthMap", 2);
+        shader.setFloat("heightScale", 0.1f);
+    });
+    //the deferred lighting pass reads the G-buffer on the material units
+    ShaderVariants deferredVariants("../shaders/fullscreen.vs", "../shaders/deferred_lighting.fs", [](Shader& shader) {
+        shader.Use();
+        shader.setInt("gAlbedoMap", 0);
+        shader.setInt("gNormalMap", 1);
+        shader.setInt("gDepthMap", 2);
+        shader.setInt("shadowMap", SHADOW_TEXTURE_UNIT);
+    });
+    //both pipelines' surface programs up front, so G switches without waiting on the compiler
+    const ShaderKey parallaxKey = ShaderKey().Define("PARALLAX_MIN_LAYERS", 8).Define("PARALLAX_MAX_LAYERS", 32);
+    const ShaderKey gBufferKey = ShaderKey().Define("GBUFFER");
+    defaultVariants.Submit(defaultVariantKey());
+    defaultVariants.Submit(ShaderKey(defaultVariantKey()).Define("LIGHTMAP"));
+    mirrorVariants.Submit();
+    mirrorVariants.Submit(ShaderKey().Define("REFRACT"));
+    nMapVariants.Submit();
+    parallaxVariants.Submit(parallaxKey);
+    defaultVariants.Submit(gBufferKey);
+    defaultVariants.Submit(ShaderKey(gBufferKey).Define("REFLECTIVE"));
+    mirrorVariants.Submit(gBufferKey);
+    mirrorVariants.Submit(ShaderKey(gBufferKey).Define("REFRACT"));
+    nMapVariants.Submit(gBufferKey);
+    parallaxVariants.Submit(ShaderKey(parallaxKey).Define("GBUFFER"));
+    deferredVariants.Submit(defaultVariantKey());
+    deferredVariants.Submit(ShaderKey(defaultVariantKey()).Define("SCREEN_SPACE_REFLECTIONS"));
     Shader outlineShader("../shaders/outline.vs", "../shaders/outline.fs");
     Shader billboardShader("../shaders/billboard.vs", "../shaders/billboard.fs");
+    Shader weightedBillboardShader("../shaders/billboard.vs", "../shaders/billboard_weighted.fs");
+    Shader compositeShader("../shaders/fullscreen.vs", "../shaders/weighted_composite.fs");
     Shader skyboxShader("../shaders/skybox.vs", "../shaders/skybox.fs");
-    Shader mirrorShader("../shaders/mirrorCube.vs", "../shaders/mirrorCube.fs");
-    Shader simpleDepthShader("../shaders/shadow_mapping.vs", "../shaders/shadow_mapping.fs");
-    Shader nMapShader("../shaders/normal_mapping.vs", "../shaders/normal_mapping.fs");
-    Shader parallaxShader("../shaders/parallax.vs", "../shaders/parallax.fs");
+    Shader simpleDepthShader("../shaders/shadow_mapping.vs", "../shaders/shadow_mapping.fs", "../shaders/shadow_mapping.gs");
+    Shader atlasDepthShader("../shaders/shadow_atlas.vs", "../shaders/shadow_mapping.fs");
+    Shader pointDepthShader("../shaders/shadow_mapping.vs", "../shaders/shadow_mapping.fs", "../shaders/shadow_point.gs");
+    //reflection probe faces: the surfaces, the normal mapping planes with their vertex layout, the lightmapped ones and the sky
+    Shader probeShader("../shaders/probe.vs", "../shaders/probe.fs", "../shaders/probe.gs");
+    Shader probeTangentShader("../shaders/probe.vs", "../shaders/probe.fs", "../shaders/probe.gs", "#define TANGENT_LAYOUT 1\n");
+    Shader probeLightmapShader("../shaders/probe.vs", "../shaders/probe.fs", "../shaders/probe.gs", "#define LIGHTMAP 1\n");
+    Shader probeSkyShader("../shaders/probe.vs", "../shaders/probe.fs", "../shaders/probe.gs", "#define SKY 1\n");
 #ifdef DEBUG
     Shader debugDepthQuad("../shaders/3.1.3.debug_quad.vs", "../shaders/3.1.3.debug_quad.fs");    //DEBUG
 #endif
+    GLfloat submitTime = glfwGetTime() - submitStart;
+    frameUniforms.Create();
+    transforms.Create(BENCHMARK_COUNTS[3] + SCENE_TRANSFORMS);   //the largest benchmark plus the scene
 
     float skyboxVertices[] = {
     -1.0f,  1.0f, -1.0f,
@@ -656,6 +1139,14 @@ int main()
         glm::vec3(1.0f, 2.5f, -2.5f),
         glm::vec3(1.2f, 1.5f, 1.0f)
     };
+    //and the baked reflection probes: where each captures the scene, the box its reflections are projected onto and
+    //how far inside it they fade into the next; the floor ends every box, so none fades vertically
+    std::vector<BakedProbe> bakedProbeLayout
+    {
+        { glm::vec3(0.3f, 0.5f, -0.6f), glm::vec3(-5.0f, -0.5f, -5.0f), glm::vec3(5.0f, 4.0f, 5.0f), glm::vec3(1.0f, 0.0f, 1.0f) },
+        { glm::vec3(-6.5f, 1.0f, 2.0f), glm::vec3(-10.0f, -0.5f, -2.0f), glm::vec3(-3.5f, 5.0f, 6.0f), glm::vec3(1.0f, 0.0f, 1.0f) },
+        { glm::vec3(0.0f, 2.5f, 0.0f), glm::vec3(-10.0f, -0.5f, -10.0f), glm::vec3(10.0f, 12.0f, 10.0f), glm::vec3(1.0f, 0.0f, 1.0f) }
+    };
     //skybox locatoins and load
     std::vector<std::string> skyboxFaces
     {
@@ -666,7 +1157,9 @@ int main()
         "../textures/skybox/front.jpg",
         "../textures/skybox/back.jpg"
     };
-    unsigned int skyboxTexture = loadSkybox(skyboxFaces);
+    GLfloat loadStart = glfwGetTime();
+    CubeFaces skyboxPixels;
+    unsigned int skyboxTexture = loadSkybox(skyboxFaces, skyboxPixels);
 
     stbi_set_flip_vertically_on_load(true);
 
@@ -674,7 +1167,7 @@ int main()
     unsigned int VBO, containerVAO;
     glGenVertexArrays(1, &containerVAO);
     glGenBuffers(1, &VBO);
-    glBindVertexArray(containerVAO);
+    glState.BindVertexArray(containerVAO);
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (GLvoid*)0);
@@ -684,13 +1177,13 @@ int main()
     glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (GLvoid*)(5 * sizeof(float)));
     glEnableVertexAttribArray(2);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    glState.BindVertexArray(0);
 
     //for floor
     unsigned int planeVAO, planeVBO;
     glGenVertexArrays(1, &planeVAO);
     glGenBuffers(1, &planeVBO);
-    glBindVertexArray(planeVAO);
+    glState.BindVertexArray(planeVAO);
     glBindBuffer(GL_ARRAY_BUFFER, planeVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(planeVertices), &planeVertices, GL_STATIC_DRAW);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
@@ -699,44 +1192,55 @@ int main()
     glEnableVertexAttribArray(1);
     glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(5 * sizeof(float)));
     glEnableVertexAttribArray(2);
-    glBindVertexArray(0);
+    glState.BindVertexArray(0);
 
     //for billboards
     unsigned int transparentVAO, transparentVBO;
     glGenVertexArrays(1, &transparentVAO);
     glGenBuffers(1, &transparentVBO);
-    glBindVertexArray(transparentVAO);
+    glState.BindVertexArray(transparentVAO);
     glBindBuffer(GL_ARRAY_BUFFER, transparentVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(transparentVertices), transparentVertices, GL_STATIC_DRAW);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
     glEnableVertexAttribArray(1);
-    glBindVertexArray(0);
+    glState.BindVertexArray(0);
+    //the billboards share its quad, their instances come from a stream buffer
+    billboardRenderer.Create(transparentVBO, 3 + BILLBOARD_COUNTS[3]);
+    //and so do the particles, with room for the largest benchmark and what is emitted before the oldest die
+    ParticleSettings particleSettings;
+    particleSettings.capacity = PARTICLE_COUNTS[3] + PARTICLE_COUNTS[3] / 4;
+    particles.Create(transparentVBO, particleSettings);
+    particles.Emitter.position = glm::vec3(-2.2f, -0.5f, -2.0f);
 
     //for skybox
     unsigned int skyboxVAO, skyboxVBO;
     glGenVertexArrays(1, &skyboxVAO);
     glGenBuffers(1, &skyboxVBO);
-    glBindVertexArray(skyboxVAO);
+    glState.BindVertexArray(skyboxVAO);
     glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), skyboxVertices, GL_STATIC_DRAW);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (GLvoid*)0);
     glEnableVertexAttribArray(0);
-    glBindVertexArray(0);
+    glState.BindVertexArray(0);
     
     //for mirror and refraction cubes
     unsigned int mirrorVAO;
     glGenVertexArrays(1, &mirrorVAO);
-    glBindVertexArray(mirrorVAO);
+    glState.BindVertexArray(mirrorVAO);
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (GLvoid*)0);
     glEnableVertexAttribArray(0);
     glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (GLvoid*)(5 * sizeof(float)));
     glEnableVertexAttribArray(1);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    glState.BindVertexArray(0);
     
+    //for full screen passes, the triangle needs no attributes but core GL needs a VAO
+    unsigned int emptyVAO;
+    glGenVertexArrays(1, &emptyVAO);
+
     //for normal mapping
     unsigned int nMapVAO, nMapVBO;
     //coords
@@ -804,7 +1308,7 @@ int main()
     };
     glGenVertexArrays(1, &nMapVAO);
     glGenBuffers(1, &nMapVBO);
-    glBindVertexArray(nMapVAO);
+    glState.BindVertexArray(nMapVAO);
     glBindBuffer(GL_ARRAY_BUFFER, nMapVBO);
     glBufferData(GL_ARRAY_BUFFER, sizeof(quadVertices), &quadVertices, GL_STATIC_DRAW);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 14 * sizeof(float), (void*)0);
@@ -818,58 +1322,405 @@ int main()
     glVertexAttribPointer(4, 3, GL_FLOAT, GL_FALSE, 14 * sizeof(float), (void*)(11 * sizeof(float)));
     glEnableVertexAttribArray(4);
     glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
-
-    //framebuffer for shadows
-    const unsigned int SHADOW_WIDTH = 1280, SHADOW_HEIGHT = 1280;
-    unsigned int shadowMapFBO;
-    glGenFramebuffers(1, &shadowMapFBO);
-    unsigned int shadowMap;
-    glGenTextures(1, &shadowMap);
-    glBindTexture(GL_TEXTURE_2D, shadowMap);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-    float borderColor[] = { 1.0, 1.0, 1.0, 1.0 };
-    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-    glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, shadowMap, 0);
-    glDrawBuffer(GL_NONE);
-    glReadBuffer(GL_NONE);
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glState.BindVertexArray(0);
+
+    //cascaded shadow maps for the direct light
+    CascadeSettings cascadeSettings;
+    cascadeSettings.splitLambda = SPLIT_LAMBDAS[splitLevel];
+    cascades.Create(cascadeSettings);
+    shadowFilter.Create(cascades);
+    shadowTimer.Create();
+    probeTimer.Create();
+    //local lights: the flashlight first, then fixed point lights around the cubes and a spot light from the left
+    LocalLight flashlight;
+    flashlight.type = LIGHT_SPOT;
+    flashlight.range = 50.0f;         //chose constants for 50 units
+    flashlight.linear = 0.09f;
+    flashlight.quadratic = 0.032f;
+    flashlight.innerCutOff = glm::cos(glm::radians(12.5f));
+    flashlight.outerCutOff = glm::cos(glm::radians(15.5f));
+    sceneLights.push_back(flashlight);
+    glm::vec3 pointLightPositions[numberOfPointLights] = { glm::vec3(-2.0f, 1.0f, -3.0f), glm::vec3(3.5f, 1.5f, 0.5f) };
+    glm::vec3 pointLightColors[numberOfPointLights] = { glm::vec3(1.0f, 0.6f, 0.3f), glm::vec3(0.3f, 0.5f, 1.0f) };
+    for (int i = 0; i < numberOfPointLights; i++)
+    {
+        LocalLight pointLight;
+        pointLight.position = pointLightPositions[i];
+        pointLight.color = pointLightColors[i];
+        pointLight.range = 4.0f;
+        pointLight.linear = 0.35f;
+        pointLight.quadratic = 0.44f;
+        sceneLights.push_back(pointLight);
+    }
+    LocalLight spotLight;
+    spotLight.type = LIGHT_SPOT;
+    spotLight.position = glm::vec3(-4.0f, 3.5f, -0.5f);
+    spotLight.direction = glm::vec3(0.0f, 0.0f, -1.0f) - spotLight.position;
+    spotLight.color = glm::vec3(0.9f, 0.9f, 0.8f);
+    spotLight.range = 10.0f;
+    spotLight.linear = 0.14f;
+    spotLight.quadratic = 0.07f;
+    spotLight.innerCutOff = glm::cos(glm::radians(20.0f));
+    spotLight.outerCutOff = glm::cos(glm::radians(25.0f));
+    sceneLights.push_back(spotLight);
+    sceneLightCount = sceneLights.size();
+    lightUniforms.Create();
+    ClusterSettings clusterSettings;
+    clusterSettings.nearPlane = 0.1f;
+    clusterSettings.farPlane = 100.0f;
+    lightClusters.Create(WIDTH, HEIGHT, clusterSettings);
+    gBuffer.Create(WIDTH, HEIGHT);
+    ScreenSpaceReflectionSettings ssrSettings;
+    ssrSettings.divisor = SSR_DIVISORS[ssrLevel];
+    screenSpaceReflections.Create(WIDTH, HEIGHT, ssrSettings);
+    weightedTransparency.Create(WIDTH, HEIGHT);
+    shadowAtlas.Create(ShadowAtlasSettings());
+    pointShadows.Create(512);
+    //one probe in each mirror cube, reflecting what moves within 12 units
+    reflectionProbes.Add(mirrorCubePos, 12.0f);
+    reflectionProbes.Add(mirrorCubePos + glm::vec3(0.0f, 1.0f, 1.0f), 12.0f);
+    ReflectionProbeSettings probeSettings;
+    probeSettings.resolution = PROBE_RESOLUTIONS[probeResolutionLevel];
+    reflectionProbes.Create(probeSettings);
+    prefilterTimer.Create();
+    lightingTimer.Create();
+    //inside the lighting timer's stretch
+    ssrTimer.Create(true);
 
     unsigned int diffuseMap = loadTexture("../textures/container2.png");
     unsigned int specularMap = loadTexture("../textures/container2_specular.png");
     unsigned int emissionMap = loadTexture("../textures/matrix.jpg");
     unsigned int floorTexture = loadTexture("../textures/metal_floor.jpg");
-    unsigned int billboardTexture = loadTexture("../textures/window.png");
     unsigned int nMapDiffuseMap = loadTexture("../textures/Wall_Stone.jpg");
     unsigned int nMapNormalMap = loadTexture("../textures/Wall_Stone_normal.jpg");
     unsigned int parallaxDiffuse = loadTexture("../textures/Sci-fi_Wall_009_basecolor.jpg");
     unsigned int parallaxNormal = loadTexture("../textures/Sci-fi_Wall_009_normal.jpg");
     unsigned int parallaxHeight = loadTexture("../textures/Sci-fi_Wall_009_height.png");
+    //the window first, the scene's billboards show sprite 0
+    loadSprite(spriteAtlas, "../textures/window.png");
+    loadSprite(spriteAtlas, "../textures/awesomeface.png");
+    int particleSprite = spriteAtlas.Add(ParticleSystem::SpritePixels(64).data(), 64, 64);
+    spriteAtlas.Build(SpriteAtlasSettings());
+    billboardRenderer.SetFrames(spriteAtlas.Frames);
+    particles.Sprite = spriteAtlas.Frames[particleSprite];
+    GLfloat loadTime = glfwGetTime() - loadStart;
+
+    //now resolve the programs, this only waits for the ones the driver hasn't finished yet
+    GLfloat resolveStart = glfwGetTime();
+    Shader* plainPrograms[] = { &outlineShader, &billboardShader, &skyboxShader, &weightedBillboardShader, &compositeShader,
+        &simpleDepthShader, &atlasDepthShader, &pointDepthShader, &probeShader, &probeTangentShader, &probeLightmapShader, &probeSkyShader };
+    unsigned int programsReady = 0, programsSubmitted = 0;
+    for (Shader* program : plainPrograms)
+    {
+        programsReady += program->Ready() ? 1 : 0;
+        programsSubmitted++;
+    }
+    //the surface programs of the current pipeline, picked again whenever a key changes them
+    Shader* myShader = &defaultVariants.Get(defaultVariantKey());
+    Shader* floorShader = myShader;
+    Shader* mirrorShader = &mirrorVariants.Get();
+    Shader* refractShader = &mirrorVariants.Get(ShaderKey().Define("REFRACT"));
+    Shader* chromeShader = &mirrorVariants.Get(ShaderKey().Define("BAKED_PROBES"));
+    Shader* nMapShader = &nMapVariants.Get();
+    Shader* parallaxShader = &parallaxVariants.Get(parallaxKey);
+    Shader* lightingShader = nullptr;
+    Shader* lightmapShader = nullptr;
+    outlineObjectUniform = outlineShader.uniform<int>("objectIndex");
+    depthObjectUniform = simpleDepthShader.uniform<int>("objectIndex");
+    depthCascadeMaskUniform = simpleDepthShader.uniform<int>("cascadeMask");
+    atlasObjectUniform = atlasDepthShader.uniform<int>("objectIndex");
+    atlasTileCountUniform = atlasDepthShader.uniform<int>("tileCount");
+    atlasTilesUniform = atlasDepthShader.uniform<int>("tiles[0]");
+    pointObjectUniform = pointDepthShader.uniform<int>("objectIndex");
+    pointShadowUniform = pointDepthShader.uniform<int>("pointShadow");
+    Shader* probeShaders[] = { &probeShader, &probeTangentShader, &probeLightmapShader, &probeSkyShader };
+    for (int i = 0; i < 4; i++)
+    {
+        probeFaceMatricesUniforms[i] = probeShaders[i]->uniform<glm::mat4>("faceMatrices[0]");
+        probeFaceMaskUniforms[i] = probeShaders[i]->uniform<int>("faceMask");
+    }
+    probeObjectUniform = probeShader.uniform<int>("objectIndex");
+    probeTangentObjectUniform = probeTangentShader.uniform<int>("objectIndex");
+    probeLightmapObjectUniform = probeLightmapShader.uniform<int>("objectIndex");
+    probeSkyPositionUniform = probeSkyShader.uniform<glm::vec3>("probePosition");
+    GLfloat resolveTime = glfwGetTime() - resolveStart;
+
+    const ProgramCacheStats& programStats = ProgramCache::Instance().Stats;
+    std::cout << "program cache: " << programStats.hits << " hits, " << programStats.misses << " misses ("
+        << programStats.rejected << " rejected), " << programStats.loadMilliseconds << " ms loading binaries, "
+        << programStats.compileMilliseconds << " ms compiling" << std::endl;
+    std::cout << "startup: " << submitTime * 1000.0f << " ms submitting programs, " << loadTime * 1000.0f << " ms loading textures, "
+        << resolveTime * 1000.0f << " ms waiting on programs (" << programsReady << " of " << programsSubmitted << " plain programs already done, parallel compile "
+        << (glExtensions().parallelShaderCompile ? "on" : "off") << ")" << std::endl;
+    //the sky's irradiance, reflections and BRDF table, computed on the thread pool unless the cache has them
+    if (skyboxPixels.pixels.size() != 6)
+        skyboxPixels = CubeFaces();
+    imageBasedLighting.Create(skyboxPixels, ImageBasedLightingSettings());
+    skyboxPixels = CubeFaces();
+    const ImageBasedLightingStats& iblStats = imageBasedLighting.Stats;
+    std::cout << "image based lighting: " << imageBasedLighting.Settings.size << "x" << imageBasedLighting.Settings.size << " environment, "
+        << imageBasedLighting.Settings.levels << " levels " << (iblStats.environmentCached ? "loaded" : "prefiltered") << " in "
+        << iblStats.environmentMilliseconds << " ms (" << iblStats.hashMilliseconds << " ms hashing the faces), BRDF table "
+        << (iblStats.lutCached ? "loaded" : "integrated") << " in " << iblStats.lutMilliseconds << " ms, "
+        << ThreadPool::Instance().Threads() << " threads" << std::endl;
+
+    //the static surfaces' lighting, path traced on the thread pool unless the cache has it; the albedos are the
+    //textures' means, the floor sits where its transform puts it
+    int floorSurface = lightmap.AddSurface(planeVertices, 6, 8, 5, glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -0.01f, 0.0f)),
+        averageTextureColor(floorTexture));
+    int cubeSurfaces[3];
+    glm::vec3 cubeAlbedo = averageTextureColor(diffuseMap);
+    for (int i = 0; i < 3; i++)
+        cubeSurfaces[i] = lightmap.AddSurface(vertices, 36, 8, 5, glm::translate(glm::mat4(1.0f), cubePositions[i]), cubeAlbedo);
+    LightmapLighting bakedLighting = { directLightPos, directLightDiffuse, directLightAmbient };
+    lightmap.Bake(LightmapSettings(), bakedLighting, imageBasedLighting);
+    const LightmapStats& lightmapStats = lightmap.Stats;
+    std::cout << "lightmap: " << lightmapStats.triangles << " static triangles in " << lightmapStats.bvhNodes << " BVH nodes, "
+        << lightmapStats.charts << " charts in " << lightmap.Width << "x" << lightmap.Height << " (" << lightmapStats.texels << " texels, "
+        << lightmapStats.invalidTexels << " buried), " << lightmapStats.chartMilliseconds << " ms charting, "
+        << (lightmapStats.cached ? "loaded" : "baked") << " in " << lightmapStats.bakeMilliseconds << " ms, "
+        << lightmap.Settings.samples << " paths of " << lightmap.Settings.bounces << " bounces per texel on "
+        << ThreadPool::Instance().Threads() << " threads" << std::endl;
+    //the baked probes, from the cache when the scene under them is the same as last time
+    for (const BakedProbe& probe : bakedProbeLayout)
+        bakedProbes.Add(probe);
+    bakedProbes.Create(BakedProbeSettings(), lightmap.CacheKey);
+    //the floor's vertices with their lightmap coordinates as a fourth attribute
+    const std::vector<glm::vec2>& floorCoordinates = lightmap.Coordinates(floorSurface);
+    unsigned int floorLightmapVAO, floorLightmapVBO;
+    glGenVertexArrays(1, &floorLightmapVAO);
+    glGenBuffers(1, &floorLightmapVBO);
+    glState.BindVertexArray(floorLightmapVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, planeVBO);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(5 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+    glBindBuffer(GL_ARRAY_BUFFER, floorLightmapVBO);
+    glBufferData(GL_ARRAY_BUFFER, floorCoordinates.size() * sizeof(glm::vec2), floorCoordinates.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, sizeof(glm::vec2), (void*)0);
+    glEnableVertexAttribArray(3);
+    glState.BindVertexArray(0);
+    //the scene cubes moved into world space, each vertex followed by its lightmap coordinates
+    std::vector<float> staticCubeVertices;
+    for (int i = 0; i < 3; i++)
+    {
+        const std::vector<glm::vec2>& coordinates = lightmap.Coordinates(cubeSurfaces[i]);
+        for (int v = 0; v < 36; v++)
+        {
+            const float* vertex = vertices + v * 8;
+            staticCubeVertices.insert(staticCubeVertices.end(), { vertex[0] + cubePositions[i].x, vertex[1] + cubePositions[i].y,
+                vertex[2] + cubePositions[i].z, vertex[3], vertex[4], vertex[5], vertex[6], vertex[7], coordinates[v].x, coordinates[v].y });
+        }
+    }
+    unsigned int staticCubesVAO, staticCubesVBO;
+    glGenVertexArrays(1, &staticCubesVAO);
+    glGenBuffers(1, &staticCubesVBO);
+    glState.BindVertexArray(staticCubesVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, staticCubesVBO);
+    glBufferData(GL_ARRAY_BUFFER, staticCubeVertices.size() * sizeof(float), staticCubeVertices.data(), GL_STATIC_DRAW);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 10 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 10 * sizeof(float), (void*)(3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 10 * sizeof(float), (void*)(5 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(3, 2, GL_FLOAT, GL_FALSE, 10 * sizeof(float), (void*)(8 * sizeof(float)));
+    glEnableVertexAttribArray(3);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    glState.BindVertexArray(0);
 
     //we need to set up proper texture unit
-    myShader.Use();
-    myShader.setInt("material.diffuse", 0);
-    myShader.setInt("material.specular", 1);
-    myShader.setInt("material.emission", 2);
-    myShader.setInt("shadowMap", 3);
     billboardShader.Use();
-    billboardShader.setInt("billboardTexture", 0);
+    billboardShader.setInt("spriteAtlas", 0);
+    weightedBillboardShader.Use();
+    weightedBillboardShader.setInt("spriteAtlas", 0);
+    compositeShader.Use();
+    compositeShader.setInt("accumulationMap", 0);
+    compositeShader.setInt("weightMap", 1);
     skyboxShader.Use();
     skyboxShader.setInt("skybox", 0);
-    nMapShader.Use();
-    nMapShader.setInt("diffuseMap", 0);
-    nMapShader.setInt("normalMap", 1);
-    parallaxShader.Use();
-    parallaxShader.setInt("diffuseMap", 0);
-    parallaxShader.setInt("normalMap", 1);
-    parallaxShader.setInt("depthMap", 2);
+    probeShader.Use();
+    probeShader.setInt("diffuseMap", 0);
+    probeTangentShader.Use();
+    probeTangentShader.setInt("diffuseMap", 0);
+    probeLightmapShader.Use();
+    probeLightmapShader.setInt("diffuseMap", 0);
+    probeSkyShader.Use();
+    probeSkyShader.setInt("skybox", 0);
+    outlineShader.Use();
+    outlineShader.setVec3("outlineColor", glm::vec3(0.0f, 0.0f, 1.0f));
+
+    //materials: the textures each draw binds, unit by unit
+    materials.none = queue.AddMaterial(Material());
+    Material floorMaterial;
+    floorMaterial.textures = { { GL_TEXTURE_2D, floorTexture }, { GL_TEXTURE_2D, floorTexture }, { GL_TEXTURE_2D, 0 } };
+    floorMaterial.writeStencil = false;
+    materials.floor = queue.AddMaterial(floorMaterial);
+    Material cubeMaterial;
+    cubeMaterial.textures = { { GL_TEXTURE_2D, diffuseMap }, { GL_TEXTURE_2D, specularMap }, { GL_TEXTURE_2D, emissionMap } };
+    materials.cubes = queue.AddMaterial(cubeMaterial);
+    Material mirrorMaterial;
+    mirrorMaterial.textures = { { GL_TEXTURE_CUBE_MAP, skyboxTexture } };
+    mirrorMaterial.writeStencil = false;
+    materials.mirror = queue.AddMaterial(mirrorMaterial);
+    materials.skybox = queue.AddMaterial(mirrorMaterial);
+    mirrorMaterial.textures = { { GL_TEXTURE_CUBE_MAP, reflectionProbes.Texture(0) } };
+    materials.mirrorProbe = queue.AddMaterial(mirrorMaterial);
+    mirrorMaterial.textures = { { GL_TEXTURE_CUBE_MAP, reflectionProbes.Texture(1) } };
+    materials.refractProbe = queue.AddMaterial(mirrorMaterial);
+    Material nMapMaterial;
+    nMapMaterial.textures = { { GL_TEXTURE_2D, nMapDiffuseMap }, { GL_TEXTURE_2D, nMapNormalMap } };
+    materials.nMap = queue.AddMaterial(nMapMaterial);
+    Material parallaxMaterial;
+    parallaxMaterial.textures = { { GL_TEXTURE_2D, parallaxDiffuse }, { GL_TEXTURE_2D, parallaxNormal }, { GL_TEXTURE_2D, parallaxHeight } };
+    materials.parallax = queue.AddMaterial(parallaxMaterial);
+    Material billboardMaterial;
+    billboardMaterial.textures = { { GL_TEXTURE_2D_ARRAY, spriteAtlas.Texture } };
+    materials.billboards = queue.AddMaterial(billboardMaterial);
+    billboardMaterial.weightedBlended = true;
+    materials.billboardsWeighted = queue.AddMaterial(billboardMaterial);
+    Material gBufferMaterial;
+    gBufferMaterial.textures = { { GL_TEXTURE_2D, gBuffer.AlbedoTexture }, { GL_TEXTURE_2D, gBuffer.NormalTexture },
+        { GL_TEXTURE_2D, gBuffer.DepthTexture } };
+    materials.gBuffer = queue.AddMaterial(gBufferMaterial);
+
+    //pass-wide state, set by the queue whenever the pass changes
+    std::function<void(RenderQueue::Pass)> beginPass = [&](RenderQueue::Pass pass)
+    {
+        switch (pass)
+        {
+        case RenderQueue::PASS_SHADOW_STATIC:
+        case RenderQueue::PASS_SHADOW:
+            glState.Viewport(0, 0, cascades.Settings.resolution, cascades.Settings.resolution);
+            glState.DepthFunc(GL_LESS);
+            //casters between the light and a cascade's near plane are flattened onto it instead of clipped
+            glState.Enable(GL_DEPTH_CLAMP);
+            simpleDepthShader.Use();
+            if (pass == RenderQueue::PASS_SHADOW_STATIC)
+            {
+                cascades.BeginStaticPass();
+                simpleDepthShader.set(depthCascadeMaskUniform, (int)cascades.StaticDirtyMask());
+            }
+            else
+            {
+                //the cached static depth, then the dynamic casters on top of it
+                cascades.BeginDynamicPass();
+                simpleDepthShader.set(depthCascadeMaskUniform, (1 << MAX_SHADOW_CASCADES) - 1);
+            }
+            break;
+        case RenderQueue::PASS_SHADOW_ATLAS:
+            //the dirty tiles of the local lights, every caster instanced over them
+            glState.Disable(GL_DEPTH_CLAMP);
+            glState.DepthFunc(GL_LESS);
+            shadowAtlas.BeginPass();
+            atlasDepthShader.Use();
+            atlasDepthShader.set(atlasTileCountUniform, (int)shadowAtlas.DirtyTiles().size());
+            glUniform1iv(atlasTilesUniform.location, (GLsizei)shadowAtlas.DirtyTiles().size(), shadowAtlas.DirtyTiles().data());
+            break;
+        case RenderQueue::PASS_SHADOW_POINT:
+            //the dirty point lights, the items set the slot and the geometry shader picks the faces
+            shadowAtlas.EndPass();
+            glState.Disable(GL_DEPTH_CLAMP);
+            glState.DepthFunc(GL_LESS);
+            pointShadows.BeginPass();
+            break;
+        case RenderQueue::PASS_PROBE:
+            //this frame's faces of the scheduled probe, the geometry shaders send each triangle to them
+            shadowAtlas.EndPass();
+            shadowTimer.End();
+            probeTimer.Begin();
+            glState.Disable(GL_DEPTH_CLAMP);
+            glState.DepthFunc(GL_LEQUAL);
+            renderedProbes->BeginPass();
+            lightmap.Bind();
+            for (int i = 0; i < 4; i++)
+            {
+                probeShaders[i]->Use();
+                glUniformMatrix4fv(probeFaceMatricesUniforms[i].location, 6, GL_FALSE, glm::value_ptr(renderedProbes->FaceMatrices()[0]));
+                probeShaders[i]->set(probeFaceMaskUniforms[i], renderedProbes->FaceMask());
+            }
+            probeSkyShader.set(probeSkyPositionUniform, renderedProbes->ActivePosition());
+            break;
+        case RenderQueue::PASS_OPAQUE:
+            //the probe pass, when there was one, came after the shadows
+            if (renderedProbes->Active() >= 0)
+            {
+                renderedProbes->EndPass();
+                probeTimer.End();
+            }
+            else
+            {
+                shadowAtlas.EndPass();
+                shadowTimer.End();
+            }
+            //EVSM blurs the moments here, once per shadow texel instead of per shaded pixel
+            prefilterTimer.Begin(shadowFilter.Mode);
+            shadowFilter.Prefilter(cascades);
+            prefilterTimer.End();
+            lightingTimer.Begin(lightingTag());
+            glState.Viewport(0, 0, WIDTH, HEIGHT);
+            glState.Disable(GL_DEPTH_CLAMP);
+            glState.StencilMask(0xFF);
+            if (deferredShading)
+            {
+                //blending would scale the G-buffer by what its alpha channels hold
+                glState.Disable(GL_BLEND);
+                gBuffer.BeginGeometryPass();
+            }
+            else
+            {
+                glState.Enable(GL_BLEND);
+                glState.BindFramebuffer(0);
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
+            }
+            glState.StencilFunc(GL_ALWAYS, 1, 0xFF);
+            glState.DepthFunc(GL_LESS);
+            shadowFilter.Bind(cascades);
+            glState.BindTexture(SHADOW_ATLAS_TEXTURE_UNIT, GL_TEXTURE_2D, shadowAtlas.Texture);
+            glState.BindTexture(POINT_SHADOW_TEXTURE_UNIT, GL_TEXTURE_2D_ARRAY, pointShadows.Texture);
+            imageBasedLighting.Bind();
+            lightmap.Bind();
+            bakedProbes.Bind();
+            break;
+        case RenderQueue::PASS_LIGHTING:
+            //the reflections trace the finished depth while the color target still holds the last frame
+            if (ssrLevel > 0)
+            {
+                ssrTimer.Begin(ssrLevel);
+                screenSpaceReflections.Trace(gBuffer, frameUniforms.Data.projectionMat * frameUniforms.Data.viewMat);
+                ssrTimer.End();
+            }
+            //the G-buffer lit pixel by pixel into a target without depth, the pass samples it
+            glState.Enable(GL_BLEND);
+            gBuffer.BeginLightingPass();
+            lightingShader->Use();
+            lightingShader->set(inverseViewProjectionUniform, glm::inverse(frameUniforms.Data.projectionMat * frameUniforms.Data.viewMat));
+            break;
+        case RenderQueue::PASS_OUTLINE:
+            //deferred: the lit color with the geometry's depth and stencil from here on
+            glState.BindFramebuffer(deferredShading ? gBuffer.SceneFramebuffer : 0);
+            glState.StencilFunc(GL_NOTEQUAL, 1, 0xFF);
+            glState.StencilMask(0x00);
+            break;
+        case RenderQueue::PASS_SKY:
+            glState.BindFramebuffer(deferredShading ? gBuffer.SceneFramebuffer : 0);
+            glState.StencilFunc(GL_ALWAYS, 1, 0xFF);
+            glState.DepthFunc(GL_LEQUAL);
+            break;
+        case RenderQueue::PASS_TRANSPARENT:
+            glState.BindFramebuffer(deferredShading ? gBuffer.SceneFramebuffer : 0);
+            glState.DepthFunc(GL_LESS);
+            break;
+        case RenderQueue::PASS_WEIGHTED:
+            //tested against the scene's depth, composited after the queue
+            weightedTransparency.BeginAccumulation(deferredShading ? gBuffer.SceneFramebuffer : 0);
+            break;
+        }
+    };
 
-    glBindTexture(GL_TEXTURE_2D, 0); // Unbind texture when done
 
     while (!glfwWindowShouldClose(window))
     {
@@ -877,107 +1728,230 @@ int main()
         GLfloat currentFrame = glfwGetTime();
         deltaTime = currentFrame - lastFrame;
         lastFrame = currentFrame;
+        Shader::resetStats();
+        glState.ResetStats();
 
         glfwPollEvents();
         moveCamera();
 
+        //pick the surface programs for the current keys, a new permutation is built the first time it is asked for;
+        //deferred, the surfaces only fill the G-buffer and the lighting pass takes the shadow and light keys
+        if (variantChanged)
+        {
+            ShaderKey surfaceKey = deferredShading ? gBufferKey : ShaderKey();
+            myShader = &defaultVariants.Get(deferredShading ? gBufferKey : defaultVariantKey());
+            mirrorShader = &mirrorVariants.Get(surfaceKey);
+            refractShader = &mirrorVariants.Get(ShaderKey(surfaceKey).Define("REFRACT"));
+            chromeShader = &mirrorVariants.Get(ShaderKey(surfaceKey).Define("BAKED_PROBES"));
+            nMapShader = &nMapVariants.Get(surfaceKey);
+            parallaxShader = &parallaxVariants.Get(deferredShading ? ShaderKey(parallaxKey).Define("GBUFFER") : parallaxKey);
+            defaultObjectUniform = myShader->uniform<int>("objectIndex");
+            //deferred with the reflections on, the floor is marked reflective in the G-buffer
+            floorShader = deferredShading && ssrLevel > 0 ? &defaultVariants.Get(ShaderKey(gBufferKey).Define("REFLECTIVE")) : myShader;
+            floorObjectUniform = floorShader->uniform<int>("objectIndex");
+            mirrorObjectUniform = mirrorShader->uniform<int>("objectIndex");
+            refractObjectUniform = refractShader->uniform<int>("objectIndex");
+            nMapObjectUniform = nMapShader->uniform<int>("objectIndex");
+            parallaxObjectUniform = parallaxShader->uniform<int>("objectIndex");
+            mirrorRoughnessUniform = mirrorShader->uniform<float>("roughness");
+            refractRoughnessUniform = refractShader->uniform<float>("roughness");
+            mirrorShader->Use();
+            mirrorShader->set(mirrorRoughnessUniform, MIRROR_ROUGHNESSES[mirrorRoughnessLevel]);
+            refractShader->Use();
+            refractShader->set(refractRoughnessUniform, MIRROR_ROUGHNESSES[mirrorRoughnessLevel]);
+            mirrorProbeLevelUniform = mirrorShader->uniform<int>("probeMaxLevel");
+            refractProbeLevelUniform = refractShader->uniform<int>("probeMaxLevel");
+            chromeObjectUniform = chromeShader->uniform<int>("objectIndex");
+            chromeSelectionUniform = chromeShader->uniform<int>("probeSelection");
+            chromeRoughnessUniform = chromeShader->uniform<float>("roughness");
+            chromeShader->Use();
+            chromeShader->set(chromeRoughnessUniform, MIRROR_ROUGHNESSES[mirrorRoughnessLevel]);
+            //lightmapped static surfaces, forward only
+            lightmapShader = nullptr;
+            if (useLightmap && !deferredShading)
+            {
+                lightmapShader = &defaultVariants.Get(ShaderKey(defaultVariantKey()).Define("LIGHTMAP"));
+                lightmapObjectUniform = lightmapShader->uniform<int>("objectIndex");
+            }
+            if (deferredShading)
+            {
+                lightingShader = &deferredVariants.Get(ssrLevel > 0 ? ShaderKey(defaultVariantKey()).Define("SCREEN_SPACE_REFLECTIONS")
+                    : defaultVariantKey());
+                inverseViewProjectionUniform = lightingShader->uniform<glm::mat4>("inverseViewProjection");
+            }
+            shadowFilter.BlurRadius = shadowPcfTaps == 1 ? 0 : (shadowPcfTaps == 9 ? 1 : 2);
+            if (ssrLevel > 0)
+                screenSpaceReflections.SetDivisor(SSR_DIVISORS[ssrLevel]);
+            variantChanged = false;
+        }
+
         glClearColor(0.05f, 0.05f, 0.05f, 1.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
 
+        //a new cascade count needs a new texture array
+        if (cascadesChanged)
+        {
+            CascadeSettings settings = cascades.Settings;
+            settings.count = settings.count % MAX_SHADOW_CASCADES + 1;
+            cascades.Destroy();
+            cascades.Create(settings);
+            shadowFilter.Destroy();
+            shadowFilter.Create(cascades);
+            cascadesChanged = false;
+        }
+        cascades.Settings.splitLambda = SPLIT_LAMBDAS[splitLevel];
+
+        //then we write everything every program shares into the frame block, once
+        FrameData& frame = frameUniforms.Data;
         //transformations
-        glm::mat4 projectionMat = glm::mat4(1.0f);
-        glm::mat4 viewMat = glm::mat4(1.0f);
-        glm::mat4 modelMat = glm::mat4(1.0f);
-        projectionMat = glm::perspective(glm::radians(camera.Zoom), (GLfloat)WIDTH / (GLfloat)HEIGHT, 0.1f, 100.0f);
-        viewMat = camera.GetViewMatrix();
-
-        myShader.Use();
-        //passing all sorts of values to the shader
-        myShader.setVec3("viewPos", camera.Position.x, camera.Position.y, camera.Position.z);
-        myShader.setFloat("time", 5.0 * currentFrame);
-        //material
-        myShader.setFloat("material.shininess", 64.0f);
-        //lights
-        glm::vec3 lightColor = glm::vec3(1.0f);
-        glm::vec3 diffuseColor = lightColor * glm::vec3(0.5f); // decrease the influence
-        glm::vec3 ambientColor = lightColor * glm::vec3(0.2f); // low influence
+        frame.projectionMat = glm::perspective(glm::radians(camera.Zoom), (GLfloat)WIDTH / (GLfloat)HEIGHT, 0.1f, 100.0f);
+        frame.viewMat = camera.GetViewMatrix();
+        //the light space of every cascade, fitted to this frame's view
+        cascades.Update(frame.viewMat, glm::radians(camera.Zoom), (GLfloat)WIDTH / (GLfloat)HEIGHT, 0.1f, directLightPos);
+        cascades.Fill(frame);
+        imageBasedLighting.Fill(frame);
+        frame.viewPos = camera.Position;
+        frame.time = 5.0f * currentFrame;
         //direction light
-        myShader.setVec3("directLight.direction", directLightPos);
-        myShader.setVec3("directLight.ambient", glm::vec3(0.05f));
-        myShader.setVec3("directLight.diffuse", glm::vec3(0.7f));
-        myShader.setVec3("directLight.specular", glm::vec3(1.0f));
-
-        //spotlight
-        myShader.setVec3("spotlight.position", camera.Position);
-        myShader.setVec3("spotlight.direction", camera.Front);
-        myShader.setFloat("spotlight.cutOff", glm::cos(glm::radians(12.5f)));
-        myShader.setFloat("spotlight.outerCutOff", glm::cos(glm::radians(15.5f)));
-        myShader.setFloat("spotlight.constant", 1.0f);          //chose constants for 50 units
-        myShader.setFloat("spotlight.linear", 0.09f);
-        myShader.setFloat("spotlight.quadratic", 0.032f);
-        myShader.setVec3("spotlight.ambient", glm::vec3(0.0f));
-        myShader.setVec3("spotlight.diffuse", glm::vec3(1.0f));
-        myShader.setVec3("spotlight.specular", glm::vec3(1.0f));
-
-        //first we draw the scene to make shadow map
-        glm::mat4 lightProjection, lightView;
-        glm::mat4 lightSpaceMatrix;
-        float near_plane = 1.0f, far_plane = 20.0f;
-        //lightProjection = glm::perspective(glm::radians(45.0f), (GLfloat)SHADOW_WIDTH / (GLfloat)SHADOW_HEIGHT, near_plane, far_plane); // обратите внимание, что если вы используете матрицу перспективной проекции, вам придется изменить положение света, так как текущего положения света недостаточно для отображения всей сцены
-        lightProjection = glm::ortho(-15.0f, 20.0f, -15.0f, 20.0f, near_plane, far_plane);
-        lightView = glm::lookAt(-directLightPos, glm::vec3(0.0f), glm::vec3(0.0, 1.0, 0.0));
-        lightSpaceMatrix = lightProjection * lightView;
-
-        simpleDepthShader.Use();
-        simpleDepthShader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
-
-        glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-        glBindFramebuffer(GL_FRAMEBUFFER, shadowMapFBO);
-        glClear(GL_DEPTH_BUFFER_BIT);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, 0);
-        drawSceneForShadows(simpleDepthShader, planeVAO, containerVAO, mirrorVAO, nMapVAO, cubePositions);
-        glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-        //then we draw the scene normally
-        glViewport(0, 0, WIDTH, HEIGHT);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-
-        myShader.Use();
-        myShader.setMat4("lightSpaceMatrix", lightSpaceMatrix);
-        glActiveTexture(GL_TEXTURE3);
-        glBindTexture(GL_TEXTURE_2D, shadowMap);
-
-        drawFloor(projectionMat, planeVAO, myShader, floorTexture);
-        drawNMap(projectionMat, nMapVAO, nMapShader, nMapDiffuseMap, nMapNormalMap);
-        drawParallax(projectionMat, nMapVAO, parallaxShader, parallaxDiffuse, parallaxNormal, parallaxHeight);
-        drawCubesAndOutline(projectionMat, containerVAO, myShader, outlineShader, cubePositions, diffuseMap, specularMap, emissionMap);
-        drawSkyboxAndCubes(projectionMat, skyboxVAO, mirrorVAO, skyboxShader, mirrorShader, skyboxTexture);
-        drawBillboards(projectionMat, transparentVAO, billboardShader, billboards, billboardTexture);
+        frame.directLight.direction = glm::vec4(directLightPos, 0.0f);
+        frame.directLight.ambient = glm::vec4(directLightAmbient, 0.0f);
+        frame.directLight.diffuse = glm::vec4(directLightDiffuse, 0.0f);
+        frame.directLight.specular = glm::vec4(directLightSpecular, 0.0f);
+        //and every object's matrices, in one pass
+        addSceneTransforms(cubePositions, currentFrame);
+        transforms.Update(frame.projectionMat * frame.viewMat);
+        frame.transformBase = transforms.Base();
+        frameUniforms.Upload();
+        //local lights, the flashlight follows the camera; then their shadows and the froxels they reach
+        sceneLights[0].enabled = useSpotlight;
+        sceneLights[0].position = camera.Position;
+        sceneLights[0].direction = camera.Front;
+        updateStressLights(currentFrame);
+        std::vector<int> lightIndices = lightUniforms.SetLights(sceneLights);
+        shadowAtlas.Update(sceneLights, lightIndices, frame.viewMat, frame.projectionMat, HEIGHT, dynamicCasters, lightUniforms);
+        pointShadows.Update(sceneLights, lightIndices, frame.viewMat, frame.projectionMat, dynamicCasters, lightUniforms);
+        lightClusters.Build(lightUniforms.Lights, frame.viewMat, frame.projectionMat, lightUniforms.Data);
+        //the reflection probe faces that fit this frame's budget
+        if (probesChanged)
+        {
+            reflectionProbes.SetResolution(PROBE_RESOLUTIONS[probeResolutionLevel]);
+            probesChanged = false;
+        }
+        //the baked probes' capture takes the probe pass while it lasts, the live probes wait for it
+        renderedProbes = &reflectionProbes;
+        if (bakedProbes.Update())
+            renderedProbes = &bakedProbes.Capture();
+        else
+        {
+            reflectionProbes.Settings.facesPerFrame = PROBE_FACE_BUDGETS[probeBudgetLevel];
+            reflectionProbes.Update(camera.Position, probeMovers);
+        }
+        lightUniforms.Upload();
+        //billboards in view, back to front
+        if (billboardsChanged)
+        {
+            placeBillboards(billboards);
+            billboardsChanged = false;
+        }
+        billboardRenderer.Update(camera.Position, camera.Front, 100.0f, !useWeightedBlending);
+        //particles, started at the steady state of the emission rate that keeps the benchmark's count alive; the step
+        //is capped so a long frame doesn't throw them through the floor
+        if (particlesChanged)
+        {
+            ParticleEmitter& emitter = particles.Emitter;
+            emitter.rate = PARTICLE_COUNTS[particleLevel] / (0.5f * (emitter.minLife + emitter.maxLife));
+            particles.Prewarm(PARTICLE_COUNTS[particleLevel]);
+            particlesChanged = false;
+        }
+        particles.Update(std::min(deltaTime, 0.05f));
+
+        //every draw of the frame goes into the queue, sorted, then executed pass by pass
+        queue.Begin(camera.Position, camera.Front, 100.0f);
+        submitSceneForShadows(simpleDepthShader, atlasDepthShader, pointDepthShader, planeVAO, containerVAO, mirrorVAO, nMapVAO);
+        if (lightmapShader)
+            submitFloor(floorLightmapVAO, *lightmapShader, lightmapObjectUniform);
+        else
+            submitFloor(planeVAO, *floorShader, floorObjectUniform);
+        submitNMap(nMapVAO, *nMapShader);
+        submitParallax(nMapVAO, *parallaxShader);
+        submitCubesAndOutline(containerVAO, staticCubesVAO, *myShader, lightmapShader, outlineShader, cubePositions);
+        submitSkyboxAndCubes(skyboxVAO, mirrorVAO, skyboxShader, *mirrorShader, *refractShader);
+        submitChromeCubes(mirrorVAO, *chromeShader);
+        submitReflectionProbe(probeShader, probeTangentShader, probeLightmapShader, probeSkyShader, floorLightmapVAO, staticCubesVAO,
+            containerVAO, nMapVAO, skyboxVAO);
+        if (deferredShading)
+            submitDeferredLighting(emptyVAO, *lightingShader);
+        submitBillboards(billboardShader, weightedBillboardShader, billboards[0]);
+        submitParticles(weightedBillboardShader);
+        queue.Sort();
+        //the shadow passes come first, the lighting passes end with the queue
+        shadowTimer.Begin(shadowFilter.Mode);
+        queue.Execute(beginPass);
+        if (queue.Stats.passDrawCalls[RenderQueue::PASS_WEIGHTED] > 0)
+            weightedTransparency.Composite(compositeShader, emptyVAO, deferredShading ? gBuffer.SceneFramebuffer : 0);
+        if (deferredShading)
+            gBuffer.Present();
+        lightingTimer.End();
 
 #ifdef DEBUG
         //DEBUG
         // рендеринг на плоскости карты глубины для наглядной отладки
         // ---------------------------------------------
         debugDepthQuad.Use();
-        debugDepthQuad.setFloat("near_plane", near_plane);
-        debugDepthQuad.setFloat("far_plane", far_plane);
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, shadowMap);
+        debugDepthQuad.setInt("layer", 0);
+        glState.BindTexture(0, GL_TEXTURE_2D_ARRAY, cascades.Texture);
         renderQuad();
 #endif
+        frameUniforms.EndFrame();
+        lightUniforms.EndFrame();
+        lightClusters.EndFrame();
+        billboardRenderer.EndFrame();
+        particles.EndFrame();
+        transforms.EndFrame();
+        if (showStats && currentFrame - lastStatsTime >= 1.0f)
+        {
+            lastStatsTime = currentFrame;
+            printFrameStats();
+        }
         glfwSwapBuffers(window);
     }
 
-    glDeleteVertexArrays(1, &containerVAO);
-    glDeleteVertexArrays(1, &planeVAO);
-    glDeleteVertexArrays(1, &transparentVAO);
-    glDeleteVertexArrays(1, &skyboxVAO);
-    glDeleteVertexArrays(1, &mirrorVAO);
+    frameUniforms.Destroy();
+    transforms.Destroy();
+    cascades.Destroy();
+    shadowFilter.Destroy();
+    shadowAtlas.Destroy();
+    pointShadows.Destroy();
+    lightUniforms.Destroy();
+    lightClusters.Destroy();
+    gBuffer.Destroy();
+    screenSpaceReflections.Destroy();
+    weightedTransparency.Destroy();
+    imageBasedLighting.Destroy();
+    reflectionProbes.Destroy();
+    bakedProbes.Destroy();
+    lightmap.Destroy();
+    billboardRenderer.Destroy();
+    particles.Destroy();
+    spriteAtlas.Destroy();
+    shadowTimer.Destroy();
+    probeTimer.Destroy();
+    prefilterTimer.Destroy();
+    lightingTimer.Destroy();
+    ssrTimer.Destroy();
+    glState.DeleteVertexArrays(1, &containerVAO);
+    glState.DeleteVertexArrays(1, &planeVAO);
+    glState.DeleteVertexArrays(1, &transparentVAO);
+    glState.DeleteVertexArrays(1, &skyboxVAO);
+    glState.DeleteVertexArrays(1, &mirrorVAO);
+    glState.DeleteVertexArrays(1, &emptyVAO);
+    glState.DeleteVertexArrays(1, &floorLightmapVAO);
+    glState.DeleteVertexArrays(1, &staticCubesVAO);
     glDeleteBuffers(1, &VBO);
     glDeleteBuffers(1, &transparentVBO);
     glDeleteBuffers(1, &planeVBO);
     glDeleteBuffers(1, &skyboxVBO);
+    glDeleteBuffers(1, &floorLightmapVBO);
+    glDeleteBuffers(1, &staticCubesVBO);
 
     glfwTerminate();
     return 0;
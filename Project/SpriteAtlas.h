@@ -0,0 +1,203 @@
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+// GL Includes
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_precision.hpp>
+
+#include "GLState.h"
+
+// Where a sprite lies in the atlas: its rectangle on the page (u0, v0, u1, v1, normalized 16 bit) and the page,
+// the layer of the texture array. Billboard instances carry both, see BillboardInstance
+struct SpriteFrame
+{
+    glm::u16vec4 rect = glm::u16vec4(0, 0, 65535, 65535);
+    float layer = 0.0f;
+};
+
+struct SpriteAtlasSettings
+{
+    int pageSize = 512;         // square pages, the layers of the texture array
+    int maxSpriteSize = 256;    // larger sprites are halved until they fit
+    int padding = 4;            // texels of repeated edge around each sprite, covers the mip levels kept
+};
+
+struct SpriteAtlasStats
+{
+    int sprites = 0;
+    int pages = 0;
+    float occupancy = 0.0f;     // of all pages, sprites and their padding
+    double milliseconds = 0.0;
+};
+
+// Sprite textures packed at load time into the pages of one RGBA8 texture array, so billboards of any mix of
+// sprites are one material and one draw: the page and rectangle of each billboard come with its instance.
+// Sprites are added as RGBA8 pixels, then Build() sorts them by height and fills the pages shelf by shelf.
+// Each sprite is framed by a few texels of its own edge so filtering doesn't pick up its neighbours; the
+// mip chain stops at the level where that frame shrinks to one texel, and the framed cells are placed and
+// sized in multiples of that level's texel, so no texel of a kept level straddles two sprites.
+class SpriteAtlas
+{
+public:
+    SpriteAtlasSettings Settings;
+    SpriteAtlasStats Stats;
+    GLuint Texture = 0;                 // GL_TEXTURE_2D_ARRAY
+    std::vector<SpriteFrame> Frames;    // by sprite index, filled by Build()
+
+    // Queues a sprite and returns its index
+    int Add(const unsigned char* pixels, int width, int height)
+    {
+        Sprite sprite;
+        sprite.width = width;
+        sprite.height = height;
+        sprite.pixels.assign(pixels, pixels + (size_t)width * height * 4);
+        this->sprites.push_back(sprite);
+        return (int)this->sprites.size() - 1;
+    }
+
+    void Build(const SpriteAtlasSettings& settings)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        this->Settings = settings;
+        const int page = settings.pageSize, padding = settings.padding;
+        int levels = 1;
+        while ((padding >> levels) > 0)
+            levels++;
+        const int granularity = 1 << (levels - 1);
+        for (Sprite& sprite : this->sprites)
+            while (std::max(sprite.width, sprite.height) > std::min(settings.maxSpriteSize, page - 2 * padding))
+                halve(sprite);
+
+        // tallest first, each shelf as high as its first sprite
+        std::vector<int> order(this->sprites.size());
+        for (size_t i = 0; i < order.size(); i++)
+            order[i] = (int)i;
+        std::sort(order.begin(), order.end(), [&](int a, int b) { return this->sprites[a].height > this->sprites[b].height; });
+        std::vector<glm::ivec3> places(this->sprites.size());
+        int pages = this->sprites.empty() ? 0 : 1, x = 0, y = 0, shelf = 0;
+        size_t usedTexels = 0;
+        for (int index : order)
+        {
+            const Sprite& sprite = this->sprites[index];
+            int width = aligned(sprite.width + 2 * padding, granularity), height = aligned(sprite.height + 2 * padding, granularity);
+            if (x + width > page)
+            {
+                x = 0;
+                y += shelf;
+                shelf = 0;
+            }
+            if (y + height > page)
+            {
+                pages++;
+                x = y = shelf = 0;
+            }
+            places[index] = glm::ivec3(x, y, pages - 1);
+            x += width;
+            shelf = std::max(shelf, height);
+            usedTexels += (size_t)width * height;
+        }
+
+        GLState& state = GLState::Instance();
+        glGenTextures(1, &this->Texture);
+        state.BindTexture(0, GL_TEXTURE_2D_ARRAY, this->Texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, page, page, std::max(pages, 1), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+        std::vector<unsigned char> framed;
+        this->Frames.resize(this->sprites.size());
+        for (size_t i = 0; i < this->sprites.size(); i++)
+        {
+            const Sprite& sprite = this->sprites[i];
+            const glm::ivec3& place = places[i];
+            int width = aligned(sprite.width + 2 * padding, granularity), height = aligned(sprite.height + 2 * padding, granularity);
+            framed.resize((size_t)width * height * 4);
+            for (int row = 0; row < height; row++)
+                for (int column = 0; column < width; column++)
+                {
+                    int sx = std::min(std::max(column - padding, 0), sprite.width - 1);
+                    int sy = std::min(std::max(row - padding, 0), sprite.height - 1);
+                    const unsigned char* source = &sprite.pixels[((size_t)sy * sprite.width + sx) * 4];
+                    std::copy(source, source + 4, &framed[((size_t)row * width + column) * 4]);
+                }
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, place.x, place.y, place.z, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, framed.data());
+            SpriteFrame& frame = this->Frames[i];
+            frame.rect = glm::u16vec4(normalized(place.x + padding), normalized(place.y + padding),
+                normalized(place.x + padding + sprite.width), normalized(place.y + padding + sprite.height));
+            frame.layer = (float)place.z;
+        }
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+
+        this->Stats.sprites = (int)this->sprites.size();
+        this->Stats.pages = pages;
+        this->Stats.occupancy = pages > 0 ? (float)usedTexels / ((float)page * page * pages) : 0.0f;
+        this->Stats.milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        // the pixels live on the GPU now
+        this->sprites.clear();
+        this->sprites.shrink_to_fit();
+    }
+
+    void Destroy()
+    {
+        GLState::Instance().DeleteTextures(1, &this->Texture);
+    }
+
+    // The pages and their mip levels
+    size_t MemoryBytes() const
+    {
+        size_t bytes = 0;
+        for (int size = this->Settings.pageSize, level = 0; (this->Settings.padding >> level) > 0; size /= 2, level++)
+            bytes += (size_t)size * size * 4;
+        return bytes * this->Stats.pages;
+    }
+
+private:
+    struct Sprite
+    {
+        int width = 0, height = 0;
+        std::vector<unsigned char> pixels;
+    };
+    std::vector<Sprite> sprites;
+
+    // Rounds up to a multiple of granularity, a power of two
+    static int aligned(int texels, int granularity)
+    {
+        return (texels + granularity - 1) & ~(granularity - 1);
+    }
+
+    std::uint16_t normalized(int texel) const
+    {
+        return (std::uint16_t)(65535.0f * texel / this->Settings.pageSize + 0.5f);
+    }
+
+    // 2x2 box filter, an odd last row or column is dropped
+    static void halve(Sprite& sprite)
+    {
+        int width = std::max(sprite.width / 2, 1), height = std::max(sprite.height / 2, 1);
+        std::vector<unsigned char> pixels((size_t)width * height * 4);
+        for (int y = 0; y < height; y++)
+            for (int x = 0; x < width; x++)
+                for (int channel = 0; channel < 4; channel++)
+                {
+                    int sum = 0;
+                    for (int dy = 0; dy < 2; dy++)
+                        for (int dx = 0; dx < 2; dx++)
+                        {
+                            int sx = std::min(2 * x + dx, sprite.width - 1), sy = std::min(2 * y + dy, sprite.height - 1);
+                            sum += sprite.pixels[((size_t)sy * sprite.width + sx) * 4 + channel];
+                        }
+                    pixels[((size_t)y * width + x) * 4 + channel] = (unsigned char)((sum + 2) / 4);
+                }
+        sprite.width = width;
+        sprite.height = height;
+        sprite.pixels.swap(pixels);
+    }
+};
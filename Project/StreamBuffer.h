@@ -0,0 +1,115 @@
+#pragma once
+
+// Std. Includes
+#include <cstring>
+
+// GL Includes
+#include <glad/glad.h>
+
+#include "GLExtensions.h"
+
+// Triple-buffered ring for data rewritten every frame. Each frame writes its own slice while the GPU may
+// still read the previous two; a fence per slice keeps the CPU from overwriting data still in flight.
+// With ARB_buffer_storage the whole ring stays persistently mapped, otherwise each slice is mapped
+// unsynchronized for the write.
+class StreamBuffer
+{
+public:
+    static const int FRAMES = 3;
+    GLuint Buffer = 0;
+    unsigned int Stalls = 0;    // waits on a slice the GPU was still reading
+
+    void Create(GLenum target, GLsizeiptr frameSize)
+    {
+        this->target = target;
+        GLint alignment = 1;
+        if (target == GL_UNIFORM_BUFFER)
+            glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+        this->frameSize = frameSize;
+        this->stride = (frameSize + alignment - 1) / alignment * alignment;
+        this->persistent = glExtensions().bufferStorage;
+
+        glGenBuffers(1, &this->Buffer);
+        glBindBuffer(target, this->Buffer);
+        if (this->persistent)
+        {
+            GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            glExtensions().BufferStorage(target, this->stride * FRAMES, NULL, flags);
+            this->mapped = (char*)glMapBufferRange(target, 0, this->stride * FRAMES, flags);
+        }
+        else
+            glBufferData(target, this->stride * FRAMES, NULL, GL_STREAM_DRAW);
+        glBindBuffer(target, 0);
+    }
+
+    void Destroy()
+    {
+        for (int i = 0; i < FRAMES; i++)
+            if (this->fences[i])
+                glDeleteSync(this->fences[i]);
+        if (this->persistent && this->mapped)
+        {
+            glBindBuffer(this->target, this->Buffer);
+            glUnmapBuffer(this->target);
+            glBindBuffer(this->target, 0);
+        }
+        glDeleteBuffers(1, &this->Buffer);
+    }
+
+    // Returns the write pointer of the current frame's slice, waiting for the GPU only if it is three frames behind
+    void* Map()
+    {
+        GLsync& fence = this->fences[this->frame];
+        if (fence)
+        {
+            while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000) == GL_TIMEOUT_EXPIRED)
+                this->Stalls++;
+            glDeleteSync(fence);
+            fence = 0;
+        }
+        if (this->persistent)
+            return this->mapped + this->Offset();
+        glBindBuffer(this->target, this->Buffer);
+        return glMapBufferRange(this->target, this->Offset(), this->frameSize,
+            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+    }
+
+    void Unmap()
+    {
+        if (this->persistent)
+            return;
+        glUnmapBuffer(this->target);
+        glBindBuffer(this->target, 0);
+    }
+
+    // Byte offset of the current frame's slice
+    GLintptr Offset() const
+    {
+        return this->stride * this->frame;
+    }
+
+    // Call once all draws reading the current slice are submitted. A frame that skipped Map() left the slice's
+    // old fence in place; the new one signals after it, so it is deleted without waiting
+    void EndFrame()
+    {
+        GLsync& fence = this->fences[this->frame];
+        if (fence)
+            glDeleteSync(fence);
+        fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        this->frame = (this->frame + 1) % FRAMES;
+    }
+
+    bool Persistent() const
+    {
+        return this->persistent;
+    }
+
+private:
+    GLenum target = GL_ARRAY_BUFFER;
+    GLsizeiptr frameSize = 0;
+    GLsizeiptr stride = 0;
+    bool persistent = false;
+    char* mapped = nullptr;
+    int frame = 0;
+    GLsync fences[FRAMES] = {};
+};
@@ -0,0 +1,129 @@
+#pragma once
+
+// Std. Includes
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Worker threads that live for the whole run, one less than the hardware has; ParallelFor splits a range
+// into chunks that the workers and the calling thread take in turn. One ParallelFor runs at a time, it is
+// meant to be called from the render thread only.
+class ThreadPool
+{
+public:
+    static ThreadPool& Instance()
+    {
+        static ThreadPool pool;
+        return pool;
+    }
+
+    // Threads a ParallelFor runs on, the caller included
+    int Threads() const
+    {
+        return (int)this->workers.size() + 1;
+    }
+
+    // Calls body(begin, end) for chunks of at most grain items covering [0, count), returns once all are done
+    void ParallelFor(int count, int grain, const std::function<void(int, int)>& body)
+    {
+        if (count <= 0)
+            return;
+        grain = std::max(grain, 1);
+        int chunks = (count + grain - 1) / grain;
+        if (chunks == 1 || this->workers.empty())
+        {
+            body(0, count);
+            return;
+        }
+        {
+            // a worker that woke too late for the last job may still be looking at it
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->done.wait(lock, [this] { return this->busy == 0; });
+            this->body = &body;
+            this->count = count;
+            this->grain = grain;
+            this->chunks = chunks;
+            this->nextChunk = 0;
+            this->pending = chunks;
+            this->generation++;
+        }
+        this->wake.notify_all();
+        this->run();
+        // the last chunks may still run on workers, the job is only over once they left
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->done.wait(lock, [this] { return this->pending == 0 && this->busy == 0; });
+        this->body = nullptr;
+    }
+
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->stop = true;
+        }
+        this->wake.notify_all();
+        for (std::thread& worker : this->workers)
+            worker.join();
+    }
+
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    const std::function<void(int, int)>* body = nullptr;
+    int count = 0, grain = 1, chunks = 0;
+    std::atomic<int> nextChunk{ 0 };
+    std::atomic<int> pending{ 0 };
+    int busy = 0;                   // workers inside run(), guarded by mutex
+    unsigned int generation = 0;    // bumped by every job, wakes the workers
+    bool stop = false;
+
+    ThreadPool()
+    {
+        int threads = (int)std::thread::hardware_concurrency();
+        for (int i = 1; i < threads; i++)
+            this->workers.emplace_back([this] { this->work(); });
+    }
+
+    void work()
+    {
+        unsigned int seen = 0;
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(this->mutex);
+                this->wake.wait(lock, [&] { return this->stop || this->generation != seen; });
+                if (this->stop)
+                    return;
+                seen = this->generation;
+                this->busy++;
+            }
+            this->run();
+            std::lock_guard<std::mutex> lock(this->mutex);
+            if (--this->busy == 0)
+                this->done.notify_all();
+        }
+    }
+
+    // Takes chunks until there are none left
+    void run()
+    {
+        for (;;)
+        {
+            int chunk = this->nextChunk++;
+            if (chunk >= this->chunks)
+                return;
+            int begin = chunk * this->grain;
+            (*this->body)(begin, std::min(begin + this->grain, this->count));
+            if (--this->pending == 0)
+            {
+                std::lock_guard<std::mutex> lock(this->mutex);
+                this->done.notify_all();
+            }
+        }
+    }
+};
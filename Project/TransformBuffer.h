@@ -0,0 +1,231 @@
+#pragma once
+
+// Std. Includes
+#include <iostream>
+#include <algorithm>
+#include <vector>
+#include <chrono>
+#include <cstring>
+
+// SSE2, part of every x86-64 target
+#include <emmintrin.h>
+#include <xmmintrin.h>
+
+// GL Includes
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "GLState.h"
+#include "StreamBuffer.h"
+
+// Texture unit of the transforms samplerBuffer, set in every program that declares it
+const GLuint TRANSFORM_TEXTURE_UNIT = 15;
+
+// Per-object matrices of the frame. Objects are added as translation, rotation and scale into contiguous
+// arrays, then Update() computes model, normal and MVP matrices for all of them in one pass, four objects
+// per SSE2 lane set, and writes them straight into a streamed texture buffer that shaders index with objectIndex
+// (shaders/transforms.glsl); an instanced draw covers consecutive objects. Since every model matrix is T * R * S, the normal matrix is R * S^-1 and no
+// matrix is ever inverted, neither here nor in a vertex shader.
+class TransformBuffer
+{
+public:
+    // model (4 texels), MVP (4), normal matrix (3), material index (1)
+    static const int TEXELS_PER_OBJECT = 12;
+    static const int FLOATS_PER_OBJECT = TEXELS_PER_OBJECT * 4;
+    GLuint Texture = 0;
+    double Milliseconds = 0.0;  // last Update(), CPU side
+
+    // The capacity is clamped to what a texture buffer can address, all frames of the ring together
+    void Create(int capacity)
+    {
+        GLint maxTexels = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+        int maxObjects = maxTexels / (TEXELS_PER_OBJECT * StreamBuffer::FRAMES);
+        if (capacity > maxObjects)
+            std::cout << "TRANSFORMS::CAPACITY::CLAMPED " << capacity << " to " << maxObjects << std::endl;
+        this->capacity = capacity = std::min(capacity, maxObjects);
+        this->ring.Create(GL_TEXTURE_BUFFER, (GLsizeiptr)capacity * FLOATS_PER_OBJECT * sizeof(float));
+        glGenTextures(1, &this->Texture);
+        GLState::Instance().BindTexture(TRANSFORM_TEXTURE_UNIT, GL_TEXTURE_BUFFER, this->Texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, this->ring.Buffer);
+        for (std::vector<float>* array : { &this->px, &this->py, &this->pz, &this->qx, &this->qy, &this->qz, &this->qw, &this->sx, &this->sy, &this->sz, &this->material })
+            array->reserve(capacity);
+    }
+
+    void Destroy()
+    {
+        GLState::Instance().DeleteTextures(1, &this->Texture);
+        this->ring.Destroy();
+    }
+
+    // Starts a new frame's object list
+    void Clear()
+    {
+        for (std::vector<float>* array : { &this->px, &this->py, &this->pz, &this->qx, &this->qy, &this->qz, &this->qw, &this->sx, &this->sy, &this->sz, &this->material })
+            array->clear();
+    }
+
+    // Returns the object index to pass to the shader, or -1 when the buffer is full
+    int Add(const glm::vec3& position, const glm::quat& rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f), const glm::vec3& scale = glm::vec3(1.0f),
+        int material = 0)
+    {
+        if (this->Count() >= this->capacity)
+            return -1;
+        this->px.push_back(position.x); this->py.push_back(position.y); this->pz.push_back(position.z);
+        this->qx.push_back(rotation.x); this->qy.push_back(rotation.y); this->qz.push_back(rotation.z); this->qw.push_back(rotation.w);
+        this->sx.push_back(scale.x); this->sy.push_back(scale.y); this->sz.push_back(scale.z);
+        this->material.push_back((float)material);
+        return this->Count() - 1;
+    }
+
+    int Count() const
+    {
+        return (int)this->px.size();
+    }
+
+    // Objects one frame can hold, after Create() clamped it
+    int Capacity() const
+    {
+        return this->capacity;
+    }
+
+    // Computes the matrices of every object and writes them into this frame's slice
+    void Update(const glm::mat4& viewProjection)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        float* out = (float*)this->ring.Map();
+        const float* vp = &viewProjection[0][0];
+        const int count = this->Count();
+        int i = 0;
+        for (; i + 4 <= count; i += 4, out += 4 * FLOATS_PER_OBJECT)
+            this->updateQuad(i, vp, out);
+        for (; i < count; i++, out += FLOATS_PER_OBJECT)
+            this->updateOne(i, vp, out);
+        this->ring.Unmap();
+        this->Milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // First texel of this frame's slice, goes into FrameData::transformBase
+    int Base() const
+    {
+        return (int)(this->ring.Offset() / (4 * sizeof(float)));
+    }
+
+    void EndFrame()
+    {
+        this->ring.EndFrame();
+    }
+
+private:
+    int capacity = 0;
+    StreamBuffer ring;
+    // object inputs, one array per component
+    std::vector<float> px, py, pz;
+    std::vector<float> qx, qy, qz, qw;
+    std::vector<float> sx, sy, sz;
+    std::vector<float> material;
+
+    // Objects i .. i + 3, one per lane: every matrix element is computed for the four at once straight from
+    // the component arrays, then each texel's four lanes are transposed into the objects' layout on the stack
+    // and the block goes out in one sequential copy, the slice may be write-combined memory
+    void updateQuad(int i, const float* vp, float* out) const
+    {
+        const __m128 zeros = _mm_setzero_ps(), ones = _mm_set1_ps(1.0f), twos = _mm_set1_ps(2.0f);
+        __m128 x = _mm_loadu_ps(&this->qx[i]), y = _mm_loadu_ps(&this->qy[i]), z = _mm_loadu_ps(&this->qz[i]), w = _mm_loadu_ps(&this->qw[i]);
+        __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y), zz = _mm_mul_ps(z, z);
+        __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z), yz = _mm_mul_ps(y, z);
+        __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y), wz = _mm_mul_ps(w, z);
+        // rotation matrix columns from the quaternions, as in updateOne()
+        __m128 r[9] = {
+            _mm_sub_ps(ones, _mm_mul_ps(twos, _mm_add_ps(yy, zz))), _mm_mul_ps(twos, _mm_add_ps(xy, wz)), _mm_mul_ps(twos, _mm_sub_ps(xz, wy)),
+            _mm_mul_ps(twos, _mm_sub_ps(xy, wz)), _mm_sub_ps(ones, _mm_mul_ps(twos, _mm_add_ps(xx, zz))), _mm_mul_ps(twos, _mm_add_ps(yz, wx)),
+            _mm_mul_ps(twos, _mm_add_ps(xz, wy)), _mm_mul_ps(twos, _mm_sub_ps(yz, wx)), _mm_sub_ps(ones, _mm_mul_ps(twos, _mm_add_ps(xx, yy)))
+        };
+        __m128 scale[3] = { _mm_loadu_ps(&this->sx[i]), _mm_loadu_ps(&this->sy[i]), _mm_loadu_ps(&this->sz[i]) };
+        // texels 0-3 model, 4-7 MVP, 8-10 normal matrix, 11 material; element (texel, component) for all four objects
+        __m128 texels[TEXELS_PER_OBJECT][4];
+        for (int c = 0; c < 3; c++)
+        {
+            __m128 inverseScale = _mm_div_ps(ones, scale[c]);
+            for (int row = 0; row < 3; row++)
+            {
+                texels[c][row] = _mm_mul_ps(r[c * 3 + row], scale[c]);
+                texels[8 + c][row] = _mm_mul_ps(r[c * 3 + row], inverseScale);
+            }
+            texels[c][3] = zeros;
+            texels[8 + c][3] = zeros;
+        }
+        texels[3][0] = _mm_loadu_ps(&this->px[i]);
+        texels[3][1] = _mm_loadu_ps(&this->py[i]);
+        texels[3][2] = _mm_loadu_ps(&this->pz[i]);
+        texels[3][3] = ones;
+        for (int c = 0; c < 4; c++)
+            for (int row = 0; row < 4; row++)
+            {
+                __m128 sum = _mm_mul_ps(_mm_set1_ps(vp[row]), texels[c][0]);
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(vp[4 + row]), texels[c][1]));
+                sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(vp[8 + row]), texels[c][2]));
+                texels[4 + c][row] = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(vp[12 + row]), texels[c][3]));
+            }
+        texels[11][0] = _mm_loadu_ps(&this->material[i]);
+        texels[11][1] = texels[11][2] = texels[11][3] = zeros;
+
+        alignas(16) float block[4 * FLOATS_PER_OBJECT];
+        for (int texel = 0; texel < TEXELS_PER_OBJECT; texel++)
+        {
+            __m128 a = texels[texel][0], b = texels[texel][1], c = texels[texel][2], d = texels[texel][3];
+            _MM_TRANSPOSE4_PS(a, b, c, d);
+            _mm_store_ps(block + 0 * FLOATS_PER_OBJECT + texel * 4, a);
+            _mm_store_ps(block + 1 * FLOATS_PER_OBJECT + texel * 4, b);
+            _mm_store_ps(block + 2 * FLOATS_PER_OBJECT + texel * 4, c);
+            _mm_store_ps(block + 3 * FLOATS_PER_OBJECT + texel * 4, d);
+        }
+        std::memcpy(out, block, sizeof(block));
+    }
+
+    // The objects after the last group of four
+    void updateOne(int i, const float* vp, float* out) const
+    {
+        // rotation matrix columns from the quaternion
+        float x = this->qx[i], y = this->qy[i], z = this->qz[i], w = this->qw[i];
+        float r[9] = {
+            1.0f - 2.0f * (y * y + z * z), 2.0f * (x * y + w * z), 2.0f * (x * z - w * y),
+            2.0f * (x * y - w * z), 1.0f - 2.0f * (x * x + z * z), 2.0f * (y * z + w * x),
+            2.0f * (x * z + w * y), 2.0f * (y * z - w * x), 1.0f - 2.0f * (x * x + y * y)
+        };
+        float s[3] = { this->sx[i], this->sy[i], this->sz[i] };
+        // model = T * R * S, built on the stack since the slice may be write-combined memory
+        float model[16];
+        for (int c = 0; c < 3; c++)
+        {
+            model[c * 4 + 0] = r[c * 3 + 0] * s[c];
+            model[c * 4 + 1] = r[c * 3 + 1] * s[c];
+            model[c * 4 + 2] = r[c * 3 + 2] * s[c];
+            model[c * 4 + 3] = 0.0f;
+        }
+        model[12] = this->px[i]; model[13] = this->py[i]; model[14] = this->pz[i]; model[15] = 1.0f;
+        std::memcpy(out, model, sizeof(model));
+        multiply(vp, model, out + 16);
+        // normal matrix = R * S^-1, one column per texel
+        float* normal = out + 32;
+        for (int c = 0; c < 3; c++)
+        {
+            float inverseScale = 1.0f / s[c];
+            normal[c * 4 + 0] = r[c * 3 + 0] * inverseScale;
+            normal[c * 4 + 1] = r[c * 3 + 1] * inverseScale;
+            normal[c * 4 + 2] = r[c * 3 + 2] * inverseScale;
+            normal[c * 4 + 3] = 0.0f;
+        }
+        normal[12] = this->material[i];
+        normal[13] = normal[14] = normal[15] = 0.0f;
+    }
+
+    // out = a * b, column-major 4x4
+    static void multiply(const float* a, const float* b, float* out)
+    {
+        for (int c = 0; c < 4; c++)
+            for (int row = 0; row < 4; row++)
+                out[c * 4 + row] = a[row] * b[c * 4] + a[4 + row] * b[c * 4 + 1] + a[8 + row] * b[c * 4 + 2] + a[12 + row] * b[c * 4 + 3];
+    }
+};
@@ -0,0 +1,139 @@
+#pragma once
+
+// Std. Includes
+#include <iostream>
+
+// GL Includes
+#include <glad/glad.h>
+
+#include "GLState.h"
+#include "Shader.h"
+
+// Weighted blended order-independent transparency (McGuire and Bavoil 2013). Items of a weightedBlended
+// material go into RenderQueue::PASS_WEIGHTED unsorted, and every fragment adds itself into two targets
+// with one blend function, glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA)
+// (GL 3.3 has no blend state per draw buffer; layout in shaders/weighted_blended.glsl):
+//   accumulation  RGBA16F  sum of premultiplied color * weight, alpha keeps the product of (1 - alpha)
+//   weights       R16F     sum of alpha * weight
+// Composite() then lays the weighted average color over the scene with the coverage the product leaves.
+// The pass tests against a copy of the scene's depth and writes none, so the order of the draws and of the
+// triangles inside them doesn't matter: intersecting and instanced transparent geometry blend the same way.
+class WeightedTransparency
+{
+public:
+    GLuint AccumulationTexture = 0;
+    GLuint WeightTexture = 0;
+    GLuint DepthBuffer = 0;             // DEPTH24_STENCIL8 renderbuffer, the scene's depth is copied into it
+    GLuint Framebuffer = 0;
+
+    void Create(int width, int height)
+    {
+        this->width = width;
+        this->height = height;
+        this->AccumulationTexture = this->createTarget(GL_RGBA16F, GL_RGBA);
+        this->WeightTexture = this->createTarget(GL_R16F, GL_RED);
+        glGenRenderbuffers(1, &this->DepthBuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, this->DepthBuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+        glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+        GLState& state = GLState::Instance();
+        glGenFramebuffers(1, &this->Framebuffer);
+        state.BindFramebuffer(this->Framebuffer);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->AccumulationTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, this->WeightTexture, 0);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, this->DepthBuffer);
+        const GLenum drawBuffers[] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+        glDrawBuffers(2, drawBuffers);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::WEIGHTED_TRANSPARENCY::FRAMEBUFFER_INCOMPLETE" << std::endl;
+        state.BindFramebuffer(0);
+        // depth blits need the same format on both ends; the window asks for 24/8 bits, but that is only a hint
+        GLint depthBits = 0, stencilBits = 0;
+        glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_DEPTH, GL_FRAMEBUFFER_ATTACHMENT_DEPTH_SIZE, &depthBits);
+        glGetFramebufferAttachmentParameteriv(GL_FRAMEBUFFER, GL_STENCIL, GL_FRAMEBUFFER_ATTACHMENT_STENCIL_SIZE, &stencilBits);
+        this->defaultDepthMatches = depthBits == 24 && stencilBits == 8;
+        if (!this->defaultDepthMatches)
+            std::cout << "WEIGHTED_TRANSPARENCY::DEFAULT_FRAMEBUFFER_DEPTH " << depthBits << "/" << stencilBits
+                << " bits, forward transparency is not depth tested against the scene" << std::endl;
+    }
+
+    void Destroy()
+    {
+        GLState& state = GLState::Instance();
+        state.DeleteFramebuffers(1, &this->Framebuffer);
+        GLuint textures[] = { this->AccumulationTexture, this->WeightTexture };
+        state.DeleteTextures(2, textures);
+        glDeleteRenderbuffers(1, &this->DepthBuffer);
+    }
+
+    // Copies the depth of the scene drawn so far, binds and clears the targets and sets the additive blending;
+    // depth writes stay off until Composite(). A default framebuffer whose depth isn't 24/8 can't be blitted
+    // from, its layers are then cleared to the far plane instead
+    void BeginAccumulation(GLuint sceneFramebuffer)
+    {
+        GLState& state = GLState::Instance();
+        if (sceneFramebuffer != 0 || this->defaultDepthMatches)
+        {
+            state.BindFramebuffer(GL_READ_FRAMEBUFFER, sceneFramebuffer);
+            state.BindFramebuffer(GL_DRAW_FRAMEBUFFER, this->Framebuffer);
+            glBlitFramebuffer(0, 0, this->width, this->height, 0, 0, this->width, this->height, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+            state.BindFramebuffer(this->Framebuffer);
+        }
+        else
+        {
+            state.BindFramebuffer(this->Framebuffer);
+            state.DepthMask(GL_TRUE);
+            glClearBufferfi(GL_DEPTH_STENCIL, 0, 1.0f, 0);
+        }
+        // nothing accumulated yet: no color, full revealage, no weight
+        const GLfloat accumulation[] = { 0.0f, 0.0f, 0.0f, 1.0f };
+        const GLfloat weight[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+        glClearBufferfv(GL_COLOR, 0, accumulation);
+        glClearBufferfv(GL_COLOR, 1, weight);
+        state.Enable(GL_BLEND);
+        state.BlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+        state.DepthFunc(GL_LESS);
+        state.DepthMask(GL_FALSE);
+    }
+
+    // Blends the accumulated layers over sceneFramebuffer with one full screen triangle (vertexArray may be
+    // empty, fullscreen.vs needs no attributes) and restores the blending and depth state of the other passes
+    void Composite(Shader& shader, GLuint vertexArray, GLuint sceneFramebuffer)
+    {
+        GLState& state = GLState::Instance();
+        state.BindFramebuffer(sceneFramebuffer);
+        state.BlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+        state.DepthMask(GL_TRUE);
+        state.Disable(GL_DEPTH_TEST);
+        state.BindTexture(0, GL_TEXTURE_2D, this->AccumulationTexture);
+        state.BindTexture(1, GL_TEXTURE_2D, this->WeightTexture);
+        shader.Use();
+        state.BindVertexArray(vertexArray);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        state.Enable(GL_DEPTH_TEST);
+    }
+
+    size_t MemoryBytes() const
+    {
+        return (size_t)this->width * this->height * (8 + 2 + 4);
+    }
+
+private:
+    int width = 0, height = 0;
+    bool defaultDepthMatches = true;    // the window got the 24/8 depth stencil buffer it asked for
+
+    // Read texel by texel, no filtering or mipmaps
+    GLuint createTarget(GLenum internalFormat, GLenum format)
+    {
+        GLuint texture;
+        glGenTextures(1, &texture);
+        GLState::Instance().BindTexture(0, GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, this->width, this->height, 0, format, GL_FLOAT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        return texture;
+    }
+};
@@ -0,0 +1,68 @@
+//reflection probes baked at load (BakedReflectionProbes.h): six layers per probe of one texture array, BC1 holding
+//the square root of the color, and the boxes their reflections are projected onto. Include after environment.glsl
+#define MAX_BAKED_PROBES 16
+#define NO_BAKED_PROBE 255
+
+layout (std140) uniform BakedProbeData
+{
+	vec4 bakedProbePosition[MAX_BAKED_PROBES];
+	vec4 bakedProbeBoxMin[MAX_BAKED_PROBES];
+	vec4 bakedProbeBoxMax[MAX_BAKED_PROBES];
+	int bakedProbeCount;
+	float bakedProbeMaxLevel;
+};
+
+uniform sampler2DArray bakedProbes;
+
+//a cube face lookup by hand, the face and its coordinates as GL picks them for cube maps (+X, -X, +Y, -Y, +Z, -Z)
+vec3 bakedProbeTexel(int probe, vec3 direction, float level)
+{
+	vec3 a = abs(direction);
+	float face;
+	vec3 st;
+	if (a.x >= a.y && a.x >= a.z)
+	{
+		face = direction.x > 0.0 ? 0.0 : 1.0;
+		st = vec3(direction.x > 0.0 ? -direction.z : direction.z, -direction.y, a.x);
+	}
+	else if (a.y >= a.z)
+	{
+		face = direction.y > 0.0 ? 2.0 : 3.0;
+		st = vec3(direction.x, direction.y > 0.0 ? direction.z : -direction.z, a.y);
+	}
+	else
+	{
+		face = direction.z > 0.0 ? 4.0 : 5.0;
+		st = vec3(direction.z > 0.0 ? direction.x : -direction.x, -direction.y, a.z);
+	}
+	vec3 color = textureLod(bakedProbes, vec3(st.xy / st.z * 0.5 + 0.5, float(probe) * 6.0 + face), level).rgb;
+	return color * color;
+}
+
+//parallax correction: where the ray from position along r leaves the probe's box, seen from the probe
+vec3 bakedProbeDirection(int probe, vec3 position, vec3 r)
+{
+	vec3 first = (bakedProbeBoxMax[probe].xyz - position) / r;
+	vec3 second = (bakedProbeBoxMin[probe].xyz - position) / r;
+	vec3 furthest = max(first, second);
+	float distance = min(min(furthest.x, furthest.y), furthest.z);
+	return position + r * distance - bakedProbePosition[probe].xyz;
+}
+
+//the reflection along r at position through a lobe of the given roughness, from the probes an object's selection
+//names (BakedReflectionProbes::Selection()), the sky when it names none; a second fetch only while blending
+vec3 bakedProbeReflection(int selection, vec3 position, vec3 r, float roughness)
+{
+	int probe = selection & 0xFF;
+	if (probe == NO_BAKED_PROBE)
+		return roughness > 0.0 ? environmentReflection(r, roughness) : textureLod(environmentMap, r, 0.0).rgb;
+	float level = roughness * bakedProbeMaxLevel;
+	vec3 color = bakedProbeTexel(probe, bakedProbeDirection(probe, position, r), level);
+	float blend = float(selection >> 16) / 255.0;
+	if (blend > 0.0)
+	{
+		int next = (selection >> 8) & 0xFF;
+		color = mix(color, bakedProbeTexel(next, bakedProbeDirection(next, position, r), level), blend);
+	}
+	return color;
+}
@@ -1,11 +1,11 @@
 #version 330 core
-in vec2 texCoords;
+in vec3 texCoords;
 
 out vec4 FragColor;
 
-uniform sampler2D billboardTexture;
+uniform sampler2DArray spriteAtlas;
 
 void main()
 {
-    FragColor = texture(billboardTexture, texCoords);
+    FragColor = texture(spriteAtlas, texCoords);
 }
\ No newline at end of file
@@ -1,26 +1,20 @@
 #version 330 core
+#include "frame_data.glsl"
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec2 coordinates;
+//per instance: center and size, sorted back to front by BillboardRenderer; the sprite's rectangle and page in the atlas
+layout (location = 2) in vec4 billboard;
+layout (location = 3) in vec4 spriteRect;
+layout (location = 4) in float spriteLayer;
 
-out vec2 texCoords;
-
-//uniform vec3 cameraPos;
-uniform mat4 modelMat;
-uniform mat4 viewMat;
-uniform mat4 projectionMat;
+out vec3 texCoords;
 
 void main()
 {
-    /*
-    mat3 M1 = inverse(mat3(viewMat));
-    vec3 objToCam = normalize(cameraPos - position);
-    vec3 objToCamProj = normalize(vec3(objToCam.x, 0.0, objToCam.z));
-    vec3 right = normalize(vec3(M1[0][0], M1[1][0], M1 [2][0]));
-    vec3 up = normalize(vec3(M1[0][1], M1[1][1], M1 [2][1]));
-    vec3 lookAt = cross(up, right);
-    */
-    vec3 Position = inverse(mat3(viewMat)) * position;
-
-    texCoords = coordinates;    
-    gl_Position = projectionMat * viewMat * modelMat * vec4(Position, 1.0f);
-}
\ No newline at end of file
+    //the rows of the view rotation are the camera's right and up in world space
+    vec3 right = vec3(viewMat[0][0], viewMat[1][0], viewMat[2][0]);
+    vec3 up = vec3(viewMat[0][1], viewMat[1][1], viewMat[2][1]);
+    vec3 worldPos = billboard.xyz + (right * position.x + up * position.y) * billboard.w;
+    texCoords = vec3(mix(spriteRect.xy, spriteRect.zw, coordinates), spriteLayer);
+    gl_Position = projectionMat * viewMat * vec4(worldPos, 1.0f);
+}
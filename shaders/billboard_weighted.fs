@@ -0,0 +1,11 @@
+#version 330 core
+#include "weighted_blended.glsl"
+//billboard.fs for the weighted blended material, the layers are added in any order
+in vec3 texCoords;
+
+uniform sampler2DArray spriteAtlas;
+
+void main()
+{
+    writeWeightedBlended(texture(spriteAtlas, texCoords));
+}
@@ -1,23 +1,27 @@
 #version 330 core
+#include "frame_data.glsl"
+#include "transforms.glsl"
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec2 coordinates;
 layout (location = 2) in vec3 normal;
+#ifdef LIGHTMAP
+layout (location = 3) in vec2 lightmapCoordinates;
+out vec2 LightmapCoords;
+#endif
 
 out vec2 texCoords;
 out vec3 Normal;
 out vec3 FragmentPos;
-out vec4 FragPosLightSpace;
-
-uniform mat4 modelMat;
-uniform mat4 viewMat;
-uniform mat4 projectionMat;
-uniform mat4 lightSpaceMatrix;
+out float ViewDepth;
 
 void main()
 {
-    gl_Position = projectionMat * viewMat * modelMat * vec4(position, 1.0f);
+    gl_Position = objectMVP() * vec4(position, 1.0f);
     texCoords = coordinates;
-    Normal = mat3(transpose(inverse(modelMat))) * normal;
-    FragmentPos = vec3(modelMat * vec4(position, 1.0f));
-    FragPosLightSpace = lightSpaceMatrix * vec4(FragmentPos, 1.0);
+    Normal = objectNormal() * normal;
+    FragmentPos = vec3(objectModel() * vec4(position, 1.0f));
+    ViewDepth = -(viewMat * vec4(FragmentPos, 1.0)).z;
+#ifdef LIGHTMAP
+    LightmapCoords = lightmapCoordinates;
+#endif
 }
\ No newline at end of file
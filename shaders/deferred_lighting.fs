@@ -0,0 +1,62 @@
+#version 330 core
+#include "frame_data.glsl"
+#include "environment.glsl"
+#include "shadow_moments.glsl"
+#include "light_data.glsl"
+#include "lighting.glsl"
+#include "gbuffer.glsl"
+
+//the deferred pipeline's lighting pass: one full screen triangle that lights every pixel the geometry pass
+//covered, with the same variant keys as the forward shader; SCREEN_SPACE_REFLECTIONS puts the traced reflections
+//(ScreenSpaceReflections.h) in place of the environment's on the reflective pixels
+in vec2 texCoords;
+
+out vec4 color;
+
+uniform sampler2D gAlbedoMap;
+uniform sampler2D gNormalMap;
+uniform sampler2D gDepthMap;
+uniform mat4 inverseViewProjection;
+#ifdef SCREEN_SPACE_REFLECTIONS
+uniform sampler2D screenSpaceReflections;  //at half or quarter resolution, premultiplied by coverage
+#endif
+
+void main()
+{
+	ivec2 texel = ivec2(gl_FragCoord.xy);
+	float depth = texelFetch(gDepthMap, texel, 0).r;
+	//nothing was drawn here, the sky pass fills it later
+	if (depth >= 1.0)
+		discard;
+	vec4 albedo = texelFetch(gAlbedoMap, texel, 0);
+	vec4 normal = texelFetch(gNormalMap, texel, 0);
+	int model = int(normal.a * 3.0 + 0.5);
+	if (model == LIGHTING_MODEL_UNLIT)
+	{
+		color = vec4(albedo.rgb, 1.0);
+		return;
+	}
+	vec4 world = inverseViewProjection * vec4(vec3(texCoords, depth) * 2.0 - 1.0, 1.0);
+
+	Surface surface;
+	surface.position = world.xyz / world.w;
+	surface.normal = decodeOctahedral(normal.xy * 2.0 - 1.0);
+	surface.albedo = albedo.rgb;
+	surface.specular = vec3(albedo.a);
+	surface.shininess = normal.b * GBUFFER_SHININESS_SCALE;
+	surface.viewDepth = -(viewMat * vec4(surface.position, 1.0)).z;
+	color = vec4(shadeSurface(surface), 1.0);
+#ifdef SCREEN_SPACE_REFLECTIONS
+	//the reflected radiance through the same split-sum weight as the ambient reflection, blended over it by the
+	//coverage: where a ray hit, its radiance replaces the environment's, where it missed the environment stays
+	vec4 reflection = texture(screenSpaceReflections, texCoords);
+	if (model == LIGHTING_MODEL_REFLECTIVE && reflection.a > 0.0)
+	{
+		vec3 viewDir = normalize(viewPos - surface.position);
+		float roughness = pow(2.0 / (0.25 * surface.shininess + 2.0), 0.25);
+		vec2 brdf = environmentBrdf(max(dot(surface.normal, viewDir), 0.0), roughness);
+		vec3 environment = directLight.ambient * environmentScale * environmentReflection(reflect(-viewDir, surface.normal), roughness);
+		color.rgb += (reflection.rgb - reflection.a * environment) * (surface.specular * brdf.x + brdf.y);
+	}
+#endif
+}
@@ -0,0 +1,32 @@
+//image based lighting precomputed from the skybox (ImageBasedLighting.h): the irradiance as spherical harmonics in
+//the FrameData block, a prefiltered reflection cube whose level r * environmentMaxLevel holds GGX roughness r,
+//and the split-sum BRDF table. Irradiance and reflection are over the sky's average luminance once scaled.
+//Include after frame_data.glsl
+uniform samplerCube environmentMap;
+uniform sampler2D brdfLut;      //scale and bias of F0 by (n.v, roughness)
+
+//cosine-weighted sky around the normal, 1 on average over the sphere
+vec3 environmentIrradiance(vec3 n)
+{
+	vec3 irradiance = irradianceSH[0].rgb * 0.282095
+		+ irradianceSH[1].rgb * 0.488603 * n.y
+		+ irradianceSH[2].rgb * 0.488603 * n.z
+		+ irradianceSH[3].rgb * 0.488603 * n.x
+		+ irradianceSH[4].rgb * 1.092548 * n.x * n.y
+		+ irradianceSH[5].rgb * 1.092548 * n.y * n.z
+		+ irradianceSH[6].rgb * 0.315392 * (3.0 * n.z * n.z - 1.0)
+		+ irradianceSH[7].rgb * 1.092548 * n.x * n.z
+		+ irradianceSH[8].rgb * 0.546274 * (n.x * n.x - n.y * n.y);
+	return max(irradiance, vec3(0.0));
+}
+
+//the sky seen along r through a lobe of the given roughness, as stored (not normalized)
+vec3 environmentReflection(vec3 r, float roughness)
+{
+	return textureLod(environmentMap, r, roughness * environmentMaxLevel).rgb;
+}
+
+vec2 environmentBrdf(float nDotV, float roughness)
+{
+	return texture(brdfLut, vec2(nDotV, roughness)).rg;
+}
@@ -0,0 +1,27 @@
+//per-frame block, written once per frame into a ring buffer (FrameUniforms.h) and shared by every program
+#define MAX_CASCADES 4
+#define IRRADIANCE_COEFFICIENTS 9
+
+struct DirectLight {
+	vec3 direction;
+
+	vec3 ambient;
+	vec3 diffuse;
+	vec3 specular;
+};
+
+layout (std140) uniform FrameData
+{
+	mat4 viewMat;
+	mat4 projectionMat;
+	mat4 cascadeMatrices[MAX_CASCADES];
+	vec4 cascadeSplits;
+	vec3 viewPos;
+	float time;
+	DirectLight directLight;
+	int transformBase;
+	int cascadeCount;
+	float environmentScale;
+	float environmentMaxLevel;
+	vec4 irradianceSH[IRRADIANCE_COEFFICIENTS];    //rgb, see environment.glsl
+};
@@ -0,0 +1,9 @@
+#version 330 core
+//one triangle covering the viewport, drawn without vertex buffers as glDrawArrays(GL_TRIANGLES, 0, 3)
+out vec2 texCoords;
+
+void main()
+{
+	texCoords = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+	gl_Position = vec4(texCoords * 2.0 - 1.0, 0.0, 1.0);
+}
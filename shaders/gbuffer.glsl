@@ -0,0 +1,38 @@
+//layout of the deferred pipeline's G-buffer (GBuffer.h), two 32-bit targets and depth:
+//  albedo  RGBA8     rgb albedo, a specular intensity
+//  normal  RGB10_A2  rg octahedral normal, b shininess / 256, a lighting model
+//a fragment shader writing it defines GBUFFER_OUTPUTS before the include
+#define LIGHTING_MODEL_LIT 0        //shaded by every light
+#define LIGHTING_MODEL_UNLIT 1      //albedo is the final color, e.g. the environment mapped cubes
+#define LIGHTING_MODEL_REFLECTIVE 2 //lit, plus the screen-space reflections when they are on, e.g. the floor
+#define GBUFFER_SHININESS_SCALE 256.0
+
+#ifdef GBUFFER_OUTPUTS
+layout (location = 0) out vec4 gAlbedo;
+layout (location = 1) out vec4 gNormal;
+#endif
+
+//unit normal onto the octahedron, then its lower half folded over the upper one, [-1, 1]^2
+vec2 encodeOctahedral(vec3 n)
+{
+	n /= abs(n.x) + abs(n.y) + abs(n.z);
+	vec2 folded = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+	return n.z >= 0.0 ? n.xy : folded;
+}
+
+vec3 decodeOctahedral(vec2 e)
+{
+	vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+	float t = clamp(-n.z, 0.0, 1.0);
+	n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+	return normalize(n);
+}
+
+#ifdef GBUFFER_OUTPUTS
+void writeGBuffer(vec3 albedo, float specular, vec3 normal, float shininess, int model)
+{
+	gAlbedo = vec4(albedo, specular);
+	gNormal = vec4(encodeOctahedral(normalize(normal)) * 0.5 + 0.5, clamp(shininess / GBUFFER_SHININESS_SCALE, 0.0, 1.0),
+		float(model) / 3.0);
+}
+#endif
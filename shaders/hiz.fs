@@ -0,0 +1,31 @@
+#version 330 core
+//one level of the min-depth pyramid the screen-space reflections trace against (ScreenSpaceReflections.h). COPY_DEPTH
+//fills level 0 from the depth buffer; otherwise source's base level is the level above and each texel keeps the
+//nearest of the 2x2 under it, plus the third row or column at the edge of an odd sized level, so a cell never
+//claims to be further than anything it covers
+out float depth;
+
+uniform sampler2D source;
+
+void main()
+{
+	ivec2 texel = ivec2(gl_FragCoord.xy);
+#ifdef COPY_DEPTH
+	depth = texelFetch(source, texel, 0).r;
+#else
+	ivec2 size = textureSize(source, 0);
+	ivec2 base = texel * 2;
+	ivec2 last = size - 1;
+	float nearest = min(min(texelFetch(source, min(base, last), 0).r, texelFetch(source, min(base + ivec2(1, 0), last), 0).r),
+		min(texelFetch(source, min(base + ivec2(0, 1), last), 0).r, texelFetch(source, min(base + ivec2(1, 1), last), 0).r));
+	bool extraColumn = (size.x & 1) == 1 && base.x + 2 == last.x;
+	bool extraRow = (size.y & 1) == 1 && base.y + 2 == last.y;
+	if (extraColumn)
+		nearest = min(nearest, min(texelFetch(source, min(base + ivec2(2, 0), last), 0).r, texelFetch(source, min(base + ivec2(2, 1), last), 0).r));
+	if (extraRow)
+		nearest = min(nearest, min(texelFetch(source, min(base + ivec2(0, 2), last), 0).r, texelFetch(source, min(base + ivec2(1, 2), last), 0).r));
+	if (extraColumn && extraRow)
+		nearest = min(nearest, texelFetch(source, base + ivec2(2, 2), 0).r);
+	depth = nearest;
+#endif
+}
@@ -0,0 +1,64 @@
+//local lights of the frame (LightUniforms.h) and their shadows: atlas tiles for spot lights (ShadowAtlas.h),
+//six layers of the point shadow array for point lights (PointShadows.h); the lights are sorted into the
+//froxels of the view frustum (LightClusters.h)
+#define MAX_SHADOW_TILES 32
+#define MAX_POINT_SHADOWS 4
+#define LIGHT_POINT 0
+#define LIGHT_SPOT 1
+
+struct LocalLight {
+	vec3 position;
+	float range;
+	vec3 color;
+	float linear;
+	vec3 direction;
+	float quadratic;
+	float innerCutOff;
+	float outerCutOff;
+	int shadowTile;    //spot: its atlas tile, point: its point shadow slot, -1 without shadow
+	int type;
+};
+
+struct ShadowTile {
+	mat4 matrix;
+	vec4 rect;         //offset and size in atlas texture coordinates
+};
+
+layout (std140) uniform LightData
+{
+	ShadowTile shadowTiles[MAX_SHADOW_TILES];
+	//world to clip space of each cube face, 6 per slot (+X, -X, +Y, -Y, +Z, -Z), layer = 6 * slot + face
+	mat4 pointShadowMatrices[MAX_POINT_SHADOWS * 6];
+	ivec4 clusterGrid;      //froxels across, down and deep, tile size in pixels
+	vec4 clusterDepth;      //near plane, slices per unit of log depth
+	int lightBase;          //first texel of this frame's slice of each texture buffer
+	int clusterBase;
+	int lightIndexBase;
+	int lightCount;
+};
+
+uniform samplerBuffer lights;           //4 texels per light, laid out like LocalLight
+uniform usamplerBuffer lightClusters;   //offset into lightIndices and count of each froxel
+uniform usamplerBuffer lightIndices;    //the froxels' lists, one after the other
+
+LocalLight fetchLight(int index)
+{
+	int texel = lightBase + 4 * index;
+	vec4 a = texelFetch(lights, texel), b = texelFetch(lights, texel + 1);
+	vec4 c = texelFetch(lights, texel + 2), d = texelFetch(lights, texel + 3);
+	return LocalLight(a.xyz, a.w, b.xyz, b.w, c.xyz, c.w, d.x, d.y, floatBitsToInt(d.z), floatBitsToInt(d.w));
+}
+
+//offset into lightIndices and light count of the froxel a fragment falls into
+uvec2 lightCluster(vec2 fragCoord, float viewDepth)
+{
+	int slice = int(log(max(viewDepth, clusterDepth.x) / clusterDepth.x) * clusterDepth.y);
+	ivec3 cell = min(ivec3(ivec2(fragCoord) / clusterGrid.w, slice), clusterGrid.xyz - 1);
+	return texelFetch(lightClusters, clusterBase + (cell.z * clusterGrid.y + cell.y) * clusterGrid.x + cell.x).xy;
+}
+
+//the n-th light of a froxel's list
+int clusterLight(uvec2 cluster, uint n)
+{
+	return int(texelFetch(lightIndices, lightIndexBase + int(cluster.x + n)).r);
+}
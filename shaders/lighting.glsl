@@ -0,0 +1,298 @@
+//lighting of a surface point by the direct light, its cascaded shadow and the local lights with their shadows,
+//shared by the forward shader (default.fs) and the deferred lighting pass (deferred_lighting.fs).
+//Include after frame_data.glsl, environment.glsl, shadow_moments.glsl and light_data.glsl
+//variant keys: SHADOW_FILTER picks one of the filters below for the direct light,
+//SHADOW_PCF_TAPS is 1, 9 or 25 (the Poisson kernel takes that many taps too)
+#define SHADOW_FILTER_PCF 0         //manual depth comparisons on a grid
+#define SHADOW_FILTER_HARDWARE 1    //the same grid through a comparison sampler, each tap filters 2x2 texels
+#define SHADOW_FILTER_POISSON 2     //rotated Poisson disk through the comparison sampler
+#define SHADOW_FILTER_EVSM 3        //one fetch of prefiltered exponential moments
+#ifndef SHADOW_FILTER
+#define SHADOW_FILTER SHADOW_FILTER_PCF
+#endif
+#ifndef SHADOW_PCF_TAPS
+#define SHADOW_PCF_TAPS 9
+#endif
+//CLUSTERED_LIGHTS 1 loops over the lights of the fragment's froxel, 0 over every light of the frame
+#ifndef CLUSTERED_LIGHTS
+#define CLUSTERED_LIGHTS 1
+#endif
+#if SHADOW_PCF_TAPS >= 25
+#define SHADOW_PCF_RADIUS 2
+#elif SHADOW_PCF_TAPS >= 9
+#define SHADOW_PCF_RADIUS 1
+#else
+#define SHADOW_PCF_RADIUS 0
+#endif
+
+//what the lighting needs to know about the point being shaded, from the material or the G-buffer
+struct Surface {
+	vec3 position;
+	vec3 normal;        //normalized
+	vec3 albedo;
+	vec3 specular;
+	float shininess;
+	float viewDepth;    //distance along the view direction, picks the cascade and the froxel
+};
+
+#if SHADOW_FILTER == SHADOW_FILTER_HARDWARE || SHADOW_FILTER == SHADOW_FILTER_POISSON
+uniform sampler2DArrayShadow shadowMap;    //one layer per cascade
+#else
+uniform sampler2DArray shadowMap;    //one layer per cascade, depth or moments
+#endif
+uniform sampler2DShadow shadowAtlas;    //tiles of the spot lights
+uniform sampler2DArrayShadow pointShadowMap;    //six layers per point light
+//====================================FUNCTIONS===============================================
+//the direct light's ambient color spread over the sky: its irradiance around the normal on the albedo, and its
+//reflection through the roughness the Blinn-Phong exponent below amounts to, weighted by the split-sum table
+vec3 calculateAmbient(DirectLight light, Surface surface, vec3 viewDir)
+{
+	float roughness = pow(2.0 / (0.25 * surface.shininess + 2.0), 0.25);
+	vec2 brdf = environmentBrdf(max(dot(surface.normal, viewDir), 0.0), roughness);
+	vec3 reflection = environmentScale * environmentReflection(reflect(-viewDir, surface.normal), roughness);
+	return light.ambient * (environmentIrradiance(surface.normal) * surface.albedo + reflection * (surface.specular * brdf.x + brdf.y));
+}
+
+vec3 calculateDirectLight(DirectLight light, Surface surface, vec3 viewDir, float shadow)
+{
+	vec3 resLight = vec3(0.0, 0.0, 0.0);
+
+	vec3 lightDir = normalize(-light.direction);
+	//diffuse component
+	float diff = max(dot(surface.normal, lightDir), 0.0);
+	//specular component
+	/* Phong model
+	vec3 reflectDir = reflect(-lightDir, surface.normal);
+	float spec = pow(max(dot(viewDir, reflectDir), 0.0), surface.shininess);
+	*/
+	//Blinn-Phong model
+	vec3 halfwayDir = normalize(lightDir + viewDir);
+	float spec = pow(max(dot(surface.normal, halfwayDir),0.0), 0.25 * surface.shininess);
+
+	vec3 ambient = calculateAmbient(light, surface, viewDir);
+	vec3 diffuse = light.diffuse * diff * surface.albedo;
+	vec3 specular = light.specular * spec * surface.specular;
+
+	resLight += ambient + (1.0 - shadow)*(diffuse + specular);
+
+	return resLight;
+}
+
+//fraction of a local light's shadow tile that hides the fragment, 2x2 comparison taps
+float calculatePointShadow(LocalLight light, vec3 fragPos, vec3 normal)
+{
+	vec3 toFragment = fragPos - light.position;
+	//the cube face the fragment is on, by the major axis
+	vec3 a = abs(toFragment);
+	int face;
+	if (a.x >= a.y && a.x >= a.z)
+		face = toFragment.x > 0.0 ? 0 : 1;
+	else if (a.y >= a.z)
+		face = toFragment.y > 0.0 ? 2 : 3;
+	else
+		face = toFragment.z > 0.0 ? 4 : 5;
+	int layer = 6 * light.shadowTile + face;
+	//normal offset by the world size of a texel at this depth, a 90 degree face spans twice the depth
+	vec2 texelSize = 1.0 / vec2(textureSize(pointShadowMap, 0).xy);
+	float texelWorld = 2.0 * max(a.x, max(a.y, a.z)) * texelSize.x;
+	vec4 clip = pointShadowMatrices[layer] * vec4(fragPos + normal * 1.5 * texelWorld, 1.0);
+	vec3 projCoords = clip.xyz / clip.w * 0.5 + 0.5;
+	if (projCoords.z > 1.0)
+		return 0.0;
+	float lit = 0.0;
+	for (int x = 0; x < 2; ++x)
+		for (int y = 0; y < 2; ++y)
+			lit += texture(pointShadowMap, vec4(projCoords.xy + (vec2(x, y) - 0.5) * texelSize, layer, projCoords.z - 0.00002));
+	return 1.0 - 0.25 * lit;
+}
+
+float calculateSpotShadow(LocalLight light, vec3 fragPos, vec3 normal)
+{
+	vec3 toFragment = fragPos - light.position;
+	vec4 rect = shadowTiles[light.shadowTile].rect;
+	mat4 lightMatrix = shadowTiles[light.shadowTile].matrix;
+	//normal offset by the world size of a tile texel at this distance, the projection scale is lightMatrix[1][1]
+	vec2 texelSize = 1.0 / vec2(textureSize(shadowAtlas, 0));
+	float texelWorld = 2.0 * length(toFragment) * texelSize.x / (rect.z * length(vec3(lightMatrix[0][1], lightMatrix[1][1], lightMatrix[2][1])));
+	vec4 clip = lightMatrix * vec4(fragPos + normal * 1.5 * texelWorld, 1.0);
+	vec3 projCoords = clip.xyz / clip.w * 0.5 + 0.5;
+	if (projCoords.z > 1.0)
+		return 0.0;
+	//taps stay inside the tile, a neighbour's texels are another light's
+	vec2 lower = rect.xy + 1.5 * texelSize, upper = rect.xy + rect.zw - 1.5 * texelSize;
+	vec2 uv = rect.xy + projCoords.xy * rect.zw;
+	float lit = 0.0;
+	for (int x = 0; x < 2; ++x)
+		for (int y = 0; y < 2; ++y)
+			lit += texture(shadowAtlas, vec3(clamp(uv + (vec2(x, y) - 0.5) * texelSize, lower, upper), projCoords.z - 0.00002));
+	return 1.0 - 0.25 * lit;
+}
+
+vec3 calculateLocalLight(LocalLight light, Surface surface, vec3 viewDir)
+{
+	vec3 toLight = light.position - surface.position;
+	float distance = length(toLight);
+	if (distance > light.range)
+		return vec3(0.0);
+	vec3 lightDir = toLight / distance;
+	//diffuse component
+	float diff = max(dot(surface.normal, lightDir), 0.0);
+	//Blinn-Phong model
+	vec3 halfwayDir = normalize(lightDir + viewDir);
+	float spec = pow(max(dot(surface.normal, halfwayDir),0.0), 2 * surface.shininess);
+	//intensity(for soft edges), spot lights only
+	float intensity = 1.0;
+	if (light.type == LIGHT_SPOT)
+	{
+		float theta = dot(lightDir, normalize(-light.direction));
+		float epsilon = (light.innerCutOff - light.outerCutOff);
+		intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+	}
+	//attenuation, faded to zero at the range
+	float attenuation = 1.0 / (1.0 + light.linear * distance + light.quadratic * (distance * distance));
+	float fade = clamp(1.0 - pow(distance / light.range, 4.0), 0.0, 1.0);
+	attenuation *= fade * fade;
+	if (intensity * attenuation <= 0.0)
+		return vec3(0.0);
+
+	float shadow = 0.0;
+	if (light.shadowTile >= 0)
+		shadow = light.type == LIGHT_POINT ? calculatePointShadow(light, surface.position, surface.normal)
+			: calculateSpotShadow(light, surface.position, surface.normal);
+	vec3 diffuse = light.color * diff * surface.albedo;
+	vec3 specular = light.color * spec * surface.specular;
+	return (1.0 - shadow) * intensity * attenuation * (diffuse + specular);
+}
+
+#if SHADOW_FILTER == SHADOW_FILTER_POISSON
+const vec2 POISSON_DISK[25] = vec2[](
+	vec2(0.0000, 0.0000), vec2(-0.2665, 0.9638), vec2(-0.8549, -0.5187), vec2(0.9857, 0.1682),
+	vec2(0.2208, -0.9751), vec2(-0.9304, 0.3644), vec2(0.5378, 0.8396), vec2(0.8252, -0.5577),
+	vec2(-0.3921, -0.9193), vec2(-0.3626, 0.4169), vec2(0.4607, 0.2975), vec2(-0.5304, -0.0957),
+	vec2(0.3086, -0.4442), vec2(-0.1911, -0.4671), vec2(0.0952, 0.6282), vec2(0.6440, -0.1351),
+	vec2(-0.9871, -0.0834), vec2(-0.6670, 0.7412), vec2(0.8203, 0.5413), vec2(0.5553, -0.8169),
+	vec2(0.0947, 0.9903), vec2(-0.5207, -0.5992), vec2(-0.0628, -0.7844), vec2(0.9746, -0.2191),
+	vec2(0.3384, -0.0090)
+);
+
+//per-pixel rotation of the kernel, turns banding into fine noise
+float interleavedGradientNoise(vec2 pixel)
+{
+	return fract(52.9829189 * fract(dot(pixel, vec2(0.06711056, 0.00583715))));
+}
+#endif
+
+#if SHADOW_FILTER == SHADOW_FILTER_EVSM
+//upper bound of the lit fraction from the mean and variance of the warped occluder depths
+float chebyshevUpperBound(vec2 moments, float depth, float minVariance)
+{
+	float variance = max(moments.y - moments.x * moments.x, minVariance);
+	float d = depth - moments.x;
+	float pMax = variance / (variance + d * d);
+	//cut the tail of the bound against light bleeding
+	pMax = clamp((pMax - 0.2) / 0.8, 0.0, 1.0);
+	return depth <= moments.x ? 1.0 : pMax;
+}
+#else
+//1 when the texel at uv is in shadow, filtered by the comparison sampler where there is one
+float shadowTap(vec2 uv, int cascade, float depth)
+{
+#if SHADOW_FILTER == SHADOW_FILTER_PCF
+	return depth > texture(shadowMap, vec3(uv, cascade)).r ? 1.0 : 0.0;
+#else
+	return 1.0 - texture(shadowMap, vec4(uv, cascade, depth));
+#endif
+}
+#endif
+
+float calculateShadow(Surface surface, vec3 lightDir)
+{
+	//the first cascade whose slice reaches the fragment, none past the last one
+	if (surface.viewDepth > cascadeSplits[cascadeCount - 1])
+		return 0.0;
+	int cascade = 0;
+	for (int i = 0; i < cascadeCount - 1; ++i)
+	{
+		if (surface.viewDepth > cascadeSplits[i])
+			cascade = i + 1;
+	}
+	mat4 lightMatrix = cascadeMatrices[cascade];
+
+	//world size of a shadow texel and depth units per world unit, from the rows of the light matrix
+	vec2 texelSize = 1.0 / textureSize(shadowMap, 0).xy;
+	float texelWorld = 2.0 * texelSize.x / length(vec3(lightMatrix[0][0], lightMatrix[1][0], lightMatrix[2][0]));
+	float depthScale = 0.5 * length(vec3(lightMatrix[0][2], lightMatrix[1][2], lightMatrix[2][2]));
+	//normal offset against acne, grows with the slope like the old bias
+	float slope = 1.0 - max(dot(surface.normal, lightDir), 0.0);
+	vec3 offsetPos = surface.position + surface.normal * texelWorld * (1.0 + 2.0 * slope);
+	vec3 projCoords = (lightMatrix * vec4(offsetPos, 1.0)).xyz * 0.5 + 0.5;
+	float currentDepth = projCoords.z - texelWorld * depthScale;
+	if (currentDepth > 1.0)
+		return 0.0;
+
+#if SHADOW_FILTER == SHADOW_FILTER_EVSM
+	//the blur already happened on the moments, one filtered fetch whatever the softness
+	vec4 moments = texture(shadowMap, vec3(projCoords.xy, cascade));
+	vec2 warped = warpDepth(currentDepth);
+	vec2 minVariance = 0.0001 * vec2(EVSM_POSITIVE, EVSM_NEGATIVE) * warped;
+	minVariance *= minVariance;
+	float lit = min(chebyshevUpperBound(moments.xy, warped.x, minVariance.x), chebyshevUpperBound(moments.zw, warped.y, minVariance.y));
+	return 1.0 - lit;
+#elif SHADOW_FILTER == SHADOW_FILTER_POISSON
+	float angle = 6.2831853 * interleavedGradientNoise(gl_FragCoord.xy);
+	mat2 rotation = mat2(cos(angle), sin(angle), -sin(angle), cos(angle));
+	vec2 kernelSize = (float(SHADOW_PCF_RADIUS) + 1.0) * texelSize;
+	float shadow = 0.0;
+	for (int i = 0; i < SHADOW_PCF_TAPS; ++i)
+		shadow += shadowTap(projCoords.xy + rotation * POISSON_DISK[i] * kernelSize, cascade, currentDepth);
+	return shadow / float(SHADOW_PCF_TAPS);
+#else
+	// PCF
+	float shadow = 0.0;
+	for(int x = -SHADOW_PCF_RADIUS; x <= SHADOW_PCF_RADIUS; ++x)
+	{
+		for(int y = -SHADOW_PCF_RADIUS; y <= SHADOW_PCF_RADIUS; ++y)
+		{
+			shadow += shadowTap(projCoords.xy + vec2(x, y) * texelSize, cascade, currentDepth);
+		}
+	}
+	return shadow / float((2 * SHADOW_PCF_RADIUS + 1) * (2 * SHADOW_PCF_RADIUS + 1));
+#endif
+}
+
+//the local lights reaching the surface seen through the pixel at gl_FragCoord
+vec3 shadeLocalLights(Surface surface, vec3 viewDir)
+{
+	vec3 result = vec3(0.0);
+#if CLUSTERED_LIGHTS
+	uvec2 cluster = lightCluster(gl_FragCoord.xy, surface.viewDepth);
+	for (uint i = 0u; i < cluster.y; ++i)
+		result += calculateLocalLight(fetchLight(clusterLight(cluster, i)), surface, viewDir);
+#else
+	for (int i = 0; i < lightCount; ++i)
+		result += calculateLocalLight(fetchLight(i), surface, viewDir);
+#endif
+	return result;
+}
+
+//every light of the frame on the surface seen through the pixel at gl_FragCoord
+vec3 shadeSurface(Surface surface)
+{
+	vec3 viewDir = normalize(viewPos - surface.position);
+
+	float shadow = calculateShadow(surface, normalize(-directLight.direction));
+
+	//applying all light components
+	return calculateDirectLight(directLight, surface, viewDir, shadow) + shadeLocalLights(surface, viewDir);
+}
+
+//a static surface whose direct light and sky are baked (Lightmap.h): the lightmap's irradiance / pi on the albedo,
+//the direct light's highlight through the baked visibility instead of the cascades, the local lights as usual
+vec3 shadeLightmappedSurface(Surface surface, vec3 baked, float visibility)
+{
+	vec3 viewDir = normalize(viewPos - surface.position);
+	vec3 halfwayDir = normalize(normalize(-directLight.direction) + viewDir);
+	float spec = pow(max(dot(surface.normal, halfwayDir), 0.0), 0.25 * surface.shininess);
+	return baked * surface.albedo + visibility * directLight.specular * spec * surface.specular + shadeLocalLights(surface, viewDir);
+}
+//============================================================================================
@@ -1,21 +1,59 @@
 #version 330 core
+#include "frame_data.glsl"
+#include "environment.glsl"
+#ifdef BAKED_PROBES
+#include "baked_probes.glsl"
+#endif
+#ifdef GBUFFER
+#define GBUFFER_OUTPUTS
+#include "gbuffer.glsl"
+#else
 out vec4 FragColor;
+#endif
  
 in vec3 Normal;
 in vec3 Position;
  
-uniform bool refractFlag;
-uniform vec3 cameraPos;
+//the sky, or the cube's reflection probe (ReflectionProbes.h) when probeMaxLevel is above 0
 uniform samplerCube skybox;
+//0 is a polished surface that sees the sky itself, above it the prefiltered environment's blurrier levels
+uniform float roughness;
+//the probe's mip level for a roughness of 1, its box filtered levels stand in for the prefiltered ones
+uniform int probeMaxLevel;
+#ifdef BAKED_PROBES
+//the object's baked probes, as BakedReflectionProbes::Selection() packs them
+uniform int probeSelection;
+#endif
  
+//REFRACT selects the glass variant, otherwise the cube is a mirror, a metal whose F0 is white; BAKED_PROBES reflects
+//the baked probes, parallax corrected, instead of its own cube; GBUFFER writes the environment's color into the
+//G-buffer as an unlit surface
 void main()
 {    
+    vec3 I = normalize(Position - viewPos);
+    vec3 N = normalize(Normal);
+#ifdef REFRACT
     float ratio = 1.00 / 1.52;
-    vec3 I = normalize(Position - cameraPos);
-    vec3 R = vec3(1.0, 1.0, 1.0);
-    if (refractFlag)
-        R = refract(I, normalize(Normal), ratio);
+    vec3 R = refract(I, N, ratio);
+#else
+    vec3 R = reflect(I, N);
+#endif
+    vec3 environment;
+#ifdef BAKED_PROBES
+    environment = bakedProbeReflection(probeSelection, Position, R, roughness);
+#else
+    if (probeMaxLevel > 0)
+        environment = textureLod(skybox, R, roughness * float(probeMaxLevel)).rgb;
     else
-        R = reflect(I, normalize(Normal));
-    FragColor = vec4(texture(skybox, R).rgb, 1.0);
-}
\ No newline at end of file
+        environment = roughness > 0.0 ? environmentReflection(R, roughness) : texture(skybox, R).rgb;
+#endif
+#ifndef REFRACT
+    vec2 brdf = environmentBrdf(max(dot(N, -I), 0.0), roughness);
+    environment *= brdf.x + brdf.y;
+#endif
+#ifdef GBUFFER
+    writeGBuffer(environment, 0.0, Normal, 0.0, LIGHTING_MODEL_UNLIT);
+#else
+    FragColor = vec4(environment, 1.0);
+#endif
+}
@@ -1,4 +1,6 @@
 #version 330 core
+#include "frame_data.glsl"
+#include "transforms.glsl"
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 texCoords;
@@ -10,34 +12,32 @@ out vec2 TexCoords;
 out vec3 TangentLightPos;
 out vec3 TangentViewPos;
 out vec3 TangentFragPos;
+#ifdef GBUFFER
+out mat3 WorldTBN;   //tangent to world space, the G-buffer holds world normals
+#endif
 //out vec3 FragmentPos;
 //out vec4 FragPosLightSpace;
 
-uniform mat4 projectionMat;
-uniform mat4 viewMat;
-uniform mat4 modelMat;
-//uniform mat4 lightSpaceMatrix;
-
-uniform vec3 lightPos;
-uniform vec3 viewPos;
-
 void main()
 {
-    FragPos = vec3(modelMat * vec4(position, 1.0));   
+    FragPos = vec3(objectModel() * vec4(position, 1.0));   
     TexCoords = texCoords;
     
-    mat3 normalMatrix = transpose(inverse(mat3(modelMat)));
+    mat3 normalMatrix = objectNormal();
     vec3 T = normalize(normalMatrix * Tangent);
     vec3 N = normalize(normalMatrix * normal);
     T = normalize(T - dot(T, N) * N);
     vec3 B = cross(N, T);
     
     mat3 TBN = transpose(mat3(T, B, N));    
-    TangentLightPos = TBN * lightPos;
+#ifdef GBUFFER
+    WorldTBN = mat3(T, B, N);
+#endif
+    TangentLightPos = TBN * -directLight.direction;
     TangentViewPos  = TBN * viewPos;
     TangentFragPos  = TBN * FragPos;
     
     //FragPosLightSpace = lightSpaceMatrix * vec4(FragmentPos, 1.0);
 
-    gl_Position = projectionMat * viewMat * modelMat * vec4(position, 1.0);
+    gl_Position = objectMVP() * vec4(position, 1.0);
 }
\ No newline at end of file
@@ -1,11 +1,20 @@
 #version 330 core
+//variant keys: GBUFFER writes the surface into the G-buffer for the deferred lighting pass instead of lighting it
+#ifdef GBUFFER
+#define GBUFFER_OUTPUTS
+#include "gbuffer.glsl"
+#else
 out vec4 FragColor;
+#endif
 
 in vec3 FragPos;
 in vec2 TexCoords;
 in vec3 TangentLightPos;
 in vec3 TangentViewPos;
 in vec3 TangentFragPos;
+#ifdef GBUFFER
+in mat3 WorldTBN;
+#endif
 
 uniform sampler2D diffuseMap;
 uniform sampler2D normalMap;
@@ -13,11 +22,19 @@ uniform sampler2D depthMap;
 
 uniform float heightScale;
 
+//variant keys: layer count range of the height field march
+#ifndef PARALLAX_MIN_LAYERS
+#define PARALLAX_MIN_LAYERS 8
+#endif
+#ifndef PARALLAX_MAX_LAYERS
+#define PARALLAX_MAX_LAYERS 32
+#endif
+
 //=================================================================================================
 vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
 { 
-    const float minLayers = 8;
-    const float maxLayers = 32;
+    const float minLayers = PARALLAX_MIN_LAYERS;
+    const float maxLayers = PARALLAX_MAX_LAYERS;
     float numLayers = mix(maxLayers, minLayers, abs(dot(vec3(0.0, 0.0, 1.0), viewDir)));  
     float layerDepth = 1.0 / numLayers;
     float currentLayerDepth = 0.0;
@@ -27,7 +44,8 @@ vec2 ParallaxMapping(vec2 texCoords, vec3 viewDir)
     vec2  currentTexCoords     = texCoords;
     float currentDepthMapValue = texture(depthMap, currentTexCoords).r;
       
-    while(currentLayerDepth < currentDepthMapValue)
+    //the constant bound lets the compiler size the loop
+    for(int i = 0; i < PARALLAX_MAX_LAYERS && currentLayerDepth < currentDepthMapValue; i++)
     {
         currentTexCoords -= deltaTexCoords;
         currentDepthMapValue = texture(depthMap, currentTexCoords).r;  
@@ -60,6 +78,10 @@ void main()
    
     //diffuse color
     vec3 color = texture(diffuseMap, texCoords).rgb;
+#ifdef GBUFFER
+    //the specular of the forward variant, 0.2 at an exponent of 32 under the direct light
+    writeGBuffer(color, 0.2, WorldTBN * normal, 128.0, LIGHTING_MODEL_LIT);
+#else
     //ambient component
     vec3 ambient = 0.1 * color;
     //diffuse component
@@ -73,4 +95,5 @@ void main()
 
     vec3 specular = vec3(0.2) * spec;
     FragColor = vec4(ambient + diffuse + specular, 1.0);
+#endif
 }
\ No newline at end of file
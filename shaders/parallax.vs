@@ -1,4 +1,6 @@
 #version 330 core
+#include "frame_data.glsl"
+#include "transforms.glsl"
 layout (location = 0) in vec3 aPos;
 layout (location = 1) in vec3 aNormal;
 layout (location = 2) in vec2 aTexCoords;
@@ -10,16 +12,13 @@ out vec2 TexCoords;
 out vec3 TangentLightPos;
 out vec3 TangentViewPos;
 out vec3 TangentFragPos;
-
-uniform mat4 projectionMat;
-uniform mat4 viewMat;
-uniform mat4 modelMat;
-
-uniform vec3 lightPos;
-uniform vec3 viewPos;
+#ifdef GBUFFER
+out mat3 WorldTBN;   //tangent to world space, the G-buffer holds world normals
+#endif
 
 void main()
 {
+    mat4 modelMat = objectModel();
     FragPos = vec3(modelMat * vec4(aPos, 1.0));   
     TexCoords = aTexCoords;   
     
@@ -27,10 +26,13 @@ void main()
     vec3 B = normalize(mat3(modelMat) * aBitangent);
     vec3 N = normalize(mat3(modelMat) * aNormal);
     mat3 TBN = transpose(mat3(T, B, N));
+#ifdef GBUFFER
+    WorldTBN = mat3(T, B, N);
+#endif
 
-    TangentLightPos = TBN * lightPos;
+    TangentLightPos = TBN * -directLight.direction;
     TangentViewPos  = TBN * viewPos;
     TangentFragPos  = TBN * FragPos;
     
-    gl_Position = projectionMat * viewMat * modelMat * vec4(aPos, 1.0);
+    gl_Position = objectMVP() * vec4(aPos, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,33 @@
+#version 330 core
+#include "frame_data.glsl"
+#include "environment.glsl"
+out vec4 FragColor;
+
+#ifdef SKY
+in vec3 texCoords;
+uniform samplerCube skybox;
+#else
+in vec2 texCoords;
+in vec3 Normal;
+uniform sampler2D diffuseMap;
+#ifdef LIGHTMAP
+in vec2 LightmapCoords;
+uniform sampler2D lightmap;     //irradiance / pi
+#endif
+#endif
+
+//what a reflection probe sees, cheaply: the sky, and the surfaces' albedo under the sun and the sky's irradiance,
+//or under their baked light when LIGHTMAP; no shadows but the baked ones, local lights or specular
+void main()
+{
+#ifdef SKY
+    FragColor = texture(skybox, texCoords);
+#elif defined(LIGHTMAP)
+    FragColor = vec4(texture(diffuseMap, texCoords).rgb * texture(lightmap, LightmapCoords).rgb, 1.0);
+#else
+    vec3 albedo = texture(diffuseMap, texCoords).rgb;
+    vec3 normal = normalize(Normal);
+    vec3 sun = directLight.diffuse * max(dot(normal, normalize(-directLight.direction)), 0.0);
+    FragColor = vec4(albedo * (sun + directLight.ambient * environmentIrradiance(normal)), 1.0);
+#endif
+}
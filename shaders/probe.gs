@@ -0,0 +1,60 @@
+#version 330 core
+layout (triangles) in;
+layout (triangle_strip, max_vertices = 18) out;    //3 * 6 faces
+
+//view-projection of each face of the probe being rendered, +X, -X, +Y, -Y, +Z, -Z, and a bit per face to draw
+uniform mat4 faceMatrices[6];
+uniform int faceMask;
+
+#ifdef SKY
+in vec3 vertexCoords[];
+out vec3 texCoords;
+#else
+in vec2 vertexCoords[];
+in vec3 vertexNormal[];
+out vec2 texCoords;
+out vec3 Normal;
+#ifdef LIGHTMAP
+in vec2 vertexLightmapCoords[];
+out vec2 LightmapCoords;
+#endif
+#endif
+
+//sends every triangle to the probe's cube faces of this frame through gl_Layer, skipping the faces it can't touch
+void main()
+{
+	for (int face = 0; face < 6; ++face)
+	{
+		if ((faceMask & (1 << face)) == 0)
+			continue;
+		vec4 clip[3];
+		for (int i = 0; i < 3; ++i)
+			clip[i] = faceMatrices[face] * gl_in[i].gl_Position;
+		//outside when all three vertices are beyond the same plane of the face's frustum
+		bvec3 below = bvec3(true), above = bvec3(true);
+		for (int i = 0; i < 3; ++i)
+		{
+			below = bvec3(below.x && clip[i].x < -clip[i].w, below.y && clip[i].y < -clip[i].w, below.z && clip[i].z < -clip[i].w);
+			above = bvec3(above.x && clip[i].x > clip[i].w, above.y && clip[i].y > clip[i].w, above.z && clip[i].z > clip[i].w);
+		}
+		if (any(below) || any(above))
+			continue;
+		for (int i = 0; i < 3; ++i)
+		{
+			gl_Layer = face;
+			texCoords = vertexCoords[i];
+#ifdef SKY
+			//on the far plane, behind everything the probe sees
+			gl_Position = clip[i].xyww;
+#else
+			Normal = vertexNormal[i];
+#ifdef LIGHTMAP
+			LightmapCoords = vertexLightmapCoords[i];
+#endif
+			gl_Position = clip[i];
+#endif
+			EmitVertex();
+		}
+		EndPrimitive();
+	}
+}
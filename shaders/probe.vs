@@ -0,0 +1,40 @@
+#version 330 core
+#include "frame_data.glsl"
+#include "transforms.glsl"
+//world space, probe.gs projects it into the probe's faces. SKY draws the skybox cube around the probe,
+//TANGENT_LAYOUT reads the normal mapping planes' vertices, normal before the texture coordinates, LIGHTMAP the
+//static surfaces' lightmap coordinates
+layout (location = 0) in vec3 position;
+#ifdef SKY
+uniform vec3 probePosition;
+out vec3 vertexCoords;
+#else
+#ifdef TANGENT_LAYOUT
+layout (location = 1) in vec3 normal;
+layout (location = 2) in vec2 coordinates;
+#else
+layout (location = 1) in vec2 coordinates;
+layout (location = 2) in vec3 normal;
+#endif
+out vec2 vertexCoords;
+out vec3 vertexNormal;
+#ifdef LIGHTMAP
+layout (location = 3) in vec2 lightmapCoordinates;
+out vec2 vertexLightmapCoords;
+#endif
+#endif
+
+void main()
+{
+#ifdef SKY
+    vertexCoords = position;
+    gl_Position = vec4(probePosition + position, 1.0);
+#else
+    vertexCoords = coordinates;
+    vertexNormal = objectNormal() * normal;
+#ifdef LIGHTMAP
+    vertexLightmapCoords = lightmapCoordinates;
+#endif
+    gl_Position = objectModel() * vec4(position, 1.0);
+#endif
+}
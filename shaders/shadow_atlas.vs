@@ -0,0 +1,23 @@
+#version 330 core
+#include "frame_data.glsl"
+#include "light_data.glsl"
+//instances go over objects x tiles, the tile fastest
+uniform int tileCount;
+uniform int tiles[MAX_SHADOW_TILES];
+#define OBJECT_INSTANCE (gl_InstanceID / tileCount)
+#include "transforms.glsl"
+layout (location = 0) in vec3 position;
+
+out float gl_ClipDistance[4];
+
+void main()
+{
+	ShadowTile tile = shadowTiles[tiles[gl_InstanceID % tileCount]];
+	vec4 clip = tile.matrix * objectModel() * vec4(position, 1.0);
+	//cut at the edges of the light's view, then squeeze that view into the tile
+	gl_ClipDistance[0] = clip.w + clip.x;
+	gl_ClipDistance[1] = clip.w - clip.x;
+	gl_ClipDistance[2] = clip.w + clip.y;
+	gl_ClipDistance[3] = clip.w - clip.y;
+	gl_Position = vec4(clip.xy * tile.rect.zw + (2.0 * tile.rect.xy + tile.rect.zw - 1.0) * clip.w, clip.zw);
+}
@@ -0,0 +1,36 @@
+#version 330 core
+#include "frame_data.glsl"
+layout (triangles) in;
+layout (triangle_strip, max_vertices = 12) out;    //3 * MAX_CASCADES
+
+//bit per cascade to draw into, static casters only go to the cascades whose cached layer is redrawn
+uniform int cascadeMask;
+
+//sends every shadow caster triangle to each cascade's layer, skipping the cascades it can't touch
+void main()
+{
+	for (int cascade = 0; cascade < cascadeCount; ++cascade)
+	{
+		if ((cascadeMask & (1 << cascade)) == 0)
+			continue;
+		vec4 clip[3];
+		for (int i = 0; i < 3; ++i)
+			clip[i] = cascadeMatrices[cascade] * gl_in[i].gl_Position;
+		//outside when all three vertices are beyond the same side, depth is clamped so only far counts
+		bvec3 below = bvec3(true), above = bvec3(true);
+		for (int i = 0; i < 3; ++i)
+		{
+			below = bvec3(below.x && clip[i].x < -1.0, below.y && clip[i].y < -1.0, false);
+			above = bvec3(above.x && clip[i].x > 1.0, above.y && clip[i].y > 1.0, above.z && clip[i].z > 1.0);
+		}
+		if (any(below) || any(above))
+			continue;
+		for (int i = 0; i < 3; ++i)
+		{
+			gl_Layer = cascade;
+			gl_Position = clip[i];
+			EmitVertex();
+		}
+		EndPrimitive();
+	}
+}
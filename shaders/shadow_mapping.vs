@@ -1,10 +1,10 @@
 #version 330 core
+#include "frame_data.glsl"
+#include "transforms.glsl"
 layout (location = 0) in vec3 position;
 
-uniform mat4 lightSpaceMatrix;
-uniform mat4 modelMat;
-
+//world space, shadow_mapping.gs projects it into every cascade
 void main()
 {
-    gl_Position = lightSpaceMatrix * modelMat * vec4(position, 1.0);
+    gl_Position = objectModel() * vec4(position, 1.0);
 }
@@ -0,0 +1,16 @@
+//exponential variance shadow maps: depth in [0, 1] is warped by a positive and a negative exponential and
+//both warps are stored with their squares. The exponents are as large as 32-bit float moments allow
+#define EVSM_POSITIVE 40.0
+#define EVSM_NEGATIVE 5.0
+
+vec2 warpDepth(float depth)
+{
+	depth = 2.0 * depth - 1.0;
+	return vec2(exp(EVSM_POSITIVE * depth), -exp(-EVSM_NEGATIVE * depth));
+}
+
+vec4 shadowMoments(float depth)
+{
+	vec2 warped = warpDepth(depth);
+	return vec4(warped.x, warped.x * warped.x, warped.y, warped.y * warped.y);
+}
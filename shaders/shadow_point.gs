@@ -0,0 +1,35 @@
+#version 330 core
+#include "light_data.glsl"
+layout (triangles) in;
+layout (triangle_strip, max_vertices = 18) out;    //3 * 6 faces
+
+//point shadow slot of the light being drawn, its faces are layers 6 * slot .. 6 * slot + 5
+uniform int pointShadow;
+
+//sends every shadow caster triangle to each cube face of the light, skipping the faces it can't touch
+void main()
+{
+	for (int face = 0; face < 6; ++face)
+	{
+		int layer = 6 * pointShadow + face;
+		vec4 clip[3];
+		for (int i = 0; i < 3; ++i)
+			clip[i] = pointShadowMatrices[layer] * gl_in[i].gl_Position;
+		//outside when all three vertices are beyond the same plane of the face's frustum
+		bvec3 below = bvec3(true), above = bvec3(true);
+		for (int i = 0; i < 3; ++i)
+		{
+			below = bvec3(below.x && clip[i].x < -clip[i].w, below.y && clip[i].y < -clip[i].w, below.z && clip[i].z < -clip[i].w);
+			above = bvec3(above.x && clip[i].x > clip[i].w, above.y && clip[i].y > clip[i].w, above.z && clip[i].z > clip[i].w);
+		}
+		if (any(below) || any(above))
+			continue;
+		for (int i = 0; i < 3; ++i)
+		{
+			gl_Layer = layer;
+			gl_Position = clip[i];
+			EmitVertex();
+		}
+		EndPrimitive();
+	}
+}
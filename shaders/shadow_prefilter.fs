@@ -0,0 +1,42 @@
+#version 330 core
+#include "shadow_moments.glsl"
+
+//variant keys: EVSM_CONVERT turns a layer of the cascade depth array into moments at half its resolution,
+//without it the moments are blurred along blurAxis (0 is x, 1 is y), one axis per pass
+in vec2 texCoords;
+
+out vec4 moments;
+
+uniform sampler2DArray source;
+uniform int layer;
+#ifndef EVSM_CONVERT
+uniform int blurAxis;
+uniform int blurRadius;
+#endif
+
+void main()
+{
+	ivec2 texel = ivec2(gl_FragCoord.xy);
+#ifdef EVSM_CONVERT
+	//average of the 2x2 depth texels under this one, as moments
+	ivec2 depthTexel = texel * 2;
+	moments = 0.25 * (shadowMoments(texelFetch(source, ivec3(depthTexel, layer), 0).r)
+		+ shadowMoments(texelFetch(source, ivec3(depthTexel + ivec2(1, 0), layer), 0).r)
+		+ shadowMoments(texelFetch(source, ivec3(depthTexel + ivec2(0, 1), layer), 0).r)
+		+ shadowMoments(texelFetch(source, ivec3(depthTexel + ivec2(1, 1), layer), 0).r));
+#else
+	//gaussian with the radius at two sigma, taps past the edge repeat it
+	ivec2 last = textureSize(source, 0).xy - 1;
+	ivec2 direction = blurAxis == 0 ? ivec2(1, 0) : ivec2(0, 1);
+	float sigma = 0.5 * float(blurRadius) + 0.5;
+	vec4 sum = vec4(0.0);
+	float weights = 0.0;
+	for (int i = -blurRadius; i <= blurRadius; ++i)
+	{
+		float weight = exp(-float(i * i) / (2.0 * sigma * sigma));
+		sum += weight * texelFetch(source, ivec3(clamp(texel + direction * i, ivec2(0), last), layer), 0);
+		weights += weight;
+	}
+	moments = sum / weights;
+#endif
+}
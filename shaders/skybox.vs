@@ -1,14 +1,13 @@
 #version 330 core
+#include "frame_data.glsl"
 layout (location = 0) in vec3 position;
  
 out vec3 texCoords;
  
-uniform mat4 projectionMat;
-uniform mat4 viewMat;
- 
 void main()
 {
     texCoords = position;
-    vec4 pos = projectionMat * viewMat * vec4(position, 1.0);
+    //drop the translation of the view matrix, so the skybox stays around the camera
+    vec4 pos = projectionMat * mat4(mat3(viewMat)) * vec4(position, 1.0);
     gl_Position = pos.xyww;
 }
\ No newline at end of file
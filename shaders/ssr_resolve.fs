@@ -0,0 +1,41 @@
+#version 330 core
+//temporal accumulation of the screen-space reflections (ScreenSpaceReflections.h): the reflecting surface is
+//reprojected into the last frame, its resolved reflection there is clamped to what this frame's trace holds around
+//the texel and blended in, which averages the lobe samples of many frames without trailing ghosts
+in vec2 texCoords;
+
+out vec4 reflection;
+
+uniform sampler2D current;      //this frame's trace
+uniform sampler2D history;      //the last frame's resolve
+uniform sampler2D gDepthMap;
+uniform mat4 reprojection;      //this frame's clip space to the previous frame's
+uniform int divisor;
+uniform float historyWeight;
+
+void main()
+{
+	ivec2 texel = ivec2(gl_FragCoord.xy);
+	ivec2 last = textureSize(current, 0) - 1;
+	vec4 center = texelFetch(current, texel, 0);
+	vec4 low = center, high = center;
+	for (int y = -1; y <= 1; y++)
+		for (int x = -1; x <= 1; x++)
+		{
+			vec4 neighbor = texelFetch(current, clamp(texel + ivec2(x, y), ivec2(0), last), 0);
+			low = min(low, neighbor);
+			high = max(high, neighbor);
+		}
+	//the traced texel's surface, where it was a frame ago
+	ivec2 size = textureSize(gDepthMap, 0);
+	ivec2 full = min(texel * divisor + divisor / 2, size - 1);
+	float depth = texelFetch(gDepthMap, full, 0).r;
+	vec4 previous = reprojection * vec4(vec3((vec2(full) + 0.5) / vec2(size), depth) * 2.0 - 1.0, 1.0);
+	vec2 previousUV = previous.xy / previous.w * 0.5 + 0.5;
+	if (center.a == 0.0 || any(lessThan(previousUV, vec2(0.0))) || any(greaterThan(previousUV, vec2(1.0))))
+	{
+		reflection = center;
+		return;
+	}
+	reflection = mix(center, clamp(textureLod(history, previousUV, 0.0), low, high), historyWeight);
+}
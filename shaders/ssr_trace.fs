@@ -0,0 +1,194 @@
+#version 330 core
+#include "frame_data.glsl"
+#include "environment.glsl"
+#include "baked_probes.glsl"
+#include "gbuffer.glsl"
+
+//screen-space reflections, traced at a fraction of the resolution (ScreenSpaceReflections.h): every reflective pixel
+//sends one ray through a microfacet normal of its lobe, picked anew each frame, and walks it through the min-depth
+//pyramid in window space. A hit reads the previous frame's final color where the hit was then; a miss, or the part
+//of a hit that fades out at the screen's edges, takes the baked probe around the pixel or the sky. The result is
+//premultiplied by coverage, 0 where nothing reflects, so the lighting pass can upsample it without dark fringes
+in vec2 texCoords;
+
+out vec4 reflection;
+
+uniform sampler2D gNormalMap;
+uniform sampler2D gDepthMap;
+uniform sampler2D hiZ;
+uniform int hiZLevels;
+uniform sampler2D previousColor;
+uniform mat4 inverseViewProjection;
+uniform mat4 reprojection;      //this frame's clip space to the previous frame's
+uniform int divisor;            //full resolution texels per traced texel along each axis
+uniform int frame;              //seeds the lobe samples and the start offsets
+uniform int maxSteps;
+uniform float thickness;        //view depth behind a surface a ray still hits it
+uniform float maxDistance;      //world units
+
+const float PI = 3.14159265359;
+
+uint hash(uint x)
+{
+	x ^= x >> 16u;
+	x *= 0x7feb352du;
+	x ^= x >> 15u;
+	x *= 0x846ca68bu;
+	x ^= x >> 16u;
+	return x;
+}
+
+vec3 random3(ivec2 texel, int frame)
+{
+	uint h = hash(uint(texel.x) ^ hash(uint(texel.y) ^ hash(uint(frame))));
+	uint g = hash(h);
+	return vec3(float(h & 0xFFFFu), float(h >> 16u), float(g & 0xFFFFu)) / 65535.0;
+}
+
+//a GGX microfacet normal around n for the roughness, u uniform in [0, 1]^2
+vec3 sampleLobe(vec3 n, float roughness, vec2 u)
+{
+	float a = roughness * roughness;
+	float cosTheta = sqrt((1.0 - u.x) / (1.0 + (a * a - 1.0) * u.x));
+	float sinTheta = sqrt(1.0 - cosTheta * cosTheta);
+	float phi = 2.0 * PI * u.y;
+	vec3 tangent = normalize(cross(abs(n.y) < 0.999 ? vec3(0.0, 1.0, 0.0) : vec3(1.0, 0.0, 0.0), n));
+	vec3 bitangent = cross(n, tangent);
+	return normalize(tangent * (sinTheta * cos(phi)) + bitangent * (sinTheta * sin(phi)) + n * cosTheta);
+}
+
+float linearDepth(float depth)
+{
+	return projectionMat[3][2] / (depth * 2.0 - 1.0 + projectionMat[2][2]);
+}
+
+//the probe with the smallest box around the position, as BakedReflectionProbes::Selection() picks without blending,
+//or the sky
+vec3 fallbackReflection(vec3 position, vec3 r, float roughness)
+{
+	int probe = NO_BAKED_PROBE;
+	float smallest = 0.0;
+	for (int i = 0; i < bakedProbeCount; i++)
+	{
+		vec3 boxMin = bakedProbeBoxMin[i].xyz, boxMax = bakedProbeBoxMax[i].xyz;
+		if (any(lessThan(position, boxMin)) || any(greaterThan(position, boxMax)))
+			continue;
+		vec3 size = boxMax - boxMin;
+		float volume = size.x * size.y * size.z;
+		if (probe == NO_BAKED_PROBE || volume < smallest)
+		{
+			probe = i;
+			smallest = volume;
+		}
+	}
+	return bakedProbeReflection(probe, position, r, roughness);
+}
+
+//walks the segment from start to end (level 0 texels and window depth) through the pyramid: a cell whose nearest
+//depth lies behind the ray's stretch through it is skipped whole and the next cell is looked at one level coarser,
+//otherwise the ray moves up to that depth and looks one level finer. At level 0 that is a hit unless the ray went
+//more than the thickness behind the surface, then it carries on behind it. w is 1 on a hit
+vec4 traceHiZ(vec3 start, vec3 end, float jitter)
+{
+	vec3 direction = end - start;
+	vec2 across = mix(direction.xy, vec2(1e-5), lessThan(abs(direction.xy), vec2(1e-5)));
+	float texelT = 1.0 / max(max(abs(direction.x), abs(direction.y)), 1e-5);
+	vec2 forward = step(vec2(0.0), direction.xy);
+	int maxLevel = hiZLevels - 1;
+	//a texel or two out, so the ray leaves its own surface
+	float t = (1.0 + jitter) * texelT;
+	int level = 0;
+	for (int steps = 0; steps < maxSteps && t < 1.0; steps++)
+	{
+		vec3 position = start + direction * t;
+		float cellSize = float(1 << level);
+		vec2 cell = floor(position.xy / cellSize);
+		vec2 boundary = (cell + forward) * cellSize;
+		vec2 boundaryT = (boundary - start.xy) / across;
+		float exitT = min(min(boundaryT.x, boundaryT.y), 1.0);
+		float nearest = texelFetch(hiZ, clamp(ivec2(cell), ivec2(0), textureSize(hiZ, level) - 1), level).r;
+		float exitDepth = start.z + direction.z * exitT;
+		if (max(position.z, exitDepth) < nearest)
+		{
+			t = exitT + 0.01 * texelT;
+			level = min(level + 1, maxLevel);
+			continue;
+		}
+		//the ray only gets there going away from the camera
+		float meetT = position.z < nearest ? (nearest - start.z) / direction.z : t;
+		if (level > 0)
+		{
+			t = meetT;
+			level--;
+			continue;
+		}
+		vec3 hit = start + direction * meetT;
+		if (linearDepth(hit.z) - linearDepth(nearest) < thickness)
+			return vec4(hit, 1.0);
+		t = exitT + 0.01 * texelT;
+	}
+	return vec4(0.0);
+}
+
+float edgeFade(vec2 uv)
+{
+	vec2 edge = min(uv, 1.0 - uv);
+	return clamp(min(edge.x, edge.y) * 10.0, 0.0, 1.0);
+}
+
+void main()
+{
+	ivec2 size = textureSize(gDepthMap, 0);
+	ivec2 texel = min(ivec2(gl_FragCoord.xy) * divisor + divisor / 2, size - 1);
+	float depth = texelFetch(gDepthMap, texel, 0).r;
+	vec4 normal = texelFetch(gNormalMap, texel, 0);
+	if (depth >= 1.0 || int(normal.a * 3.0 + 0.5) != LIGHTING_MODEL_REFLECTIVE)
+	{
+		reflection = vec4(0.0);
+		return;
+	}
+	vec2 uv = (vec2(texel) + 0.5) / vec2(size);
+	vec4 world = inverseViewProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+	vec3 position = world.xyz / world.w;
+	vec3 n = decodeOctahedral(normal.xy * 2.0 - 1.0);
+	vec3 viewDir = normalize(viewPos - position);
+	float roughness = pow(2.0 / (0.25 * normal.b * GBUFFER_SHININESS_SCALE + 2.0), 0.25);
+	vec3 color = fallbackReflection(position, reflect(-viewDir, n), roughness);
+
+	vec3 noise = random3(texel, frame);
+	vec3 r = reflect(-viewDir, sampleLobe(n, roughness, noise.xy));
+	if (dot(r, n) <= 0.0)
+		r = reflect(-viewDir, n);
+	//the ray in window space, kept in front of the near plane, then cut to the screen and the depth range
+	float viewZ = (viewMat * vec4(position, 1.0)).z;
+	float rayZ = (mat3(viewMat) * r).z;
+	float nearPlane = projectionMat[3][2] / (projectionMat[2][2] - 1.0);
+	float rayLength = maxDistance;
+	if (rayZ > 0.0)
+		rayLength = min(rayLength, 0.99 * (-nearPlane - viewZ) / rayZ);
+	vec4 clip = projectionMat * viewMat * vec4(position + r * rayLength, 1.0);
+	vec3 start = vec3(uv * vec2(size), depth);
+	vec3 end = (clip.xyz / clip.w * 0.5 + 0.5) * vec3(size, 1.0);
+	vec3 direction = end - start;
+	float endT = 1.0;
+	if (direction.x != 0.0)
+		endT = min(endT, ((direction.x > 0.0 ? float(size.x) : 0.0) - start.x) / direction.x);
+	if (direction.y != 0.0)
+		endT = min(endT, ((direction.y > 0.0 ? float(size.y) : 0.0) - start.y) / direction.y);
+	if (direction.z > 0.0)
+		endT = min(endT, (1.0 - start.z) / direction.z);
+
+	vec4 hit = traceHiZ(start, start + direction * endT, noise.z);
+	if (hit.w > 0.0)
+	{
+		//back faces and rays coming back at the camera show what the screen doesn't hold
+		vec3 hitNormal = decodeOctahedral(texelFetch(gNormalMap, ivec2(hit.xy), 0).xy * 2.0 - 1.0);
+		vec2 hitUV = hit.xy / vec2(size);
+		vec4 previous = reprojection * vec4(vec3(hitUV, hit.z) * 2.0 - 1.0, 1.0);
+		vec2 previousUV = previous.xy / previous.w * 0.5 + 0.5;
+		float confidence = edgeFade(hitUV) * edgeFade(previousUV) * (1.0 - smoothstep(0.3, 0.8, rayZ))
+			* (dot(hitNormal, r) < 0.0 ? 1.0 : 0.0);
+		color = mix(color, textureLod(previousColor, previousUV, 0.0).rgb, confidence);
+	}
+	reflection = vec4(color, 1.0);
+}
@@ -0,0 +1,30 @@
+//per-object matrices computed on the CPU (TransformBuffer.h), 12 texels per object:
+//model, MVP, the normal matrix and the material index. Include after frame_data.glsl
+//in vertex shaders only: instanced draws cover consecutive objects starting at objectIndex, a shader that
+//instances over something else as well defines OBJECT_INSTANCE before the include
+uniform samplerBuffer transforms;
+uniform int objectIndex;
+#ifndef OBJECT_INSTANCE
+#define OBJECT_INSTANCE gl_InstanceID
+#endif
+
+mat4 fetchTransform(int first)
+{
+	int texel = transformBase + (objectIndex + OBJECT_INSTANCE) * 12 + first;
+	return mat4(texelFetch(transforms, texel), texelFetch(transforms, texel + 1),
+		texelFetch(transforms, texel + 2), texelFetch(transforms, texel + 3));
+}
+
+mat4 objectModel() { return fetchTransform(0); }
+mat4 objectMVP() { return fetchTransform(4); }
+
+mat3 objectNormal()
+{
+	int texel = transformBase + (objectIndex + OBJECT_INSTANCE) * 12 + 8;
+	return mat3(texelFetch(transforms, texel).xyz, texelFetch(transforms, texel + 1).xyz, texelFetch(transforms, texel + 2).xyz);
+}
+
+int objectMaterial()
+{
+	return int(texelFetch(transforms, transformBase + (objectIndex + OBJECT_INSTANCE) * 12 + 11).x);
+}
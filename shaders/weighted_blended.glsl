@@ -0,0 +1,18 @@
+//weighted blended order-independent transparency (WeightedTransparency.h): fragment shaders of weightedBlended
+//materials include this instead of declaring an output and end with writeWeightedBlended()
+layout (location = 0) out vec4 accumulation;    //premultiplied color * weight, alpha: product of (1 - alpha)
+layout (location = 1) out float weight;         //alpha * weight
+
+//eq. 7 of the paper: near layers outweigh far ones, the distance along the view comes from gl_FragCoord.w
+float blendWeight(float alpha)
+{
+	float distance = 1.0 / gl_FragCoord.w;
+	return alpha * clamp(10.0 / (1e-5 + pow(distance / 5.0, 2.0) + pow(distance / 200.0, 6.0)), 1e-2, 3e3);
+}
+
+void writeWeightedBlended(vec4 color)
+{
+	float w = blendWeight(color.a);
+	accumulation = vec4(color.rgb * color.a * w, color.a);
+	weight = color.a * w;
+}
@@ -0,0 +1,21 @@
+#version 330 core
+//lays the weighted blended layers over the scene: their weighted average color, blended with the coverage
+//the product of (1 - alpha) leaves (SRC_ALPHA, ONE_MINUS_SRC_ALPHA)
+in vec2 texCoords;
+
+out vec4 color;
+
+uniform sampler2D accumulationMap;
+uniform sampler2D weightMap;
+
+void main()
+{
+	ivec2 texel = ivec2(gl_FragCoord.xy);
+	vec4 accumulation = texelFetch(accumulationMap, texel, 0);
+	float revealage = accumulation.a;
+	//no transparent layer here
+	if (revealage >= 1.0)
+		discard;
+	float weight = texelFetch(weightMap, texel, 0).r;
+	color = vec4(accumulation.rgb / max(weight, 1e-5), 1.0 - revealage);
+}